@@ -40,6 +40,8 @@
 /* FreeRTOS includes. */
 #include <FreeRTOS.h>
 
+#ifdef WIN32
+
 /* Variables used in the creation of the run time stats time base.  Run time
 stats record how much time each task spends in the Running state. */
 static long long llInitialRunTimeCounterValue = 0LL, llTicksPerHundedthMillisecond = 0LL;
@@ -97,3 +99,34 @@ unsigned long ulReturn;
 	return ulReturn;
 }
 /*-----------------------------------------------------------*/
+
+#else /* WIN32 */
+
+#include <time.h>
+
+/* The Posix port uses the monotonic clock, scaled to the same 1/100th of a
+millisecond units as the Win32 performance counter above. */
+static struct timespec xInitialRunTimeCounterValue = { 0, 0 };
+
+/*-----------------------------------------------------------*/
+
+void vConfigureTimerForRunTimeStats( void )
+{
+	clock_gettime( CLOCK_MONOTONIC, &xInitialRunTimeCounterValue );
+}
+/*-----------------------------------------------------------*/
+
+unsigned long ulGetRunTimeCounterValue( void )
+{
+struct timespec xCurrentCount;
+long long llElapsedNs;
+
+	clock_gettime( CLOCK_MONOTONIC, &xCurrentCount );
+	llElapsedNs = ( long long ) ( xCurrentCount.tv_sec - xInitialRunTimeCounterValue.tv_sec ) * 1000000000LL
+				+ ( xCurrentCount.tv_nsec - xInitialRunTimeCounterValue.tv_nsec );
+
+	return ( unsigned long ) ( llElapsedNs / 10000LL );
+}
+/*-----------------------------------------------------------*/
+
+#endif /* WIN32 */
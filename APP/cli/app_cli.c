@@ -1,8 +1,14 @@
 /* FreeRTOS includes. */
 #include <string.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <time.h>
+#ifdef WIN32
 #include <windows.h>
+#else
+#include <unistd.h>
+#include <sys/utsname.h>
+#endif
 
 #include "FreeRTOS.h"
 #include "task.h"
@@ -36,7 +42,24 @@ build_var(date, "Display current time.", 0);
 #if ( configUSE_TRACE_FACILITY == 1 )
 build_var(top, "List all the tasks state.", 0);
 #endif
-build_var(isotp, "Test isotp function.Usage:isotp <datalen> <BS> <STmin>", 3);
+build_var(isotp, "Test isotp function.Usage:isotp <datalen> <BS> <STmin> <TX_DL>", 4);
+build_var(mux, "Test isotp channels sharing a bus.Usage:mux <channels> <datalen> <0 normal|1 extended|2 mixed>", 3);
+build_var(duplex, "Test isotp messages in both directions at once.Usage:duplex <datalen> <0 one buffer|1 two buffers>", 2);
+build_var(fc, "Test isotp flow control policies on a slow receiver.Usage:fc <0 fixed|1 max throughput|2 low cpu|3 memory> <datalen> <frames per ms> <store bytes per ms>", 4);
+build_var(bench, "Benchmark isotp over a loopback bus.Usage:bench <csv file|->", 1);
+build_var(vcan, "Test isotp on a loaded virtual CAN bus.Usage:vcan <bitrate> <load %> <datalen> <fault ppm>", 4);
+build_var(ring, "Test isotp reception through the frame ring.Usage:ring <datalen> <ring size> <bitrate>", 3);
+build_var(can, "Test isotp on a Linux CAN interface.Usage:can <interface> <datalen> <TX_DL 8|64> <0 both|1 send|2 receive>", 4);
+build_var(capture, "Capture isotp frames to a candump log or pcap file.Usage:capture <file> <0 candump|1 pcap> <datalen> <TX_DL>", 4);
+build_var(replay, "Replay the tester frames of a capture to an ECU channel.Usage:replay <file> <0 candump|1 pcap> <0 at once|1 as captured|N times faster>", 3);
+build_var(stats, "Show the isotp statistics of the test channels.Usage:stats <all|channel|reset>", 1);
+build_var(fuzz, "Fuzz the isotp receive path.Usage:fuzz <runs> <seed>", 2);
+build_var(uds, "UDS server flashing sequence.Usage:uds <image size> <block length>", 2);
+build_var(flash, "Download an image over the virtual CAN bus, as before and with the download engine.Usage:flash <file|-> <bitrate> <TX_DL> <max block>", 4);
+build_var(cpp, "Echo a message over the ISO-TP channels of the C++ template.Usage:cpp <datalen>", 1);
+build_var(collect, "Collect the responses of many ECUs to one functional request.Usage:collect <ecus> <response length>", 2);
+build_var(pool, "Test isotp channels receiving into a shared reassembly pool.Usage:pool <channels> <contexts> <datalen>", 3);
+build_var(ctxsw, "Measure context switch latency.Usage:ctxsw <loops>", 1);
 build_var(clear, "Clear Terminal.", 0);
 
 static void app_cli_register(void)
@@ -45,18 +68,40 @@ static void app_cli_register(void)
 	mid_cli_register(&date);
 	mid_cli_register(&top);
 	mid_cli_register(&isotp);
+	mid_cli_register(&mux);
+	mid_cli_register(&duplex);
+	mid_cli_register(&fc);
+	mid_cli_register(&bench);
+	mid_cli_register(&vcan);
+	mid_cli_register(&ring);
+	mid_cli_register(&can);
+	mid_cli_register(&capture);
+	mid_cli_register(&replay);
+	mid_cli_register(&stats);
+	mid_cli_register(&fuzz);
+	mid_cli_register(&uds);
+	mid_cli_register(&flash);
+	mid_cli_register(&cpp);
+	mid_cli_register(&collect);
+	mid_cli_register(&pool);
+	mid_cli_register(&ctxsw);
 	mid_cli_register(&clear);
 }
 
 cmd_handle(info)
 {
+#ifdef WIN32
 	SYSTEM_INFO  sysInfo;
 	OSVERSIONINFOEX osvi;
 	char buffer[50];
+#else
+	struct utsname name;
+#endif
 
 	(void) help_info;
 	(void) argv;
 	configASSERT(dest);
+#ifdef WIN32
 	GetSystemInfo(&sysInfo);
 	sprintf_s(buffer, 50, "    OemId : %u\n", sysInfo.dwOemId);
 	strcat_s(dest, 50, buffer);
@@ -91,6 +136,14 @@ cmd_handle(info)
 		strcat_s(dest, cmdMAX_OUTPUT_SIZE - strlen(dest), buffer);
 	}
 
+#else
+	if(uname(&name) == 0)
+	{
+		sprintf_s(dest, cmdMAX_OUTPUT_SIZE, "    System      : %s %s\n    Machine     : %s\n", name.sysname, name.release, name.machine);
+	}
+	sprintf_s(dest + strlen(dest), cmdMAX_OUTPUT_SIZE - strlen(dest), "    Processors  : %ld\n    Page size   : %ld\n", sysconf(_SC_NPROCESSORS_ONLN), sysconf(_SC_PAGESIZE));
+#endif
+
 	return pdFALSE;
 }
 
@@ -113,7 +166,11 @@ cmd_handle(date)
 	configASSERT(dest);
 
 	time( &nowtime );
+#ifdef WIN32
 	localtime_s(&timeinfo, &nowtime );
+#else
+	localtime_r(&nowtime, &timeinfo);
+#endif
 	sprintf_s(dest, cmdMAX_OUTPUT_SIZE, "    Current time: %d-%d-%d %d %02d:%02d:%02d\n", 
 		timeinfo.tm_year + 1900, 
 		timeinfo.tm_mon + 1, 
@@ -126,14 +183,201 @@ cmd_handle(date)
 	return pdFALSE;
 }
 
-extern void isotp_test_main(unsigned short datalen, unsigned char bs, unsigned char stmin);
+extern void isotp_test_main(unsigned long datalen, unsigned char bs, unsigned char stmin, unsigned char tx_dl);
 cmd_handle(isotp)
 {
 	(void) help_info;
 	(void) argv;
 	configASSERT(dest);
 
-	isotp_test_main(atoi(argv[1]), atoi(argv[2]), atoi(argv[3]));
+	isotp_test_main(strtoul(argv[1], NULL, 10), atoi(argv[2]), atoi(argv[3]), atoi(argv[4]));
+
+	return pdFALSE;
+}
+
+extern void isotp_dispatch_test_main(unsigned char channels, unsigned long datalen, unsigned char mode);
+cmd_handle(mux)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_dispatch_test_main(atoi(argv[1]), strtoul(argv[2], NULL, 10), atoi(argv[3]));
+
+	return pdFALSE;
+}
+
+extern void isotp_duplex_test_main(unsigned long datalen, unsigned char mode);
+cmd_handle(duplex)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_duplex_test_main(strtoul(argv[1], NULL, 10), atoi(argv[2]));
+
+	return pdFALSE;
+}
+
+extern void isotp_fc_test_main(unsigned char policy, unsigned long datalen, unsigned long frames, unsigned long bytes);
+cmd_handle(fc)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_fc_test_main(atoi(argv[1]), strtoul(argv[2], NULL, 10), strtoul(argv[3], NULL, 10), strtoul(argv[4], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern unsigned long isotp_bench_main(const char *path);
+cmd_handle(bench)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	sprintf_s(dest, cmdMAX_OUTPUT_SIZE, "    Failed combinations: %lu\r\n", isotp_bench_main(argv[1]));
+
+	return pdFALSE;
+}
+
+extern void vcan_test_main(unsigned long bitrate, unsigned char load, unsigned long datalen, unsigned long ppm);
+cmd_handle(vcan)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	vcan_test_main(strtoul(argv[1], NULL, 10), atoi(argv[2]), strtoul(argv[3], NULL, 10), strtoul(argv[4], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern unsigned long phy_ring_test_main(unsigned long datalen, unsigned long size, unsigned long bitrate);
+cmd_handle(ring)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	phy_ring_test_main(strtoul(argv[1], NULL, 10), strtoul(argv[2], NULL, 10), strtoul(argv[3], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern void socketcan_test_main(const char *ifname, unsigned long datalen, unsigned char tx_dl, unsigned char mode);
+cmd_handle(can)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	socketcan_test_main(argv[1], strtoul(argv[2], NULL, 10), atoi(argv[3]), atoi(argv[4]));
+
+	return pdFALSE;
+}
+
+extern void isotp_capture_test_main(const char *name, unsigned char format, unsigned long datalen, unsigned char tx_dl);
+cmd_handle(capture)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_capture_test_main(argv[1], atoi(argv[2]), strtoul(argv[3], NULL, 10), atoi(argv[4]));
+
+	return pdFALSE;
+}
+
+extern void isotp_replay_test_main(const char *name, unsigned char format, unsigned long speed);
+cmd_handle(replay)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_replay_test_main(argv[1], atoi(argv[2]), strtoul(argv[3], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern void isotp_stats_test_main(const char *arg);
+cmd_handle(stats)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_stats_test_main(argv[1]);
+
+	return pdFALSE;
+}
+
+extern unsigned long isotp_fuzz_main(unsigned long runs, unsigned long seed);
+cmd_handle(fuzz)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_fuzz_main(strtoul(argv[1], NULL, 10), strtoul(argv[2], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern void uds_test_main(unsigned long size, unsigned long block);
+cmd_handle(uds)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	uds_test_main(strtoul(argv[1], NULL, 10), strtoul(argv[2], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern void uds_flash_test_main(const char *path, unsigned long bitrate, unsigned long tx_dl, unsigned long max_block);
+cmd_handle(flash)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	uds_flash_test_main(argv[1], strtoul(argv[2], NULL, 10), strtoul(argv[3], NULL, 10), strtoul(argv[4], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern void isotp_channel_test_main(unsigned long len);
+cmd_handle(cpp)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_channel_test_main(strtoul(argv[1], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern void isotp_collect_test_main(unsigned long ecus, unsigned long len);
+cmd_handle(collect)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_collect_test_main(strtoul(argv[1], NULL, 10), strtoul(argv[2], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern void isotp_pool_test_main(unsigned long channels, unsigned long contexts, unsigned long datalen);
+cmd_handle(pool)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	isotp_pool_test_main(strtoul(argv[1], NULL, 10), strtoul(argv[2], NULL, 10), strtoul(argv[3], NULL, 10));
+
+	return pdFALSE;
+}
+
+extern unsigned long ctxsw_test_main(unsigned long loops);
+cmd_handle(ctxsw)
+{
+	(void) help_info;
+	configASSERT(dest);
+
+	sprintf_s(dest, cmdMAX_OUTPUT_SIZE, "    Context switch: %lu ns\r\n", ctxsw_test_main(strtoul(argv[1], NULL, 10)));
 
 	return pdFALSE;
 }
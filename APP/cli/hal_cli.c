@@ -1,6 +1,55 @@
 #include "hal_cli.h"
 #include <stdio.h>
+#include <stdlib.h>
+#ifdef WIN32
 #include <conio.h>
+#else
+#include <signal.h>
+#include <unistd.h>
+#include <termios.h>
+#include <sys/select.h>
+#endif
+
+#ifndef WIN32
+static struct termios saved_termios;
+static int termios_saved = 0;
+
+static void hal_cli_restore_terminal(void)
+{
+	if(termios_saved)
+	{
+		tcsetattr(STDIN_FILENO, TCSANOW, &saved_termios);
+	}
+}
+
+static void hal_cli_signal_exit(int sig)
+{
+	hal_cli_restore_terminal();
+	_exit(128 + sig);
+}
+
+/*
+ * Switch the terminal to unbuffered input without echo, the command line
+ * echoes input itself, just like _getch() on Windows.
+ */
+static void hal_cli_terminal_init(void)
+{
+	struct termios raw;
+
+	if(isatty(STDIN_FILENO) && tcgetattr(STDIN_FILENO, &saved_termios) == 0)
+	{
+		termios_saved = 1;
+		raw = saved_termios;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 1;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+		atexit(hal_cli_restore_terminal);
+		signal(SIGINT, hal_cli_signal_exit);
+		signal(SIGTERM, hal_cli_signal_exit);
+	}
+}
+#endif
 
 portBASE_TYPE hal_cli_data_tx(char *data, unsigned short len)
 {
@@ -8,12 +57,43 @@ portBASE_TYPE hal_cli_data_tx(char *data, unsigned short len)
 	{
 		printf("%c", *(data++));
 	}
+	fflush(stdout);
 	return pdTRUE;
 }
 
 portBASE_TYPE hal_cli_data_rx(char *data, unsigned short len)
 {
+#ifdef WIN32
 	*data = _getch();
 	fflush(stdin);
 	return 1;
-}
\ No newline at end of file
+#else
+	static int initialised = 0;
+	fd_set fds;
+	struct timeval no_wait = {0, 0};
+
+	(void) len;
+	if(!initialised)
+	{
+		initialised = 1;
+		hal_cli_terminal_init();
+	}
+	/* 
+	 * Do not block the task thread in the host, the caller polls with
+	 * vTaskDelay() so other tasks (and the idle task) keep running.
+	 */
+	FD_ZERO(&fds);
+	FD_SET(STDIN_FILENO, &fds);
+	if(select(STDIN_FILENO + 1, &fds, NULL, NULL, &no_wait) <= 0
+		|| read(STDIN_FILENO, data, 1) != 1)
+	{
+		return -1;
+	}
+	/* Terminals send DEL for backspace */
+	if(*data == 0x7F)
+	{
+		*data = '\b';
+	}
+	return 1;
+#endif
+}
@@ -6,4 +6,32 @@
 portBASE_TYPE hal_cli_data_tx(char *data, unsigned short len);
 portBASE_TYPE hal_cli_data_rx(char *data, unsigned short len);
 
-#endif
\ No newline at end of file
+#ifndef WIN32
+#include <stdio.h>
+#include <string.h>
+
+/* 
+ * The command line is written against the MSVC bounds checked string
+ * functions, map them on to the C library on other hosts.
+ */
+#define sprintf_s	snprintf
+
+static inline int strcat_s(char *dest, size_t size, const char *src)
+{
+	size_t len = strlen(dest);
+
+	if(len < size)
+	{
+		snprintf(dest + len, size - len, "%s", src);
+	}
+	return 0;
+}
+
+static inline int strcpy_s(char *dest, size_t size, const char *src)
+{
+	snprintf(dest, size, "%s", src);
+	return 0;
+}
+#endif
+
+#endif
@@ -338,6 +338,11 @@ static int8_t mid_cli_string_split(char **dest, const char *cmd_string)
 		}
 		cmd_string ++;
 	}
+	/* Add EOS(end of string) for the last parameter */
+	if(segment < cmdMAX_VARS_SIZE)
+	{
+		dest[segment][index] = '\0';
+	}
 	return segment;
 }
 
@@ -0,0 +1,68 @@
+#include <stdio.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+/*
+ * Context switch latency test.
+ * Two tasks ping-pong a direct to task notification, every round trip costs
+ * two context switches. The elapsed time is taken from the run time stats
+ * counter, which counts in 1/100th of a millisecond on both the Win32 and the
+ * Posix port, so the results of both ports can be compared directly.
+ */
+#define CTXSW_PRIORITY	(configMAX_PRIORITIES - 2)
+
+static TaskHandle_t ping_task, pong_task, owner_task;
+static unsigned long ping_loops;
+static unsigned long elapsed;
+
+static void pong_thread(void *arg)
+{
+	(void) arg;
+	for(;;)
+	{
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		xTaskNotifyGive(ping_task);
+	}
+}
+
+static void ping_thread(void *arg)
+{
+	unsigned long start, loops;
+
+	(void) arg;
+	loops = ping_loops;
+	start = portGET_RUN_TIME_COUNTER_VALUE();
+	while(loops --)
+	{
+		xTaskNotifyGive(pong_task);
+		ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	}
+	elapsed = portGET_RUN_TIME_COUNTER_VALUE() - start;
+	xTaskNotifyGive(owner_task);
+	vTaskSuspend(NULL);
+}
+
+/*
+ * run the test
+ * @parameter in:
+ * loops: number of round trips
+ * @parameter out:
+ * average latency of one context switch in nanoseconds
+ */
+unsigned long ctxsw_test_main(unsigned long loops)
+{
+	if(loops == 0UL)
+	{
+		return 0UL;
+	}
+	ping_loops = loops;
+	owner_task = xTaskGetCurrentTaskHandle();
+	xTaskCreate(pong_thread, "ctxsw_pong", configMINIMAL_STACK_SIZE, NULL, CTXSW_PRIORITY, &pong_task);
+	xTaskCreate(ping_thread, "ctxsw_ping", configMINIMAL_STACK_SIZE, NULL, CTXSW_PRIORITY, &ping_task);
+	ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+	vTaskDelete(ping_task);
+	vTaskDelete(pong_task);
+
+	/* 10000ns per run time counter unit, two switches per loop */
+	return (unsigned long)((elapsed * 10000ULL) / (loops * 2UL));
+}
@@ -0,0 +1,357 @@
+#include "isotp.h"
+#include "isotp_dispatch.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+#include "comm_typedef.h"
+
+/*
+ * ISO-TP benchmark.
+ * A sender and a receiver channel in one task, connected by an in-memory
+ * loopback bus, so the figures are the cost of the protocol alone. Every
+ * combination of TX_DL, DL, BS and STmin below is run BENCH_REPEAT times,
+ * one CSV row per combination:
+ *
+ *	tx_dl,dl,bs,stmin,transfers,errors,bytes_per_s,frames_per_s,
+ *	lat_p50_us,lat_p90_us,lat_p99_us,lat_max_us,cpu_us_per_transfer
+ *
+ * The latency of a transfer is from isotp_send_start() to the rx_done_cb of
+ * the receiver, the CPU time is the one of the benchmark thread. The sender
+ * builds its CFs ahead and both sides move bursts with the batch functions.
+ */
+#define BENCH_REPEAT		(10UL)
+/* frames in flight on the loopback bus, a whole message with BS 0 */
+#define BENCH_RING_LEN		(1024UL)
+/* CFs the sender builds ahead, one block of the largest BS */
+#define BENCH_TX_RING_LEN	(8UL)
+
+#define BENCH_TX_ID			(0x7E0UL)
+#define BENCH_RX_ID			(0x7E8UL)
+
+static const uint8_t bench_tx_dl[] = {8, 64};
+static const uint32_t bench_dl[] = {7, 62, 512, ISOTP_FF_DL};
+static const uint8_t bench_bs[] = {0, 8};
+static const uint8_t bench_stmin[] = {0x00, 0xF1, 0x01};
+
+struct bench_result_t
+{
+	uint32_t transfers;
+	uint32_t errors;
+	uint32_t frames;
+	uint32_t bytes;
+	uint32_t elapsed_us;
+	uint32_t cpu_us;
+	uint32_t latency_us[BENCH_REPEAT];
+};
+
+static ERROR_CODE bench_send(struct phy_msg_t *msg);
+static ERROR_CODE bench_receive(struct phy_msg_t *msg);
+static ERROR_CODE bench_send_batch(struct phy_msg_t *msg, uint32_t count, uint32_t *done);
+static ERROR_CODE bench_receive_batch(struct phy_msg_t *msg, uint32_t count, uint32_t *done);
+static ERROR_CODE bench_rx_done(struct isotp_t* msg);
+static uint32_t bench_cpu_us(void);
+static int bench_cmp(const void *a, const void *b);
+static uint32_t bench_percentile(const uint32_t *sorted, uint32_t count, uint32_t percent);
+static void bench_run(uint8_t tx_dl, uint32_t dl, uint8_t bs, uint8_t stmin, struct bench_result_t *result);
+
+static struct isotp_t sender, receiver;
+static struct isotp_route_t bench_route[2];
+static struct isotp_dispatch_t bench_bus;
+static uint8_t sender_buffer[ISOTP_FF_DL];
+static uint8_t receiver_buffer[ISOTP_FF_DL];
+static struct phy_msg_t sender_ring[BENCH_TX_RING_LEN];
+static struct phy_msg_t bench_batch[BENCH_TX_RING_LEN];
+/* the loopback bus */
+static struct phy_msg_t ring[BENCH_RING_LEN];
+static uint32_t ring_head, ring_tail;
+static uint32_t ring_frames;
+/* end of the transfer in progress */
+static Bool rx_finished;
+static uint32_t rx_end_us;
+
+static ERROR_CODE bench_send(struct phy_msg_t *msg)
+{
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		if(ring_head - ring_tail >= BENCH_RING_LEN)
+		{
+			return ERR_FULL;
+		}
+		memcpy(&ring[ring_head % BENCH_RING_LEN], msg, sizeof(*msg));
+		ring_head ++;
+		ring_frames ++;
+	}
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE bench_receive(struct phy_msg_t *msg)
+{
+	if(ring_head == ring_tail)
+	{
+		return ERR_EMPTY;
+	}
+	memcpy(msg, &ring[ring_tail % BENCH_RING_LEN], sizeof(*msg));
+	ring_tail ++;
+	return STATUS_NORMAL;
+}
+
+/*
+ * the frames of a burst in one call, a full bus takes the first ones
+ */
+static ERROR_CODE bench_send_batch(struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+{
+	for(*done = 0UL; *done < count; (*done) ++)
+	{
+		if(ring_head - ring_tail >= BENCH_RING_LEN)
+		{
+			return ERR_FULL;
+		}
+		msg[*done].new_data = FALSE;
+		memcpy(&ring[ring_head % BENCH_RING_LEN], &msg[*done], sizeof(*msg));
+		ring_head ++;
+		ring_frames ++;
+	}
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE bench_receive_batch(struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+{
+	for(*done = 0UL; *done < count && ring_head != ring_tail; (*done) ++)
+	{
+		memcpy(&msg[*done], &ring[ring_tail % BENCH_RING_LEN], sizeof(*msg));
+		ring_tail ++;
+	}
+	return (*done != 0UL) ? STATUS_NORMAL : ERR_EMPTY;
+}
+
+static ERROR_CODE bench_rx_done(struct isotp_t* msg)
+{
+	rx_end_us = timer_us();
+	rx_finished = TRUE;
+	return STATUS_NORMAL;
+}
+
+/*
+ * CPU time of the calling thread, every task is a thread of the host
+ */
+static uint32_t bench_cpu_us(void)
+{
+#ifdef WIN32
+	FILETIME creation, exit, kernel, user;
+	ULARGE_INTEGER k, u;
+
+	GetThreadTimes(GetCurrentThread(), &creation, &exit, &kernel, &user);
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (uint32_t)((k.QuadPart + u.QuadPart) / 10ULL);
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return (uint32_t)((unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000UL);
+#endif
+}
+
+static int bench_cmp(const void *a, const void *b)
+{
+	uint32_t x = *(const uint32_t *)a;
+	uint32_t y = *(const uint32_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+/*
+ * nearest rank percentile of sorted samples
+ */
+static uint32_t bench_percentile(const uint32_t *sorted, uint32_t count, uint32_t percent)
+{
+	uint32_t rank;
+
+	if(count == 0UL)
+	{
+		return 0UL;
+	}
+	rank = (percent * count + 99UL) / 100UL;
+	if(rank == 0UL)
+	{
+		rank = 1UL;
+	}
+	return sorted[rank - 1UL];
+}
+
+/*
+ * run BENCH_REPEAT transfers of one combination
+ */
+static void bench_run(uint8_t tx_dl, uint32_t dl, uint8_t bs, uint8_t stmin, struct bench_result_t *result)
+{
+	uint32_t index, start, wait, next, cpu;
+
+	memset(result, 0, sizeof(*result));
+	ring_head = ring_tail = ring_frames = 0UL;
+	isotp_init(&sender, BENCH_RX_ID, BENCH_TX_ID, NULL, bench_send, bench_receive);
+	isotp_init(&receiver, BENCH_TX_ID, BENCH_RX_ID, NULL, bench_send, bench_receive);
+	isotp_buffer_set(&sender, sender_buffer, sizeof(sender_buffer));
+	isotp_buffer_set(&receiver, receiver_buffer, sizeof(receiver_buffer));
+	isotp_tx_ring_set(&sender, sender_ring, BENCH_TX_RING_LEN);
+	isotp_send_batch_set(&sender, bench_send_batch);
+	isotp_cb_set(&receiver, bench_rx_done, NULL);
+	isotp_dl_set(&sender, tx_dl);
+	isotp_dl_set(&receiver, tx_dl);
+	fc_set(&receiver, ISOTP_FS_CTS, bs, stmin);
+	isotp_dispatch_init(&bench_bus, bench_route, 2, bench_receive);
+	isotp_dispatch_batch_set(&bench_bus, bench_receive_batch, bench_batch, BENCH_TX_RING_LEN);
+	isotp_dispatch_add(&bench_bus, &sender);
+	isotp_dispatch_add(&bench_bus, &receiver);
+	for(index = 0; index < dl; index ++)
+	{
+		sender_buffer[index] = (uint8_t)index;
+	}
+
+	cpu = bench_cpu_us();
+	for(index = 0; index < BENCH_REPEAT; index ++)
+	{
+		rx_finished = FALSE;
+		sender.tx.DL = dl;
+		start = timer_us();
+		if(isotp_send_start(&sender) != STATUS_NORMAL)
+		{
+			result->errors ++;
+			continue;
+		}
+		for(;;)
+		{
+			if(isotp_dispatch_receive(&bench_bus) == STATUS_NORMAL)
+			{
+				continue;
+			}
+			if(rx_finished == TRUE && sender.tx.state == ISOTP_IDLE)
+			{
+				break;
+			}
+			wait = isotp_dispatch_poll(&bench_bus);
+			if(ring_head != ring_tail)
+			{
+				continue;
+			}
+			if(wait == ISOTP_WAIT_FOREVER)
+			{
+				/* stalled, the transfer can not end any more */
+				break;
+			}
+			if(wait != 0UL)
+			{
+				vTaskDelay(pdMS_TO_TICKS(wait));
+			}
+		}
+		next = result->transfers;
+		if(rx_finished == TRUE && receiver.rx.reply == N_OK && sender.tx.reply == N_OK
+			&& memcmp(sender_buffer, receiver_buffer, dl) == 0)
+		{
+			result->latency_us[next] = rx_end_us - start;
+			result->elapsed_us += rx_end_us - start;
+			result->bytes += dl;
+			result->transfers ++;
+		}
+		else
+		{
+			result->errors ++;
+		}
+	}
+	result->cpu_us = bench_cpu_us() - cpu;
+	result->frames = ring_frames;
+}
+
+/*
+ * run the benchmark
+ *
+ * @parameter in:
+ * path:      CSV file for the results, NULL or "-" for the console only
+ * @parameter out:
+ * number of combinations that had errors
+ */
+unsigned long isotp_bench_main(const char *path)
+{
+	static struct bench_result_t result;
+	FILE *out = NULL;
+	char row[160];
+	uint32_t a, b, c, d;
+	uint32_t failed = 0UL;
+	uint32_t elapsed_us;
+
+	if(path != NULL && strcmp(path, "-") != 0)
+	{
+		out = fopen(path, "w");
+		if(out == NULL)
+		{
+			printf("Can not open %s\r\n", path);
+			return 1UL;
+		}
+	}
+	strcpy(row, "tx_dl,dl,bs,stmin,transfers,errors,bytes_per_s,frames_per_s,"
+			"lat_p50_us,lat_p90_us,lat_p99_us,lat_max_us,cpu_us_per_transfer");
+	printf("%s\r\n", row);
+	if(out != NULL)
+	{
+		fprintf(out, "%s\n", row);
+	}
+	for(a = 0; a < sizeof(bench_tx_dl) / sizeof(bench_tx_dl[0]); a ++)
+	{
+		for(b = 0; b < sizeof(bench_dl) / sizeof(bench_dl[0]); b ++)
+		{
+			for(c = 0; c < sizeof(bench_bs) / sizeof(bench_bs[0]); c ++)
+			{
+				for(d = 0; d < sizeof(bench_stmin) / sizeof(bench_stmin[0]); d ++)
+				{
+					bench_run(bench_tx_dl[a], bench_dl[b], bench_bs[c], bench_stmin[d], &result);
+					qsort(result.latency_us, result.transfers, sizeof(result.latency_us[0]), bench_cmp);
+					elapsed_us = (result.elapsed_us != 0UL) ? result.elapsed_us : 1UL;
+					sprintf(row, "%u,%lu,%u,0x%02X,%lu,%lu,%.0f,%.0f,%lu,%lu,%lu,%lu,%lu",
+							bench_tx_dl[a], (unsigned long)bench_dl[b], bench_bs[c], bench_stmin[d],
+							(unsigned long)result.transfers, (unsigned long)result.errors,
+							result.bytes * 1000000.0 / elapsed_us,
+							result.frames * 1000000.0 / elapsed_us,
+							(unsigned long)bench_percentile(result.latency_us, result.transfers, 50UL),
+							(unsigned long)bench_percentile(result.latency_us, result.transfers, 90UL),
+							(unsigned long)bench_percentile(result.latency_us, result.transfers, 99UL),
+							(unsigned long)bench_percentile(result.latency_us, result.transfers, 100UL),
+							(unsigned long)(result.cpu_us / BENCH_REPEAT));
+					printf("%s\r\n", row);
+					if(out != NULL)
+					{
+						fprintf(out, "%s\n", row);
+					}
+					if(result.errors != 0UL)
+					{
+						failed ++;
+					}
+				}
+			}
+		}
+	}
+	if(out != NULL)
+	{
+		fclose(out);
+	}
+
+	return failed;
+}
+
+/*
+ * headless run, see main(): the benchmark is the only task and the
+ * simulator exits with the number of failed combinations
+ */
+void isotp_bench_task(void *arg)
+{
+	exit((int)isotp_bench_main((const char *)arg));
+}
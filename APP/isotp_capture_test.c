@@ -0,0 +1,294 @@
+#include "isotp.h"
+#include "isotp_capture.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * Frame capture and replay.
+ * capture: the tester sends one message to the ECU on the queue pair of
+ * test_util.c. The transfer runs once without and once with the ECU tapped,
+ * while a task below the tester writes the capture to a candump log or a
+ * pcap file.
+ * replay: the frames the tester sent in such a file are fed to a new ECU
+ * channel at the pace of the file or faster, the FCs of the ECU go nowhere.
+ */
+#define CAPTURE_TESTER_ID		(0x7E0UL)
+#define CAPTURE_ECU_ID			(0x7E8UL)
+
+#define CAPTURE_BS				(8UL)
+#define CAPTURE_STMIN			(0UL)
+#define CAPTURE_QUEUE_LEN		(32UL)
+/* the channels do not block during a message, the ring holds all of it */
+#define CAPTURE_RING_LEN		(1024UL)
+#define CAPTURE_FLUSH_PERIOD	(10UL)
+#define CAPTURE_TIMEOUT			(10000UL)
+
+/* frames of the largest message with TX_DL 8, and their FCs */
+#define REPLAY_MAX_FRAMES		(1024UL)
+#define REPLAY_FILE_LEN			(REPLAY_MAX_FRAMES * 180UL)
+
+#define CAPTURE_FLUSH_PRIORITY	(tskIDLE_PRIORITY + 1)
+#define CAPTURE_ECU_PRIORITY	(tskIDLE_PRIORITY + 1)
+#define CAPTURE_TESTER_PRIORITY	(tskIDLE_PRIORITY + 2)
+
+static ERROR_CODE no_receive(struct phy_msg_t *msg);
+static ERROR_CODE replay_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_done(struct isotp_t* msg);
+static ERROR_CODE file_write(void *arg, const uint8_t *data, uint32_t len);
+static uint32_t transfer(unsigned long datalen, unsigned char tx_dl, struct isotp_capture_t *capture);
+static uint32_t pattern_errors(const uint8_t *data, uint32_t len);
+static void flush_thread(void *arg);
+static Bool ecu_receiving(void);
+
+static struct isotp_t tester, ecu;
+static uint8_t tester_buffer[ISOTP_FF_DL];
+static uint8_t ecu_buffer[ISOTP_FF_DL];
+static struct isotp_capture_t capture;
+static struct isotp_capture_rec_t capture_rec[CAPTURE_RING_LEN];
+static struct isotp_replay_t replay;
+static struct isotp_capture_rec_t replay_rec[REPLAY_MAX_FRAMES];
+static uint8_t replay_file[REPLAY_FILE_LEN];
+static enum isotp_capture_format_e flush_format;
+static FILE *flush_file;
+static volatile Bool ecu_finished;
+static uint32_t ecu_end_us;
+static uint32_t replay_fc;
+
+static uint32_t pattern_errors(const uint8_t *data, uint32_t len)
+{
+	uint32_t index, errors = 0UL;
+
+	for(index = 0; index < len; index ++)
+	{
+		if(data[index] != (uint8_t)index)
+		{
+			errors ++;
+		}
+	}
+	return errors;
+}
+
+/*
+ * a message is coming in, its end is still to be seen
+ */
+static Bool ecu_receiving(void)
+{
+	return (ecu.rx.state == ISOTP_WAIT_DATA || ecu.rx.state == ISOTP_SEND_FC) ? TRUE : FALSE;
+}
+
+/*
+ * writes the capture out while the channels run
+ */
+static void flush_thread(void *arg)
+{
+	for(;;)
+	{
+		isotp_capture_flush(&capture, flush_format, file_write, flush_file);
+		vTaskDelay(pdMS_TO_TICKS(CAPTURE_FLUSH_PERIOD));
+	}
+}
+
+/*
+ * one message from the tester to the ECU, time until the ECU has it
+ */
+static uint32_t transfer(unsigned long datalen, unsigned char tx_dl, struct isotp_capture_t *capture)
+{
+	struct phy_msg_t frame;
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+	uint32_t index, wait, start;
+
+	isotp_init(&tester, CAPTURE_ECU_ID, CAPTURE_TESTER_ID, NULL, test_tester_send, test_tester_receive);
+	isotp_init(&ecu, CAPTURE_TESTER_ID, CAPTURE_ECU_ID, NULL, test_ecu_send, test_ecu_receive);
+	isotp_buffer_set(&tester, tester_buffer, sizeof(tester_buffer));
+	isotp_buffer_set(&ecu, ecu_buffer, sizeof(ecu_buffer));
+	isotp_dl_set(&tester, tx_dl);
+	isotp_dl_set(&ecu, tx_dl);
+	isotp_cb_set(&ecu, ecu_done, NULL);
+	fc_set(&ecu, ISOTP_FS_CTS, CAPTURE_BS, CAPTURE_STMIN);
+	/* the ECU sees every frame on the bus, the tester would record them again */
+	isotp_capture_set(&ecu, capture);
+	memset(ecu_buffer, 0, sizeof(ecu_buffer));
+	/* empty the queues of the last transfer */
+	test_queues_init(CAPTURE_QUEUE_LEN);
+	ecu_finished = FALSE;
+
+	test_ecu_channel_start(&ecu, "isotp_capture_ecu", CAPTURE_ECU_PRIORITY);
+	vTaskPrioritySet(NULL, CAPTURE_TESTER_PRIORITY);
+	start = timer_us();
+	tester.tx.DL = datalen;
+	isotp_send_start(&tester);
+	for(;;)
+	{
+		wait = isotp_poll(&tester);
+		if(tester.tx.state == ISOTP_IDLE)
+		{
+			break;
+		}
+		if(test_frame_get(TEST_TESTER, &frame, wait) == pdPASS)
+		{
+			isotp_on_frame(&tester, &frame);
+		}
+	}
+	/* the last CFs may still wait in the queue, give the ECU up to N_Cr */
+	for(index = 0; index < 1000UL && ecu_finished == FALSE; index ++)
+	{
+		vTaskDelay(pdMS_TO_TICKS(1UL));
+	}
+	test_ecu_stop();
+	vTaskPrioritySet(NULL, priority);
+
+	return (ecu_finished == TRUE) ? ecu_end_us - start : 0UL;
+}
+
+void isotp_capture_test_main(const char *name, unsigned char format, unsigned long datalen, unsigned char tx_dl)
+{
+	TaskHandle_t flush_task;
+	uint32_t index, plain_us, tapped_us;
+
+	if(name == NULL || format > ISOTP_CAPTURE_PCAP || datalen == 0UL || datalen > ISOTP_FF_DL
+		|| tx_dl < CAN_MAX_DL || tx_dl > CANFD_MAX_DL)
+	{
+		printf("Usage:capture <file> <0 candump|1 pcap> <1-%lu> <8|12|16|20|24|32|48|64>\r\n", ISOTP_FF_DL);
+		return;
+	}
+	if(test_queues_init(CAPTURE_QUEUE_LEN) != pdPASS)
+	{
+		printf("No memory for the frame queues\r\n");
+		return;
+	}
+	flush_file = fopen(name, (format == ISOTP_CAPTURE_PCAP) ? "wb" : "w");
+	if(flush_file == NULL)
+	{
+		printf("Can not create %s\r\n", name);
+		return;
+	}
+	for(index = 0; index < datalen; index ++)
+	{
+		tester_buffer[index] = (uint8_t)index;
+	}
+
+	printf("Capture test, %s DL:%lu TX_DL:%d\r\n", name, datalen, tx_dl);
+	plain_us = transfer(datalen, tx_dl, NULL);
+
+	flush_format = (enum isotp_capture_format_e)format;
+	isotp_capture_init(&capture, capture_rec, CAPTURE_RING_LEN, (uint32_t)time(NULL));
+	isotp_capture_header(&capture, flush_format, file_write, flush_file);
+	xTaskCreate(flush_thread, "isotp_capture", 200, NULL, CAPTURE_FLUSH_PRIORITY, &flush_task);
+	tapped_us = transfer(datalen, tx_dl, &capture);
+	vTaskDelete(flush_task);
+	isotp_capture_flush(&capture, flush_format, file_write, flush_file);
+	fclose(flush_file);
+
+	printf("Capture Rx result:%d errors:%lu\r\n", (ecu_finished == TRUE) ? ecu.rx.reply : -1,
+			(unsigned long)pattern_errors(ecu_buffer, datalen));
+	printf("Capture time without tap:%lu us with tap:%lu us\r\n", (unsigned long)plain_us, (unsigned long)tapped_us);
+	printf("Capture frames:%lu overflow:%lu\r\n", (unsigned long)capture.written, (unsigned long)capture.overflow);
+}
+
+void isotp_replay_test_main(const char *name, unsigned char format, unsigned long speed)
+{
+	FILE *file;
+	uint32_t len, offset, used, count = 0UL, bad = 0UL, capture_fc = 0UL;
+	uint32_t wait, ecu_wait, start;
+	TickType_t begin;
+	ERROR_CODE err;
+
+	if(name == NULL || format > ISOTP_CAPTURE_PCAP)
+	{
+		printf("Usage:replay <file> <0 candump|1 pcap> <0 at once|1 as captured|N times faster>\r\n");
+		return;
+	}
+	file = fopen(name, "rb");
+	if(file == NULL)
+	{
+		printf("Can not open %s\r\n", name);
+		return;
+	}
+	len = (uint32_t)fread(replay_file, 1, sizeof(replay_file), file);
+	fclose(file);
+	for(offset = 0UL; offset < len && count < REPLAY_MAX_FRAMES; offset += used)
+	{
+		err = isotp_capture_parse((enum isotp_capture_format_e)format, &replay_file[offset], len - offset,
+									&replay_rec[count], &used);
+		if(err == STATUS_NORMAL)
+		{
+			if(replay_rec[count].id == CAPTURE_ECU_ID)
+			{
+				capture_fc ++;
+			}
+			count ++;
+		}
+		else if(err == ERR_PARAMETER)
+		{
+			bad ++;
+		}
+		if(used == 0UL)
+		{
+			break;
+		}
+	}
+
+	isotp_init(&ecu, CAPTURE_TESTER_ID, CAPTURE_ECU_ID, NULL, replay_send, no_receive);
+	isotp_buffer_set(&ecu, ecu_buffer, sizeof(ecu_buffer));
+	/* the TX_DL of the ECU only matters for its FCs */
+	isotp_cb_set(&ecu, ecu_done, NULL);
+	fc_set(&ecu, ISOTP_FS_CTS, CAPTURE_BS, CAPTURE_STMIN);
+	memset(ecu_buffer, 0, sizeof(ecu_buffer));
+	ecu_finished = FALSE;
+	replay_fc = 0UL;
+
+	printf("Replay test, %s frames:%lu unreadable:%lu speed:%lu\r\n", name, (unsigned long)count,
+			(unsigned long)bad, speed);
+	begin = xTaskGetTickCount();
+	start = timer_us();
+	isotp_replay_init(&replay, replay_rec, count, CAPTURE_TESTER_ID, speed);
+	while(xTaskGetTickCount() - begin < pdMS_TO_TICKS(CAPTURE_TIMEOUT))
+	{
+		wait = isotp_replay_run(&replay, &ecu);
+		ecu_wait = isotp_poll(&ecu);
+		if(wait == ISOTP_WAIT_FOREVER && ecu_receiving() == FALSE)
+		{
+			break;
+		}
+		vTaskDelay(test_wait_ticks((ecu_wait < wait) ? ecu_wait : wait));
+	}
+
+	printf("Replay Rx result:%d DL:%lu errors:%lu time:%lu us\r\n", (ecu_finished == TRUE) ? ecu.rx.reply : -1,
+			(unsigned long)ecu.rx.DL, (unsigned long)pattern_errors(ecu_buffer, ecu.rx.DL),
+			(ecu_finished == TRUE) ? (unsigned long)(ecu_end_us - start) : 0UL);
+	printf("Replay fed:%lu FC sent:%lu FC in capture:%lu\r\n", (unsigned long)replay.fed,
+			(unsigned long)replay_fc, (unsigned long)capture_fc);
+}
+
+static ERROR_CODE file_write(void *arg, const uint8_t *data, uint32_t len)
+{
+	return (fwrite(data, 1, len, (FILE *)arg) == len) ? STATUS_NORMAL : ERR_FAIL;
+}
+
+/*
+ * frames are handed to the channels by the test
+ */
+static ERROR_CODE no_receive(struct phy_msg_t *msg)
+{
+	return ERR_EMPTY;
+}
+
+static ERROR_CODE replay_send(struct phy_msg_t *msg)
+{
+	msg->new_data = FALSE;
+	replay_fc ++;
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE ecu_done(struct isotp_t* msg)
+{
+	ecu_end_us = timer_us();
+	ecu_finished = TRUE;
+	return STATUS_NORMAL;
+}
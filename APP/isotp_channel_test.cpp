@@ -0,0 +1,179 @@
+#include "isotp_channel.hpp"
+#include <stdio.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+/*
+ * ISO-TP channels of the C++ template.
+ * A tester and an ECU channel of the same template are connected by an
+ * in-memory loopback, in the command line task. The tester sends a message
+ * of the given length, the ECU sends it back from its rx_done callback,
+ * and the tester compares the echo. This runs for classical CAN with
+ * normal addressing, CAN FD with extended addressing and a buffer past
+ * ISOTP_FF_DL, and a short CAN FD message with mixed addressing.
+ */
+#define CHANNEL_TESTER_ID		(0x7E0UL)
+#define CHANNEL_ECU_ID			(0x7E8UL)
+#define CHANNEL_TESTER_AE		(0xF1U)
+#define CHANNEL_ECU_AE			(0x10U)
+#define CHANNEL_BS				(8U)
+/* frames the loopback holds in each direction, a block and the FC */
+#define CHANNEL_RING_LEN		(32UL)
+#define CHANNEL_TIMEOUT_MS		(2000UL)
+#define CHANNEL_LONG			(20000UL)
+#define CHANNEL_SHORT			(64UL)
+
+struct loop_ring_t
+{
+	struct phy_msg_t frame[CHANNEL_RING_LEN];
+	uint32_t head;
+	uint32_t tail;
+};
+
+static struct loop_ring_t rings[2];
+
+/* node 0 is the tester, node 1 the ECU; a node receives from its ring */
+template <unsigned Node>
+struct LoopPhy
+{
+	static ERROR_CODE send(struct phy_msg_t &frame)
+	{
+		struct loop_ring_t &ring = rings[Node ^ 1U];
+
+		if(frame.new_data != TRUE)
+		{
+			return STATUS_NORMAL;
+		}
+		if(ring.head - ring.tail >= CHANNEL_RING_LEN)
+		{
+			return ERR_FULL;
+		}
+		frame.new_data = FALSE;
+		ring.frame[ring.head % CHANNEL_RING_LEN] = frame;
+		ring.head ++;
+
+		return STATUS_NORMAL;
+	}
+
+	static ERROR_CODE receive(struct phy_msg_t &frame)
+	{
+		struct loop_ring_t &ring = rings[Node];
+
+		if(ring.head == ring.tail)
+		{
+			return ERR_EMPTY;
+		}
+		frame = ring.frame[ring.tail % CHANNEL_RING_LEN];
+		ring.tail ++;
+
+		return STATUS_NORMAL;
+	}
+};
+
+typedef IsoTpChannel<ISOTP_FF_DL, 8, IsoTpAddressing::Normal, LoopPhy<0> > ClassicTester;
+typedef IsoTpChannel<ISOTP_FF_DL, 8, IsoTpAddressing::Normal, LoopPhy<1> > ClassicEcu;
+typedef IsoTpChannel<CHANNEL_LONG, 64, IsoTpAddressing::Extended, LoopPhy<0> > LongTester;
+typedef IsoTpChannel<CHANNEL_LONG, 64, IsoTpAddressing::Extended, LoopPhy<1> > LongEcu;
+typedef IsoTpChannel<CHANNEL_SHORT, 16, IsoTpAddressing::Mixed, LoopPhy<0> > ShortTester;
+typedef IsoTpChannel<CHANNEL_SHORT, 16, IsoTpAddressing::Mixed, LoopPhy<1> > ShortEcu;
+
+/* the geometry is known to the compiler */
+static_assert(ClassicTester::frames(7) == 1UL && ClassicTester::frames(8) == 2UL, "SF up to 7 bytes");
+static_assert(ClassicTester::frames(ISOTP_FF_DL) == 586UL, "FF and 585 CFs");
+static_assert(LongTester::sf_max == 61UL && LongTester::cf_len == 62UL, "extended addressing takes a byte");
+static_assert(LongTester::escape && !ClassicTester::escape, "escape FF past 4095 bytes");
+
+static ClassicTester classic_tester(CHANNEL_ECU_ID, CHANNEL_TESTER_ID);
+static ClassicEcu classic_ecu(CHANNEL_TESTER_ID, CHANNEL_ECU_ID);
+/* extended addressing: the first byte is the address of the receiver */
+static LongTester long_tester(CHANNEL_ECU_ID, CHANNEL_TESTER_ID, CHANNEL_ECU_AE, CHANNEL_TESTER_AE);
+static LongEcu long_ecu(CHANNEL_TESTER_ID, CHANNEL_ECU_ID, CHANNEL_TESTER_AE, CHANNEL_ECU_AE);
+/* mixed addressing: both directions carry the same N_AE */
+static ShortTester short_tester(CHANNEL_ECU_ID, CHANNEL_TESTER_ID, CHANNEL_ECU_AE, CHANNEL_ECU_AE);
+static ShortEcu short_ecu(CHANNEL_TESTER_ID, CHANNEL_ECU_ID, CHANNEL_ECU_AE, CHANNEL_ECU_AE);
+
+static volatile Bool echoed;
+static enum N_Result echo_result, ecu_result;
+
+template <class Channel>
+static void ecu_received(Channel &channel, enum N_Result result)
+{
+	ecu_result = result;
+	if(result == N_OK)
+	{
+		channel.send(channel.rx_data(), channel.rx_len());
+	}
+}
+
+template <class Channel>
+static void tester_received(Channel &channel, enum N_Result result)
+{
+	(void)channel;
+	echo_result = result;
+	echoed = TRUE;
+}
+
+/*
+ * one message there and back
+ */
+template <class Tester, class Ecu>
+static void echo_run(const char *name, Tester &tester, Ecu &ecu, uint32_t len)
+{
+	TickType_t begin;
+	uint32_t index, errors = 0UL, start;
+
+	memset(rings, 0, sizeof(rings));
+	tester.fc(ISOTP_FS_CTS, CHANNEL_BS, 0U);
+	ecu.fc(ISOTP_FS_CTS, CHANNEL_BS, 0U);
+	tester.callbacks(tester_received<Tester>, NULL);
+	ecu.callbacks(ecu_received<Ecu>, NULL);
+	for(index = 0; index < len; index ++)
+	{
+		tester.tx_data()[index] = (uint8_t)(index * 5UL + (index >> 8));
+	}
+	echoed = FALSE;
+	echo_result = N_ERROR;
+	ecu_result = N_ERROR;
+	begin = xTaskGetTickCount();
+	start = timer_us();
+	if(tester.send(len) == STATUS_NORMAL)
+	{
+		while(echoed == FALSE && xTaskGetTickCount() - begin < pdMS_TO_TICKS(CHANNEL_TIMEOUT_MS))
+		{
+			tester.service();
+			ecu.service();
+		}
+	}
+	start = timer_us() - start;
+	if(echoed == TRUE && echo_result == N_OK)
+	{
+		for(index = 0; index < len; index ++)
+		{
+			if(tester.rx_data()[index] != tester.tx_data()[index])
+			{
+				errors ++;
+			}
+		}
+	}
+	printf("Cpp %-8s DL:%lu frames:%lu ECU Rx result:%d Tester Rx result:%d errors:%lu time:%lu us size:%lu\r\n",
+			name, (unsigned long)len, (unsigned long)Tester::frames(len), ecu_result,
+			(echoed == TRUE) ? echo_result : -1, (unsigned long)errors, (unsigned long)start,
+			(unsigned long)sizeof(Tester));
+}
+
+extern "C" void isotp_channel_test_main(unsigned long len)
+{
+	if(len == 0UL || len > CHANNEL_LONG)
+	{
+		printf("Usage:cpp <1-%lu>\r\n", CHANNEL_LONG);
+		return;
+	}
+	if(len <= ISOTP_FF_DL)
+	{
+		echo_run("classic", classic_tester, classic_ecu, len);
+	}
+	echo_run("fd ext", long_tester, long_ecu, len);
+	echo_run("fd mixed", short_tester, short_ecu, (len < CHANNEL_SHORT) ? len : CHANNEL_SHORT);
+	printf("Cpp a C channel with two %lu byte buffers takes %lu bytes\r\n",
+			ISOTP_FF_DL, (unsigned long)(sizeof(struct isotp_t) + 2UL * ISOTP_FF_DL));
+}
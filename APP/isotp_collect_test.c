@@ -0,0 +1,423 @@
+#include "isotp.h"
+#include "isotp_collect.h"
+#include "vcan.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * Functional request over the virtual CAN bus.
+ * Up to COLLECT_MAX_ECUS ECUs, each a node of its own, answer a
+ * ReadDataByIdentifier with a multi-frame response, after
+ * COLLECT_ECU_DELAY_MS of processing. The tester asks them first one after
+ * the other with physical requests, then all at once with one functional
+ * request and the collector of lib/isotp_collect.c. The IDs are those of
+ * the normal fixed addressing with 29 bit IDs, the ECU address in the low
+ * byte of the response ID and in the second byte of the request ID.
+ */
+#define COLLECT_FUNCTIONAL_ID	(0x18DB33F1UL)
+#define COLLECT_PHYSICAL_ID		(0x18DA00F1UL)
+#define COLLECT_RESPONSE_ID		(0x18DAF100UL)
+#define COLLECT_RESPONSE_MASK	(0x1FFFFF00UL)
+/* address of the first ECU */
+#define COLLECT_ECU_ADDRESS		(0x10UL)
+
+#define COLLECT_MAX_ECUS		(32UL)
+/*
+ * The responses of all ECUs stay within N_Bs: an ECU whose FirstFrame
+ * loses the arbitration to the others waits for its FC from the time it
+ * handed the frame to its driver
+ */
+#define COLLECT_MAX_LEN			(128UL)
+#define COLLECT_ECU_DELAY_MS	(2UL)
+/* P2 of the ECUs and the latency of the bus */
+#define COLLECT_WINDOW_MS		(50UL)
+/* one FC per response, the ECUs take the bus in the order of their IDs */
+#define COLLECT_BS				(0UL)
+#define COLLECT_STMIN			(0UL)
+#define COLLECT_BITRATE			(500000UL)
+/* frames of all ECUs in flight to the tester */
+#define COLLECT_TESTER_FIFO_LEN	(256UL)
+#define COLLECT_ECU_FIFO_LEN	(16UL)
+#define COLLECT_NODES			(COLLECT_MAX_ECUS + 1UL)
+/* a run that takes longer than this failed */
+#define COLLECT_RUN_MS			(10000UL)
+
+/* ReadDataByIdentifier of the VIN */
+#define COLLECT_SID				(0x22U)
+#define COLLECT_DID				(0xF190UL)
+#define COLLECT_HEAD			(3UL)
+
+/* as APP/vcan_test.c */
+#define COLLECT_BUS_PRIORITY	(tskIDLE_PRIORITY + 1)
+#define COLLECT_NODE_PRIORITY	(tskIDLE_PRIORITY + 2)
+
+struct collect_ecu_t
+{
+	struct isotp_t channel;
+	struct vcan_node_t node;
+	uint8_t req[COLLECT_HEAD];
+	uint8_t resp[COLLECT_MAX_LEN];
+	struct timer_t delay;		/* the response is due after COLLECT_ECU_DELAY_MS */
+	TaskHandle_t task;
+};
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg);
+static ERROR_CODE tester_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_request(struct isotp_t *msg);
+static uint32_t ecu_poll(struct collect_ecu_t *self);
+static uint32_t physical_id(uint32_t id);
+static uint32_t response_check(uint32_t ecu, const uint8_t *data, uint32_t len);
+static uint32_t physical_run(uint32_t ecus);
+static uint32_t functional_run(uint32_t ecus);
+static void bus_print(void);
+static void ecu_thread(void *arg);
+
+static const uint8_t request[COLLECT_HEAD] = {COLLECT_SID, (uint8_t)(COLLECT_DID >> 8), (uint8_t)COLLECT_DID};
+
+static struct vcan_bus_t bus;
+static struct vcan_node_t *bus_node[COLLECT_NODES];
+static struct vcan_node_t tester_node;
+static struct vcan_frame_t tester_fifo[2][COLLECT_TESTER_FIFO_LEN];
+static struct vcan_frame_t ecu_fifo[COLLECT_MAX_ECUS][2][COLLECT_ECU_FIFO_LEN];
+static struct collect_ecu_t ecu[COLLECT_MAX_ECUS];
+static uint32_t resp_len;
+static struct isotp_t tester;
+static uint8_t tester_req[COLLECT_HEAD], tester_buffer[COLLECT_MAX_LEN];
+static struct isotp_collect_t collect;
+static struct isotp_responder_t responder[COLLECT_MAX_ECUS];
+static struct isotp_route_t route[COLLECT_MAX_ECUS];
+static uint8_t responses[COLLECT_MAX_ECUS][COLLECT_MAX_LEN];
+
+/*
+ * Every ECU runs in a task of its own, its channel takes the functional
+ * request and the frames of its physical request ID
+ */
+static void ecu_thread(void *arg)
+{
+	struct collect_ecu_t *self = (struct collect_ecu_t *)arg;
+	struct phy_msg_t frame;
+
+	for(;;)
+	{
+		ulTaskNotifyTake(pdTRUE, test_wait_ticks(ecu_poll(self)));
+		while(vcan_receive(&self->node, &frame) == STATUS_NORMAL)
+		{
+			isotp_on_frame(&self->channel, &frame);
+		}
+	}
+}
+
+/*
+ * send the response when it is due
+ *
+ * @parameter out:
+ * milliseconds until the ECU needs to be polled again
+ */
+static uint32_t ecu_poll(struct collect_ecu_t *self)
+{
+	uint32_t wait, next;
+
+	if(timer_is_added(&self->delay) == TRUE
+		&& timer_overflow(&self->delay, COLLECT_ECU_DELAY_MS) == TRUE)
+	{
+		xtimer_delete(&self->delay);
+		self->channel.tx.DL = resp_len;
+		isotp_send_start(&self->channel);
+	}
+	wait = isotp_poll(&self->channel);
+	next = timer_remain(&self->delay, COLLECT_ECU_DELAY_MS);
+
+	return (next < wait) ? next : wait;
+}
+
+/*
+ * the ECU builds the response at once and sends it when its time is over
+ */
+static ERROR_CODE ecu_request(struct isotp_t *msg)
+{
+	struct collect_ecu_t *self = (struct collect_ecu_t *)msg;
+	uint32_t index;
+
+	if(msg->rx.reply != N_OK || msg->rx.DL != COLLECT_HEAD || memcmp(self->req, request, COLLECT_HEAD) != 0)
+	{
+		return STATUS_NORMAL;
+	}
+	self->resp[0] = COLLECT_SID + 0x40U;
+	self->resp[1] = request[1];
+	self->resp[2] = request[2];
+	for(index = COLLECT_HEAD; index < resp_len; index ++)
+	{
+		self->resp[index] = (uint8_t)(index + (uint32_t)(self - ecu) * 7UL);
+	}
+	timer_add(&self->delay);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * the ECU at the low byte of a response ID takes its FCs on its request ID
+ */
+static uint32_t physical_id(uint32_t id)
+{
+	return COLLECT_PHYSICAL_ID | ((id & 0xFFUL) << 8);
+}
+
+/*
+ * @parameter out:
+ * bytes of a response that differ from what the ECU sends
+ */
+static uint32_t response_check(uint32_t index, const uint8_t *data, uint32_t len)
+{
+	uint32_t pos, errors = 0UL;
+
+	if(len != resp_len)
+	{
+		return resp_len;
+	}
+	if(data[0] != COLLECT_SID + 0x40U || data[1] != request[1] || data[2] != request[2])
+	{
+		errors ++;
+	}
+	for(pos = COLLECT_HEAD; pos < len; pos ++)
+	{
+		if(data[pos] != (uint8_t)(pos + index * 7UL))
+		{
+			errors ++;
+		}
+	}
+	return errors;
+}
+
+/*
+ * every ECU asked on its own, a request is sent when the response
+ * before is in
+ *
+ * @parameter out:
+ * microseconds, 0 if a response failed
+ */
+static uint32_t physical_run(uint32_t ecus)
+{
+	struct phy_msg_t frame;
+	TickType_t begin = xTaskGetTickCount();
+	uint32_t index, start, errors = 0UL;
+
+	/* frames left by the run before */
+	ulTaskNotifyTake(pdTRUE, 0);
+	vcan_stats_reset(&bus);
+	start = timer_us();
+	for(index = 0; index < ecus; index ++)
+	{
+		isotp_init(&tester, COLLECT_RESPONSE_ID | (COLLECT_ECU_ADDRESS + index),
+				COLLECT_PHYSICAL_ID | ((COLLECT_ECU_ADDRESS + index) << 8), NULL, tester_send, tester_receive);
+		isotp_rx_buffer_set(&tester, tester_buffer, sizeof(tester_buffer));
+		isotp_tx_buffer_set(&tester, tester_req, sizeof(tester_req));
+		fc_set(&tester, ISOTP_FS_CTS, COLLECT_BS, COLLECT_STMIN);
+		tester.tx.DL = COLLECT_HEAD;
+		if(isotp_send_start(&tester) != STATUS_NORMAL)
+		{
+			break;
+		}
+		while(tester.rx.state != ISOTP_FINISHED && tester.rx.state != ISOTP_ERROR
+			&& xTaskGetTickCount() - begin < pdMS_TO_TICKS(COLLECT_RUN_MS))
+		{
+			ulTaskNotifyTake(pdTRUE, test_wait_ticks(isotp_poll(&tester)));
+			while(vcan_receive(&tester_node, &frame) == STATUS_NORMAL)
+			{
+				if(frame.id == tester.isotp.N_SA)
+				{
+					isotp_on_frame(&tester, &frame);
+				}
+			}
+		}
+		if(tester.rx.state != ISOTP_FINISHED || tester.rx.reply != N_OK)
+		{
+			break;
+		}
+		errors += response_check(index, tester_buffer, tester.rx.DL);
+	}
+	start = timer_us() - start;
+	printf("Collect physical   responses:%lu errors:%lu time:%lu us\r\n",
+			(unsigned long)index, (unsigned long)errors, (unsigned long)start);
+	bus_print();
+
+	return (index == ecus && errors == 0UL) ? start : 0UL;
+}
+
+/*
+ * one functional request, the responses collected side by side
+ *
+ * @parameter out:
+ * microseconds, 0 if a response failed
+ */
+static uint32_t functional_run(uint32_t ecus)
+{
+	TickType_t begin = xTaskGetTickCount();
+	uint32_t index, errors = 0UL, ok = 0UL, wait;
+	uint32_t first = ISOTP_WAIT_FOREVER, last = 0UL;
+
+	fc_set(&collect.request, ISOTP_FS_CTS, COLLECT_BS, COLLECT_STMIN);
+	ulTaskNotifyTake(pdTRUE, 0);
+	vcan_stats_reset(&bus);
+	if(isotp_collect_start(&collect, request, COLLECT_HEAD, (uint16_t)ecus, COLLECT_WINDOW_MS) != STATUS_NORMAL)
+	{
+		printf("Collect functional request failed\r\n");
+		return 0UL;
+	}
+	for(;;)
+	{
+		wait = isotp_collect_poll(&collect);
+		if(collect.state != ISOTP_COLLECT_WAIT || xTaskGetTickCount() - begin >= pdMS_TO_TICKS(COLLECT_RUN_MS))
+		{
+			break;
+		}
+		ulTaskNotifyTake(pdTRUE, test_wait_ticks(wait));
+		isotp_collect_receive(&collect);
+	}
+	for(index = 0; index < collect.count; index ++)
+	{
+		if(responder[index].done != TRUE || responder[index].channel.rx.reply != N_OK)
+		{
+			continue;
+		}
+		ok ++;
+		/* the responders are in the order of the first frames */
+		errors += response_check((responder[index].channel.isotp.N_SA & 0xFFUL) - COLLECT_ECU_ADDRESS,
+				responses[index], responder[index].channel.rx.DL);
+		if(responder[index].time_us < first)
+		{
+			first = responder[index].time_us;
+		}
+		if(responder[index].time_us > last)
+		{
+			last = responder[index].time_us;
+		}
+	}
+	printf("Collect functional responses:%lu errors:%lu time:%lu us first:%lu us last:%lu us late:%lu overflow:%lu\r\n",
+			(unsigned long)ok, (unsigned long)errors, (unsigned long)(collect.end_us - collect.start_us),
+			(unsigned long)((ok != 0UL) ? first : 0UL), (unsigned long)last,
+			(unsigned long)collect.late, (unsigned long)collect.overflow);
+	bus_print();
+
+	return (collect.state == ISOTP_COLLECT_DONE && ok == ecus && errors == 0UL) ? collect.end_us - collect.start_us : 0UL;
+}
+
+static void bus_print(void)
+{
+	printf("                   bus load:%lu.%lu%% frames:%lu\r\n",
+			(unsigned long)(vcan_bus_load(&bus) / 10UL), (unsigned long)(vcan_bus_load(&bus) % 10UL),
+			(unsigned long)bus.frames);
+}
+
+void isotp_collect_test_main(unsigned long ecus, unsigned long len)
+{
+	uint32_t index, address, created, physical = 0UL, functional = 0UL;
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+
+	if(ecus == 0UL || ecus > COLLECT_MAX_ECUS || len < COLLECT_HEAD || len > COLLECT_MAX_LEN)
+	{
+		printf("Usage:collect <1-%lu> <%lu-%lu>\r\n", COLLECT_MAX_ECUS, COLLECT_HEAD, COLLECT_MAX_LEN);
+		return;
+	}
+	resp_len = len;
+
+	vcan_bus_init(&bus, bus_node, (uint8_t)(ecus + 1UL), COLLECT_BITRATE, VCAN_DATA_BITRATE_DEFAULT);
+	vcan_node_init(&tester_node, tester_fifo[0], COLLECT_TESTER_FIFO_LEN, tester_fifo[1], COLLECT_TESTER_FIFO_LEN);
+	vcan_filter_set(&tester_node, COLLECT_RESPONSE_ID, COLLECT_RESPONSE_MASK);
+	vcan_attach(&bus, &tester_node);
+	for(index = 0; index < ecus; index ++)
+	{
+		address = COLLECT_ECU_ADDRESS + index;
+		vcan_node_init(&ecu[index].node, ecu_fifo[index][0], COLLECT_ECU_FIFO_LEN, ecu_fifo[index][1], COLLECT_ECU_FIFO_LEN);
+		/* 0x18DA??F1 and 0x18DB??F1, the channel takes its own */
+		vcan_filter_set(&ecu[index].node, COLLECT_PHYSICAL_ID, 0x1FFE00FFUL);
+		vcan_attach(&bus, &ecu[index].node);
+		isotp_init(&ecu[index].channel, COLLECT_PHYSICAL_ID | (address << 8), COLLECT_RESPONSE_ID | address,
+				NULL, ecu_send, ecu_receive);
+		isotp_functional_set(&ecu[index].channel, COLLECT_FUNCTIONAL_ID);
+		isotp_tx_buffer_set(&ecu[index].channel, ecu[index].resp, sizeof(ecu[index].resp));
+		isotp_rx_buffer_set(&ecu[index].channel, ecu[index].req, sizeof(ecu[index].req));
+		isotp_cb_set(&ecu[index].channel, ecu_request, NULL);
+		xtimer_delete(&ecu[index].delay);
+	}
+
+	isotp_collect_init(&collect, responder, route, COLLECT_MAX_ECUS, responses[0], COLLECT_MAX_LEN,
+			tester_send, tester_receive);
+	isotp_collect_id_set(&collect, COLLECT_FUNCTIONAL_ID, COLLECT_RESPONSE_ID, COLLECT_RESPONSE_MASK, physical_id);
+	memcpy(tester_req, request, sizeof(tester_req));
+
+	test_bus_start(&bus, "collect_bus", COLLECT_BUS_PRIORITY);
+	vTaskPrioritySet(NULL, COLLECT_NODE_PRIORITY);
+	test_node_wake_set(&tester_node, xTaskGetCurrentTaskHandle());
+	/* the real stack is the one of the thread, as APP/ctxsw_test.c */
+	for(created = 0; created < ecus; created ++)
+	{
+		if(xTaskCreate(ecu_thread, "collect_ecu", configMINIMAL_STACK_SIZE, &ecu[created],
+				COLLECT_NODE_PRIORITY, &ecu[created].task) != pdPASS)
+		{
+			break;
+		}
+		test_node_wake_set(&ecu[created].node, ecu[created].task);
+	}
+
+	if(created == ecus)
+	{
+		printf("Collect %lu ECUs, response:%lu bytes, bitrate:%lu ECU delay:%lu ms\r\n",
+				ecus, len, COLLECT_BITRATE, COLLECT_ECU_DELAY_MS);
+		physical = physical_run(ecus);
+		functional = functional_run(ecus);
+	}
+	else
+	{
+		printf("No memory for %lu ECU tasks\r\n", ecus);
+	}
+
+	for(index = 0; index < created; index ++)
+	{
+		vTaskDelete(ecu[index].task);
+	}
+	test_bus_stop();
+	vTaskPrioritySet(NULL, priority);
+	if(physical != 0UL && functional != 0UL)
+	{
+		printf("Collect speed-up:%lu.%02lu\r\n", (unsigned long)(physical / functional),
+				(unsigned long)(physical % functional * 100UL / functional));
+	}
+	else
+	{
+		printf("Collect failed\r\n");
+	}
+}
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg)
+{
+	return test_node_send(&tester_node, msg);
+}
+
+static ERROR_CODE tester_receive(struct phy_msg_t *msg)
+{
+	return vcan_receive(&tester_node, msg);
+}
+
+/*
+ * the ECU is the low byte of the response ID
+ */
+static ERROR_CODE ecu_send(struct phy_msg_t *msg)
+{
+	return test_node_send(&ecu[(msg->id & 0xFFUL) - COLLECT_ECU_ADDRESS].node, msg);
+}
+
+/*
+ * frames are passed by the ECU task, nothing is fetched
+ */
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg)
+{
+	(void)msg;
+	return ERR_EMPTY;
+}
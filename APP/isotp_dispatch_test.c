@@ -0,0 +1,183 @@
+#include "isotp.h"
+#include "isotp_dispatch.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * A tester and an ECU connected by one bus, MUX_MAX_CHANNELS channels on
+ * each side sending at the same time. With normal addressing every channel
+ * has its own pair of CAN IDs, with extended and mixed addressing all
+ * channels share one pair and are told apart by the address byte.
+ * Then the tester sends a functional SingleFrame that every ECU channel
+ * listening to MUX_FUNC_ID takes: all of them with normal addressing,
+ * the one whose address byte the request carries otherwise.
+ */
+#define MUX_MAX_CHANNELS	(8UL)
+#define MUX_MAX_DL			(1024UL)
+
+/* CAN IDs of channel 0 with normal addressing, of all channels otherwise */
+#define MUX_TESTER_ID		(0x700UL)
+#define MUX_ECU_ID			(0x780UL)
+/* functional ID shared by all ECU channels */
+#define MUX_FUNC_ID			(0x7DFUL)
+/* address byte of channel 0 on the way to the ECU and to the tester */
+#define MUX_ECU_AE			(0x10UL)
+#define MUX_TESTER_AE		(0x90UL)
+
+/* FC of the ECU channels, small blocks so the channels interleave */
+#define MUX_BS				(4UL)
+#define MUX_STMIN			(0UL)
+
+/* frames in flight between the two sides */
+#define MUX_QUEUE_LEN		(32UL)
+
+static ERROR_CODE ecu_done(struct isotp_t* msg);
+
+static struct isotp_t tester[MUX_MAX_CHANNELS], ecu[MUX_MAX_CHANNELS], func;
+/* the ECU channels take a functional route each too */
+static struct isotp_route_t tester_route[MUX_MAX_CHANNELS], ecu_route[MUX_MAX_CHANNELS * 2UL];
+static struct isotp_dispatch_t tester_bus, ecu_bus;
+static uint8_t tester_buffer[MUX_MAX_CHANNELS][MUX_MAX_DL];
+static uint8_t ecu_buffer[MUX_MAX_CHANNELS][MUX_MAX_DL];
+/* TesterPresent, no response */
+static uint8_t func_request[] = {0x3E, 0x80};
+static Bool func_phase;
+static uint32_t func_received;
+
+void isotp_dispatch_test_main(unsigned char channels, unsigned long datalen, unsigned char mode)
+{
+	uint32_t index, pos;
+	uint32_t tester_id, ecu_id;
+	uint8_t tester_ae, ecu_ae;
+	Bool busy;
+	struct phy_msg_t frame;
+
+	if(channels == 0UL || channels > MUX_MAX_CHANNELS
+		|| datalen == 0UL || datalen > MUX_MAX_DL
+		|| mode > ISOTP_ADDR_MIXED)
+	{
+		printf("Usage:mux <1-%lu> <1-%lu> <0 normal|1 extended|2 mixed>\r\n", MUX_MAX_CHANNELS, MUX_MAX_DL);
+		return;
+	}
+	if(test_queues_init(MUX_QUEUE_LEN) != pdPASS)
+	{
+		printf("No memory for the frame queues\r\n");
+		return;
+	}
+
+	isotp_dispatch_init(&tester_bus, tester_route, MUX_MAX_CHANNELS, test_tester_receive);
+	isotp_dispatch_init(&ecu_bus, ecu_route, MUX_MAX_CHANNELS * 2UL, test_ecu_receive);
+	for(index = 0; index < channels; index ++)
+	{
+		tester_id = MUX_TESTER_ID;
+		ecu_id = MUX_ECU_ID;
+		if(mode == ISOTP_ADDR_NORMAL)
+		{
+			tester_id += index;
+			ecu_id += index;
+		}
+		/* mixed addressing uses the same N_AE in both directions */
+		ecu_ae = (uint8_t)(MUX_ECU_AE + index);
+		tester_ae = (mode == ISOTP_ADDR_MIXED) ? ecu_ae : (uint8_t)(MUX_TESTER_AE + index);
+
+		isotp_init(&tester[index], ecu_id, tester_id, NULL, test_tester_send, test_tester_receive);
+		isotp_addr_set(&tester[index], (enum isotp_addr_e)mode, ecu_ae, tester_ae);
+		isotp_buffer_set(&tester[index], tester_buffer[index], sizeof(tester_buffer[index]));
+		isotp_dispatch_add(&tester_bus, &tester[index]);
+
+		isotp_init(&ecu[index], tester_id, ecu_id, NULL, test_ecu_send, test_ecu_receive);
+		isotp_addr_set(&ecu[index], (enum isotp_addr_e)mode, tester_ae, ecu_ae);
+		isotp_buffer_set(&ecu[index], ecu_buffer[index], sizeof(ecu_buffer[index]));
+		isotp_cb_set(&ecu[index], ecu_done, NULL);
+		fc_set(&ecu[index], ISOTP_FS_CTS, MUX_BS, MUX_STMIN);
+		isotp_functional_set(&ecu[index], MUX_FUNC_ID);
+		isotp_dispatch_add(&ecu_bus, &ecu[index]);
+
+		/* every channel sends its own pattern */
+		for(pos = 0; pos < datalen; pos ++)
+		{
+			tester_buffer[index][pos] = (uint8_t)(pos + index);
+		}
+		memset(ecu_buffer[index], 0, sizeof(ecu_buffer[index]));
+		tester[index].tx.DL = datalen;
+	}
+
+	func_phase = FALSE;
+	test_ecu_dispatch_start(&ecu_bus, "isotp_dispatch_ecu", 1);
+	printf("Mux test, channels:%d DL:%lu addressing:%d\r\n", channels, datalen, mode);
+	for(index = 0; index < channels; index ++)
+	{
+		isotp_send_start(&tester[index]);
+	}
+	/* serve the tester channels until all transmissions ended */
+	for(;;)
+	{
+		busy = FALSE;
+		for(index = 0; index < channels; index ++)
+		{
+			if(tester[index].tx.state != ISOTP_IDLE)
+			{
+				busy = TRUE;
+			}
+		}
+		if(busy == FALSE)
+		{
+			break;
+		}
+		if(test_frame_get(TEST_TESTER, &frame, isotp_dispatch_poll(&tester_bus)) == pdPASS)
+		{
+			isotp_dispatch_frame(&tester_bus, &frame);
+		}
+	}
+	/* let the ECU handle the last frames */
+	vTaskDelay(pdMS_TO_TICKS(10UL));
+
+	/* one request to all ECU channels, the address byte of channel 0 */
+	func_phase = TRUE;
+	func_received = 0UL;
+	isotp_init(&func, ISOTP_NO_ID, MUX_FUNC_ID, NULL, test_tester_send, test_tester_receive);
+	isotp_addr_set(&func, (enum isotp_addr_e)mode, MUX_ECU_AE, MUX_TESTER_AE);
+	isotp_buffer_set(&func, func_request, sizeof(func_request));
+	func.tx.DL = sizeof(func_request);
+	isotp_functional_send(&func);
+	vTaskDelay(pdMS_TO_TICKS(10UL));
+	test_ecu_stop();
+	for(index = 0; index < channels; index ++)
+	{
+		printf("Mux ch:%lu Tx result:%d\r\n", (unsigned long)index, tester[index].tx.reply);
+	}
+	printf("Mux functional Tx result:%d taken:%lu of %lu\r\n", func.tx.reply, (unsigned long)func_received,
+			(mode == ISOTP_ADDR_NORMAL) ? (unsigned long)channels : 1UL);
+	printf("Mux unrouted tester:%lu ecu:%lu\r\n", (unsigned long)tester_bus.unrouted, (unsigned long)ecu_bus.unrouted);
+}
+
+static ERROR_CODE ecu_done(struct isotp_t* msg)
+{
+	uint32_t channel = msg - ecu;
+	uint32_t index;
+	uint32_t errors = 0UL;
+
+	if(func_phase == TRUE)
+	{
+		if(msg->rx.reply == N_OK && msg->rx.DL == sizeof(func_request)
+			&& memcmp(ecu_buffer[channel], func_request, sizeof(func_request)) == 0)
+		{
+			func_received ++;
+		}
+		return STATUS_NORMAL;
+	}
+	for(index = 0; index < msg->rx.DL; index ++)
+	{
+		if(ecu_buffer[channel][index] != (uint8_t)(index + channel))
+		{
+			errors ++;
+		}
+	}
+	printf("Mux ch:%lu Rx result:%d DL:%lu errors:%lu\r\n", (unsigned long)channel, msg->rx.reply, (unsigned long)msg->rx.DL, (unsigned long)errors);
+	return STATUS_NORMAL;
+}
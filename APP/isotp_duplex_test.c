@@ -0,0 +1,205 @@
+#include "isotp.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * Full-duplex channels.
+ * The tester and the ECU each send a long message at the same time, like a
+ * TransferData request crossing an upload response. The ECU sends slower,
+ * and once its own message is out the tester sends a TesterPresent every
+ * DUPLEX_TP_PERIOD ms, which the ECU has to take while it is still sending.
+ * With one buffer per channel for both directions the channels are
+ * half-duplex, and each side ignores the message of the other.
+ */
+#define DUPLEX_TESTER_ID	(0x7E0UL)
+#define DUPLEX_ECU_ID		(0x7E8UL)
+
+/* FC of the tester slows the ECU down to one CF per ms */
+#define DUPLEX_BS			(8UL)
+#define DUPLEX_TESTER_STMIN	(1UL)
+#define DUPLEX_ECU_STMIN	(0UL)
+
+#define DUPLEX_TP_PERIOD	(50UL)
+#define DUPLEX_TIMEOUT		(3000UL)
+
+#define DUPLEX_QUEUE_LEN	(32UL)
+
+/*
+ * The ECU sleeps the part of STmin shorter than a tick while it holds the
+ * host CPU, the tester runs above it so that its own message is not paced
+ * by the STmin of the ECU
+ */
+#define DUPLEX_ECU_PRIORITY		(tskIDLE_PRIORITY + 1)
+#define DUPLEX_TESTER_PRIORITY	(tskIDLE_PRIORITY + 2)
+
+static ERROR_CODE ecu_rx_done(struct isotp_t* msg);
+static ERROR_CODE tester_rx_done(struct isotp_t* msg);
+static uint32_t pattern_errors(const uint8_t *data, uint32_t len, uint8_t seed);
+
+static struct isotp_t tester, ecu;
+static uint8_t tester_tx[ISOTP_FF_DL], tester_rx[ISOTP_FF_DL];
+static uint8_t ecu_tx[ISOTP_FF_DL], ecu_rx[ISOTP_FF_DL];
+static const uint8_t tester_present[] = {0x3E, 0x80};
+/* results, written by the callbacks */
+static volatile Bool tester_finished, ecu_finished;
+static uint32_t tester_errors, ecu_errors;
+static uint32_t tp_received, tp_while_sending;
+static uint32_t start_us, tester_end_tx_us, tester_end_us, ecu_end_us;
+
+static uint32_t pattern_errors(const uint8_t *data, uint32_t len, uint8_t seed)
+{
+	uint32_t index, errors = 0UL;
+
+	for(index = 0; index < len; index ++)
+	{
+		if(data[index] != (uint8_t)(index + seed))
+		{
+			errors ++;
+		}
+	}
+	return errors;
+}
+
+void isotp_duplex_test_main(unsigned long datalen, unsigned char mode)
+{
+	struct phy_msg_t frame;
+	TickType_t begin, next_tp;
+	uint32_t index, wait;
+	Bool long_sent = FALSE;
+	enum N_Result long_reply = N_ERROR;
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+
+	if(datalen <= 7UL || datalen > ISOTP_FF_DL || mode > 1UL)
+	{
+		printf("Usage:duplex <8-%lu> <0 one buffer|1 two buffers>\r\n", ISOTP_FF_DL);
+		return;
+	}
+	if(test_queues_init(DUPLEX_QUEUE_LEN) != pdPASS)
+	{
+		printf("No memory for the frame queues\r\n");
+		return;
+	}
+
+	isotp_init(&tester, DUPLEX_ECU_ID, DUPLEX_TESTER_ID, NULL, test_tester_send, test_tester_receive);
+	isotp_init(&ecu, DUPLEX_TESTER_ID, DUPLEX_ECU_ID, NULL, test_ecu_send, test_ecu_receive);
+	if(mode == 1UL)
+	{
+		isotp_tx_buffer_set(&tester, tester_tx, sizeof(tester_tx));
+		isotp_rx_buffer_set(&tester, tester_rx, sizeof(tester_rx));
+		isotp_tx_buffer_set(&ecu, ecu_tx, sizeof(ecu_tx));
+		isotp_rx_buffer_set(&ecu, ecu_rx, sizeof(ecu_rx));
+	}
+	else
+	{
+		/* the message received would be written over the one sent */
+		isotp_buffer_set(&tester, tester_tx, sizeof(tester_tx));
+		isotp_buffer_set(&ecu, ecu_tx, sizeof(ecu_tx));
+	}
+	isotp_cb_set(&tester, tester_rx_done, NULL);
+	isotp_cb_set(&ecu, ecu_rx_done, NULL);
+	fc_set(&tester, ISOTP_FS_CTS, DUPLEX_BS, DUPLEX_TESTER_STMIN);
+	fc_set(&ecu, ISOTP_FS_CTS, DUPLEX_BS, DUPLEX_ECU_STMIN);
+	for(index = 0; index < datalen; index ++)
+	{
+		tester_tx[index] = (uint8_t)index;
+		ecu_tx[index] = (uint8_t)(index + 0x80);
+	}
+	memset(tester_rx, 0, sizeof(tester_rx));
+	memset(ecu_rx, 0, sizeof(ecu_rx));
+	tester_finished = ecu_finished = FALSE;
+	tester_errors = ecu_errors = 0UL;
+	tp_received = tp_while_sending = 0UL;
+	tester_end_us = ecu_end_us = 0UL;
+
+	test_ecu_channel_start(&ecu, "isotp_duplex_ecu", DUPLEX_ECU_PRIORITY);
+	vTaskPrioritySet(NULL, DUPLEX_TESTER_PRIORITY);
+	printf("Duplex test, DL:%lu buffers:%d\r\n", datalen, mode + 1);
+	begin = xTaskGetTickCount();
+	start_us = timer_us();
+	tester.tx.DL = datalen;
+	ecu.tx.DL = datalen;
+	isotp_send_start(&tester);
+	isotp_send_start(&ecu);
+	while(xTaskGetTickCount() - begin < pdMS_TO_TICKS(DUPLEX_TIMEOUT))
+	{
+		wait = isotp_poll(&tester);
+		if(tester.tx.state == ISOTP_IDLE)
+		{
+			if(long_sent == FALSE)
+			{
+				long_sent = TRUE;
+				long_reply = tester.tx.reply;
+				tester_end_tx_us = timer_us();
+				next_tp = xTaskGetTickCount();
+			}
+			if(ecu.tx.state == ISOTP_IDLE)
+			{
+				break;
+			}
+			/* keep the session of the ECU alive while it is sending */
+			if((int32_t)(xTaskGetTickCount() - next_tp) >= 0)
+			{
+				memcpy(tester_tx, tester_present, sizeof(tester_present));
+				tester.tx.DL = sizeof(tester_present);
+				isotp_send_start(&tester);
+				next_tp += pdMS_TO_TICKS(DUPLEX_TP_PERIOD);
+			}
+			if(wait > DUPLEX_TP_PERIOD)
+			{
+				wait = DUPLEX_TP_PERIOD;
+			}
+		}
+		if(test_frame_get(TEST_TESTER, &frame, wait) == pdPASS)
+		{
+			isotp_on_frame(&tester, &frame);
+		}
+	}
+	/* let the ECU handle the last frames */
+	vTaskDelay(pdMS_TO_TICKS(10UL));
+	test_ecu_stop();
+	vTaskPrioritySet(NULL, priority);
+
+	printf("Duplex tester Tx result:%d time:%lu us\r\n", long_reply,
+			(long_sent == TRUE) ? (unsigned long)(tester_end_tx_us - start_us) : 0UL);
+	printf("Duplex ECU Tx result:%d\r\n", ecu.tx.reply);
+	printf("Duplex ECU Rx result:%d errors:%lu time:%lu us\r\n", (ecu_finished == TRUE) ? ecu.rx.reply : -1,
+			(unsigned long)ecu_errors, (ecu_finished == TRUE) ? (unsigned long)(ecu_end_us - start_us) : 0UL);
+	printf("Duplex tester Rx result:%d errors:%lu time:%lu us\r\n", (tester_finished == TRUE) ? tester.rx.reply : -1,
+			(unsigned long)tester_errors, (tester_finished == TRUE) ? (unsigned long)(tester_end_us - start_us) : 0UL);
+	printf("Duplex TesterPresent received:%lu while sending:%lu\r\n",
+			(unsigned long)tp_received, (unsigned long)tp_while_sending);
+}
+
+/*
+ * the long message of the tester or a TesterPresent
+ */
+static ERROR_CODE ecu_rx_done(struct isotp_t* msg)
+{
+	if(msg->rx.reply == N_OK && msg->rx.DL == sizeof(tester_present)
+		&& memcmp(ecu_rx, tester_present, sizeof(tester_present)) == 0)
+	{
+		tp_received ++;
+		if(msg->tx.state != ISOTP_IDLE)
+		{
+			tp_while_sending ++;
+		}
+		return STATUS_NORMAL;
+	}
+	ecu_end_us = timer_us();
+	ecu_errors = pattern_errors(ecu_rx, msg->rx.DL, 0x00);
+	ecu_finished = TRUE;
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE tester_rx_done(struct isotp_t* msg)
+{
+	tester_end_us = timer_us();
+	tester_errors = pattern_errors(tester_rx, msg->rx.DL, 0x80);
+	tester_finished = TRUE;
+	return STATUS_NORMAL;
+}
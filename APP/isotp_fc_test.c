@@ -0,0 +1,279 @@
+#include "isotp.h"
+#include "isotp_fc.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * Flow control policies against a slow receiver.
+ * The ECU task handles a limited number of frames per ms from a short
+ * receive queue, like a CAN controller FIFO, and streams the data into a
+ * small store the application empties at its own rate. A frame sent to a
+ * full queue is lost, a store too full to take a CF ends the message.
+ * The fixed FC of fc_set() lets the sender overrun both, the policies make
+ * it wait.
+ */
+#define FC_TESTER_ID		(0x7E0UL)
+#define FC_ECU_ID			(0x7E8UL)
+
+#define FC_QUEUE_LEN		(16UL)
+#define FC_STORE_LEN		(256UL)
+#define FC_TIMEOUT			(10000UL)
+
+/* the ECU handles its frames once per tick, before the tester goes on */
+#define FC_ECU_PRIORITY		(tskIDLE_PRIORITY + 2)
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_done(struct isotp_t* msg);
+static ERROR_CODE store_put(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len);
+static void store_drain(uint32_t len);
+static void ecu_probe(struct isotp_t* msg, struct isotp_fc_state_t *state);
+static void ecu_thread(void *arg);
+/* counts of the channels for the stats command, see APP/isotp_stats_test.c */
+extern ERROR_CODE isotp_stats_test_attach(struct isotp_t *msg, const char *name);
+
+static const struct
+{
+	const char *name;
+	isotp_fc_policy policy;
+} fc_policies[] =
+{
+	{"fixed", NULL},
+	{"max throughput", isotp_fc_max_throughput},
+	{"low cpu", isotp_fc_low_cpu},
+	{"memory", isotp_fc_memory},
+};
+
+static struct isotp_t tester, ecu;
+static uint8_t tester_buffer[ISOTP_FF_DL];
+/* the store of the application, filled by the sink */
+static uint8_t store[FC_STORE_LEN];
+static uint32_t store_head, store_tail, store_max;
+static uint32_t store_errors;
+/* the receiver, set by the test */
+static uint32_t frames_per_ms, store_per_ms;
+static uint32_t ecu_load, queue_max;
+static uint32_t dropped, fc_frames, fc_waits;
+static volatile Bool ecu_finished;
+static uint32_t ecu_end_us;
+
+/*
+ * One tick of the ECU: at most frames_per_ms frames, then the application
+ * takes store_per_ms bytes out of the store
+ */
+static void ecu_thread(void *arg)
+{
+	struct phy_msg_t frame;
+	uint32_t handled, depth;
+
+	for(;;)
+	{
+		depth = test_frames_waiting(TEST_ECU);
+		if(depth > queue_max)
+		{
+			queue_max = depth;
+		}
+		for(handled = 0; handled < frames_per_ms; handled ++)
+		{
+			if(test_frame_get(TEST_ECU, &frame, 0UL) != pdPASS)
+			{
+				break;
+			}
+			isotp_on_frame(&ecu, &frame);
+		}
+		/* average over about 8 ticks, a burst alone is no load */
+		ecu_load = (ecu_load * 7UL + handled * 1000UL / frames_per_ms) / 8UL;
+		store_drain(store_per_ms);
+		isotp_poll(&ecu);
+		vTaskDelay(1);
+	}
+}
+
+void isotp_fc_test_main(unsigned char policy, unsigned long datalen, unsigned long frames, unsigned long bytes)
+{
+	struct phy_msg_t frame;
+	TaskHandle_t ecu_task;
+	TickType_t begin;
+	uint32_t index, start, wait;
+
+	if(policy >= sizeof(fc_policies) / sizeof(fc_policies[0])
+		|| datalen <= 7UL || datalen > ISOTP_FF_DL
+		|| frames == 0UL || frames > FC_QUEUE_LEN || bytes == 0UL || bytes > FC_STORE_LEN)
+	{
+		printf("Usage:fc <0 fixed|1 max throughput|2 low cpu|3 memory> <8-%lu> <1-%lu> <1-%lu>\r\n",
+				ISOTP_FF_DL, FC_QUEUE_LEN, FC_STORE_LEN);
+		return;
+	}
+	if(test_queues_init(FC_QUEUE_LEN) != pdPASS)
+	{
+		printf("No memory for the frame queues\r\n");
+		return;
+	}
+
+	isotp_init(&tester, FC_ECU_ID, FC_TESTER_ID, NULL, tester_send, test_tester_receive);
+	isotp_init(&ecu, FC_TESTER_ID, FC_ECU_ID, NULL, ecu_send, test_ecu_receive);
+	isotp_stats_test_attach(&tester, "fc_tester");
+	isotp_stats_test_attach(&ecu, "fc_ecu");
+	isotp_buffer_set(&tester, tester_buffer, sizeof(tester_buffer));
+	isotp_stream_set(&ecu, store_put, NULL);
+	isotp_cb_set(&ecu, ecu_done, NULL);
+	/* the receiver claims to keep up with anything */
+	fc_set(&ecu, ISOTP_FS_CTS, 0, 0);
+	isotp_fc_policy_set(&ecu, fc_policies[policy].policy, ecu_probe);
+	for(index = 0; index < datalen; index ++)
+	{
+		tester_buffer[index] = (uint8_t)index;
+	}
+	store_head = store_tail = store_max = 0UL;
+	store_errors = 0UL;
+	frames_per_ms = frames;
+	store_per_ms = bytes;
+	ecu_load = queue_max = 0UL;
+	dropped = fc_frames = fc_waits = 0UL;
+	ecu_finished = FALSE;
+
+	xTaskCreate(ecu_thread, "isotp_fc_ecu", 200, NULL, FC_ECU_PRIORITY, &ecu_task);
+	printf("Fc test, policy:%s DL:%lu frames:%lu/ms store:%lu B/ms\r\n", fc_policies[policy].name, datalen, frames, bytes);
+	begin = xTaskGetTickCount();
+	start = timer_us();
+	tester.tx.DL = datalen;
+	if(isotp_send_start(&tester) == STATUS_NORMAL)
+	{
+		for(;;)
+		{
+			wait = isotp_poll(&tester);
+			if(tester.tx.state == ISOTP_IDLE)
+			{
+				break;
+			}
+			if(test_frame_get(TEST_TESTER, &frame, wait) == pdPASS)
+			{
+				isotp_on_frame(&tester, &frame);
+			}
+		}
+	}
+	/* the ECU ends the message when it handled the last CF, or times out */
+	while(ecu_finished == FALSE && xTaskGetTickCount() - begin < pdMS_TO_TICKS(FC_TIMEOUT))
+	{
+		vTaskDelay(pdMS_TO_TICKS(1UL));
+	}
+	/* the application empties the store */
+	while(store_head != store_tail && xTaskGetTickCount() - begin < pdMS_TO_TICKS(FC_TIMEOUT))
+	{
+		vTaskDelay(pdMS_TO_TICKS(1UL));
+	}
+	vTaskDelete(ecu_task);
+
+	printf("Fc Tx result:%d Rx result:%d errors:%lu\r\n", tester.tx.reply,
+			(ecu_finished == TRUE) ? ecu.rx.reply : -1, (unsigned long)store_errors);
+	if(ecu_finished == TRUE && ecu.rx.reply == N_OK)
+	{
+		printf("Fc time:%lu us rate:%lu B/s\r\n", (unsigned long)(ecu_end_us - start),
+				(unsigned long)((unsigned long long)datalen * 1000000ULL / (ecu_end_us - start + 1UL)));
+	}
+	printf("Fc FC:%lu wait:%lu dropped:%lu max queue:%lu max store:%lu\r\n",
+			(unsigned long)fc_frames, (unsigned long)fc_waits, (unsigned long)dropped,
+			(unsigned long)queue_max, (unsigned long)store_max);
+}
+
+/*
+ * The receive queue, the load of the last ticks and the room in the store
+ */
+static void ecu_probe(struct isotp_t* msg, struct isotp_fc_state_t *state)
+{
+	uint32_t space = FC_STORE_LEN - (store_head - store_tail);
+
+	state->queue_depth = test_frames_waiting(TEST_ECU);
+	state->queue_size = FC_QUEUE_LEN;
+	state->cpu_load = ecu_load;
+	if(space < state->space)
+	{
+		state->space = space;
+	}
+}
+
+/*
+ * sink of the ECU, a CF that does not fit ends the message
+ */
+static ERROR_CODE store_put(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	uint16_t index;
+
+	if(FC_STORE_LEN - (store_head - store_tail) < len)
+	{
+		return ERR_FULL;
+	}
+	for(index = 0; index < len; index ++)
+	{
+		store[store_head % FC_STORE_LEN] = data[index];
+		store_head ++;
+	}
+	if(store_head - store_tail > store_max)
+	{
+		store_max = store_head - store_tail;
+	}
+	return STATUS_NORMAL;
+}
+
+/*
+ * the application takes up to len bytes, store_tail is also the offset in
+ * the message
+ */
+static void store_drain(uint32_t len)
+{
+	while(len > 0UL && store_tail != store_head)
+	{
+		if(store[store_tail % FC_STORE_LEN] != (uint8_t)store_tail)
+		{
+			store_errors ++;
+		}
+		store_tail ++;
+		len --;
+	}
+}
+
+/*
+ * A frame sent to a full receive queue is lost
+ */
+static ERROR_CODE tester_send(struct phy_msg_t *msg)
+{
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		if(test_frame_put(TEST_ECU, msg, 0) != pdPASS)
+		{
+			dropped ++;
+		}
+	}
+	return STATUS_NORMAL;
+}
+
+/*
+ * the ECU only sends FCs
+ */
+static ERROR_CODE ecu_send(struct phy_msg_t *msg)
+{
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		fc_frames ++;
+		if((msg->data[0] & 0x0F) == ISOTP_FS_WAIT)
+		{
+			fc_waits ++;
+		}
+		test_frame_put(TEST_TESTER, msg, portMAX_DELAY);
+	}
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE ecu_done(struct isotp_t* msg)
+{
+	ecu_end_us = timer_us();
+	ecu_finished = TRUE;
+	return STATUS_NORMAL;
+}
@@ -0,0 +1,477 @@
+#include "isotp.h"
+#include "isotp_stats.h"
+#include "timer.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * ISO-TP receive path fuzzer.
+ * Every input is a channel setup and a sequence of frames from the bus,
+ * handed to isotp_on_frame() as isotp_receive() does:
+ *
+ *	byte 0:	bits 0-1 addressing, 0 normal, 1 extended, 2 mixed
+ *			bit 2    the message goes to a sink instead of the buffer
+ *			bit 3    a message is being sent, so FCs are taken
+ *			bits 4-5 size of the receive buffer, see fuzz_rx_size
+ *			bit 6    TX_DL 64
+ *			bit 7    one buffer for both directions
+ *	then per frame:
+ *			one byte, bits 0-6 the frame length, bit 7 isotp_poll() after it,
+ *			and the data bytes of the frame, as far as the input goes
+ *
+ * After every frame the buffers are checked for writes outside them, the
+ * position of the reception for consistency, and the frames the channel
+ * sent for a valid length and ID.
+ * The search is guided by the transitions of the channel states: an input
+ * that makes a frame move the channel in a way no input did before is kept
+ * and mutated further. Without instrumentation that is the coverage the
+ * state machine gives, and it runs at the speed of isotp_on_frame().
+ * Built with ISOTP_LIBFUZZER ('make libfuzzer') the same inputs and checks
+ * run under libFuzzer, which brings main() and the coverage of the code.
+ */
+#define FUZZ_RX_ID			(0x7E0UL)
+#define FUZZ_TX_ID			(0x7E8UL)
+#define FUZZ_AE				(0x55U)
+
+#define FUZZ_INPUT_MAX		(512UL)
+#define FUZZ_CORPUS_LEN		(256UL)
+/* bits of the map of state transitions seen */
+#define FUZZ_MAP_BITS		(65536UL)
+#define FUZZ_GUARD			(16UL)
+#define FUZZ_GUARD_BYTE		(0xA5U)
+#define FUZZ_REPORT_MAX		(4UL)
+
+/* what an input broke */
+#define FUZZ_BAD_GUARD		(0x01UL)	/* a write outside a buffer */
+#define FUZZ_BAD_INDEX		(0x02UL)	/* buffer_index + rest != DL, or DL above the buffer */
+#define FUZZ_BAD_SINK		(0x04UL)	/* the sink was given data outside the message */
+#define FUZZ_BAD_FRAME		(0x08UL)	/* the channel sent a frame of a wrong length or ID */
+
+static const uint32_t fuzz_rx_size[] = {7, 62, 300, ISOTP_FF_DL};
+static const uint8_t fuzz_interesting[] = {0x00, 0x01, 0x02, 0x07, 0x08, 0x0F, 0x10, 0x20,
+										0x21, 0x30, 0x31, 0x32, 0x3F, 0x40, 0x7F, 0x80,
+										0xF1, 0xF9, 0xFF};
+
+struct fuzz_input_t
+{
+	uint32_t len;
+	uint8_t data[FUZZ_INPUT_MAX];
+};
+
+static ERROR_CODE fuzz_send(struct phy_msg_t *msg);
+static ERROR_CODE fuzz_receive(struct phy_msg_t *msg);
+static ERROR_CODE fuzz_sink(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len);
+static uint32_t fuzz_check(void);
+static uint32_t fuzz_run(const uint8_t *data, uint32_t len, Bool *new_cover);
+static uint32_t fuzz_random(void);
+static void fuzz_mutate(struct fuzz_input_t *input);
+static void fuzz_seed(void);
+static void fuzz_report(const struct fuzz_input_t *input, uint32_t bad);
+
+static struct isotp_t channel;
+static struct isotp_stats_t stats;
+static uint8_t rx_area[FUZZ_GUARD + ISOTP_FF_DL + FUZZ_GUARD];
+static uint8_t tx_area[FUZZ_GUARD + CANFD_MAX_DL * 2UL + FUZZ_GUARD];
+static uint32_t rx_size;
+static uint32_t tx_size;
+static uint32_t bad_found;
+static uint8_t cover_map[FUZZ_MAP_BITS / 8UL];
+static uint32_t cover_bits;
+static struct fuzz_input_t corpus[FUZZ_CORPUS_LEN];
+static uint32_t corpus_count;
+static uint32_t random_state;
+
+static ERROR_CODE fuzz_send(struct phy_msg_t *msg)
+{
+	if(msg->length == 0UL || msg->length > CANFD_MAX_DL
+		|| (msg->length > CAN_MAX_DL && msg->length < 12UL)
+		|| msg->id != FUZZ_TX_ID)
+	{
+		bad_found |= FUZZ_BAD_FRAME;
+	}
+
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE fuzz_receive(struct phy_msg_t *msg)
+{
+	(void)msg;
+
+	return ERR_EMPTY;
+}
+
+/*
+ * a sink as bounded as the receive buffer
+ */
+static ERROR_CODE fuzz_sink(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	if(offset + len > msg->rx.DL)
+	{
+		bad_found |= FUZZ_BAD_SINK;
+	}
+	if(offset + len > rx_size)
+	{
+		return ERR_FULL;
+	}
+	memcpy(rx_area + FUZZ_GUARD + offset, data, len);
+
+	return STATUS_NORMAL;
+}
+
+static uint32_t fuzz_check(void)
+{
+	uint32_t index;
+	uint32_t bad = 0UL;
+
+	for(index = 0; index < FUZZ_GUARD; index ++)
+	{
+		if(rx_area[index] != FUZZ_GUARD_BYTE
+			|| rx_area[FUZZ_GUARD + rx_size + index] != FUZZ_GUARD_BYTE
+			|| tx_area[index] != FUZZ_GUARD_BYTE
+			|| tx_area[FUZZ_GUARD + tx_size + index] != FUZZ_GUARD_BYTE)
+		{
+			bad |= FUZZ_BAD_GUARD;
+			break;
+		}
+	}
+	if(channel.rx.state == ISOTP_WAIT_DATA || channel.rx.state == ISOTP_SEND_FC)
+	{
+		if(channel.rx.buffer_index + channel.rx.rest != channel.rx.DL
+			|| (channel.sink == NULL && channel.rx.DL > channel.rx.buffer_size))
+		{
+			bad |= FUZZ_BAD_INDEX;
+		}
+	}
+
+	return bad;
+}
+
+/*
+ * run one input on a new channel
+ *
+ * @parameter in:
+ * data:      the input, see the top of the file
+ * len:       bytes of the input
+ * @parameter out:
+ * new_cover: set when the input made a state transition not seen before
+ * return:    the FUZZ_BAD_ flags of what the input broke
+ */
+static uint32_t fuzz_run(const uint8_t *data, uint32_t len, Bool *new_cover)
+{
+	static const uint8_t addr_mode[] = {ISOTP_ADDR_NORMAL, ISOTP_ADDR_EXTENDED, ISOTP_ADDR_MIXED, ISOTP_ADDR_NORMAL};
+	struct phy_msg_t frame;
+	uint32_t pos = 1UL, part, hash;
+	uint8_t config, head, rx_state, tx_state, pci;
+	ERROR_CODE err;
+
+	if(len == 0UL)
+	{
+		return 0UL;
+	}
+	config = data[0];
+	bad_found = 0UL;
+	rx_size = fuzz_rx_size[(config >> 4) & 0x03];
+	memset(rx_area, FUZZ_GUARD_BYTE, FUZZ_GUARD + rx_size + FUZZ_GUARD);
+
+	isotp_init(&channel, FUZZ_RX_ID, FUZZ_TX_ID, NULL, fuzz_send, fuzz_receive);
+	isotp_addr_set(&channel, addr_mode[config & 0x03], FUZZ_AE, FUZZ_AE);
+	isotp_dl_set(&channel, (config & 0x40) ? CANFD_MAX_DL : CAN_MAX_DL);
+	fc_set(&channel, ISOTP_FS_CTS, 2, 0);
+	isotp_stats_set(&channel, &stats);
+	/* a message of one FF and one CF, it never waits STmin */
+	tx_size = ((config & 0x40) ? CANFD_MAX_DL * 2UL - 3UL : CAN_MAX_DL * 2UL - 3UL) - 2UL * channel.isotp.addr_len;
+	memset(tx_area, FUZZ_GUARD_BYTE, FUZZ_GUARD + tx_size + FUZZ_GUARD);
+	if(config & 0x80)
+	{
+		isotp_buffer_set(&channel, rx_area + FUZZ_GUARD, rx_size);
+		channel.tx.DL = (tx_size < rx_size) ? tx_size : rx_size;
+	}
+	else
+	{
+		isotp_rx_buffer_set(&channel, rx_area + FUZZ_GUARD, rx_size);
+		isotp_tx_buffer_set(&channel, tx_area + FUZZ_GUARD, tx_size);
+		channel.tx.DL = tx_size;
+	}
+	if(config & 0x04)
+	{
+		isotp_stream_set(&channel, fuzz_sink, NULL);
+	}
+	if(config & 0x08)
+	{
+		isotp_send_start(&channel);
+	}
+
+	while(pos < len)
+	{
+		head = data[pos ++];
+		memset(&frame, 0, sizeof(frame));
+		frame.id = FUZZ_RX_ID;
+		frame.length = head & 0x7F;
+		part = (frame.length < CANFD_MAX_DL) ? frame.length : CANFD_MAX_DL;
+		if(part > len - pos)
+		{
+			part = len - pos;
+		}
+		memcpy(frame.data, data + pos, part);
+		pos += part;
+
+		rx_state = (uint8_t)channel.rx.state;
+		tx_state = (uint8_t)channel.tx.state;
+		pci = frame.data[channel.isotp.addr_len] >> 4;
+		err = isotp_on_frame(&channel, &frame);
+		if(head & 0x80)
+		{
+			isotp_poll(&channel);
+		}
+		bad_found |= fuzz_check();
+
+		/* the transition this frame made */
+		hash = ((((((uint32_t)pci * 16UL + rx_state) * 16UL + tx_state) * 32UL
+				+ ((uint32_t)err & 0x1FUL)) * 16UL + channel.rx.state) * 16UL + channel.tx.state);
+		hash = ((hash * 2654435761UL) >> 16) % FUZZ_MAP_BITS;
+		if((cover_map[hash >> 3] & (1U << (hash & 7UL))) == 0U)
+		{
+			cover_map[hash >> 3] |= (uint8_t)(1U << (hash & 7UL));
+			cover_bits ++;
+			*new_cover = TRUE;
+		}
+	}
+
+	return bad_found;
+}
+
+/*
+ * xorshift32
+ */
+static uint32_t fuzz_random(void)
+{
+	random_state ^= random_state << 13;
+	random_state ^= random_state >> 17;
+	random_state ^= random_state << 5;
+
+	return random_state;
+}
+
+static void fuzz_mutate(struct fuzz_input_t *input)
+{
+	const struct fuzz_input_t *other;
+	uint32_t count = 1UL + fuzz_random() % 4UL;
+	uint32_t at, span;
+
+	while(count -- > 0UL)
+	{
+		at = (input->len > 0UL) ? fuzz_random() % input->len : 0UL;
+		switch(fuzz_random() % 6UL)
+		{
+			case 0:
+				input->data[at] ^= (uint8_t)(1U << (fuzz_random() % 8UL));
+				break;
+			case 1:
+				input->data[at] = fuzz_interesting[fuzz_random() % sizeof(fuzz_interesting)];
+				break;
+			case 2:
+				input->data[at] = (uint8_t)fuzz_random();
+				break;
+			case 3:
+				/* repeat a piece, a frame sent twice or one more CF */
+				span = 1UL + fuzz_random() % 16UL;
+				if(at + span > input->len || input->len + span > FUZZ_INPUT_MAX)
+				{
+					break;
+				}
+				memmove(input->data + at + span, input->data + at, input->len - at);
+				input->len += span;
+				break;
+			case 4:
+				span = 1UL + fuzz_random() % 16UL;
+				if(at + span >= input->len)
+				{
+					break;
+				}
+				memmove(input->data + at, input->data + at + span, input->len - at - span);
+				input->len -= span;
+				break;
+			default:
+				/* the rest of another input */
+				other = &corpus[fuzz_random() % corpus_count];
+				if(other->len <= 1UL || at == 0UL)
+				{
+					break;
+				}
+				span = fuzz_random() % other->len;
+				if(at + other->len - span > FUZZ_INPUT_MAX)
+				{
+					break;
+				}
+				memcpy(input->data + at, other->data + span, other->len - span);
+				input->len = at + other->len - span;
+				break;
+		}
+	}
+}
+
+/*
+ * start from valid traffic: a SF, a classical and a CAN FD segmented
+ * message, and the FCs of a message being sent
+ */
+static void fuzz_seed(void)
+{
+	static const uint8_t sf[] = {0x00, 0x04, 0x03, 0x11, 0x22, 0x33};
+	static const uint8_t fc[] = {0x08, 0x83, 0x30, 0x00, 0x00, 0x03, 0x31, 0x00, 0x00, 0x03, 0x30, 0x01, 0xF1};
+	struct fuzz_input_t *input;
+	uint32_t tx_dl, dl, sent, part, sn;
+
+	memcpy(corpus[0].data, sf, sizeof(sf));
+	corpus[0].len = sizeof(sf);
+	memcpy(corpus[1].data, fc, sizeof(fc));
+	corpus[1].len = sizeof(fc);
+	corpus_count = 2UL;
+	for(tx_dl = CAN_MAX_DL; tx_dl <= CANFD_MAX_DL; tx_dl += CANFD_MAX_DL - CAN_MAX_DL)
+	{
+		input = &corpus[corpus_count ++];
+		dl = (tx_dl == CAN_MAX_DL) ? 40UL : 200UL;
+		input->data[0] = 0x20 | ((tx_dl == CANFD_MAX_DL) ? 0x40 : 0x00);
+		input->data[1] = (uint8_t)tx_dl;
+		input->data[2] = 0x10 | (uint8_t)(dl >> 8);
+		input->data[3] = (uint8_t)dl;
+		memset(input->data + 4, 0x5A, tx_dl - 2UL);
+		input->len = 2UL + tx_dl;
+		sent = tx_dl - 2UL;
+		for(sn = 1UL; sent < dl; sn ++)
+		{
+			part = (dl - sent < tx_dl - 1UL) ? dl - sent : tx_dl - 1UL;
+			input->data[input->len ++] = (uint8_t)(part + 1UL);
+			input->data[input->len ++] = 0x20 | (uint8_t)(sn & 0x0F);
+			memset(input->data + input->len, (uint8_t)sn, part);
+			input->len += part;
+			sent += part;
+		}
+	}
+}
+
+static void fuzz_report(const struct fuzz_input_t *input, uint32_t bad)
+{
+	uint32_t index;
+
+	printf("Fuzz input broke 0x%02lX:", (unsigned long)bad);
+	for(index = 0; index < input->len; index ++)
+	{
+		printf("%s%02X", (index % 32UL) ? " " : "\r\n  ", input->data[index]);
+	}
+	printf("\r\n");
+}
+
+/*
+ * fuzz the receive path
+ *
+ * @parameter in:
+ * runs:      inputs to try
+ * seed:      of the mutations, the same seed gives the same inputs
+ * @parameter out:
+ * number of inputs that broke something
+ */
+unsigned long isotp_fuzz_main(unsigned long runs, unsigned long seed)
+{
+	static struct fuzz_input_t input;
+	unsigned long run, failed = 0UL;
+	uint32_t index, bad, start, elapsed;
+	Bool new_cover;
+
+	random_state = (seed != 0UL) ? (uint32_t)seed : 1UL;
+	memset(cover_map, 0, sizeof(cover_map));
+	cover_bits = 0UL;
+	isotp_stats_reset(&stats);
+	fuzz_seed();
+
+	start = timer_us();
+	for(run = 0; run < runs; run ++)
+	{
+		if(run < corpus_count)
+		{
+			memcpy(&input, &corpus[run], sizeof(input));
+		}
+		else
+		{
+			memcpy(&input, &corpus[fuzz_random() % corpus_count], sizeof(input));
+			fuzz_mutate(&input);
+		}
+		new_cover = FALSE;
+		bad = fuzz_run(input.data, input.len, &new_cover);
+		if(bad != 0UL)
+		{
+			if(failed < FUZZ_REPORT_MAX)
+			{
+				fuzz_report(&input, bad);
+			}
+			failed ++;
+			continue;
+		}
+		if(new_cover == TRUE && run >= corpus_count)
+		{
+			/* a full corpus keeps the newest inputs */
+			index = (corpus_count < FUZZ_CORPUS_LEN) ? corpus_count ++ : fuzz_random() % FUZZ_CORPUS_LEN;
+			memcpy(&corpus[index], &input, sizeof(input));
+		}
+	}
+	elapsed = timer_us() - start;
+
+	printf("Fuzz runs:%lu execs/s:%lu corpus:%lu transitions:%lu frames:%lu failed:%lu\r\n",
+			runs, (unsigned long)((unsigned long long)runs * 1000000ULL / (elapsed + 1UL)),
+			(unsigned long)corpus_count, (unsigned long)cover_bits,
+			(unsigned long)stats.rx_frames, failed);
+	printf("Fuzz results rx N_OK:%lu N_WRONG_SN:%lu N_BUFFER_OVFLW:%lu tx N_OK:%lu N_INVALID_FS:%lu N_WFT_OVRN:%lu\r\n",
+			(unsigned long)stats.rx_result[N_OK], (unsigned long)stats.rx_result[N_WRONG_SN],
+			(unsigned long)stats.rx_result[N_BUFFER_OVFLW], (unsigned long)stats.tx_result[N_OK],
+			(unsigned long)stats.tx_result[N_INVALID_FS], (unsigned long)stats.tx_result[N_WFT_OVRN]);
+
+	return failed;
+}
+
+/*
+ * headless run, see main(): the simulator exits with the number of inputs
+ * that broke something
+ */
+void isotp_fuzz_task(void *arg)
+{
+	char **argv = (char **)arg;
+
+	exit((int)(isotp_fuzz_main(strtoul(argv[0], NULL, 10), strtoul(argv[1], NULL, 10)) != 0UL));
+}
+
+#ifdef ISOTP_LIBFUZZER
+/*
+ * No scheduler runs under libFuzzer, the channel timers see the time stand
+ * still, as they nearly do at the speed of the headless run
+ */
+TickType_t xTaskGetTickCount(void)
+{
+	return 0;
+}
+
+void vTaskDelay(const TickType_t xTicksToDelay)
+{
+	(void)xTicksToDelay;
+}
+
+/*
+ * libFuzzer entry, an input that breaks a check is reported as a crash
+ */
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size)
+{
+	Bool new_cover = FALSE;
+	uint32_t bad;
+
+	bad = fuzz_run(data, (uint32_t)size, &new_cover);
+	if(bad != 0UL)
+	{
+		printf("Fuzz input broke 0x%02lX\r\n", (unsigned long)bad);
+		abort();
+	}
+	return 0;
+}
+#endif /* ISOTP_LIBFUZZER */
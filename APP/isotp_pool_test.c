@@ -0,0 +1,213 @@
+#include "isotp.h"
+#include "isotp_dispatch.h"
+#include "isotp_pool.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * A tester and an ECU connected by one bus, POOL_MAX_CHANNELS channels on
+ * each side. The ECU channels have no buffer of their own, they receive
+ * into a pool of as many contexts as given, with the blocks for that many
+ * messages of POOL_MAX_DL bytes. The tester sends on every channel at
+ * once, the FFs the pool has no context for are answered with FC.OVFLW,
+ * and the tester sends those again in the next round.
+ */
+#define POOL_MAX_CHANNELS	(32UL)
+#define POOL_MAX_DL			(ISOTP_FF_DL)
+#define POOL_BLOCK_SIZE		(256UL)
+/* blocks a message of POOL_MAX_DL bytes takes */
+#define POOL_MSG_BLOCKS		((POOL_MAX_DL + POOL_BLOCK_SIZE - 1UL) / POOL_BLOCK_SIZE)
+#define POOL_MAX_ROUNDS		(POOL_MAX_CHANNELS + 1UL)
+
+#define POOL_TESTER_ID		(0x700UL)
+#define POOL_ECU_ID			(0x780UL)
+/* FC of the ECU channels, small blocks so the channels interleave */
+#define POOL_BS				(4UL)
+#define POOL_STMIN			(0UL)
+
+/* frames in flight between the two sides */
+#define POOL_QUEUE_LEN		(32UL)
+/* time the ECU gets for the last frames of a round */
+#define POOL_DRAIN_MS		(100UL)
+
+static ERROR_CODE tester_source(struct isotp_t *msg, uint32_t offset, uint8_t *data, uint16_t len);
+static ERROR_CODE ecu_done(struct isotp_t* msg);
+
+static struct isotp_t tester[POOL_MAX_CHANNELS], ecu[POOL_MAX_CHANNELS];
+static struct isotp_route_t tester_route[POOL_MAX_CHANNELS], ecu_route[POOL_MAX_CHANNELS];
+static struct isotp_dispatch_t tester_bus, ecu_bus;
+static struct isotp_pool_t pool;
+static struct isotp_pool_ctx_t pool_ctx[POOL_MAX_CHANNELS];
+static uint8_t pool_blocks[POOL_MAX_CHANNELS * POOL_MSG_BLOCKS][POOL_BLOCK_SIZE];
+/* results of the ECU channels, written by the ECU task */
+static volatile Bool received[POOL_MAX_CHANNELS];
+static volatile uint32_t rx_errors, rx_overflow, rx_ended;
+
+void isotp_pool_test_main(unsigned long channels, unsigned long contexts, unsigned long datalen)
+{
+	uint32_t index, round, sent, done = 0UL, refused = 0UL;
+	Bool busy;
+	struct phy_msg_t frame;
+	TickType_t begin;
+
+	if(channels == 0UL || channels > POOL_MAX_CHANNELS
+		|| contexts == 0UL || contexts > POOL_MAX_CHANNELS
+		|| datalen == 0UL || datalen > POOL_MAX_DL)
+	{
+		printf("Usage:pool <channels 1-%lu> <contexts 1-%lu> <1-%lu>\r\n",
+				POOL_MAX_CHANNELS, POOL_MAX_CHANNELS, POOL_MAX_DL);
+		return;
+	}
+	if(test_queues_init(POOL_QUEUE_LEN) != pdPASS)
+	{
+		printf("No memory for the frame queues\r\n");
+		return;
+	}
+
+	isotp_pool_init(&pool, pool_ctx, (uint16_t)contexts, pool_blocks[0], POOL_BLOCK_SIZE, contexts * POOL_MSG_BLOCKS);
+	isotp_dispatch_init(&tester_bus, tester_route, POOL_MAX_CHANNELS, test_tester_receive);
+	isotp_dispatch_init(&ecu_bus, ecu_route, POOL_MAX_CHANNELS, test_ecu_receive);
+	for(index = 0; index < channels; index ++)
+	{
+		/* the tester only sends, every channel its own pattern */
+		isotp_init(&tester[index], POOL_ECU_ID + index, POOL_TESTER_ID + index, NULL, test_tester_send, test_tester_receive);
+		isotp_stream_set(&tester[index], NULL, tester_source);
+		isotp_dispatch_add(&tester_bus, &tester[index]);
+
+		isotp_init(&ecu[index], POOL_TESTER_ID + index, POOL_ECU_ID + index, NULL, test_ecu_send, test_ecu_receive);
+		isotp_pool_set(&ecu[index], &pool);
+		isotp_cb_set(&ecu[index], ecu_done, NULL);
+		fc_set(&ecu[index], ISOTP_FS_CTS, POOL_BS, POOL_STMIN);
+		isotp_dispatch_add(&ecu_bus, &ecu[index]);
+
+		tester[index].tx.DL = datalen;
+		received[index] = FALSE;
+	}
+	rx_errors = 0UL;
+	rx_overflow = 0UL;
+
+	test_ecu_dispatch_start(&ecu_bus, "isotp_pool_ecu", 1);
+	printf("Pool test, channels:%lu contexts:%lu DL:%lu\r\n", channels, contexts, datalen);
+	for(round = 0; round < POOL_MAX_ROUNDS; round ++)
+	{
+		sent = 0UL;
+		rx_ended = 0UL;
+		for(index = 0; index < channels; index ++)
+		{
+			if(received[index] == FALSE)
+			{
+				isotp_send_start(&tester[index]);
+				sent ++;
+			}
+		}
+		if(sent == 0UL)
+		{
+			break;
+		}
+		/* serve the tester channels until all transmissions ended */
+		for(;;)
+		{
+			busy = FALSE;
+			for(index = 0; index < channels; index ++)
+			{
+				if(tester[index].tx.state != ISOTP_IDLE)
+				{
+					busy = TRUE;
+				}
+			}
+			if(busy == FALSE)
+			{
+				break;
+			}
+			if(test_frame_get(TEST_TESTER, &frame, isotp_dispatch_poll(&tester_bus)) == pdPASS)
+			{
+				isotp_dispatch_frame(&tester_bus, &frame);
+			}
+		}
+		/* every message sent ends in one rx_done of the ECU, received or refused */
+		begin = xTaskGetTickCount();
+		while(rx_ended < sent && xTaskGetTickCount() - begin < pdMS_TO_TICKS(POOL_DRAIN_MS))
+		{
+			vTaskDelay(1);
+		}
+		done = 0UL;
+		for(index = 0; index < channels; index ++)
+		{
+			if(tester[index].tx.reply == N_BUFFER_OVFLW)
+			{
+				refused ++;
+			}
+			if(received[index] == TRUE)
+			{
+				done ++;
+			}
+		}
+		printf("Pool round:%lu sent:%lu received:%lu\r\n", (unsigned long)round, (unsigned long)sent, (unsigned long)done);
+	}
+	test_ecu_stop();
+	printf("Pool received:%lu of %lu rounds:%lu errors:%lu FC.OVFLW:%lu ECU N_BUFFER_OVFLW:%lu\r\n",
+			(unsigned long)done, channels, (unsigned long)round, (unsigned long)rx_errors,
+			(unsigned long)refused, (unsigned long)rx_overflow);
+	printf("Pool taken:%lu full:%lu peak contexts:%u blocks:%lu of %lu in use:%u\r\n",
+			(unsigned long)pool.taken, (unsigned long)pool.full, (unsigned)pool.ctx_peak,
+			(unsigned long)pool.block_peak, (unsigned long)pool.block_count, (unsigned)pool.ctx_used);
+	printf("Pool memory:%lu bytes, a %lu byte buffer per channel:%lu bytes\r\n",
+			(unsigned long)(contexts * sizeof(struct isotp_pool_ctx_t) + pool.block_count * POOL_BLOCK_SIZE),
+			POOL_MAX_DL, channels * POOL_MAX_DL);
+}
+
+static ERROR_CODE tester_source(struct isotp_t *msg, uint32_t offset, uint8_t *data, uint16_t len)
+{
+	uint32_t channel = msg - tester;
+	uint16_t index;
+
+	for(index = 0; index < len; index ++)
+	{
+		data[index] = (uint8_t)(offset + index + channel);
+	}
+	return STATUS_NORMAL;
+}
+
+/*
+ * the message is only in the blocks of the pool until this returns
+ */
+static ERROR_CODE ecu_done(struct isotp_t* msg)
+{
+	uint32_t channel = msg - ecu;
+	uint32_t offset = 0UL, pos;
+	uint8_t index;
+
+	rx_ended ++;
+	if(msg->rx.reply == N_BUFFER_OVFLW)
+	{
+		rx_overflow ++;
+		return STATUS_NORMAL;
+	}
+	if(msg->rx.reply != N_OK)
+	{
+		rx_errors ++;
+		return STATUS_NORMAL;
+	}
+	for(index = 0; index < msg->rx.iovcnt; index ++)
+	{
+		for(pos = 0; pos < msg->rx.iov[index].len; pos ++)
+		{
+			if(msg->rx.iov[index].base[pos] != (uint8_t)(offset + channel))
+			{
+				rx_errors ++;
+			}
+			offset ++;
+		}
+	}
+	if(offset != msg->rx.DL)
+	{
+		rx_errors ++;
+	}
+	received[channel] = TRUE;
+	return STATUS_NORMAL;
+}
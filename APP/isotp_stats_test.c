@@ -0,0 +1,153 @@
+#include "isotp.h"
+#include "isotp_stats.h"
+#include <stdio.h>
+#include <string.h>
+
+#include "comm_typedef.h"
+
+/*
+ * Channel statistics of the tests.
+ * A test hands its channels to isotp_stats_test_attach() after isotp_init(),
+ * the counts of a channel name go on across runs until "stats reset".
+ */
+#define STATS_CHANNELS		(8UL)
+#define STATS_NAME_LEN		(16UL)
+
+struct stats_channel_t
+{
+	char name[STATS_NAME_LEN];
+	struct isotp_stats_t stats;
+};
+
+static void stats_print(const struct stats_channel_t *channel);
+static void hist_print(const char *name, const struct isotp_hist_t *hist);
+
+static struct stats_channel_t channels[STATS_CHANNELS];
+static uint32_t channel_count;
+
+static const char *const result_name[N_ERROR + 1] =
+{
+	"N_OK", "N_TIMEOUT_A", "N_TIMEOUT_Bs", "N_TIMEOUT_Cr", "N_WRONG_SN",
+	"N_INVALID_FS", "N_UNEXP_PDU", "N_WFT_OVRN", "N_BUFFER_OVFLW", "N_ERROR",
+};
+
+/*
+ * count the events of a channel under name
+ *
+ * @parameter in:
+ * msg:       object, after isotp_init()
+ * name:      shown by the stats command
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_stats_test_attach(struct isotp_t *msg, const char *name)
+{
+	uint32_t index;
+
+	if(msg == NULL || name == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	for(index = 0; index < channel_count; index ++)
+	{
+		if(strncmp(channels[index].name, name, STATS_NAME_LEN - 1UL) == 0)
+		{
+			return isotp_stats_set(msg, &channels[index].stats);
+		}
+	}
+	if(channel_count >= STATS_CHANNELS)
+	{
+		return ERR_FULL;
+	}
+	strncpy(channels[channel_count].name, name, STATS_NAME_LEN - 1UL);
+	isotp_stats_reset(&channels[channel_count].stats);
+	channel_count ++;
+
+	return isotp_stats_set(msg, &channels[channel_count - 1UL].stats);
+}
+
+void isotp_stats_test_main(const char *arg)
+{
+	uint32_t index;
+	Bool found = FALSE;
+
+	if(strcmp(arg, "reset") == 0)
+	{
+		for(index = 0; index < channel_count; index ++)
+		{
+			isotp_stats_reset(&channels[index].stats);
+		}
+		printf("Stats of %lu channels cleared\r\n", (unsigned long)channel_count);
+		return;
+	}
+	for(index = 0; index < channel_count; index ++)
+	{
+		if(strcmp(arg, "all") == 0 || strcmp(arg, channels[index].name) == 0)
+		{
+			stats_print(&channels[index]);
+			found = TRUE;
+		}
+	}
+	if(found == FALSE)
+	{
+		printf("Stats: no channel %s, run vcan or fc first\r\n", arg);
+	}
+}
+
+static void stats_print(const struct stats_channel_t *channel)
+{
+	const struct isotp_stats_t *stats = &channel->stats;
+	uint32_t index;
+
+	printf("Channel %s\r\n", channel->name);
+	printf("  frames tx:%lu rx:%lu bytes tx:%lu rx:%lu FC.WAIT tx:%lu rx:%lu\r\n",
+			(unsigned long)stats->tx_frames, (unsigned long)stats->rx_frames,
+			(unsigned long)stats->tx_bytes, (unsigned long)stats->rx_bytes,
+			(unsigned long)stats->fc_wait_sent, (unsigned long)stats->fc_wait_received);
+	for(index = 0; index <= N_ERROR; index ++)
+	{
+		if(stats->tx_result[index] != 0UL || stats->rx_result[index] != 0UL)
+		{
+			printf("  %-15s tx:%lu rx:%lu\r\n", result_name[index],
+					(unsigned long)stats->tx_result[index], (unsigned long)stats->rx_result[index]);
+		}
+	}
+	hist_print("FF/block->FC", &stats->fc_latency);
+	hist_print("tx CF gap", &stats->tx_cf_gap);
+	hist_print("rx CF gap", &stats->rx_cf_gap);
+	hist_print("tx time", &stats->tx_time);
+	hist_print("rx time", &stats->rx_time);
+}
+
+static void hist_print(const char *name, const struct isotp_hist_t *hist)
+{
+	uint32_t index;
+
+	if(hist->count == 0UL)
+	{
+		return;
+	}
+	printf("  %-12s n:%lu mean:%lu p50:%lu p90:%lu p99:%lu max:%lu us\r\n", name,
+			(unsigned long)hist->count, (unsigned long)isotp_hist_mean(hist),
+			(unsigned long)isotp_hist_percentile(hist, 50UL),
+			(unsigned long)isotp_hist_percentile(hist, 90UL),
+			(unsigned long)isotp_hist_percentile(hist, 99UL),
+			(unsigned long)hist->max);
+	for(index = 0; index < ISOTP_HIST_BUCKETS; index ++)
+	{
+		if(hist->bucket[index] == 0UL)
+		{
+			continue;
+		}
+		if(index == ISOTP_HIST_BUCKETS - 1UL)
+		{
+			printf("    >= %7lu us: %lu\r\n",
+					(unsigned long)isotp_hist_bucket_us(index - 1UL), (unsigned long)hist->bucket[index]);
+		}
+		else
+		{
+			printf("    < %8lu us: %lu\r\n",
+					(unsigned long)isotp_hist_bucket_us(index), (unsigned long)hist->bucket[index]);
+		}
+	}
+}
@@ -1,9 +1,11 @@
 #include "isotp.h"
+#include "test_util.h"
 #include <stdio.h>
 #include <stdarg.h>
 #include <string.h>
 #include <FreeRTOS.h>
 #include <task.h>
+#include <queue.h>
 
 #include "comm_typedef.h"
 
@@ -13,15 +15,39 @@
 #define TEST_BS (1UL)
 #define TEST_STMIN (10UL)
 
+/* the single frame test sends TEST_SF_DL bytes of TEST_SF_DATA */
+#define TEST_SF_DL (5UL)
+#define TEST_SF_DATA (6UL)
+
+/* frames in flight between the two ends */
+#define TEST_QUEUE_LEN (16UL)
+
 static ERROR_CODE sender_test_send(struct phy_msg_t *msg);
 static ERROR_CODE sender_test_receive(struct phy_msg_t *msg);
 static ERROR_CODE receiver_test_send(struct phy_msg_t *msg);
 static ERROR_CODE receiver_test_receive(struct phy_msg_t *msg);
 static ERROR_CODE receiver_set_FS(struct isotp_t* msg);
+static ERROR_CODE receiver_done(struct isotp_t* msg);
+static ERROR_CODE sender_source(struct isotp_t* msg, uint32_t offset, uint8_t *data, uint16_t len);
+static ERROR_CODE receiver_sink(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len);
+static void debug_frame(const char *who, uint32_t seq, struct phy_msg_t *msg);
 static void debug_out(const char *fmt, ...);
 
 
 static struct isotp_t sender, receiver;
+/* frames on the way to the sender and to the receiver */
+static QueueHandle_t sender_queue = NULL, receiver_queue = NULL;
+/* buffers lent to both ends, a scatter-gather list on the receiving end */
+static uint8_t sender_buffer[ISOTP_FF_DL];
+static uint8_t receiver_buffer[3][ISOTP_FF_DL / 3];
+static const struct isotp_iovec receiver_iov[3] =
+{
+	{receiver_buffer[0], sizeof(receiver_buffer[0])},
+	{receiver_buffer[1], sizeof(receiver_buffer[1])},
+	{receiver_buffer[2], sizeof(receiver_buffer[2])},
+};
+/* bytes of a streamed message that did not match the test pattern */
+static uint32_t sink_errors = 0UL;
 
 static void debug_out(const char *fmt, ...)
 {
@@ -34,19 +60,90 @@ static void debug_out(const char *fmt, ...)
 	//pthread_mutex_unlock(&dbg_mutex);
 }
 
+static void debug_frame(const char *who, uint32_t seq, struct phy_msg_t *msg)
+{
+	uint8_t index;
+
+	debug_out("%s Seq:%04d Len:%02d Id:0x%04X Data:", who, seq, msg->length, msg->id);
+	for(index = 0; index < msg->length && index < CANFD_MAX_DL; index ++)
+	{
+		debug_out("%02X ", msg->data[index]);
+	}
+	debug_out("\r\n");
+}
+
+/*
+ * The receiving end sleeps on its frame queue, it only runs when a frame
+ * arrives or a timeout of the channel is due.
+ */
 void rx_thread(void *arg)
 {
+	static uint32_t seq = 0UL;
+	struct phy_msg_t frame;
+
+	for(;;)
+	{
+		if(xQueueReceive(receiver_queue, &frame, test_wait_ticks(isotp_poll(&receiver))) == pdPASS)
+		{
+			seq ++;
+			debug_frame("Rcer-Rx", seq, &frame);
+			isotp_on_frame(&receiver, &frame);
+		}
+	}
+}
+
+/*
+ * Send the message of the sender and wait for the transmission to end
+ */
+static enum N_Result sender_send(void)
+{
+	static uint32_t seq = 0UL;
+	struct phy_msg_t frame;
+	uint32_t wait;
+
+	if(isotp_send_start(&sender) != STATUS_NORMAL)
+	{
+		return N_ERROR;
+	}
 	for(;;)
 	{
-		isotp_receive(&receiver);
+		wait = isotp_poll(&sender);
+		if(sender.tx.state == ISOTP_IDLE)
+		{
+			break;
+		}
+		if(xQueueReceive(sender_queue, &frame, test_wait_ticks(wait)) == pdPASS)
+		{
+			seq ++;
+			debug_frame("Sder-Rx", seq, &frame);
+			isotp_on_frame(&sender, &frame);
+		}
 	}
+
+	return sender.tx.reply;
 }
 
-void isotp_test_main(unsigned short datalen, unsigned char bs, unsigned char stmin)
+void isotp_test_main(unsigned long datalen, unsigned char bs, unsigned char stmin, unsigned char tx_dl)
 {
 	uint16_t index;
 	TaskHandle_t rc_task;
 
+	if(sender_queue == NULL)
+	{
+		sender_queue = xQueueCreate(TEST_QUEUE_LEN, sizeof(struct phy_msg_t));
+		receiver_queue = xQueueCreate(TEST_QUEUE_LEN, sizeof(struct phy_msg_t));
+	}
+	else
+	{
+		xQueueReset(sender_queue);
+		xQueueReset(receiver_queue);
+	}
+	if(sender_queue == NULL || receiver_queue == NULL)
+	{
+		debug_out("No memory for the frame queues\r\n");
+		return;
+	}
+
 	/* 
 	 * initialize sender parameters
 	 * sender: isotp_send object
@@ -67,6 +164,9 @@ void isotp_test_main(unsigned short datalen, unsigned char bs, unsigned char stm
 	 * receiver_test_receive: isotp_receive function of the receiver at physical layer
 	 */
 	isotp_init(&receiver, SERVER_ADDRESS, CLIENT_ADDRESS, receiver_set_FS, receiver_test_send, receiver_test_receive);
+	isotp_cb_set(&receiver, receiver_done, NULL);
+	isotp_buffer_set(&sender, sender_buffer, sizeof(sender_buffer));
+	isotp_iov_set(&receiver, receiver_iov, sizeof(receiver_iov) / sizeof(receiver_iov[0]));
 	/*
 	 * set special parameters of flow control status
 	 * receiver: operate object
@@ -75,6 +175,13 @@ void isotp_test_main(unsigned short datalen, unsigned char bs, unsigned char stm
 	 * TEST_STMIN: STmin
 	 */
 	fc_set(&receiver, ISOTP_FS_CTS, bs, stmin);
+	/* frame size of both ends, 8 for classical CAN, up to 64 for CAN FD */
+	if(isotp_dl_set(&sender, tx_dl) != STATUS_NORMAL
+		|| isotp_dl_set(&receiver, tx_dl) != STATUS_NORMAL)
+	{
+		debug_out("Invalid TX_DL:%d, use 8/12/16/20/24/32/48/64\r\n", tx_dl);
+		return;
+	}
 
 	/* create isotp_receive service */
 	xTaskCreate(rx_thread,			/* The task that implements the command console. */
@@ -84,33 +191,39 @@ void isotp_test_main(unsigned short datalen, unsigned char bs, unsigned char stm
 			1,						/* The priority allocated to the task. */
 			&rc_task);				/* A handle is not required, so just pass NULL. */
 	/* Test 1,single frame */
-	sender.DL = 5UL;
-	debug_out("Single Frame test,DL:%d\r\n", sender.DL);
-	for(index = 0; index < sender.DL; index ++)
+	sender.tx.DL = TEST_SF_DL;
+	debug_out("Single Frame test,DL:%lu\r\n", sender.tx.DL);
+	for(index = 0; index < sender.tx.DL; index ++)
 	{
-		sender.Buffer[index] = (uint8_t)6UL;
+		sender_buffer[index] = (uint8_t)TEST_SF_DATA;
 	}
-	isotp_send(&sender);
+	sender_send();
+	/* let the receiver handle it before the buffers are changed */
+	vTaskDelay(pdMS_TO_TICKS(10UL));
 
 	/* Test 2,consecutive frame */
+	sender.tx.DL = datalen;
+	
+	//pthread_mutex_init(&dbg_mutex, NULL);
+	
+	debug_out("Consecutive Frame test,DL:%lu\r\n", sender.tx.DL);
 	if(datalen > ISOTP_FF_DL)
 	{
-		sender.DL = ISOTP_FF_DL;
+		/* too long for the buffers, stream the test pattern */
+		isotp_stream_set(&sender, NULL, sender_source);
+		isotp_stream_set(&receiver, receiver_sink, NULL);
 	}
 	else
 	{
-		sender.DL = datalen;
-	}
-	
-	//pthread_mutex_init(&dbg_mutex, NULL);
-	
-	debug_out("Consecutive Frame test,DL:%d\r\n", sender.DL);
-	for(index = 0; index < sender.DL; index ++)
-	{
-		sender.Buffer[index] = (uint8_t)index;
+		for(index = 0; index < sender.tx.DL; index ++)
+		{
+			sender_buffer[index] = (uint8_t)index;
+		}
 	}
-	isotp_send(&sender);
-	
+	debug_out("Sder-Tx result:%d\r\n", sender_send());
+
+	/* let the receiver handle the last frame */
+	vTaskDelay(pdMS_TO_TICKS(10UL));
 	vTaskDelete(rc_task);
 }
 
@@ -122,39 +235,18 @@ static ERROR_CODE sender_test_send(struct phy_msg_t *msg)
 	{
 		msg->new_data = FALSE;
 		seq ++;
-		debug_out("Sder-Tx Seq:%04d Len:%02d Id:0x%04X Data:%02X %02X %02X %02X %02X %02X %02X %02X\r\n",
-					seq,
-					msg->length,
-					msg->id,
-					msg->data[0], msg->data[1], msg->data[2],
-					msg->data[3], msg->data[4], msg->data[5],
-					msg->data[6], msg->data[7]);
-		memcpy(&receiver.isotp.phy_rx, msg, sizeof(*msg));
-		receiver.isotp.phy_rx.new_data = TRUE;
+		debug_frame("Sder-Tx", seq, msg);
+		xQueueSend(receiver_queue, msg, portMAX_DELAY);
 	}
 	return STATUS_NORMAL;
 }
 
+/*
+ * Only used by the blocking isotp_send()/isotp_receive()
+ */
 static ERROR_CODE sender_test_receive(struct phy_msg_t *msg)
 {
-	static uint32_t seq = 0UL;
-	ERROR_CODE err = ERR_EMPTY;
-
-	if(msg->new_data == TRUE)
-	{
-		msg->new_data = FALSE;
-		err = STATUS_NORMAL;
-		seq ++;
-		debug_out("Sder-Rx Seq:%04d Len:%02d Id:0x%04X Data:%02X %02X %02X %02X %02X %02X %02X %02X\r\n",
-					seq,
-					msg->length,
-					msg->id,
-					msg->data[0], msg->data[1], msg->data[2],
-					msg->data[3], msg->data[4], msg->data[5],
-					msg->data[6], msg->data[7]);
-	}
-	
-	return err;
+	return (xQueueReceive(sender_queue, msg, 0) == pdPASS) ? STATUS_NORMAL : ERR_EMPTY;
 }
 
 static ERROR_CODE receiver_test_send(struct phy_msg_t *msg)
@@ -165,39 +257,15 @@ static ERROR_CODE receiver_test_send(struct phy_msg_t *msg)
 	{
 		msg->new_data = FALSE;
 		seq ++;
-		
-		debug_out("Rcer-Tx Seq:%04d Len:%02d Id:0x%04X Data:%02X %02X %02X %02X %02X %02X %02X %02X\r\n",
-					seq,
-					msg->length,
-					msg->id,
-					msg->data[0], msg->data[1], msg->data[2],
-					msg->data[3], msg->data[4], msg->data[5],
-					msg->data[6], msg->data[7]);
-		memcpy(&sender.isotp.phy_rx, msg, sizeof(*msg));
-		sender.isotp.phy_rx.new_data = TRUE;
+		debug_frame("Rcer-Tx", seq, msg);
+		xQueueSend(sender_queue, msg, portMAX_DELAY);
 	}
 	return STATUS_NORMAL;
 }
 
 static ERROR_CODE receiver_test_receive(struct phy_msg_t *msg)
 {
-	static uint32_t seq = 0UL;
-	ERROR_CODE err = ERR_EMPTY;
-
-	if(msg->new_data == TRUE)
-	{
-		msg->new_data = FALSE;
-		err = STATUS_NORMAL;
-		seq ++;
-		debug_out("Rcer-Rx Seq:%04d Len:%02d Id:0x%04X Data:%02X %02X %02X %02X %02X %02X %02X %02X\r\n",
-					seq,
-					msg->length,
-					msg->id,
-					msg->data[0], msg->data[1], msg->data[2],
-					msg->data[3], msg->data[4], msg->data[5],
-					msg->data[6], msg->data[7]);
-	}
-	return err;
+	return (xQueueReceive(receiver_queue, msg, 0) == pdPASS) ? STATUS_NORMAL : ERR_EMPTY;
 }
 
 static ERROR_CODE receiver_set_FS(struct isotp_t* msg)
@@ -214,3 +282,56 @@ static ERROR_CODE receiver_set_FS(struct isotp_t* msg)
 	return STATUS_NORMAL;
 }
 
+static ERROR_CODE receiver_done(struct isotp_t* msg)
+{
+	uint32_t index;
+	uint8_t expect;
+
+	if(msg->rx.DL <= ISOTP_FF_DL && msg->rx.reply == N_OK)
+	{
+		/* check the message in the pieces of the lent buffer */
+		sink_errors = 0UL;
+		for(index = 0; index < msg->rx.DL; index ++)
+		{
+			expect = (msg->rx.DL == TEST_SF_DL) ? (uint8_t)TEST_SF_DATA : (uint8_t)index;
+			if(receiver_buffer[index / sizeof(receiver_buffer[0])][index % sizeof(receiver_buffer[0])] != expect)
+			{
+				sink_errors ++;
+			}
+		}
+	}
+	debug_out("Rcer-Rx result:%d DL:%lu errors:%lu\r\n", msg->rx.reply, msg->rx.DL, sink_errors);
+	return STATUS_NORMAL;
+}
+
+/*
+ * The streamed test pattern, the low byte of the offset in the message
+ */
+static ERROR_CODE sender_source(struct isotp_t* msg, uint32_t offset, uint8_t *data, uint16_t len)
+{
+	uint16_t index;
+
+	for(index = 0; index < len; index ++)
+	{
+		data[index] = (uint8_t)(offset + index);
+	}
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE receiver_sink(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	uint16_t index;
+
+	if(offset == 0UL)
+	{
+		sink_errors = 0UL;
+	}
+	for(index = 0; index < len; index ++)
+	{
+		if(data[index] != (uint8_t)(offset + index))
+		{
+			sink_errors ++;
+		}
+	}
+	return STATUS_NORMAL;
+}
@@ -101,6 +101,7 @@
 
 /* Standard includes. */
 #include <stdio.h>
+#include <string.h>
 
 /* Scheduler includes. */
 #include "FreeRTOS.h"
@@ -163,14 +164,45 @@ const HeapRegion_t xHeapRegions[] =
 	vPortDefineHeapRegions( xHeapRegions );
 }
 
-int main(void)
+/* headless ISO-TP benchmark, see APP/isotp_bench.c */
+extern void isotp_bench_task(void *arg);
+/* headless ISO-TP receive path fuzzer, see APP/isotp_fuzz.c */
+extern void isotp_fuzz_task(void *arg);
+/* simulated CAN receive interrupt, see APP/phy_ring_test.c */
+extern void phy_ring_test_isr(void);
+
+/* Called from the tick interrupt. */
+void vApplicationTickHook( void )
+{
+	phy_ring_test_isr();
+}
+
+/*
+ * command-line               interactive command line
+ * command-line --bench FILE  run the ISO-TP benchmark, save the results
+ *                            to FILE as CSV and exit
+ * command-line --fuzz RUNS SEED  fuzz the ISO-TP receive path with RUNS
+ *                            inputs and exit, 1 if any broke something
+ */
+int main(int argc, char *argv[])
 {
 	/* This demo uses heap_5.c, so start by defining some heap regions.  heap_5
 	is only used for test and example reasons.  Heap_4 is more appropriate.  See
 	http://www.freertos.org/a00111.html for an explanation. */
 	prvInitialiseHeap();
 
-	app_cli_init(tskIDLE_PRIORITY + 1, NULL, NULL);
+	if(argc == 3 && strcmp(argv[1], "--bench") == 0)
+	{
+		xTaskCreate(isotp_bench_task, "isotp_bench", configMINIMAL_STACK_SIZE * 4, argv[2], tskIDLE_PRIORITY + 1, NULL);
+	}
+	else if(argc == 4 && strcmp(argv[1], "--fuzz") == 0)
+	{
+		xTaskCreate(isotp_fuzz_task, "isotp_fuzz", configMINIMAL_STACK_SIZE * 4, &argv[2], tskIDLE_PRIORITY + 1, NULL);
+	}
+	else
+	{
+		app_cli_init(tskIDLE_PRIORITY + 1, NULL, NULL);
+	}
 	/* Start the scheduler. */
 	vTaskStartScheduler();
 
@@ -0,0 +1,264 @@
+#include "isotp.h"
+#include "phy_ring.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * ISO-TP reception through the frame ring.
+ * A simulated CAN controller in the tick interrupt receives the frames of
+ * one message back to back at the bitrate, and puts them into the ring from
+ * interrupt context. The command line task drains the ring in batches into
+ * a channel. A ring of 1 frame behaves like the single mailbox of
+ * phy_msg_t.new_data.
+ * On a target the consumer runs between two ticks, the host may not run it
+ * for several. The wire waits for the consumer to drain the frames of a
+ * tick before it goes on, so the result depends on the frames of one tick
+ * and the ring size only: a ring holding the most frames of a tick receives
+ * the message, a ring smaller than the fewest frames of a tick overflows.
+ */
+#define RING_MAX_LEN		(256UL)
+/* 8 byte frame with an 11 bit ID and the interframe space, without stuffing */
+#define RING_FRAME_BITS		(111UL)
+
+#define RING_TESTER_ID		(0x7E0UL)
+#define RING_ECU_ID			(0x7E8UL)
+
+/* frames of the largest message with TX_DL 8 */
+#define RING_MAX_FRAMES		(ISOTP_FF_DL / 7UL + 2UL)
+
+static ERROR_CODE capture_send(struct phy_msg_t *msg);
+static ERROR_CODE capture_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_done(struct isotp_t* msg);
+
+static struct phy_ring_t ring;
+static struct phy_msg_t ring_frame[RING_MAX_LEN];
+static struct isotp_t sender, ecu;
+static uint8_t sender_buffer[ISOTP_FF_DL];
+static uint8_t ecu_buffer[ISOTP_FF_DL];
+/* the message on the wire, recorded from a sender channel */
+static struct phy_msg_t wire[RING_MAX_FRAMES];
+static uint32_t wire_count;
+/* simulated controller, armed by the test */
+static volatile Bool armed;
+static volatile Bool fc_received;
+static volatile uint32_t wire_next;
+static uint32_t bits_per_tick, bit_credit;
+static TaskHandle_t consumer;
+static volatile Bool ecu_finished;
+/* frames of the last tick not drained yet */
+static volatile Bool pending;
+
+/*
+ * receive interrupt of the simulated controller, called from the tick hook:
+ * the frames that were on the wire during the last tick
+ */
+void phy_ring_test_isr(void)
+{
+	struct phy_msg_t *frame;
+	uint32_t received = 0UL;
+
+	if(armed == FALSE || pending == TRUE)
+	{
+		return;
+	}
+	bit_credit += bits_per_tick;
+	while(bit_credit >= RING_FRAME_BITS && wire_next < wire_count)
+	{
+		/* the sender waits for the FC after the FF */
+		if(wire_next == 1UL && fc_received == FALSE)
+		{
+			bit_credit = 0UL;
+			break;
+		}
+		bit_credit -= RING_FRAME_BITS;
+		frame = phy_ring_claim(&ring);
+		if(frame != NULL)
+		{
+			memcpy(frame, &wire[wire_next], sizeof(*frame));
+			phy_ring_publish(&ring);
+		}
+		wire_next ++;
+		received ++;
+	}
+	/* without a woken flag the end of the tick switches to the consumer */
+	if(received != 0UL)
+	{
+		pending = TRUE;
+		vTaskNotifyGiveFromISR(consumer, NULL);
+	}
+}
+
+unsigned long phy_ring_test_main(unsigned long datalen, unsigned long size, unsigned long bitrate)
+{
+	struct phy_msg_t fc;
+	struct phy_msg_t *frame;
+	uint32_t index, count, errors, wait;
+	uint32_t batches = 0UL, batch_max = 0UL;
+	uint32_t tick_min, tick_max;
+	Bool lossless;
+	const char *expected;
+	unsigned long failures = 0UL;
+
+	if(datalen <= 7UL || datalen > ISOTP_FF_DL
+		|| phy_ring_init(&ring, ring_frame, size) != STATUS_NORMAL || size > RING_MAX_LEN
+		|| bitrate < 10000UL || bitrate > 1000000UL)
+	{
+		printf("Usage:ring <8-%lu> <1|2|4..%lu> <10000-1000000>\r\n", ISOTP_FF_DL, RING_MAX_LEN);
+		return 1UL;
+	}
+
+	/* record the frames of the message, the FC allows them all at once */
+	wire_count = 0UL;
+	isotp_init(&sender, RING_TESTER_ID, RING_ECU_ID, NULL, capture_send, capture_receive);
+	isotp_buffer_set(&sender, sender_buffer, sizeof(sender_buffer));
+	for(index = 0; index < datalen; index ++)
+	{
+		sender_buffer[index] = (uint8_t)index;
+	}
+	sender.tx.DL = datalen;
+	isotp_send_start(&sender);
+	memset(&fc, 0, sizeof(fc));
+	fc.id = RING_TESTER_ID;
+	fc.length = CAN_MAX_DL;
+	fc.data[0] = 0x30;
+	isotp_on_frame(&sender, &fc);
+	while(sender.tx.state != ISOTP_IDLE)
+	{
+		isotp_poll(&sender);
+	}
+
+	isotp_init(&ecu, RING_ECU_ID, RING_TESTER_ID, NULL, ecu_send, ecu_receive);
+	isotp_buffer_set(&ecu, ecu_buffer, sizeof(ecu_buffer));
+	isotp_cb_set(&ecu, ecu_done, NULL);
+	fc_set(&ecu, ISOTP_FS_CTS, 0, 0);
+	memset(ecu_buffer, 0, sizeof(ecu_buffer));
+	ecu_finished = FALSE;
+	fc_received = FALSE;
+	wire_next = 0UL;
+	bit_credit = 0UL;
+	pending = FALSE;
+	bits_per_tick = bitrate / configTICK_RATE_HZ;
+	consumer = xTaskGetCurrentTaskHandle();
+
+	printf("Ring test, DL:%lu ring:%lu bitrate:%lu\r\n", datalen, size, bitrate);
+	armed = TRUE;
+	for(;;)
+	{
+		wait = isotp_poll(&ecu);
+		if(ecu_finished == TRUE || (wire_next == wire_count && phy_ring_count(&ring) == 0UL))
+		{
+			break;
+		}
+		ulTaskNotifyTake(pdTRUE, test_wait_ticks(wait));
+		while((count = phy_ring_peek(&ring, &frame)) != 0UL)
+		{
+			for(index = 0; index < count; index ++)
+			{
+				isotp_on_frame(&ecu, &frame[index]);
+			}
+			phy_ring_release(&ring, count);
+			batches ++;
+			if(count > batch_max)
+			{
+				batch_max = count;
+			}
+		}
+		/* the ISR adds nothing while pending, the ring stays empty */
+		pending = FALSE;
+	}
+	armed = FALSE;
+
+	errors = 0UL;
+	for(index = 0; index < datalen; index ++)
+	{
+		if(ecu_buffer[index] != (uint8_t)index)
+		{
+			errors ++;
+		}
+	}
+	printf("Ring Rx result:%d errors:%lu\r\n", (ecu_finished == TRUE) ? ecu.rx.reply : -1, (unsigned long)errors);
+	printf("Ring frames:%lu overflow:%lu high water:%lu batches:%lu max batch:%lu\r\n",
+			(unsigned long)wire_count, (unsigned long)ring.overflow, (unsigned long)ring.high_water,
+			(unsigned long)batches, (unsigned long)batch_max);
+
+	/* the CFs of a tick, after the FF and the FC, go into an empty ring */
+	tick_min = bits_per_tick / RING_FRAME_BITS;
+	tick_max = (bits_per_tick + RING_FRAME_BITS - 1UL) / RING_FRAME_BITS;
+	lossless = (ecu_finished == TRUE && ecu.rx.reply == N_OK && errors == 0UL && ring.overflow == 0UL) ? TRUE : FALSE;
+	if(size >= tick_max)
+	{
+		expected = "lossless";
+		failures = (lossless == TRUE) ? 0UL : 1UL;
+	}
+	else if(size < tick_min && wire_count - 1UL > size)
+	{
+		expected = "overflow";
+		failures = (ring.overflow != 0UL && lossless == FALSE) ? 0UL : 1UL;
+	}
+	else
+	{
+		/* between the two, it depends on the bits left over from a tick */
+		expected = "either";
+	}
+	printf("Ring frames per tick:%lu-%lu expected:%s check:%s\r\n", (unsigned long)tick_min, (unsigned long)tick_max,
+			expected, (failures == 0UL) ? "passed" : "FAILED");
+
+	return failures;
+}
+
+/*
+ * the sender records its frames instead of sending them
+ */
+static ERROR_CODE capture_send(struct phy_msg_t *msg)
+{
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		if(wire_count >= RING_MAX_FRAMES)
+		{
+			return ERR_FULL;
+		}
+		memcpy(&wire[wire_count], msg, sizeof(*msg));
+		wire[wire_count ++].new_data = TRUE;
+	}
+	return STATUS_NORMAL;
+}
+
+/*
+ * the FC is passed to the sender directly
+ */
+static ERROR_CODE capture_receive(struct phy_msg_t *msg)
+{
+	return ERR_EMPTY;
+}
+
+/*
+ * the only frame the ECU sends is the FC, the controller goes on with the CFs
+ */
+static ERROR_CODE ecu_send(struct phy_msg_t *msg)
+{
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		fc_received = TRUE;
+	}
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg)
+{
+	return phy_ring_get(&ring, msg);
+}
+
+static ERROR_CODE ecu_done(struct isotp_t* msg)
+{
+	ecu_finished = TRUE;
+	return STATUS_NORMAL;
+}
@@ -0,0 +1,306 @@
+#include "isotp.h"
+#include "socketcan.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * ISO-TP over a Linux CAN interface.
+ * The tester sends one message to the ECU, each on its own raw socket, both
+ * served by the command line task: it polls the channels, takes the frames
+ * waiting on both sockets with one recvmmsg each, and sleeps a tick when
+ * none came. The tester sends its blocks with sendmmsg.
+ * With mode 1 or 2 only one side runs, so that the other one can be the
+ * kernel ISO-TP stack or can-utils, e.g. for mode 1
+ *	isotprecv -s 7e8 -d 7e0 -l vcan0
+ * and for mode 2
+ *	isotpsend -s 7e0 -d 7e8 vcan0 < data
+ * The receive delay is the time from the kernel time stamp of a frame to
+ * its handling by the ECU channel.
+ */
+#define CAN_TESTER_ID		(0x7E0UL)
+#define CAN_ECU_ID			(0x7E8UL)
+
+#define CAN_BS				(8UL)
+#define CAN_STMIN			(0UL)
+/* the tester builds the next block while it waits for the FC */
+#define CAN_TX_RING_LEN		(CAN_BS)
+#define CAN_TIMEOUT			(10000UL)
+
+enum can_mode_e
+{
+	CAN_MODE_BOTH = 0,
+	CAN_MODE_SEND,
+	CAN_MODE_RECEIVE,
+};
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg);
+static ERROR_CODE tester_send_batch(struct phy_msg_t *msg, uint32_t count, uint32_t *done);
+static ERROR_CODE tester_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_done(struct isotp_t* msg);
+static uint32_t drain(struct socketcan_t *can, struct isotp_t *channel, Bool measure);
+
+static struct socketcan_t tester_can, ecu_can;
+static struct isotp_t tester, ecu;
+static uint8_t tester_buffer[ISOTP_FF_DL];
+static uint8_t ecu_buffer[ISOTP_FF_DL];
+static struct phy_msg_t tester_ring[CAN_TX_RING_LEN];
+static struct phy_msg_t can_batch[SOCKETCAN_BATCH_MAX];
+static Bool ecu_finished;
+static uint32_t ecu_end_us;
+/* receive delay of the ECU frames */
+static uint32_t delay_sum, delay_max, delay_count;
+static uint32_t batches, batch_max;
+
+void socketcan_test_main(const char *ifname, unsigned long datalen, unsigned char tx_dl, unsigned char mode)
+{
+	TickType_t begin;
+	uint32_t index, errors, start, end_us = 0UL;
+	Bool tester_on, ecu_on;
+	ERROR_CODE err;
+
+	if(ifname == NULL || datalen == 0UL || datalen > ISOTP_FF_DL
+		|| (tx_dl != CAN_MAX_DL && tx_dl != CANFD_MAX_DL) || mode > CAN_MODE_RECEIVE)
+	{
+		printf("Usage:can <interface> <1-%lu> <8|64> <0 both|1 send|2 receive>\r\n", ISOTP_FF_DL);
+		return;
+	}
+	tester_on = (mode != CAN_MODE_RECEIVE) ? TRUE : FALSE;
+	ecu_on = (mode != CAN_MODE_SEND) ? TRUE : FALSE;
+	tester_can.fd = ecu_can.fd = -1;
+	for(;;)
+	{
+		if(tester_on == TRUE)
+		{
+			err = socketcan_open(&tester_can, ifname, (tx_dl > CAN_MAX_DL) ? TRUE : FALSE);
+			if(err != STATUS_NORMAL)
+			{
+				break;
+			}
+			socketcan_filter_set(&tester_can, CAN_ECU_ID, 0x7FFUL);
+		}
+		if(ecu_on == TRUE)
+		{
+			err = socketcan_open(&ecu_can, ifname, (tx_dl > CAN_MAX_DL) ? TRUE : FALSE);
+			if(err != STATUS_NORMAL)
+			{
+				break;
+			}
+			socketcan_filter_set(&ecu_can, CAN_TESTER_ID, 0x7FFUL);
+		}
+		break;
+	}
+	if(err != STATUS_NORMAL)
+	{
+		printf("Can not open %s:%d, no such CAN interface or no CAN FD\r\n", ifname, err);
+		socketcan_close(&tester_can);
+		return;
+	}
+
+	isotp_init(&tester, CAN_ECU_ID, CAN_TESTER_ID, NULL, tester_send, tester_receive);
+	isotp_init(&ecu, CAN_TESTER_ID, CAN_ECU_ID, NULL, ecu_send, ecu_receive);
+	isotp_buffer_set(&tester, tester_buffer, sizeof(tester_buffer));
+	isotp_buffer_set(&ecu, ecu_buffer, sizeof(ecu_buffer));
+	isotp_tx_ring_set(&tester, tester_ring, CAN_TX_RING_LEN);
+	isotp_send_batch_set(&tester, tester_send_batch);
+	isotp_dl_set(&tester, tx_dl);
+	isotp_dl_set(&ecu, tx_dl);
+	isotp_cb_set(&ecu, ecu_done, NULL);
+	fc_set(&ecu, ISOTP_FS_CTS, CAN_BS, CAN_STMIN);
+	for(index = 0; index < datalen; index ++)
+	{
+		tester_buffer[index] = (uint8_t)index;
+	}
+	memset(ecu_buffer, 0, sizeof(ecu_buffer));
+	ecu_finished = FALSE;
+	delay_sum = delay_max = delay_count = 0UL;
+	batches = batch_max = 0UL;
+
+	printf("Can test, %s DL:%lu TX_DL:%d mode:%d\r\n", ifname, datalen, tx_dl, mode);
+	begin = xTaskGetTickCount();
+	start = timer_us();
+	if(tester_on == TRUE)
+	{
+		tester.tx.DL = datalen;
+		isotp_send_start(&tester);
+	}
+	while(xTaskGetTickCount() - begin < pdMS_TO_TICKS(CAN_TIMEOUT))
+	{
+		if(tester_on == TRUE)
+		{
+			isotp_poll(&tester);
+			if(tester.tx.state == ISOTP_IDLE && end_us == 0UL)
+			{
+				end_us = timer_us();
+			}
+		}
+		if(ecu_on == TRUE)
+		{
+			isotp_poll(&ecu);
+		}
+		if((tester_on == FALSE || tester.tx.state == ISOTP_IDLE) && (ecu_on == FALSE || ecu_finished == TRUE))
+		{
+			break;
+		}
+		index = 0UL;
+		if(tester_on == TRUE)
+		{
+			index += drain(&tester_can, &tester, FALSE);
+		}
+		if(ecu_on == TRUE)
+		{
+			index += drain(&ecu_can, &ecu, TRUE);
+		}
+		if(index == 0UL)
+		{
+			vTaskDelay(1);
+		}
+	}
+
+	if(tester_on == TRUE)
+	{
+		printf("Can Tx result:%d time:%lu us frames:%lu full:%lu\r\n", tester.tx.reply,
+				(unsigned long)(end_us - start), (unsigned long)tester_can.tx_frames, (unsigned long)tester_can.tx_again);
+	}
+	if(ecu_on == TRUE)
+	{
+		errors = 0UL;
+		for(index = 0; index < ecu.rx.DL && index < datalen; index ++)
+		{
+			if(ecu_buffer[index] != (uint8_t)index)
+			{
+				errors ++;
+			}
+		}
+		printf("Can Rx result:%d DL:%lu errors:%lu frames:%lu dropped:%lu\r\n",
+				(ecu_finished == TRUE) ? ecu.rx.reply : -1, (unsigned long)ecu.rx.DL, (unsigned long)errors,
+				(unsigned long)ecu_can.rx_frames, (unsigned long)ecu_can.rx_dropped);
+		if(ecu_finished == TRUE && ecu.rx.reply == N_OK)
+		{
+			printf("Can time:%lu us rate:%lu B/s\r\n", (unsigned long)(ecu_end_us - start),
+					(unsigned long)((unsigned long long)ecu.rx.DL * 1000000ULL / (ecu_end_us - start + 1UL)));
+		}
+		printf("Can receive delay avg:%lu us max:%lu us batches:%lu max batch:%lu\r\n",
+				(unsigned long)(delay_sum / (delay_count + 1UL)), (unsigned long)delay_max,
+				(unsigned long)batches, (unsigned long)batch_max);
+	}
+	socketcan_close(&tester_can);
+	socketcan_close(&ecu_can);
+}
+
+/*
+ * hand the frames waiting on a socket to a channel, with the receive delay
+ * of each when measure is set
+ */
+static uint32_t drain(struct socketcan_t *can, struct isotp_t *channel, Bool measure)
+{
+	uint32_t index, done, delay, received = 0UL;
+
+	while(socketcan_receive_batch(can, can_batch, SOCKETCAN_BATCH_MAX, &done) == STATUS_NORMAL)
+	{
+		for(index = 0; index < done; index ++)
+		{
+			if(measure == TRUE && can->stamp[index].sec != 0UL)
+			{
+				delay = socketcan_age_us(&can->stamp[index]);
+				delay_sum += delay;
+				delay_count ++;
+				if(delay > delay_max)
+				{
+					delay_max = delay;
+				}
+			}
+			isotp_on_frame(channel, &can_batch[index]);
+		}
+		if(measure == TRUE)
+		{
+			batches ++;
+			if(done > batch_max)
+			{
+				batch_max = done;
+			}
+		}
+		received += done;
+	}
+	return received;
+}
+
+/*
+ * a full socket buffer empties at the bitrate of the interface
+ */
+static ERROR_CODE tester_send(struct phy_msg_t *msg)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		while((err = socketcan_send(&tester_can, msg)) == ERR_FULL)
+		{
+			vTaskDelay(1);
+		}
+	}
+	return err;
+}
+
+static ERROR_CODE tester_send_batch(struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+{
+	ERROR_CODE err;
+	uint32_t sent;
+
+	for(*done = 0UL; *done < count; *done += sent)
+	{
+		err = socketcan_send_batch(&tester_can, &msg[*done], count - *done, &sent);
+		if(err == ERR_FULL)
+		{
+			vTaskDelay(1);
+		}
+		else if(err != STATUS_NORMAL)
+		{
+			*done += sent;
+			break;
+		}
+	}
+	for(sent = 0UL; sent < *done; sent ++)
+	{
+		msg[sent].new_data = FALSE;
+	}
+	return (*done == count) ? STATUS_NORMAL : err;
+}
+
+static ERROR_CODE tester_receive(struct phy_msg_t *msg)
+{
+	return socketcan_receive(&tester_can, msg);
+}
+
+static ERROR_CODE ecu_send(struct phy_msg_t *msg)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		while((err = socketcan_send(&ecu_can, msg)) == ERR_FULL)
+		{
+			vTaskDelay(1);
+		}
+	}
+	return err;
+}
+
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg)
+{
+	return socketcan_receive(&ecu_can, msg);
+}
+
+static ERROR_CODE ecu_done(struct isotp_t* msg)
+{
+	ecu_end_us = timer_us();
+	ecu_finished = TRUE;
+	return STATUS_NORMAL;
+}
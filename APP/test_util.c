@@ -0,0 +1,336 @@
+#include "test_util.h"
+#include <queue.h>
+
+static void ecu_thread(void *arg);
+static uint32_t channel_poll(void *arg);
+static void channel_frame(void *arg, const struct phy_msg_t *frame);
+static uint32_t dispatch_poll(void *arg);
+static void dispatch_frame(void *arg, const struct phy_msg_t *frame);
+static void bus_kick(struct vcan_bus_t *bus);
+static void node_wake(struct vcan_node_t *node);
+static void bus_thread(void *arg);
+
+/* frames on the way to each side */
+static QueueHandle_t queue[TEST_SIDES] = {NULL, NULL};
+static UBaseType_t queue_length = 0UL;
+/* the ECU task and what it serves */
+static TaskHandle_t ecu_task = NULL;
+static uint32_t (*ecu_poll)(void *arg);
+static void (*ecu_frame)(void *arg, const struct phy_msg_t *frame);
+static void *ecu_arg;
+/* the task of the virtual CAN bus */
+static TaskHandle_t bus_task = NULL;
+
+/*
+ * isotp_poll() and the poll functions built on it return the time until the
+ * next timeout in ms
+ *
+ * @parameter in:
+ * ms:        time until the next timeout, ISOTP_WAIT_FOREVER if none
+ * @parameter out:
+ * ticks to block the task for
+ */
+TickType_t test_wait_ticks(uint32_t ms)
+{
+	if(ms == ISOTP_WAIT_FOREVER)
+	{
+		return portMAX_DELAY;
+	}
+	return pdMS_TO_TICKS(ms);
+}
+
+/*
+ * create the queues of both sides, or empty them for the next test
+ *
+ * @parameter in:
+ * length:    frames each queue holds
+ * @parameter out:
+ * pdPASS, pdFAIL if there is no memory for the queues
+ */
+BaseType_t test_queues_init(UBaseType_t length)
+{
+	uint32_t side;
+
+	for(side = 0; side < TEST_SIDES; side ++)
+	{
+		if(queue[side] != NULL && queue_length != length)
+		{
+			vQueueDelete(queue[side]);
+			queue[side] = NULL;
+		}
+		if(queue[side] == NULL)
+		{
+			queue[side] = xQueueCreate(length, sizeof(struct phy_msg_t));
+		}
+		else
+		{
+			xQueueReset(queue[side]);
+		}
+		if(queue[side] == NULL)
+		{
+			return pdFAIL;
+		}
+	}
+	queue_length = length;
+
+	return pdPASS;
+}
+
+/*
+ * queue a frame for a side
+ *
+ * @parameter in:
+ * side:      receiving side
+ * msg:       the frame
+ * ticks:     to wait for room in the queue
+ * @parameter out:
+ * pdPASS, errQUEUE_FULL if the queue stayed full
+ */
+BaseType_t test_frame_put(enum test_side_e side, const struct phy_msg_t *msg, TickType_t ticks)
+{
+	return xQueueSend(queue[side], msg, ticks);
+}
+
+/*
+ * take the next frame of a side
+ *
+ * @parameter in:
+ * side:      receiving side
+ * ms:        to wait for a frame, as returned by a poll function
+ * @parameter out:
+ * msg:       the frame
+ * return:    pdPASS, pdFAIL if no frame came in time
+ */
+BaseType_t test_frame_get(enum test_side_e side, struct phy_msg_t *msg, uint32_t ms)
+{
+	return xQueueReceive(queue[side], msg, test_wait_ticks(ms));
+}
+
+UBaseType_t test_frames_waiting(enum test_side_e side)
+{
+	return uxQueueMessagesWaiting(queue[side]);
+}
+
+ERROR_CODE test_tester_send(struct phy_msg_t *msg)
+{
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		test_frame_put(TEST_ECU, msg, portMAX_DELAY);
+	}
+	return STATUS_NORMAL;
+}
+
+ERROR_CODE test_tester_receive(struct phy_msg_t *msg)
+{
+	return (test_frame_get(TEST_TESTER, msg, 0UL) == pdPASS) ? STATUS_NORMAL : ERR_EMPTY;
+}
+
+ERROR_CODE test_ecu_send(struct phy_msg_t *msg)
+{
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		test_frame_put(TEST_TESTER, msg, portMAX_DELAY);
+	}
+	return STATUS_NORMAL;
+}
+
+ERROR_CODE test_ecu_receive(struct phy_msg_t *msg)
+{
+	return (test_frame_get(TEST_ECU, msg, 0UL) == pdPASS) ? STATUS_NORMAL : ERR_EMPTY;
+}
+
+/*
+ * start the task of the ECU
+ *
+ * @parameter in:
+ * poll:      ms until the ECU needs to run again, ISOTP_WAIT_FOREVER if
+ *            only a frame can change its state
+ * frame:     handles a frame taken from the queue of the ECU
+ * arg:       passed to poll and frame
+ * name:      name of the task
+ * priority:  of the task
+ * @parameter out:
+ * pdPASS, or the error of xTaskCreate()
+ */
+BaseType_t test_ecu_start(uint32_t (*poll)(void* /*arg*/),
+							void (*frame)(void* /*arg*/, const struct phy_msg_t* /*frame*/),
+							void *arg,
+							const char *name,
+							UBaseType_t priority)
+{
+	BaseType_t ret;
+
+	ecu_poll = poll;
+	ecu_frame = frame;
+	ecu_arg = arg;
+	ret = xTaskCreate(ecu_thread, name, 200, NULL, priority, &ecu_task);
+	if(ret != pdPASS)
+	{
+		ecu_task = NULL;
+	}
+	return ret;
+}
+
+/*
+ * the ECU serves one channel
+ */
+BaseType_t test_ecu_channel_start(struct isotp_t *msg, const char *name, UBaseType_t priority)
+{
+	return test_ecu_start(channel_poll, channel_frame, msg, name, priority);
+}
+
+/*
+ * the ECU serves all channels of a dispatcher
+ */
+BaseType_t test_ecu_dispatch_start(struct isotp_dispatch_t *bus, const char *name, UBaseType_t priority)
+{
+	return test_ecu_start(dispatch_poll, dispatch_frame, bus, name, priority);
+}
+
+void test_ecu_stop(void)
+{
+	if(ecu_task != NULL)
+	{
+		vTaskDelete(ecu_task);
+		ecu_task = NULL;
+	}
+}
+
+/*
+ * start the task of a bus
+ *
+ * @parameter in:
+ * bus:       bus with its nodes attached
+ * name:      name of the task
+ * priority:  below the tasks of the nodes
+ * @parameter out:
+ * pdPASS, or the error of xTaskCreate()
+ */
+BaseType_t test_bus_start(struct vcan_bus_t *bus, const char *name, UBaseType_t priority)
+{
+	BaseType_t ret;
+
+	bus->kick_cb = bus_kick;
+	ret = xTaskCreate(bus_thread, name, 200, bus, priority, &bus_task);
+	if(ret != pdPASS)
+	{
+		bus->kick_cb = NULL;
+		bus_task = NULL;
+	}
+	return ret;
+}
+
+void test_bus_stop(void)
+{
+	if(bus_task != NULL)
+	{
+		vTaskDelete(bus_task);
+		bus_task = NULL;
+	}
+}
+
+/*
+ * notify task when node receives frames
+ */
+void test_node_wake_set(struct vcan_node_t *node, TaskHandle_t task)
+{
+	node->arg = task;
+	node->rx_cb = node_wake;
+}
+
+/*
+ * A driver with no free mailbox waits for the bus
+ */
+ERROR_CODE test_node_send(struct vcan_node_t *node, struct phy_msg_t *msg)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(msg->new_data == TRUE)
+	{
+		msg->new_data = FALSE;
+		while((err = vcan_send(node, msg)) == ERR_FULL)
+		{
+			vTaskDelay(1);
+		}
+	}
+	return err;
+}
+
+static void ecu_thread(void *arg)
+{
+	struct phy_msg_t frame;
+
+	(void)arg;
+
+	for(;;)
+	{
+		if(test_frame_get(TEST_ECU, &frame, ecu_poll(ecu_arg)) == pdPASS)
+		{
+			ecu_frame(ecu_arg, &frame);
+		}
+	}
+}
+
+static uint32_t channel_poll(void *arg)
+{
+	return isotp_poll((struct isotp_t *)arg);
+}
+
+static void channel_frame(void *arg, const struct phy_msg_t *frame)
+{
+	isotp_on_frame((struct isotp_t *)arg, frame);
+}
+
+static uint32_t dispatch_poll(void *arg)
+{
+	return isotp_dispatch_poll((struct isotp_dispatch_t *)arg);
+}
+
+static void dispatch_frame(void *arg, const struct phy_msg_t *frame)
+{
+	isotp_dispatch_frame((struct isotp_dispatch_t *)arg, frame);
+}
+
+static void bus_kick(struct vcan_bus_t *bus)
+{
+	(void)bus;
+
+	xTaskNotifyGive(bus_task);
+}
+
+/*
+ * the task of a node that received frames, in arg
+ */
+static void node_wake(struct vcan_node_t *node)
+{
+	xTaskNotifyGive((TaskHandle_t)node->arg);
+}
+
+/*
+ * The bus sleeps until the frame on the wire ends, or until a node queues
+ * one when it is idle
+ */
+static void bus_thread(void *arg)
+{
+	struct vcan_bus_t *bus = (struct vcan_bus_t *)arg;
+	uint32_t wait;
+
+	for(;;)
+	{
+		wait = vcan_bus_run(bus);
+		if(wait == VCAN_IDLE)
+		{
+			ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+		}
+		else if(wait >= 1000UL)
+		{
+			ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(wait / 1000UL));
+		}
+		else
+		{
+			delay_100us((uint16_t)((wait + 99UL) / 100UL));
+		}
+	}
+}
@@ -0,0 +1,86 @@
+#ifndef __TEST_UTIL_H__
+#define __TEST_UTIL_H__
+
+#include "isotp.h"
+#include "isotp_dispatch.h"
+#include "vcan.h"
+#include <FreeRTOS.h>
+#include <task.h>
+
+/*
+ * Helpers shared by the test drivers of the command line
+ */
+
+/* ticks to block for the ms a poll function returns, ISOTP_WAIT_FOREVER included */
+TickType_t test_wait_ticks(uint32_t ms);
+
+/*
+ * Tester and ECU connected by two frame queues.
+ * What one side sends waits in the queue of the other side, a full queue
+ * blocks the sender. The tester runs in the command line task, the ECU in
+ * a task of its own that sleeps on its queue until a frame comes in or its
+ * poll function is due:
+ *
+ *	test_queues_init(32);
+ *	isotp_init(&tester, ECU_ID, TESTER_ID, NULL, test_tester_send, test_tester_receive);
+ *	isotp_init(&ecu, TESTER_ID, ECU_ID, NULL, test_ecu_send, test_ecu_receive);
+ *	isotp_dispatch_add(&ecu_bus, &ecu);
+ *	test_ecu_dispatch_start(&ecu_bus, "ecu", 1);
+ *	isotp_send_start(&tester);
+ *	while(tester.tx.state != ISOTP_IDLE)
+ *	{
+ *		if(test_frame_get(TEST_TESTER, &frame, isotp_poll(&tester)) == pdPASS)
+ *		{
+ *			isotp_on_frame(&tester, &frame);
+ *		}
+ *	}
+ *	test_ecu_stop();
+ *
+ * One driver runs at a time, as one command runs at a time.
+ */
+enum test_side_e
+{
+	TEST_TESTER = 0UL,
+	TEST_ECU,
+	TEST_SIDES
+};
+
+BaseType_t test_queues_init(UBaseType_t length);
+BaseType_t test_frame_put(enum test_side_e side, const struct phy_msg_t *msg, TickType_t ticks);
+BaseType_t test_frame_get(enum test_side_e side, struct phy_msg_t *msg, uint32_t ms);
+UBaseType_t test_frames_waiting(enum test_side_e side);
+/* data link of each side, for isotp_init() */
+ERROR_CODE test_tester_send(struct phy_msg_t *msg);
+ERROR_CODE test_tester_receive(struct phy_msg_t *msg);
+ERROR_CODE test_ecu_send(struct phy_msg_t *msg);
+ERROR_CODE test_ecu_receive(struct phy_msg_t *msg);
+BaseType_t test_ecu_start(uint32_t (*poll)(void* /*arg*/),
+							void (*frame)(void* /*arg*/, const struct phy_msg_t* /*frame*/),
+							void *arg,
+							const char *name,
+							UBaseType_t priority);
+BaseType_t test_ecu_channel_start(struct isotp_t *msg, const char *name, UBaseType_t priority);
+BaseType_t test_ecu_dispatch_start(struct isotp_dispatch_t *bus, const char *name, UBaseType_t priority);
+void test_ecu_stop(void);
+
+/*
+ * Virtual CAN bus of the test drivers.
+ * The bus runs in a task of its own and sleeps the time of a frame on the
+ * host. A node that receives frames notifies the task in its arg, so a
+ * node task waits on its notification and on the timeouts of its channels:
+ *
+ *	test_bus_start(&bus, "vcan_bus", tskIDLE_PRIORITY + 1);
+ *	vTaskPrioritySet(NULL, tskIDLE_PRIORITY + 2);
+ *	test_node_wake_set(&tester_node, xTaskGetCurrentTaskHandle());
+ *	...
+ *	test_bus_stop();
+ *
+ * The nodes run at a higher priority than the bus, so they take a frame as
+ * soon as the bus hands it over.
+ */
+BaseType_t test_bus_start(struct vcan_bus_t *bus, const char *name, UBaseType_t priority);
+void test_bus_stop(void);
+void test_node_wake_set(struct vcan_node_t *node, TaskHandle_t task);
+ERROR_CODE test_node_send(struct vcan_node_t *node, struct phy_msg_t *msg);
+
+#endif /* __TEST_UTIL_H__ */
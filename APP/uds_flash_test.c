@@ -0,0 +1,482 @@
+#include "isotp.h"
+#include "uds.h"
+#include "uds_flash.h"
+#include "vcan.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+#ifdef WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "comm_typedef.h"
+
+/*
+ * Firmware download over the virtual CAN bus.
+ * The tester (the command line task) downloads an image to an ECU task
+ * running the UDS server twice: first the way the tests did so far, one
+ * block at a time copied into a 4095 byte buffer and sent with the
+ * blocking isotp_send()/isotp_receive(), then with the download engine of
+ * lib/uds_flash.c, which sends from the image, prepares the next block
+ * while the current one is on the bus and waits for frames instead of
+ * polling. The image is a file mapped into memory, or a generated one
+ * for "-". The ECU checks the CRC-32 of what it received against the one
+ * of the RequestTransferExit.
+ */
+#define FLASH_TESTER_ID		(0x7E0UL)
+#define FLASH_ECU_ID		(0x7E8UL)
+
+#define FLASH_BS			(8UL)
+#define FLASH_STMIN			(0UL)
+#define FLASH_ADDRESS		(0x00010000UL)
+/* the image of "-" */
+#define FLASH_IMAGE_LEN		(65536UL)
+
+#define FLASH_FIFO_LEN		(32UL)
+#define FLASH_TX_RING_LEN	(FLASH_BS)
+#define FLASH_NODES			(2UL)
+#define FLASH_REQ_LEN		(64UL)
+#define FLASH_RESP_LEN		(64UL)
+/* a run that takes longer than this failed */
+#define FLASH_RUN_MS		(600000UL)
+
+/* as APP/vcan_test.c */
+#define FLASH_BUS_PRIORITY	(tskIDLE_PRIORITY + 1)
+#define FLASH_NODE_PRIORITY	(tskIDLE_PRIORITY + 2)
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg);
+static ERROR_CODE tester_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg);
+static uint8_t ecu_start(struct uds_server_t *server, uint32_t address, uint32_t size);
+static ERROR_CODE ecu_write(struct uds_server_t *server, uint32_t offset, const uint8_t *data, uint32_t len);
+static uint8_t ecu_finish(struct uds_server_t *server, const uint8_t *record, uint32_t len);
+static uint32_t baseline_request(uint32_t len);
+static uint32_t baseline_run(const uint8_t *image, uint32_t size, uint32_t max_block);
+static uint32_t engine_run(const uint8_t *image, uint32_t size, uint32_t max_block);
+static void bus_print(void);
+static const uint8_t *image_map(const char *path, uint32_t *size);
+static void image_unmap(const uint8_t *image, uint32_t size);
+static void ecu_thread(void *arg);
+
+/* no session nor security, only the download is measured */
+static const struct uds_service_t services[] =
+{
+	{UDS_SID_REQUEST_DOWNLOAD, 3, UDS_SESSIONS_ALL, 0, FALSE, uds_request_download},
+	{UDS_SID_TRANSFER_DATA, 2, UDS_SESSIONS_ALL, 0, FALSE, uds_transfer_data},
+	{UDS_SID_TRANSFER_EXIT, 1, UDS_SESSIONS_ALL, 0, FALSE, uds_transfer_exit},
+};
+static const struct uds_download_t ecu_download = {ecu_start, ecu_write, ecu_finish};
+
+static struct vcan_bus_t bus;
+static struct vcan_node_t *bus_node[FLASH_NODES];
+static struct vcan_node_t tester_node, ecu_node;
+static struct vcan_frame_t fifo[FLASH_NODES * 2][FLASH_FIFO_LEN];
+static struct uds_server_t server;
+static struct uds_flash_t flash;
+static struct isotp_t tester;
+static uint8_t ecu_req[FLASH_REQ_LEN], ecu_resp[FLASH_RESP_LEN];
+static uint8_t tester_buffer[ISOTP_FF_DL], tester_resp[FLASH_RESP_LEN];
+static struct phy_msg_t tester_ring[FLASH_TX_RING_LEN];
+static uint8_t generated[FLASH_IMAGE_LEN];
+static TaskHandle_t ecu_task;
+/* what the ECU received */
+static uint32_t ecu_crc, ecu_offset;
+
+static void ecu_thread(void *arg)
+{
+	struct phy_msg_t frame;
+
+	for(;;)
+	{
+		ulTaskNotifyTake(pdTRUE, test_wait_ticks(uds_poll(&server)));
+		while(vcan_receive(&ecu_node, &frame) == STATUS_NORMAL)
+		{
+			isotp_on_frame(&server.channel, &frame);
+		}
+	}
+}
+
+static uint8_t ecu_start(struct uds_server_t *server, uint32_t address, uint32_t size)
+{
+	(void)server;
+	(void)size;
+
+	if(address != FLASH_ADDRESS)
+	{
+		return UDS_NRC_REQUEST_OUT_OF_RANGE;
+	}
+	ecu_crc = UDS_FLASH_CRC_INIT;
+	ecu_offset = 0UL;
+
+	return UDS_NRC_OK;
+}
+
+/*
+ * the ECU keeps the CRC of the data only, in the order of the image
+ */
+static ERROR_CODE ecu_write(struct uds_server_t *server, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+	(void)server;
+
+	if(offset != ecu_offset)
+	{
+		return ERR_PARAMETER;
+	}
+	ecu_crc = uds_flash_crc32(ecu_crc, data, len);
+	ecu_offset += len;
+
+	return STATUS_NORMAL;
+}
+
+static uint8_t ecu_finish(struct uds_server_t *server, const uint8_t *record, uint32_t len)
+{
+	uint32_t crc;
+
+	(void)server;
+	if(len != 4UL)
+	{
+		return UDS_NRC_INCORRECT_LENGTH;
+	}
+	crc = ((uint32_t)record[0] << 24) | ((uint32_t)record[1] << 16) | ((uint32_t)record[2] << 8) | record[3];
+
+	return (crc == ~ecu_crc) ? UDS_NRC_OK : UDS_NRC_PROGRAMMING_FAILURE;
+}
+
+/*
+ * the request in tester_buffer, the final response after the NRC 0x78
+ *
+ * @parameter out:
+ * bytes of the response in tester_buffer, 0 if it could not be sent
+ */
+static uint32_t baseline_request(uint32_t len)
+{
+	tester.tx.DL = len;
+	if(isotp_send(&tester) != N_OK)
+	{
+		return 0UL;
+	}
+	for(;;)
+	{
+		if(isotp_receive(&tester) != N_OK)
+		{
+			return 0UL;
+		}
+		if(tester.rx.DL != 3UL || tester_buffer[0] != UDS_SID_NEGATIVE || tester_buffer[2] != UDS_NRC_PENDING)
+		{
+			return tester.rx.DL;
+		}
+	}
+}
+
+/*
+ * the download the way of APP/uds_test.c
+ *
+ * @parameter out:
+ * bytes per second, 0 if the download failed
+ */
+static uint32_t baseline_run(const uint8_t *image, uint32_t size, uint32_t max_block)
+{
+	uint32_t start, sent, part, crc = UDS_FLASH_CRC_INIT;
+	uint8_t bsc = 1U;
+
+	isotp_init(&tester, FLASH_ECU_ID, FLASH_TESTER_ID, NULL, tester_send, tester_receive);
+	isotp_dl_set(&tester, server.channel.TX_DL);
+	isotp_buffer_set(&tester, tester_buffer, sizeof(tester_buffer));
+	if(max_block > ISOTP_FF_DL)
+	{
+		max_block = ISOTP_FF_DL;
+	}
+	vcan_stats_reset(&bus);
+	start = timer_us();
+	tester_buffer[0] = UDS_SID_REQUEST_DOWNLOAD;
+	tester_buffer[1] = 0x00U;
+	tester_buffer[2] = 0x44U;
+	tester_buffer[3] = (uint8_t)(FLASH_ADDRESS >> 24);
+	tester_buffer[4] = (uint8_t)(FLASH_ADDRESS >> 16);
+	tester_buffer[5] = (uint8_t)(FLASH_ADDRESS >> 8);
+	tester_buffer[6] = (uint8_t)FLASH_ADDRESS;
+	tester_buffer[7] = (uint8_t)(size >> 24);
+	tester_buffer[8] = (uint8_t)(size >> 16);
+	tester_buffer[9] = (uint8_t)(size >> 8);
+	tester_buffer[10] = (uint8_t)size;
+	if(baseline_request(11UL) < 4UL || tester_buffer[0] != UDS_SID_REQUEST_DOWNLOAD + UDS_SID_POSITIVE)
+	{
+		printf("Flash baseline RequestDownload failed\r\n");
+		return 0UL;
+	}
+	for(sent = 0UL; sent < size; sent += part)
+	{
+		part = (size - sent < max_block - UDS_TRANSFER_HEAD) ? size - sent : max_block - UDS_TRANSFER_HEAD;
+		tester_buffer[0] = UDS_SID_TRANSFER_DATA;
+		tester_buffer[1] = bsc;
+		memcpy(tester_buffer + UDS_TRANSFER_HEAD, image + sent, part);
+		if(baseline_request(part + UDS_TRANSFER_HEAD) != 2UL
+			|| tester_buffer[0] != UDS_SID_TRANSFER_DATA + UDS_SID_POSITIVE || tester_buffer[1] != bsc)
+		{
+			printf("Flash baseline block %u failed\r\n", bsc);
+			return 0UL;
+		}
+		crc = uds_flash_crc32(crc, image + sent, part);
+		bsc ++;
+	}
+	crc = ~crc;
+	tester_buffer[0] = UDS_SID_TRANSFER_EXIT;
+	tester_buffer[1] = (uint8_t)(crc >> 24);
+	tester_buffer[2] = (uint8_t)(crc >> 16);
+	tester_buffer[3] = (uint8_t)(crc >> 8);
+	tester_buffer[4] = (uint8_t)crc;
+	if(baseline_request(5UL) == 0UL || tester_buffer[0] != UDS_SID_TRANSFER_EXIT + UDS_SID_POSITIVE)
+	{
+		printf("Flash baseline RequestTransferExit failed %02X %02X %02X\r\n",
+				tester_buffer[0], tester_buffer[1], tester_buffer[2]);
+		return 0UL;
+	}
+	start = timer_us() - start;
+	printf("Flash baseline  blocks:%u time:%lu us rate:%lu B/s\r\n", (unsigned)(bsc - 1U), (unsigned long)start,
+			(unsigned long)((start != 0UL) ? (unsigned long long)size * 1000000ULL / start : 0ULL));
+	bus_print();
+
+	return (start != 0UL) ? (uint32_t)((unsigned long long)size * 1000000ULL / start) : 0UL;
+}
+
+/*
+ * the download with the engine
+ *
+ * @parameter out:
+ * bytes per second, 0 if the download failed
+ */
+static uint32_t engine_run(const uint8_t *image, uint32_t size, uint32_t max_block)
+{
+	struct phy_msg_t frame;
+	TickType_t begin;
+	uint32_t wait;
+
+	isotp_init(&flash.channel, FLASH_ECU_ID, FLASH_TESTER_ID, NULL, tester_send, tester_receive);
+	isotp_dl_set(&flash.channel, server.channel.TX_DL);
+	isotp_tx_ring_set(&flash.channel, tester_ring, FLASH_TX_RING_LEN);
+	uds_flash_init(&flash, tester_resp, sizeof(tester_resp), max_block);
+	/* frames left by the run before */
+	ulTaskNotifyTake(pdTRUE, 0);
+	vcan_stats_reset(&bus);
+	begin = xTaskGetTickCount();
+	uds_flash_start(&flash, image, size, FLASH_ADDRESS);
+	for(;;)
+	{
+		wait = uds_flash_poll(&flash);
+		if(flash.state == UDS_FLASH_DONE || flash.state == UDS_FLASH_FAILED
+			|| xTaskGetTickCount() - begin >= pdMS_TO_TICKS(FLASH_RUN_MS))
+		{
+			break;
+		}
+		if(wait != 0UL)
+		{
+			ulTaskNotifyTake(pdTRUE, test_wait_ticks(wait));
+		}
+		while(vcan_receive(&tester_node, &frame) == STATUS_NORMAL)
+		{
+			isotp_on_frame(&flash.channel, &frame);
+		}
+	}
+	if(flash.state != UDS_FLASH_DONE)
+	{
+		printf("Flash engine failed in state %d nrc:%02X tx:%d after %lu bytes\r\n",
+				flash.state, flash.nrc, flash.channel.tx.reply, (unsigned long)flash.acked);
+		return 0UL;
+	}
+	printf("Flash engine    blocks:%lu time:%lu us rate:%lu B/s repeated:%lu pending:%lu\r\n",
+			(unsigned long)flash.blocks, (unsigned long)(flash.end_us - flash.start_us),
+			(unsigned long)uds_flash_rate(&flash), (unsigned long)flash.repeated, (unsigned long)flash.pending);
+	bus_print();
+
+	return uds_flash_rate(&flash);
+}
+
+static void bus_print(void)
+{
+	printf("                bus load:%lu.%lu%% frames:%lu\r\n",
+			(unsigned long)(vcan_bus_load(&bus) / 10UL), (unsigned long)(vcan_bus_load(&bus) % 10UL),
+			(unsigned long)bus.frames);
+}
+
+void uds_flash_test_main(const char *path, unsigned long bitrate, unsigned long tx_dl, unsigned long max_block)
+{
+	struct phy_msg_t cf;
+	const uint8_t *image;
+	uint32_t size, index, baseline, engine, limit;
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+
+	if(bitrate < 10000UL || bitrate > 1000000UL || tx_dl < CAN_MAX_DL || tx_dl > CANFD_MAX_DL
+		|| max_block <= UDS_TRANSFER_HEAD || max_block > 0xFFFFUL)
+	{
+		printf("Usage:flash <file|-> <10000-1000000> <8-64> <3-65535>\r\n");
+		return;
+	}
+	if(strcmp(path, "-") == 0)
+	{
+		for(index = 0; index < FLASH_IMAGE_LEN; index ++)
+		{
+			generated[index] = (uint8_t)(index * 13UL + (index >> 9));
+		}
+		image = generated;
+		size = FLASH_IMAGE_LEN;
+	}
+	else
+	{
+		image = image_map(path, &size);
+		if(image == NULL)
+		{
+			printf("Flash: can not map %s\r\n", path);
+			return;
+		}
+	}
+
+	vcan_bus_init(&bus, bus_node, FLASH_NODES, bitrate, VCAN_DATA_BITRATE_DEFAULT);
+	vcan_node_init(&tester_node, fifo[0], FLASH_FIFO_LEN, fifo[1], FLASH_FIFO_LEN);
+	vcan_node_init(&ecu_node, fifo[2], FLASH_FIFO_LEN, fifo[3], FLASH_FIFO_LEN);
+	vcan_filter_set(&tester_node, FLASH_ECU_ID, 0x7FFUL);
+	vcan_filter_set(&ecu_node, FLASH_TESTER_ID, 0x7FFUL);
+	vcan_attach(&bus, &tester_node);
+	vcan_attach(&bus, &ecu_node);
+
+	isotp_init(&server.channel, FLASH_TESTER_ID, FLASH_ECU_ID, NULL, ecu_send, ecu_receive);
+	if(isotp_dl_set(&server.channel, (uint8_t)tx_dl) != STATUS_NORMAL)
+	{
+		printf("Flash: %lu is no CAN FD length\r\n", tx_dl);
+		if(image != generated)
+		{
+			image_unmap(image, size);
+		}
+		return;
+	}
+	fc_set(&server.channel, ISOTP_FS_CTS, FLASH_BS, FLASH_STMIN);
+	uds_init(&server, services, sizeof(services) / sizeof(services[0]),
+			ecu_req, sizeof(ecu_req), ecu_resp, sizeof(ecu_resp));
+	uds_download_set(&server, &ecu_download, max_block);
+
+	test_bus_start(&bus, "flash_bus", FLASH_BUS_PRIORITY);
+	xTaskCreate(ecu_thread, "flash_ecu", 200, NULL, FLASH_NODE_PRIORITY, &ecu_task);
+	vTaskPrioritySet(NULL, FLASH_NODE_PRIORITY);
+	test_node_wake_set(&tester_node, xTaskGetCurrentTaskHandle());
+	test_node_wake_set(&ecu_node, ecu_task);
+
+	/* payload of a full CF over its time on the bus */
+	memset(&cf, 0, sizeof(cf));
+	cf.id = FLASH_TESTER_ID;
+	cf.length = (uint8_t)tx_dl;
+	limit = (uint32_t)((unsigned long long)(tx_dl - 1UL) * 1000000ULL / vcan_frame_time(&bus, &cf));
+	printf("Flash %s, %lu bytes, bitrate:%lu TX_DL:%lu max block:%lu bus limit:%lu B/s\r\n",
+			path, (unsigned long)size, bitrate, tx_dl, max_block, (unsigned long)limit);
+
+	baseline = baseline_run(image, size, max_block);
+	engine = engine_run(image, size, max_block);
+
+	vTaskDelete(ecu_task);
+	test_bus_stop();
+	vTaskPrioritySet(NULL, priority);
+	if(image != generated)
+	{
+		image_unmap(image, size);
+	}
+	if(baseline != 0UL && engine != 0UL)
+	{
+		printf("Flash speed-up:%lu.%02lu, the engine at %lu%% of the bus limit\r\n",
+				(unsigned long)(engine / baseline), (unsigned long)(engine % baseline * 100UL / baseline),
+				(unsigned long)((unsigned long long)engine * 100ULL / limit));
+	}
+}
+
+/*
+ * map a file read-only, the pages come in as the blocks are prepared
+ */
+static const uint8_t *image_map(const char *path, uint32_t *size)
+{
+#ifdef WIN32
+	HANDLE file, mapping;
+	LARGE_INTEGER length;
+	const uint8_t *image = NULL;
+
+	file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		return NULL;
+	}
+	if(GetFileSizeEx(file, &length) && length.QuadPart != 0 && length.QuadPart <= 0xFFFFFFFFLL)
+	{
+		mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+		if(mapping != NULL)
+		{
+			image = (const uint8_t *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+			/* the view keeps the mapping */
+			CloseHandle(mapping);
+		}
+		*size = (uint32_t)length.QuadPart;
+	}
+	CloseHandle(file);
+
+	return image;
+#else
+	struct stat info;
+	void *image;
+	int file;
+
+	file = open(path, O_RDONLY);
+	if(file < 0)
+	{
+		return NULL;
+	}
+	if(fstat(file, &info) != 0 || info.st_size == 0 || (unsigned long long)info.st_size > 0xFFFFFFFFULL)
+	{
+		close(file);
+		return NULL;
+	}
+	image = mmap(NULL, (size_t)info.st_size, PROT_READ, MAP_PRIVATE, file, 0);
+	/* the mapping keeps the file */
+	close(file);
+	if(image == MAP_FAILED)
+	{
+		return NULL;
+	}
+	madvise(image, (size_t)info.st_size, MADV_SEQUENTIAL);
+	*size = (uint32_t)info.st_size;
+
+	return (const uint8_t *)image;
+#endif
+}
+
+static void image_unmap(const uint8_t *image, uint32_t size)
+{
+#ifdef WIN32
+	(void)size;
+	UnmapViewOfFile(image);
+#else
+	munmap((void *)image, size);
+#endif
+}
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg)
+{
+	return test_node_send(&tester_node, msg);
+}
+
+static ERROR_CODE tester_receive(struct phy_msg_t *msg)
+{
+	return vcan_receive(&tester_node, msg);
+}
+
+static ERROR_CODE ecu_send(struct phy_msg_t *msg)
+{
+	return test_node_send(&ecu_node, msg);
+}
+
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg)
+{
+	return vcan_receive(&ecu_node, msg);
+}
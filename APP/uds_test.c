@@ -0,0 +1,486 @@
+#include "isotp.h"
+#include "uds.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * UDS server.
+ * The tester (the command line task) goes through a flashing sequence with
+ * an ECU task running the UDS server: sessions, a DID, a routine that takes
+ * longer than P2, SecurityAccess with a wrong and a right key, and the
+ * download of an image in blocks of the given length, with one block
+ * repeated and one out of sequence. The image is checked by the ECU in
+ * RequestTransferExit. For every block the time from the last CF sent to
+ * the positive response is measured.
+ */
+#define UDS_TESTER_ID			(0x7E0UL)
+#define UDS_ECU_ID				(0x7E8UL)
+
+#define UDS_QUEUE_LEN			(32UL)
+#define UDS_IMAGE_MAX			(65536UL)
+#define UDS_IMAGE_ADDRESS		(0x00010000UL)
+#define UDS_REQ_LEN				(64UL)
+#define UDS_RESP_LEN			(64UL)
+/* the routine and the erase take longer than P2 */
+#define UDS_ROUTINE_MS			(120UL)
+#define UDS_ERASE_MS			(60UL)
+#define UDS_KEY_MASK			(0x5A5A5A5AUL)
+#define UDS_TIMEOUT				(1000UL)
+/* a suppressed response does not come within this */
+#define UDS_SILENCE				(100UL)
+
+#define UDS_ECU_PRIORITY		(tskIDLE_PRIORITY + 1)
+#define UDS_TESTER_PRIORITY		(tskIDLE_PRIORITY + 2)
+
+static ERROR_CODE tester_rx_done(struct isotp_t* msg);
+static ERROR_CODE tester_tx_done(struct isotp_t* msg);
+static uint8_t read_did(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+static uint8_t routine_control(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+static uint8_t ecu_seed(struct uds_server_t *server, uint8_t level, uint8_t *seed, uint32_t *len);
+static uint8_t ecu_key(struct uds_server_t *server, uint8_t level, const uint8_t *key, uint32_t len);
+static uint8_t flash_start(struct uds_server_t *server, uint32_t address, uint32_t size);
+static ERROR_CODE flash_write(struct uds_server_t *server, uint32_t offset, const uint8_t *data, uint32_t len);
+static uint8_t flash_finish(struct uds_server_t *server, const uint8_t *record, uint32_t len);
+static uint32_t request(const uint8_t *req, uint32_t len, uint32_t timeout);
+static Bool step(const char *name, const uint8_t *req, uint32_t len, uint8_t sid, uint8_t nrc);
+static uint32_t server_poll(void *arg);
+static void server_frame(void *arg, const struct phy_msg_t *frame);
+
+static const struct uds_service_t services[] =
+{
+	{UDS_SID_SESSION_CONTROL, 2, UDS_SESSIONS_ALL, 0, TRUE, uds_session_control},
+	{UDS_SID_TESTER_PRESENT, 2, UDS_SESSIONS_ALL, 0, TRUE, uds_tester_present},
+	{0x22, 3, UDS_SESSIONS_ALL, 0, FALSE, read_did},
+	{0x31, 4, UDS_SESSION_BIT(UDS_SESSION_EXTENDED) | UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING), 0, TRUE, routine_control},
+	{UDS_SID_SECURITY_ACCESS, 2, UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING), 0, TRUE, uds_security_access},
+	{UDS_SID_REQUEST_DOWNLOAD, 3, UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING), 1U << 1, FALSE, uds_request_download},
+	{UDS_SID_TRANSFER_DATA, 2, UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING), 1U << 1, FALSE, uds_transfer_data},
+	{UDS_SID_TRANSFER_EXIT, 1, UDS_SESSION_BIT(UDS_SESSION_PROGRAMMING), 1U << 1, FALSE, uds_transfer_exit},
+};
+static const struct uds_security_t ecu_security = {ecu_seed, ecu_key};
+static const struct uds_download_t ecu_flash = {flash_start, flash_write, flash_finish};
+static const char ecu_vin[] = "FREERTOSVS0000001";
+
+static struct uds_server_t server;
+static struct isotp_t tester;
+static uint8_t ecu_req[UDS_REQ_LEN], ecu_resp[UDS_RESP_LEN];
+static uint8_t tester_tx[ISOTP_FF_DL], tester_rx[UDS_RESP_LEN];
+static uint8_t image[UDS_IMAGE_MAX], flash[UDS_IMAGE_MAX];
+static uint32_t flash_size, flash_writes;
+static TickType_t busy_until;
+static Bool busy;
+static uint32_t seed;
+/* results, written by the callbacks */
+static volatile Bool response;
+static uint32_t pending, tx_end_us, rx_end_us;
+static uint32_t failed;
+
+/*
+ * the ECU task of the queue pair runs the server
+ */
+static uint32_t server_poll(void *arg)
+{
+	return uds_poll((struct uds_server_t *)arg);
+}
+
+static void server_frame(void *arg, const struct phy_msg_t *frame)
+{
+	isotp_on_frame(&((struct uds_server_t *)arg)->channel, frame);
+}
+
+/*
+ * ReadDataByIdentifier 0x22 of the VIN 0xF190
+ */
+static uint8_t read_did(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	(void)server;
+
+	if(len != 3UL)
+	{
+		return UDS_NRC_INCORRECT_LENGTH;
+	}
+	if(req[1] != 0xF1U || req[2] != 0x90U)
+	{
+		return UDS_NRC_REQUEST_OUT_OF_RANGE;
+	}
+	if(*resp_len < 2UL + sizeof(ecu_vin) - 1UL)
+	{
+		return UDS_NRC_RESPONSE_TOO_LONG;
+	}
+	resp[0] = req[1];
+	resp[1] = req[2];
+	memcpy(resp + 2, ecu_vin, sizeof(ecu_vin) - 1UL);
+	*resp_len = 2UL + sizeof(ecu_vin) - 1UL;
+
+	return UDS_NRC_OK;
+}
+
+/*
+ * RoutineControl 0x31 start 0xFF00, runs for UDS_ROUTINE_MS, the response
+ * is written when it starts and kept over the NRC 0x78
+ */
+static uint8_t routine_control(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	(void)server;
+
+	if(req[1] != 0x01U)
+	{
+		return UDS_NRC_SUBFUNCTION_NOT_SUPPORTED;
+	}
+	if(len != 4UL || req[2] != 0xFFU || req[3] != 0x00U)
+	{
+		return UDS_NRC_REQUEST_OUT_OF_RANGE;
+	}
+	if(busy == FALSE)
+	{
+		busy = TRUE;
+		busy_until = xTaskGetTickCount() + pdMS_TO_TICKS(UDS_ROUTINE_MS);
+		memcpy(resp, req + 1, 3);
+	}
+	if((int32_t)(xTaskGetTickCount() - busy_until) < 0)
+	{
+		return UDS_NRC_PENDING;
+	}
+	busy = FALSE;
+	*resp_len = 3UL;
+
+	return UDS_NRC_OK;
+}
+
+static uint8_t ecu_seed(struct uds_server_t *server, uint8_t level, uint8_t *data, uint32_t *len)
+{
+	(void)server;
+
+	if(level != 1U || *len < 4UL)
+	{
+		return UDS_NRC_SUBFUNCTION_NOT_SUPPORTED;
+	}
+	seed = timer_us() | 1UL;
+	data[0] = (uint8_t)(seed >> 24);
+	data[1] = (uint8_t)(seed >> 16);
+	data[2] = (uint8_t)(seed >> 8);
+	data[3] = (uint8_t)seed;
+	*len = 4UL;
+
+	return UDS_NRC_OK;
+}
+
+static uint8_t ecu_key(struct uds_server_t *server, uint8_t level, const uint8_t *key, uint32_t len)
+{
+	uint32_t value;
+
+	(void)server;
+	(void)level;
+	if(len != 4UL)
+	{
+		return UDS_NRC_INCORRECT_LENGTH;
+	}
+	value = ((uint32_t)key[0] << 24) | ((uint32_t)key[1] << 16) | ((uint32_t)key[2] << 8) | key[3];
+
+	return (value == (seed ^ UDS_KEY_MASK)) ? UDS_NRC_OK : UDS_NRC_INVALID_KEY;
+}
+
+/*
+ * the flash is erased in UDS_ERASE_MS
+ */
+static uint8_t flash_start(struct uds_server_t *server, uint32_t address, uint32_t size)
+{
+	(void)server;
+
+	if(address != UDS_IMAGE_ADDRESS || size > UDS_IMAGE_MAX)
+	{
+		return UDS_NRC_REQUEST_OUT_OF_RANGE;
+	}
+	if(busy == FALSE)
+	{
+		busy = TRUE;
+		busy_until = xTaskGetTickCount() + pdMS_TO_TICKS(UDS_ERASE_MS);
+		memset(flash, 0xFF, size);
+	}
+	if((int32_t)(xTaskGetTickCount() - busy_until) < 0)
+	{
+		return UDS_NRC_PENDING;
+	}
+	busy = FALSE;
+	flash_size = size;
+	flash_writes = 0UL;
+
+	return UDS_NRC_OK;
+}
+
+static ERROR_CODE flash_write(struct uds_server_t *server, uint32_t offset, const uint8_t *data, uint32_t len)
+{
+	(void)server;
+
+	if(offset + len > flash_size)
+	{
+		return ERR_FULL;
+	}
+	memcpy(flash + offset, data, len);
+	flash_writes += len;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * every byte written once, and the image as sent
+ */
+static uint8_t flash_finish(struct uds_server_t *server, const uint8_t *record, uint32_t len)
+{
+	(void)server;
+	(void)record;
+	(void)len;
+
+	if(flash_writes != flash_size || memcmp(flash, image, flash_size) != 0)
+	{
+		return UDS_NRC_PROGRAMMING_FAILURE;
+	}
+	return UDS_NRC_OK;
+}
+
+/*
+ * send a request and wait for the final response, the NRC 0x78 before it
+ * are counted
+ *
+ * @parameter out:
+ * bytes of the response in tester_rx, 0 if none came in timeout ms
+ */
+static uint32_t request(const uint8_t *req, uint32_t len, uint32_t timeout)
+{
+	struct phy_msg_t frame;
+	TickType_t begin = xTaskGetTickCount();
+	uint32_t wait;
+
+	if(req != tester_tx)
+	{
+		memcpy(tester_tx, req, len);
+	}
+	tester.tx.DL = len;
+	response = FALSE;
+	isotp_send_start(&tester);
+	for(;;)
+	{
+		wait = isotp_poll(&tester);
+		if(response == TRUE)
+		{
+			if(tester.rx.DL == 3UL && tester_rx[0] == UDS_SID_NEGATIVE && tester_rx[2] == UDS_NRC_PENDING)
+			{
+				pending ++;
+				response = FALSE;
+				begin = xTaskGetTickCount();
+				timeout = UDS_P2_STAR_MS;
+			}
+			else
+			{
+				return tester.rx.DL;
+			}
+		}
+		if(xTaskGetTickCount() - begin >= pdMS_TO_TICKS(timeout))
+		{
+			return 0UL;
+		}
+		if(wait > timeout)
+		{
+			wait = timeout;
+		}
+		if(test_frame_get(TEST_TESTER, &frame, wait) == pdPASS)
+		{
+			isotp_on_frame(&tester, &frame);
+		}
+	}
+}
+
+/*
+ * one request, the response expected is positive when nrc is 0, none when
+ * sid is 0
+ */
+static Bool step(const char *name, const uint8_t *req, uint32_t len, uint8_t sid, uint8_t nrc)
+{
+	uint32_t got = request(req, len, (sid == 0U) ? UDS_SILENCE : UDS_TIMEOUT);
+	Bool ok;
+
+	if(sid == 0U)
+	{
+		ok = (got == 0UL) ? TRUE : FALSE;
+	}
+	else if(nrc == UDS_NRC_OK)
+	{
+		ok = (got >= 1UL && tester_rx[0] == sid + UDS_SID_POSITIVE) ? TRUE : FALSE;
+	}
+	else
+	{
+		ok = (got == 3UL && tester_rx[0] == UDS_SID_NEGATIVE && tester_rx[1] == sid && tester_rx[2] == nrc) ? TRUE : FALSE;
+	}
+	printf("Uds %-26s %s", name, (ok == TRUE) ? "ok  " : "FAIL");
+	if(got != 0UL)
+	{
+		printf(" %02X %02X %02X", tester_rx[0], (got > 1UL) ? tester_rx[1] : 0, (got > 2UL) ? tester_rx[2] : 0);
+	}
+	printf("\r\n");
+	if(ok == FALSE)
+	{
+		failed ++;
+	}
+	return ok;
+}
+
+void uds_test_main(unsigned long size, unsigned long block)
+{
+	static const uint8_t extended[] = {0x10, 0x03};
+	static const uint8_t programming[] = {0x10, 0x02};
+	static const uint8_t tester_present[] = {0x3E, 0x80};
+	static const uint8_t vin[] = {0x22, 0xF1, 0x90};
+	static const uint8_t routine[] = {0x31, 0x01, 0xFF, 0x00};
+	static const uint8_t seed_req[] = {0x27, 0x01};
+	static const uint8_t exit_req[] = {0x37};
+	static const uint8_t unknown[] = {0x85, 0x01};
+	uint8_t req[12];
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+	uint32_t index, sent, part, key, ack_sum = 0UL, ack_max = 0UL, blocks = 0UL, start, elapsed;
+	uint32_t max_block;
+	uint8_t bsc;
+
+	if(size == 0UL || size > UDS_IMAGE_MAX || block <= UDS_TRANSFER_HEAD || block > ISOTP_FF_DL)
+	{
+		printf("Usage:uds <1-%lu> <3-%lu>\r\n", UDS_IMAGE_MAX, ISOTP_FF_DL);
+		return;
+	}
+	if(test_queues_init(UDS_QUEUE_LEN) != pdPASS)
+	{
+		printf("No memory for the frame queues\r\n");
+		return;
+	}
+
+	isotp_init(&tester, UDS_ECU_ID, UDS_TESTER_ID, NULL, test_tester_send, test_tester_receive);
+	isotp_tx_buffer_set(&tester, tester_tx, sizeof(tester_tx));
+	isotp_rx_buffer_set(&tester, tester_rx, sizeof(tester_rx));
+	isotp_cb_set(&tester, tester_rx_done, tester_tx_done);
+	isotp_init(&server.channel, UDS_TESTER_ID, UDS_ECU_ID, NULL, test_ecu_send, test_ecu_receive);
+	fc_set(&server.channel, ISOTP_FS_CTS, 0, 0);
+	uds_init(&server, services, sizeof(services) / sizeof(services[0]),
+			ecu_req, sizeof(ecu_req), ecu_resp, sizeof(ecu_resp));
+	uds_security_set(&server, &ecu_security);
+	uds_download_set(&server, &ecu_flash, block);
+	for(index = 0; index < size; index ++)
+	{
+		image[index] = (uint8_t)(index * 7UL + (index >> 8));
+	}
+	busy = FALSE;
+	pending = 0UL;
+	failed = 0UL;
+
+	test_ecu_start(server_poll, server_frame, &server, "uds_ecu", UDS_ECU_PRIORITY);
+	vTaskPrioritySet(NULL, UDS_TESTER_PRIORITY);
+	printf("Uds test, image:%lu block:%lu\r\n", size, block);
+
+	step("extended session", extended, sizeof(extended), 0x10, UDS_NRC_OK);
+	step("tester present, silent", tester_present, sizeof(tester_present), 0, UDS_NRC_OK);
+	step("read VIN", vin, sizeof(vin), 0x22, UDS_NRC_OK);
+	if(step("routine, pending", routine, sizeof(routine), 0x31, UDS_NRC_OK) == TRUE
+		&& memcmp(tester_rx + 1, routine + 1, 3) != 0)
+	{
+		printf("Uds routine response FAIL\r\n");
+		failed ++;
+	}
+	req[0] = 0x34;
+	req[1] = 0x00;
+	req[2] = 0x44;
+	req[3] = (uint8_t)(UDS_IMAGE_ADDRESS >> 24);
+	req[4] = (uint8_t)(UDS_IMAGE_ADDRESS >> 16);
+	req[5] = (uint8_t)(UDS_IMAGE_ADDRESS >> 8);
+	req[6] = (uint8_t)UDS_IMAGE_ADDRESS;
+	req[7] = (uint8_t)(size >> 24);
+	req[8] = (uint8_t)(size >> 16);
+	req[9] = (uint8_t)(size >> 8);
+	req[10] = (uint8_t)size;
+	step("download, not in session", req, 11, 0x34, UDS_NRC_SERVICE_NOT_IN_SESSION);
+	step("programming session", programming, sizeof(programming), 0x10, UDS_NRC_OK);
+	step("download, locked", req, 11, 0x34, UDS_NRC_SECURITY_ACCESS_DENIED);
+	step("seed", seed_req, sizeof(seed_req), 0x27, UDS_NRC_OK);
+	key = ((uint32_t)tester_rx[2] << 24) | ((uint32_t)tester_rx[3] << 16) | ((uint32_t)tester_rx[4] << 8) | tester_rx[5];
+	key ^= UDS_KEY_MASK;
+	tester_tx[0] = 0x27;
+	tester_tx[1] = 0x02;
+	tester_tx[2] = (uint8_t)~(key >> 24);
+	step("wrong key", tester_tx, 6, 0x27, UDS_NRC_INVALID_KEY);
+	step("seed again", seed_req, sizeof(seed_req), 0x27, UDS_NRC_OK);
+	key = ((uint32_t)tester_rx[2] << 24) | ((uint32_t)tester_rx[3] << 16) | ((uint32_t)tester_rx[4] << 8) | tester_rx[5];
+	key ^= UDS_KEY_MASK;
+	tester_tx[0] = 0x27;
+	tester_tx[1] = 0x02;
+	tester_tx[2] = (uint8_t)(key >> 24);
+	tester_tx[3] = (uint8_t)(key >> 16);
+	tester_tx[4] = (uint8_t)(key >> 8);
+	tester_tx[5] = (uint8_t)key;
+	step("key", tester_tx, 6, 0x27, UDS_NRC_OK);
+	if(step("download, erase pending", req, 11, 0x34, UDS_NRC_OK) == TRUE)
+	{
+		max_block = ((uint32_t)tester_rx[2] << 8) | tester_rx[3];
+		start = timer_us();
+		bsc = 1U;
+		for(sent = 0UL; sent < size; sent += part)
+		{
+			part = (size - sent < max_block - UDS_TRANSFER_HEAD) ? size - sent : max_block - UDS_TRANSFER_HEAD;
+			tester_tx[0] = UDS_SID_TRANSFER_DATA;
+			tester_tx[1] = bsc;
+			memcpy(tester_tx + UDS_TRANSFER_HEAD, image + sent, part);
+			if(request(tester_tx, part + UDS_TRANSFER_HEAD, UDS_TIMEOUT) != 2UL
+				|| tester_rx[0] != UDS_SID_TRANSFER_DATA + UDS_SID_POSITIVE || tester_rx[1] != bsc)
+			{
+				printf("Uds block %u FAIL\r\n", bsc);
+				failed ++;
+				break;
+			}
+			ack_sum += rx_end_us - tx_end_us;
+			if(rx_end_us - tx_end_us > ack_max)
+			{
+				ack_max = rx_end_us - tx_end_us;
+			}
+			blocks ++;
+			if(blocks == 1UL)
+			{
+				/* the tester did not see the response, it sends the block again */
+				step("block repeated", tester_tx, part + UDS_TRANSFER_HEAD, 0x36, UDS_NRC_OK);
+				tester_tx[1] = bsc + 2U;
+				step("block out of sequence", tester_tx, part + UDS_TRANSFER_HEAD, 0x36, UDS_NRC_WRONG_BLOCK_SEQUENCE);
+			}
+			bsc ++;
+		}
+		elapsed = timer_us() - start;
+		step("transfer exit, checked", exit_req, sizeof(exit_req), 0x37, UDS_NRC_OK);
+		printf("Uds download %lu B in %lu blocks, %lu us, %lu B/s, ack mean:%lu max:%lu us\r\n",
+				(unsigned long)size, (unsigned long)blocks, (unsigned long)elapsed,
+				(unsigned long)((elapsed != 0UL) ? (unsigned long long)size * 1000000ULL / elapsed : 0ULL),
+				(unsigned long)(ack_sum / ((blocks != 0UL) ? blocks : 1UL)), (unsigned long)ack_max);
+	}
+	step("unknown service", unknown, sizeof(unknown), 0x85, UDS_NRC_SERVICE_NOT_SUPPORTED);
+
+	test_ecu_stop();
+	vTaskPrioritySet(NULL, priority);
+	printf("Uds failed:%lu requests:%lu negative:%lu pending:%lu sent / %lu seen\r\n",
+			(unsigned long)failed, (unsigned long)server.requests, (unsigned long)server.negative,
+			(unsigned long)server.pending_count, (unsigned long)pending);
+}
+
+static ERROR_CODE tester_rx_done(struct isotp_t* msg)
+{
+	if(msg->rx.reply == N_OK)
+	{
+		rx_end_us = timer_us();
+		response = TRUE;
+	}
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE tester_tx_done(struct isotp_t* msg)
+{
+	(void)msg;
+	tx_end_us = timer_us();
+
+	return STATUS_NORMAL;
+}
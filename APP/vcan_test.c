@@ -0,0 +1,235 @@
+#include "isotp.h"
+#include "vcan.h"
+#include "test_util.h"
+#include <stdio.h>
+#include <string.h>
+#include <FreeRTOS.h>
+#include <task.h>
+
+#include "comm_typedef.h"
+
+/*
+ * ISO-TP over the virtual CAN bus.
+ * The tester (the command line task) sends one message to the ECU task while
+ * a load node keeps the bus busy with higher priority frames, so the
+ * transfer competes for the bus the way it does in a vehicle.
+ */
+#define VCAN_TESTER_ID		(0x7E0UL)
+#define VCAN_ECU_ID			(0x7E8UL)
+#define VCAN_LOAD_ID		(0x100UL)
+
+#define VCAN_BS				(8UL)
+#define VCAN_STMIN			(0UL)
+
+#define VCAN_FIFO_LEN		(32UL)
+/* the tester builds the next block while it waits for the FC */
+#define VCAN_TX_RING_LEN	(VCAN_BS)
+#define VCAN_NODES			(3UL)
+
+/*
+ * The bus sleeps the time of a frame on the host, the nodes have a higher
+ * priority so that they run as soon as the bus hands them a frame
+ */
+#define VCAN_BUS_PRIORITY	(tskIDLE_PRIORITY + 1)
+#define VCAN_NODE_PRIORITY	(tskIDLE_PRIORITY + 2)
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg);
+static ERROR_CODE tester_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_send(struct phy_msg_t *msg);
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg);
+static ERROR_CODE ecu_done(struct isotp_t* msg);
+static void ecu_thread(void *arg);
+static void load_thread(void *arg);
+/* counts of the channels for the stats command, see APP/isotp_stats_test.c */
+extern ERROR_CODE isotp_stats_test_attach(struct isotp_t *msg, const char *name);
+
+static struct vcan_bus_t bus;
+static struct vcan_node_t *bus_node[VCAN_NODES];
+static struct vcan_node_t tester_node, ecu_node, load_node;
+static struct vcan_frame_t fifo[VCAN_NODES * 2][VCAN_FIFO_LEN];
+static struct isotp_t tester, ecu;
+static uint8_t tester_buffer[ISOTP_FF_DL];
+static uint8_t ecu_buffer[ISOTP_FF_DL];
+static struct phy_msg_t tester_ring[VCAN_TX_RING_LEN];
+static TaskHandle_t ecu_task, load_task;
+/* share of the bus the load node takes, per mille */
+static uint32_t load_permille;
+static volatile Bool ecu_finished;
+static uint32_t ecu_end_us;
+
+static void ecu_thread(void *arg)
+{
+	struct phy_msg_t frame;
+
+	for(;;)
+	{
+		ulTaskNotifyTake(pdTRUE, test_wait_ticks(isotp_poll(&ecu)));
+		while(vcan_receive(&ecu_node, &frame) == STATUS_NORMAL)
+		{
+			isotp_on_frame(&ecu, &frame);
+		}
+	}
+}
+
+/*
+ * Keep load_permille of the bus busy with 8 byte frames
+ */
+static void load_thread(void *arg)
+{
+	struct phy_msg_t frame;
+	uint32_t credit = 0UL;
+	uint32_t cost;
+
+	memset(&frame, 0, sizeof(frame));
+	frame.id = VCAN_LOAD_ID;
+	frame.length = CAN_MAX_DL;
+	cost = vcan_frame_time(&bus, &frame);
+	for(;;)
+	{
+		/* bus time earned in one tick */
+		credit += load_permille * portTICK_PERIOD_MS;
+		while(credit >= cost)
+		{
+			credit -= cost;
+			frame.data[0] ++;
+			vcan_send(&load_node, &frame);
+		}
+		vTaskDelay(1);
+	}
+}
+
+void vcan_test_main(unsigned long bitrate, unsigned char load, unsigned long datalen, unsigned long ppm)
+{
+	struct phy_msg_t frame;
+	uint32_t index, start, errors, wait;
+	UBaseType_t priority = uxTaskPriorityGet(NULL);
+
+	if(bitrate < 10000UL || bitrate > 1000000UL || load > 95UL
+		|| datalen == 0UL || datalen > ISOTP_FF_DL || ppm > 1000000UL)
+	{
+		printf("Usage:vcan <10000-1000000> <0-95> <1-%lu> <0-1000000>\r\n", ISOTP_FF_DL);
+		return;
+	}
+
+	vcan_bus_init(&bus, bus_node, VCAN_NODES, bitrate, 0UL);
+	vcan_node_init(&tester_node, fifo[0], VCAN_FIFO_LEN, fifo[1], VCAN_FIFO_LEN);
+	vcan_node_init(&ecu_node, fifo[2], VCAN_FIFO_LEN, fifo[3], VCAN_FIFO_LEN);
+	vcan_node_init(&load_node, fifo[4], VCAN_FIFO_LEN, fifo[5], VCAN_FIFO_LEN);
+	vcan_filter_set(&tester_node, VCAN_ECU_ID, 0x7FFUL);
+	vcan_filter_set(&ecu_node, VCAN_TESTER_ID, 0x7FFUL);
+	/* the load node listens to nothing */
+	vcan_filter_set(&load_node, 0xFFFFFFFFUL, 0xFFFFFFFFUL);
+	vcan_attach(&bus, &tester_node);
+	vcan_attach(&bus, &ecu_node);
+	vcan_attach(&bus, &load_node);
+	vcan_fault_set(&bus, VCAN_FAULT_DROP, ppm);
+	vcan_fault_set(&bus, VCAN_FAULT_CORRUPT, ppm);
+	vcan_fault_set(&bus, VCAN_FAULT_REORDER, ppm);
+	load_permille = load * 10UL;
+
+	isotp_init(&tester, VCAN_ECU_ID, VCAN_TESTER_ID, NULL, tester_send, tester_receive);
+	isotp_init(&ecu, VCAN_TESTER_ID, VCAN_ECU_ID, NULL, ecu_send, ecu_receive);
+	isotp_stats_test_attach(&tester, "vcan_tester");
+	isotp_stats_test_attach(&ecu, "vcan_ecu");
+	isotp_buffer_set(&tester, tester_buffer, sizeof(tester_buffer));
+	isotp_buffer_set(&ecu, ecu_buffer, sizeof(ecu_buffer));
+	isotp_tx_ring_set(&tester, tester_ring, VCAN_TX_RING_LEN);
+	isotp_cb_set(&ecu, ecu_done, NULL);
+	fc_set(&ecu, ISOTP_FS_CTS, VCAN_BS, VCAN_STMIN);
+	for(index = 0; index < datalen; index ++)
+	{
+		tester_buffer[index] = (uint8_t)index;
+	}
+	memset(ecu_buffer, 0, sizeof(ecu_buffer));
+	ecu_finished = FALSE;
+
+	test_bus_start(&bus, "vcan_bus", VCAN_BUS_PRIORITY);
+	xTaskCreate(ecu_thread, "vcan_ecu", 200, NULL, VCAN_NODE_PRIORITY, &ecu_task);
+	xTaskCreate(load_thread, "vcan_load", 200, NULL, VCAN_NODE_PRIORITY, &load_task);
+	vTaskPrioritySet(NULL, VCAN_NODE_PRIORITY);
+	test_node_wake_set(&tester_node, xTaskGetCurrentTaskHandle());
+	test_node_wake_set(&ecu_node, ecu_task);
+	/* let the load settle before the transfer */
+	vTaskDelay(pdMS_TO_TICKS(100UL));
+	vcan_stats_reset(&bus);
+
+	printf("Vcan test, bitrate:%lu load:%d%% DL:%lu faults:%lu ppm\r\n", bitrate, load, datalen, ppm);
+	tester.tx.DL = datalen;
+	start = timer_us();
+	if(isotp_send_start(&tester) == STATUS_NORMAL)
+	{
+		for(;;)
+		{
+			/* a timeout ends the transfer in isotp_poll() */
+			wait = isotp_poll(&tester);
+			if(tester.tx.state == ISOTP_IDLE)
+			{
+				break;
+			}
+			ulTaskNotifyTake(pdTRUE, test_wait_ticks(wait));
+			while(vcan_receive(&tester_node, &frame) == STATUS_NORMAL)
+			{
+				isotp_on_frame(&tester, &frame);
+			}
+		}
+	}
+	/* the last frames may still wait for the bus, give the ECU up to N_Cr */
+	for(index = 0; index < 1000UL && ecu_finished == FALSE; index ++)
+	{
+		vTaskDelay(pdMS_TO_TICKS(1UL));
+	}
+	vTaskDelete(load_task);
+	vTaskDelete(ecu_task);
+	test_bus_stop();
+	vTaskPrioritySet(NULL, priority);
+
+	errors = 0UL;
+	for(index = 0; index < datalen; index ++)
+	{
+		if(ecu_buffer[index] != (uint8_t)index)
+		{
+			errors ++;
+		}
+	}
+	printf("Vcan Tx result:%d Rx result:%d errors:%lu\r\n", tester.tx.reply,
+			(ecu_finished == TRUE) ? ecu.rx.reply : -1, (unsigned long)errors);
+	if(ecu_finished == TRUE && ecu.rx.reply == N_OK)
+	{
+		printf("Vcan time:%lu us rate:%lu B/s\r\n", (unsigned long)(ecu_end_us - start),
+				(unsigned long)((unsigned long long)datalen * 1000000ULL / (ecu_end_us - start + 1UL)));
+	}
+	printf("Vcan bus load:%lu.%lu%% frames:%lu drop:%lu corrupt:%lu reorder:%lu overflow:%lu\r\n",
+			(unsigned long)(vcan_bus_load(&bus) / 10UL), (unsigned long)(vcan_bus_load(&bus) % 10UL),
+			(unsigned long)bus.frames,
+			(unsigned long)bus.faults[VCAN_FAULT_DROP],
+			(unsigned long)bus.faults[VCAN_FAULT_CORRUPT],
+			(unsigned long)bus.faults[VCAN_FAULT_REORDER],
+			(unsigned long)(tester_node.rx.overflow + ecu_node.rx.overflow + load_node.tx.overflow));
+}
+
+static ERROR_CODE tester_send(struct phy_msg_t *msg)
+{
+	return test_node_send(&tester_node, msg);
+}
+
+static ERROR_CODE tester_receive(struct phy_msg_t *msg)
+{
+	return vcan_receive(&tester_node, msg);
+}
+
+static ERROR_CODE ecu_send(struct phy_msg_t *msg)
+{
+	return test_node_send(&ecu_node, msg);
+}
+
+static ERROR_CODE ecu_receive(struct phy_msg_t *msg)
+{
+	return vcan_receive(&ecu_node, msg);
+}
+
+static ERROR_CODE ecu_done(struct isotp_t* msg)
+{
+	ecu_end_us = timer_us();
+	ecu_finished = TRUE;
+	return STATUS_NORMAL;
+}
@@ -43,7 +43,7 @@
 #define configUSE_PREEMPTION					1
 #define configUSE_PORT_OPTIMISED_TASK_SELECTION	1
 #define configUSE_IDLE_HOOK						0
-#define configUSE_TICK_HOOK						0
+#define configUSE_TICK_HOOK						1
 #define configUSE_DAEMON_TASK_STARTUP_HOOK		1
 #define configTICK_RATE_HZ						( 1000 ) /* In this non-real time simulated environment the tick frequency has to be at least a multiple of the Win32 tick frequency, and therefore very slow. */
 #define configMINIMAL_STACK_SIZE				( ( unsigned short ) 70 ) /* In this simulated case, the stack only has to hold one small structure as the real stack is part of the win32 thread. */
@@ -72,6 +72,17 @@
 
 #define configMAX_PRIORITIES					( 7 )
 
+/* Simulator only: set to 1 to run on virtual time rather than the host clock.
+When every task is blocked the tick count jumps straight to the next wake time,
+so long timeouts complete immediately and runs are repeatable.  Can also be set
+from the command line, e.g. make VIRTUAL_TIME=1. */
+#ifndef configUSE_VIRTUAL_TIME
+	#define configUSE_VIRTUAL_TIME				0
+#endif
+#if ( configUSE_VIRTUAL_TIME == 1 )
+	#define configUSE_TICKLESS_IDLE				2
+#endif
+
 /* Run time stats gathering configuration options. */
 unsigned long ulGetRunTimeCounterValue( void ); /* Prototype of function that returns run time counter. */
 void vConfigureTimerForRunTimeStats( void );	/* Prototype of function that initialises the run time counter. */
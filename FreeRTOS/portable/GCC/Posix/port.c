@@ -0,0 +1,882 @@
+/*
+ * FreeRTOS Kernel V10.0.1
+ * Copyright (C) 2017 Amazon.com, Inc. or its affiliates.  All Rights Reserved.
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy of
+ * this software and associated documentation files (the "Software"), to deal in
+ * the Software without restriction, including without limitation the rights to
+ * use, copy, modify, merge, publish, distribute, sublicense, and/or sell copies of
+ * the Software, and to permit persons to whom the Software is furnished to do so,
+ * subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY, FITNESS
+ * FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR
+ * COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER
+ * IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
+ *
+ * http://www.FreeRTOS.org
+ * http://aws.amazon.com/freertos
+ *
+ * 1 tab == 4 spaces!
+ */
+
+/* Standard includes. */
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <pthread.h>
+#include <semaphore.h>
+
+/* Scheduler includes. */
+#include "FreeRTOS.h"
+#include "task.h"
+
+#define portMAX_INTERRUPTS				( ( uint32_t ) sizeof( uint32_t ) * 8UL ) /* The number of bits in an uint32_t. */
+#define portNO_CRITICAL_NESTING 		( ( uint32_t ) 0 )
+
+/* The signal sent to the thread of a task that is being switched out.  The
+handler parks the thread until the task is selected to run again. */
+#define portSIG_SUSPEND					SIGUSR1
+
+/* Length of one tick in nanoseconds, and the number of ticks the simulated
+timer is allowed to fall behind the host clock before it gives up trying to
+catch up (the host was most likely suspended or heavily loaded). */
+#define portNANOSECONDS_PER_SECOND		( 1000000000L )
+#define portTICK_PERIOD_NS				( portNANOSECONDS_PER_SECOND / configTICK_RATE_HZ )
+#define portMAX_TICK_OVERRUN			( 10L )
+
+#if( configUSE_VIRTUAL_TIME == 1 )
+	/* In virtual time mode there is no timer thread.  If the idle task has
+	been running for this long without any other activity then every task is
+	blocked, and the tick count is stepped to the next wake time instead. */
+	#define portVIRTUAL_IDLE_NS			( 50000L )
+#endif
+
+/*
+ * Created as a separate thread, this function uses an absolute monotonic
+ * deadline to simulate a tick interrupt being generated on an embedded target.
+ * Sleeping to an absolute deadline, rather than for a relative period, keeps
+ * the tick free of the drift the Win32 port accumulates from Sleep().
+ */
+static void *prvSimulatedPeripheralTimer( void *pvParameter );
+
+/*
+ * Process all the simulated interrupts - each represented by a bit in
+ * ulPendingInterrupts variable.
+ */
+static void prvProcessSimulatedInterrupts( void );
+
+/*
+ * Wait for the next simulated interrupt.  In virtual time mode the wait times
+ * out when nothing happens, and prvAdvanceVirtualTime() generates the tick
+ * instead of the (absent) timer thread.
+ */
+static void prvWaitForInterruptEvent( void );
+#if( configUSE_VIRTUAL_TIME == 1 )
+	static void prvAdvanceVirtualTime( void );
+#endif
+
+/*
+ * Interrupt handlers used by the kernel itself.  These are executed from the
+ * simulated interrupt handler thread.
+ */
+static uint32_t prvProcessYieldInterrupt( void );
+static uint32_t prvProcessTickInterrupt( void );
+
+/*
+ * Entry point of every task thread, and the signal handler that parks a task
+ * thread while another task is in the Running state.
+ */
+static void *prvTaskThreadEntry( void *pvParameter );
+static void prvSuspendSignalHandler( int iSignal );
+
+/*-----------------------------------------------------------*/
+
+/* The Posix simulator runs each task in a thread.  The context switching is
+managed by the threads, so the task stack does not have to be managed directly,
+although the task stack is still used to hold an xThreadState structure this is
+the only thing it will ever hold.  The structure indirectly maps the task handle
+to a thread handle. */
+typedef struct
+{
+	/* Handle of the thread that executes the task. */
+	pthread_t xThread;
+
+	/* Posted to wake the thread after xRunning has been set. */
+	sem_t xResume;
+
+	/* Posted once a yield requested by the task has been processed. */
+	sem_t xYieldProcessed;
+	volatile BaseType_t xYieldPending;
+
+	/* The task function and its parameter, started once the task first
+	enters the Running state. */
+	TaskFunction_t pxCode;
+	void *pvParameters;
+
+	/* Set by the simulated interrupt thread to select or deselect the task. */
+	volatile BaseType_t xRunning;
+
+	/* Set when another task deletes this task, the thread exits instead of
+	running again. */
+	volatile BaseType_t xExitRequested;
+
+	/* Cleared once the thread has been closed, see vPortCloseRunningThread(). */
+	volatile BaseType_t xValid;
+
+} xThreadState;
+
+/* Simulated interrupts waiting to be processed.  This is a bit mask where each
+bit represents one interrupt, so a maximum of 32 interrupts can be simulated. */
+static volatile uint32_t ulPendingInterrupts = 0UL;
+
+/* Condition (and flag) used to inform the simulated interrupt processing
+thread that an interrupt is pending. */
+static pthread_cond_t xInterruptEvent;
+static volatile BaseType_t xInterruptEventSet = pdFALSE;
+
+/* Mutex used to protect all the simulated interrupt variables that are accessed
+by multiple threads.  It is recursive so it behaves like the Win32 mutex the
+critical section implementation was written against. */
+static pthread_mutex_t xInterruptEventMutex;
+
+/* Posted by a task thread each time it acknowledges being parked or resumed. */
+static sem_t xThreadAck;
+
+/* The critical nesting count for the currently executing task.  This is
+initialised to a non-zero value so interrupts do not become enabled during
+the initialisation phase.  As each task has its own critical nesting value
+ulCriticalNesting will get set to zero when the first task runs.  This
+initialisation is probably not critical in this simulated environment as the
+simulated interrupt handlers do not get created until the FreeRTOS scheduler is
+started anyway. */
+static volatile uint32_t ulCriticalNesting = 9999UL;
+
+/* Handlers for all the simulated software interrupts.  The first two positions
+are used for the Yield and Tick interrupts so are handled slightly differently,
+all the other interrupts can be user defined. */
+static uint32_t (*ulIsrHandler[ portMAX_INTERRUPTS ])( void ) = { 0 };
+
+/* Pointer to the TCB of the currently executing task. */
+extern void * volatile pxCurrentTCB;
+
+/* Used to ensure nothing is processed during the startup sequence. */
+static volatile BaseType_t xPortRunning = pdFALSE;
+
+/* The thread state of the task executed by the calling thread, NULL in the
+simulated interrupt, timer and any other host threads. */
+static __thread xThreadState *pxThisThreadState = NULL;
+
+/*-----------------------------------------------------------*/
+
+static void prvSetInterruptEvent( void )
+{
+	/* Must be called with xInterruptEventMutex held. */
+	xInterruptEventSet = pdTRUE;
+	pthread_cond_signal( &xInterruptEvent );
+}
+/*-----------------------------------------------------------*/
+
+static void prvWaitForYieldProcessed( xThreadState *pxThreadState )
+{
+	/* Must be called after the yield was made pending and xYieldPending set,
+	with xInterruptEventMutex released.  The thread is parked by the simulated
+	interrupt thread from within the wait if the yield results in a different
+	task being selected.  A semaphore is used rather than a condition as a
+	thread parked inside pthread_cond_wait() could not exit cleanly if the
+	task is deleted. */
+	while( pxThreadState->xYieldPending != pdFALSE )
+	{
+		( void ) sem_wait( &( pxThreadState->xYieldProcessed ) );
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvWaitUntilRunning( xThreadState *pxThreadState )
+{
+	while( pxThreadState->xRunning == pdFALSE )
+	{
+		if( pxThreadState->xExitRequested != pdFALSE )
+		{
+			pthread_exit( NULL );
+		}
+
+		( void ) sem_wait( &( pxThreadState->xResume ) );
+	}
+
+	/* Let the simulated interrupt thread know the task is running again. */
+	sem_post( &xThreadAck );
+}
+/*-----------------------------------------------------------*/
+
+static void prvSuspendThread( xThreadState *pxThreadState )
+{
+	/* Ask the thread to park itself, then wait until it has done so.  This is
+	the equivalent of the synchronous GetThreadContext() call the Win32 port
+	makes after SuspendThread(). */
+	pxThreadState->xRunning = pdFALSE;
+	pthread_kill( pxThreadState->xThread, portSIG_SUSPEND );
+
+	while( sem_wait( &xThreadAck ) != 0 )
+	{
+		/* Interrupted, try again. */
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvResumeThread( xThreadState *pxThreadState )
+{
+	/* The resume is acknowledged too, so a task can never be asked to park
+	again before it has left the park loop - a suspend signal that arrives
+	inside the handler would otherwise only be delivered once it returns. */
+	pxThreadState->xRunning = pdTRUE;
+	sem_post( &( pxThreadState->xResume ) );
+
+	while( sem_wait( &xThreadAck ) != 0 )
+	{
+		/* Interrupted, try again. */
+	}
+}
+/*-----------------------------------------------------------*/
+
+static void prvSuspendSignalHandler( int iSignal )
+{
+xThreadState *pxThreadState = pxThisThreadState;
+int iSavedErrno = errno;
+
+	( void ) iSignal;
+
+	if( pxThreadState != NULL )
+	{
+		/* The thread is now parked. */
+		sem_post( &xThreadAck );
+		prvWaitUntilRunning( pxThreadState );
+	}
+
+	errno = iSavedErrno;
+}
+/*-----------------------------------------------------------*/
+
+static void *prvTaskThreadEntry( void *pvParameter )
+{
+xThreadState *pxThreadState = ( xThreadState * ) pvParameter;
+sigset_t xSignals;
+
+	pxThisThreadState = pxThreadState;
+
+	/* Task threads must be able to receive the suspend signal, whichever
+	thread created them. */
+	sigemptyset( &xSignals );
+	sigaddset( &xSignals, portSIG_SUSPEND );
+	pthread_sigmask( SIG_UNBLOCK, &xSignals, NULL );
+
+	/* Do not start executing the task until it is selected to run. */
+	prvWaitUntilRunning( pxThreadState );
+
+	pxThreadState->pxCode( pxThreadState->pvParameters );
+
+	/* Tasks must not return. */
+	configASSERT( pdFALSE );
+	return NULL;
+}
+/*-----------------------------------------------------------*/
+
+static void *prvSimulatedPeripheralTimer( void *pvParameter )
+{
+struct timespec xNextTick, xNow;
+long lLateNs;
+
+	/* Just to prevent compiler warnings. */
+	( void ) pvParameter;
+
+	clock_gettime( CLOCK_MONOTONIC, &xNextTick );
+
+	for( ;; )
+	{
+		/* Wait until the next tick is due.  The deadline is absolute, so
+		time spent generating the previous tick does not delay this one. */
+		xNextTick.tv_nsec += portTICK_PERIOD_NS;
+		if( xNextTick.tv_nsec >= portNANOSECONDS_PER_SECOND )
+		{
+			xNextTick.tv_nsec -= portNANOSECONDS_PER_SECOND;
+			xNextTick.tv_sec++;
+		}
+
+		while( clock_nanosleep( CLOCK_MONOTONIC, TIMER_ABSTIME, &xNextTick, NULL ) == EINTR )
+		{
+			/* Interrupted, try again. */
+		}
+
+		/* If the host fell a long way behind do not try to catch up by
+		generating a burst of ticks, restart the sequence from now instead. */
+		clock_gettime( CLOCK_MONOTONIC, &xNow );
+		lLateNs = ( long ) ( xNow.tv_sec - xNextTick.tv_sec ) * portNANOSECONDS_PER_SECOND + ( xNow.tv_nsec - xNextTick.tv_nsec );
+		if( lLateNs > ( portMAX_TICK_OVERRUN * portTICK_PERIOD_NS ) )
+		{
+			xNextTick = xNow;
+		}
+
+		configASSERT( xPortRunning );
+
+		pthread_mutex_lock( &xInterruptEventMutex );
+
+		/* The timer has expired, generate the simulated tick event. */
+		ulPendingInterrupts |= ( 1 << portINTERRUPT_TICK );
+
+		/* The interrupt is now pending - notify the simulated interrupt
+		handler thread. */
+		if( ulCriticalNesting == 0 )
+		{
+			prvSetInterruptEvent();
+		}
+
+		/* Give back the mutex so the simulated interrupt handler unblocks
+		and can	access the interrupt handler variables. */
+		pthread_mutex_unlock( &xInterruptEventMutex );
+	}
+
+	return NULL;
+}
+/*-----------------------------------------------------------*/
+
+StackType_t *pxPortInitialiseStack( StackType_t *pxTopOfStack, TaskFunction_t pxCode, void *pvParameters )
+{
+xThreadState *pxThreadState = NULL;
+int8_t *pcTopOfStack = ( int8_t * ) pxTopOfStack;
+int iResult;
+
+	/* In this simulated case a stack is not initialised, but instead a thread
+	is created that will execute the task being created.  The thread handles
+	the context switching itself.  The xThreadState object is placed onto
+	the stack that was created for the task - so the stack buffer is still
+	used, just not in the conventional way.  It will not be used for anything
+	other than holding this structure. */
+	pxThreadState = ( xThreadState * ) ( pcTopOfStack - sizeof( xThreadState ) );
+	pxThreadState->pxCode = pxCode;
+	pxThreadState->pvParameters = pvParameters;
+	pxThreadState->xRunning = pdFALSE;
+	pxThreadState->xExitRequested = pdFALSE;
+	pxThreadState->xValid = pdTRUE;
+	pxThreadState->xYieldPending = pdFALSE;
+	sem_init( &( pxThreadState->xResume ), 0, 0 );
+	sem_init( &( pxThreadState->xYieldProcessed ), 0, 0 );
+
+	/* Create the thread itself.  It parks in prvTaskThreadEntry() until the
+	task is first selected to run. */
+	iResult = pthread_create( &( pxThreadState->xThread ), NULL, prvTaskThreadEntry, pxThreadState );
+	configASSERT( iResult == 0 ); /* See comment where pthread_join() is called. */
+	( void ) iResult;
+
+	return ( StackType_t * ) pxThreadState;
+}
+/*-----------------------------------------------------------*/
+
+BaseType_t xPortStartScheduler( void )
+{
+pthread_t xTimerThread;
+pthread_mutexattr_t xMutexAttributes;
+pthread_condattr_t xCondAttributes;
+struct sigaction xSuspendAction;
+sigset_t xSignals;
+xThreadState *pxThreadState = NULL;
+int32_t lSuccess = pdPASS;
+
+	/* Install the handler that parks a task thread when the task leaves the
+	Running state.  The simulated interrupt and timer threads never receive
+	the signal, only task threads unblock it. */
+	sigemptyset( &xSignals );
+	sigaddset( &xSignals, portSIG_SUSPEND );
+	pthread_sigmask( SIG_BLOCK, &xSignals, NULL );
+
+	xSuspendAction.sa_handler = prvSuspendSignalHandler;
+	xSuspendAction.sa_flags = SA_RESTART;
+	sigfillset( &xSuspendAction.sa_mask );
+	if( sigaction( portSIG_SUSPEND, &xSuspendAction, NULL ) != 0 )
+	{
+		lSuccess = pdFAIL;
+	}
+
+	/* Install the interrupt handlers used by the scheduler itself. */
+	vPortSetInterruptHandler( portINTERRUPT_YIELD, prvProcessYieldInterrupt );
+	vPortSetInterruptHandler( portINTERRUPT_TICK, prvProcessTickInterrupt );
+
+	/* Create the conditions and mutexes that are used to synchronise all the
+	threads. */
+	pthread_mutexattr_init( &xMutexAttributes );
+	pthread_mutexattr_settype( &xMutexAttributes, PTHREAD_MUTEX_RECURSIVE );
+	pthread_condattr_init( &xCondAttributes );
+	pthread_condattr_setclock( &xCondAttributes, CLOCK_MONOTONIC );
+	if( ( pthread_mutex_init( &xInterruptEventMutex, &xMutexAttributes ) != 0 ) ||
+		( pthread_cond_init( &xInterruptEvent, &xCondAttributes ) != 0 ) ||
+		( sem_init( &xThreadAck, 0, 0 ) != 0 ) )
+	{
+		lSuccess = pdFAIL;
+	}
+	pthread_mutexattr_destroy( &xMutexAttributes );
+	pthread_condattr_destroy( &xCondAttributes );
+
+	if( lSuccess == pdPASS )
+	{
+		/* Unlike the Win32 port the task threads are not held back by host
+		thread priorities, so the port is marked as running before the first
+		task is resumed to ensure its critical sections take the mutex. */
+		xPortRunning = pdTRUE;
+
+		#if( configUSE_VIRTUAL_TIME == 0 )
+		{
+			/* Start the thread that simulates the timer peripheral to
+			generate tick interrupts. */
+			if( pthread_create( &xTimerThread, NULL, prvSimulatedPeripheralTimer, NULL ) == 0 )
+			{
+				pthread_detach( xTimerThread );
+			}
+			else
+			{
+				printf( "Failed to create the simulated timer thread\r\n" );
+			}
+		}
+		#else
+		{
+			/* Ticks are generated by prvAdvanceVirtualTime(). */
+			( void ) xTimerThread;
+			( void ) prvSimulatedPeripheralTimer;
+		}
+		#endif
+
+		/* Start the highest priority task by obtaining its associated thread
+		state structure, in which is stored the thread handle. */
+		pxThreadState = ( xThreadState * ) *( ( size_t * ) pxCurrentTCB );
+		ulCriticalNesting = portNO_CRITICAL_NESTING;
+
+		pthread_mutex_lock( &xInterruptEventMutex );
+		prvResumeThread( pxThreadState );
+
+		/* Handle all simulated interrupts - including yield requests and
+		simulated ticks. */
+		prvProcessSimulatedInterrupts();
+	}
+
+	/* Would not expect to return from prvProcessSimulatedInterrupts(), so should
+	not get here. */
+	return 0;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvProcessYieldInterrupt( void )
+{
+	return pdTRUE;
+}
+/*-----------------------------------------------------------*/
+
+static uint32_t prvProcessTickInterrupt( void )
+{
+uint32_t ulSwitchRequired;
+
+	/* Process the tick itself. */
+	configASSERT( xPortRunning );
+	ulSwitchRequired = ( uint32_t ) xTaskIncrementTick();
+
+	return ulSwitchRequired;
+}
+/*-----------------------------------------------------------*/
+
+static void prvWaitForInterruptEvent( void )
+{
+	/* Called with xInterruptEventMutex held. */
+	#if( configUSE_VIRTUAL_TIME == 0 )
+	{
+		while( xInterruptEventSet == pdFALSE )
+		{
+			pthread_cond_wait( &xInterruptEvent, &xInterruptEventMutex );
+		}
+	}
+	#else
+	{
+	struct timespec xTimeout;
+	long lWaitNs;
+
+		/* Wait briefly if only the idle task is running, so a blocked system
+		moves on quickly.  A task that is busy (polling, for example) is given
+		a tick period of host time per tick, as it would be on the target, so
+		time slicing and polling loops with timeouts still work. */
+		if( pxCurrentTCB == xTaskGetIdleTaskHandle() )
+		{
+			lWaitNs = portVIRTUAL_IDLE_NS;
+		}
+		else
+		{
+			lWaitNs = portTICK_PERIOD_NS;
+		}
+
+		clock_gettime( CLOCK_MONOTONIC, &xTimeout );
+		xTimeout.tv_nsec += lWaitNs;
+		if( xTimeout.tv_nsec >= portNANOSECONDS_PER_SECOND )
+		{
+			xTimeout.tv_nsec -= portNANOSECONDS_PER_SECOND;
+			xTimeout.tv_sec++;
+		}
+
+		while( xInterruptEventSet == pdFALSE )
+		{
+			if( pthread_cond_timedwait( &xInterruptEvent, &xInterruptEventMutex, &xTimeout ) == ETIMEDOUT )
+			{
+				if( xInterruptEventSet == pdFALSE )
+				{
+					prvAdvanceVirtualTime();
+				}
+				break;
+			}
+		}
+	}
+	#endif
+
+	xInterruptEventSet = pdFALSE;
+}
+/*-----------------------------------------------------------*/
+
+#if( configUSE_VIRTUAL_TIME == 1 )
+
+	static void prvAdvanceVirtualTime( void )
+	{
+	xThreadState *pxThreadState;
+
+		/* Called with xInterruptEventMutex held, so no task is inside a
+		critical section. */
+		if( pxCurrentTCB != xTaskGetIdleTaskHandle() )
+		{
+			/* A task is busy - let it consume one tick of virtual time
+			through the normal tick interrupt path. */
+			ulPendingInterrupts |= ( 1 << portINTERRUPT_TICK );
+		}
+		else if( ulPendingInterrupts == 0 )
+		{
+			/* Only the idle task is running.  Long idle periods are skipped
+			by vPortSuppressTicksAndSleep(), this covers the remaining single
+			ticks.  The idle task is parked first so the tick count is only
+			ever moved while no task is executing, which keeps the sequence
+			of events identical from one run to the next. */
+			pxThreadState = ( xThreadState * ) *( ( size_t * ) pxCurrentTCB );
+			prvSuspendThread( pxThreadState );
+
+			/* The idle task may have parked with the scheduler suspended, in
+			which case it is left to finish whatever it was doing. */
+			if( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+			{
+				if( xTaskIncrementTick() != pdFALSE )
+				{
+					vTaskSwitchContext();
+				}
+			}
+
+			pxThreadState = ( xThreadState * ) *( ( size_t * ) pxCurrentTCB );
+			prvResumeThread( pxThreadState );
+		}
+	}
+	/*-----------------------------------------------------------*/
+
+	void vPortSuppressTicksAndSleep( TickType_t xExpectedIdleTime )
+	{
+		/* Called by the idle task with the scheduler suspended.  Every task is
+		blocked, so jump the tick count to the tick before the next task wake
+		time and generate the final tick as an interrupt so the kernel
+		processes the wake up as usual.  If no task is waiting on a timeout
+		there is nothing to jump to. */
+		if( ( TickType_t ) ( xTaskGetTickCount() + xExpectedIdleTime ) != portMAX_DELAY )
+		{
+			vTaskStepTick( xExpectedIdleTime - 1 );
+			vPortGenerateSimulatedInterrupt( portINTERRUPT_TICK );
+		}
+	}
+	/*-----------------------------------------------------------*/
+
+#endif /* configUSE_VIRTUAL_TIME */
+
+static void prvProcessSimulatedInterrupts( void )
+{
+uint32_t ulSwitchRequired, i;
+xThreadState *pxThreadState;
+void *pvOldCurrentTCB;
+
+	/* Called with xInterruptEventMutex held, which is only released while
+	waiting for the next simulated interrupt. */
+
+	/* Create a pending tick to ensure the first task is started as soon as
+	this thread pends. */
+	ulPendingInterrupts |= ( 1 << portINTERRUPT_TICK );
+	prvSetInterruptEvent();
+
+	for(;;)
+	{
+		prvWaitForInterruptEvent();
+
+		/* The task that was running when the interrupts were raised, which is
+		the task that requested any pending yield. */
+		pvOldCurrentTCB = pxCurrentTCB;
+
+		/* Used to indicate whether the simulated interrupt processing has
+		necessitated a context switch to another task/thread. */
+		ulSwitchRequired = pdFALSE;
+
+		/* For each interrupt we are interested in processing, each of which is
+		represented by a bit in the 32bit ulPendingInterrupts variable. */
+		for( i = 0; i < portMAX_INTERRUPTS; i++ )
+		{
+			/* Is the simulated interrupt pending? */
+			if( ulPendingInterrupts & ( 1UL << i ) )
+			{
+				/* Is a handler installed? */
+				if( ulIsrHandler[ i ] != NULL )
+				{
+					/* Run the actual handler. */
+					if( ulIsrHandler[ i ]() != pdFALSE )
+					{
+						ulSwitchRequired |= ( 1 << i );
+					}
+				}
+
+				/* Clear the interrupt pending bit. */
+				ulPendingInterrupts &= ~( 1UL << i );
+			}
+		}
+
+		if( ulSwitchRequired != pdFALSE )
+		{
+			/* Select the next task to run. */
+			vTaskSwitchContext();
+
+			/* If the task selected to enter the running state is not the task
+			that is already in the running state. */
+			if( pvOldCurrentTCB != pxCurrentTCB )
+			{
+				/* Park the old thread, unless it has already closed itself. */
+				pxThreadState = ( xThreadState *) *( ( size_t * ) pvOldCurrentTCB );
+				if( pxThreadState->xValid != pdFALSE )
+				{
+					prvSuspendThread( pxThreadState );
+				}
+
+				/* Obtain the state of the task now selected to enter the
+				Running state. */
+				pxThreadState = ( xThreadState * ) ( *( size_t *) pxCurrentTCB );
+				prvResumeThread( pxThreadState );
+			}
+		}
+
+		/* Release the task if it is waiting for its yield to be processed.
+		If it has just been parked it will see the yield complete as soon as
+		it is resumed. */
+		pxThreadState = ( xThreadState * ) ( *( size_t *) pvOldCurrentTCB );
+		if( ( pxThreadState->xValid != pdFALSE ) && ( pxThreadState->xYieldPending != pdFALSE ) )
+		{
+			pxThreadState->xYieldPending = pdFALSE;
+			sem_post( &( pxThreadState->xYieldProcessed ) );
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortDeleteThread( void *pvTaskToDelete )
+{
+xThreadState *pxThreadState;
+int iResult;
+
+	/* Remove compiler warnings if configASSERT() is not defined. */
+	( void ) iResult;
+
+	/* Find the handle of the thread being deleted. */
+	pxThreadState = ( xThreadState * ) ( *( size_t *) pvTaskToDelete );
+
+	/* Check that the thread is still valid, it might have been closed by
+	vPortCloseRunningThread() - which will be the case if the task associated
+	with the thread originally deleted itself rather than being deleted by a
+	different task. */
+	if( pxThreadState->xValid != pdFALSE )
+	{
+		/* The thread is parked, so ask it to exit and wait until it has -
+		the xThreadState structure is freed along with the task stack as soon
+		as this function returns.  As with TerminateThread() in the Win32
+		port, a thread that was parked while holding a host library lock
+		will never release it. */
+		pxThreadState->xValid = pdFALSE;
+		pxThreadState->xExitRequested = pdTRUE;
+		sem_post( &( pxThreadState->xResume ) );
+
+		iResult = pthread_join( pxThreadState->xThread, NULL );
+		configASSERT( iResult == 0 );
+
+		sem_destroy( &( pxThreadState->xResume ) );
+		sem_destroy( &( pxThreadState->xYieldProcessed ) );
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortCloseRunningThread( void *pvTaskToDelete, volatile BaseType_t *pxPendYield )
+{
+xThreadState *pxThreadState;
+
+	/* Find the handle of the thread being deleted. */
+	pxThreadState = ( xThreadState * ) ( *( size_t *) pvTaskToDelete );
+
+	/* This function will not return, therefore a yield is set as pending to
+	ensure a context switch occurs away from this thread. */
+	*pxPendYield = pdTRUE;
+
+	/* Mark the thread associated with this task as invalid so neither the
+	simulated interrupt thread nor vPortDeleteThread() try to use it. */
+	pxThreadState->xValid = pdFALSE;
+	pthread_detach( pxThreadState->xThread );
+	sem_destroy( &( pxThreadState->xResume ) );
+	sem_destroy( &( pxThreadState->xYieldProcessed ) );
+	pxThisThreadState = NULL;
+
+	/* Unlike the Win32 port the switch away from this task is requested
+	now rather than on the next tick, which might never arrive when time is
+	not advancing. */
+	ulPendingInterrupts |= ( 1 << portINTERRUPT_YIELD );
+
+	/* This is called from a critical section, which must be exited before the
+	thread stops. */
+	taskEXIT_CRITICAL();
+
+	pthread_exit( NULL );
+}
+/*-----------------------------------------------------------*/
+
+void vPortEndScheduler( void )
+{
+	/* This function IS NOT TESTED! */
+	exit( 0 );
+}
+/*-----------------------------------------------------------*/
+
+void vPortGenerateSimulatedInterrupt( uint32_t ulInterruptNumber )
+{
+xThreadState *pxWaitingThread = NULL;
+
+	configASSERT( xPortRunning );
+
+	if( ( ulInterruptNumber < portMAX_INTERRUPTS ) && ( xPortRunning != pdFALSE ) )
+	{
+		/* Yield interrupts are processed even when critical nesting is
+		non-zero. */
+		pthread_mutex_lock( &xInterruptEventMutex );
+		ulPendingInterrupts |= ( 1 << ulInterruptNumber );
+
+		/* The simulated interrupt is now held pending, but don't actually
+		process it yet if this call is within a critical section.  It is
+		possible for this to be in a critical section as calls to wait for
+		mutexes are accumulative. */
+		if( ulCriticalNesting == 0 )
+		{
+			prvSetInterruptEvent();
+
+			/* A task that yields does not run on past the yield - otherwise
+			it could execute code after, say, blocking on a queue, up until
+			the point the simulated interrupt thread parks it. */
+			if( ( ulInterruptNumber == portINTERRUPT_YIELD ) && ( pxThisThreadState != NULL ) )
+			{
+				pxWaitingThread = pxThisThreadState;
+				pxWaitingThread->xYieldPending = pdTRUE;
+			}
+		}
+
+		pthread_mutex_unlock( &xInterruptEventMutex );
+
+		if( pxWaitingThread != NULL )
+		{
+			prvWaitForYieldProcessed( pxWaitingThread );
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortSetInterruptHandler( uint32_t ulInterruptNumber, uint32_t (*pvHandler)( void ) )
+{
+	if( ulInterruptNumber < portMAX_INTERRUPTS )
+	{
+		if( xPortRunning != pdFALSE )
+		{
+			pthread_mutex_lock( &xInterruptEventMutex );
+			ulIsrHandler[ ulInterruptNumber ] = pvHandler;
+			pthread_mutex_unlock( &xInterruptEventMutex );
+		}
+		else
+		{
+			ulIsrHandler[ ulInterruptNumber ] = pvHandler;
+		}
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortEnterCritical( void )
+{
+	if( xPortRunning == pdTRUE )
+	{
+		/* The interrupt event mutex is held for the entire critical section,
+		effectively disabling (simulated) interrupts. */
+		pthread_mutex_lock( &xInterruptEventMutex );
+		ulCriticalNesting++;
+	}
+	else
+	{
+		ulCriticalNesting++;
+	}
+}
+/*-----------------------------------------------------------*/
+
+void vPortExitCritical( void )
+{
+xThreadState *pxWaitingThread = NULL;
+
+	/* The interrupt event mutex should already be held by this thread as it was
+	obtained on entry to the critical section. */
+
+	if( ulCriticalNesting > portNO_CRITICAL_NESTING )
+	{
+		if( ulCriticalNesting == ( portNO_CRITICAL_NESTING + 1 ) )
+		{
+			ulCriticalNesting--;
+
+			/* Were any interrupts set to pending while interrupts were
+			(simulated) disabled? */
+			if( ulPendingInterrupts != 0UL )
+			{
+				configASSERT( xPortRunning );
+				prvSetInterruptEvent();
+
+				/* As in vPortGenerateSimulatedInterrupt(), a yield requested
+				from within the critical section takes effect before the task
+				carries on. */
+				if( ( ( ulPendingInterrupts & ( 1UL << portINTERRUPT_YIELD ) ) != 0UL ) && ( pxThisThreadState != NULL ) )
+				{
+					pxWaitingThread = pxThisThreadState;
+					pxWaitingThread->xYieldPending = pdTRUE;
+				}
+			}
+		}
+		else
+		{
+			/* Tick interrupts will still not be processed as the critical
+			nesting depth will not be zero. */
+			ulCriticalNesting--;
+		}
+	}
+
+	if( xPortRunning == pdTRUE )
+	{
+		pthread_mutex_unlock( &xInterruptEventMutex );
+	}
+
+	if( pxWaitingThread != NULL )
+	{
+		prvWaitForYieldProcessed( pxWaitingThread );
+	}
+}
+/*-----------------------------------------------------------*/
@@ -61,6 +61,15 @@ static DWORD WINAPI prvSimulatedPeripheralTimer( LPVOID lpParameter );
  */
 static void prvProcessSimulatedInterrupts( void );
 
+/*
+ * In virtual time mode there is no timer thread.  Called from the simulated
+ * interrupt handler thread, with the interrupt event mutex held, when nothing
+ * happened for a while.
+ */
+#if( configUSE_VIRTUAL_TIME == 1 )
+	static void prvAdvanceVirtualTime( void );
+#endif
+
 /*
  * Interrupt handlers used by the kernel itself.  These are executed from the
  * simulated interrupt handler thread.
@@ -295,18 +304,22 @@ SYSTEM_INFO xSystemInfo;
 
 	if( lSuccess == pdPASS )
 	{
-		/* Start the thread that simulates the timer peripheral to generate
-		tick interrupts.  The priority is set below that of the simulated
-		interrupt handler so the interrupt event mutex is used for the
-		handshake / overrun protection. */
-		pvHandle = CreateThread( NULL, 0, prvSimulatedPeripheralTimer, NULL, CREATE_SUSPENDED, NULL );
-		if( pvHandle != NULL )
+		#if( configUSE_VIRTUAL_TIME == 0 )
 		{
-			SetThreadPriority( pvHandle, portSIMULATED_TIMER_THREAD_PRIORITY );
-			SetThreadPriorityBoost( pvHandle, TRUE );
-			SetThreadAffinityMask( pvHandle, 0x01 );
-			ResumeThread( pvHandle );
+			/* Start the thread that simulates the timer peripheral to
+			generate tick interrupts.  The priority is set below that of the
+			simulated interrupt handler so the interrupt event mutex is used
+			for the handshake / overrun protection. */
+			pvHandle = CreateThread( NULL, 0, prvSimulatedPeripheralTimer, NULL, CREATE_SUSPENDED, NULL );
+			if( pvHandle != NULL )
+			{
+				SetThreadPriority( pvHandle, portSIMULATED_TIMER_THREAD_PRIORITY );
+				SetThreadPriorityBoost( pvHandle, TRUE );
+				SetThreadAffinityMask( pvHandle, 0x01 );
+				ResumeThread( pvHandle );
+			}
 		}
+		#endif
 
 		/* Start the highest priority task by obtaining its associated thread
 		state structure, in which is stored the thread handle. */
@@ -369,7 +382,22 @@ CONTEXT xContext;
 
 	for(;;)
 	{
-		WaitForMultipleObjects( sizeof( pvObjectList ) / sizeof( void * ), pvObjectList, TRUE, INFINITE );
+		#if( configUSE_VIRTUAL_TIME == 0 )
+		{
+			WaitForMultipleObjects( sizeof( pvObjectList ) / sizeof( void * ), pvObjectList, TRUE, INFINITE );
+		}
+		#else
+		{
+			/* Wait briefly if only the idle task is running, or a tick period
+			if a task is busy, then generate the tick ourselves. */
+			if( WaitForMultipleObjects( sizeof( pvObjectList ) / sizeof( void * ), pvObjectList, TRUE,
+										( pxCurrentTCB == xTaskGetIdleTaskHandle() ) ? 1 : portTICK_PERIOD_MS ) == WAIT_TIMEOUT )
+			{
+				WaitForSingleObject( pvInterruptEventMutex, INFINITE );
+				prvAdvanceVirtualTime();
+			}
+		}
+		#endif
 
 		/* Used to indicate whether the simulated interrupt processing has
 		necessitated a context switch to another task/thread. */
@@ -433,6 +461,62 @@ CONTEXT xContext;
 }
 /*-----------------------------------------------------------*/
 
+#if( configUSE_VIRTUAL_TIME == 1 )
+
+	static void prvAdvanceVirtualTime( void )
+	{
+	xThreadState *pxThreadState;
+	CONTEXT xContext;
+
+		if( pxCurrentTCB != xTaskGetIdleTaskHandle() )
+		{
+			/* A task is busy - let it consume one tick of virtual time
+			through the normal tick interrupt path. */
+			ulPendingInterrupts |= ( 1 << portINTERRUPT_TICK );
+		}
+		else if( ulPendingInterrupts == 0 )
+		{
+			/* Only the idle task is running.  Long idle periods are skipped
+			by vPortSuppressTicksAndSleep(), this covers the remaining single
+			ticks.  The idle task is stopped first so the tick count is only
+			ever moved while no task is executing. */
+			pxThreadState = ( xThreadState * ) *( ( size_t * ) pxCurrentTCB );
+			SuspendThread( pxThreadState->pvThread );
+			xContext.ContextFlags = CONTEXT_INTEGER;
+			( void ) GetThreadContext( pxThreadState->pvThread, &xContext );
+
+			/* The idle task may have stopped with the scheduler suspended, in
+			which case it is left to finish whatever it was doing. */
+			if( xTaskGetSchedulerState() == taskSCHEDULER_RUNNING )
+			{
+				if( xTaskIncrementTick() != pdFALSE )
+				{
+					vTaskSwitchContext();
+				}
+			}
+
+			pxThreadState = ( xThreadState * ) *( ( size_t * ) pxCurrentTCB );
+			ResumeThread( pxThreadState->pvThread );
+		}
+	}
+	/*-----------------------------------------------------------*/
+
+	void vPortSuppressTicksAndSleep( TickType_t xExpectedIdleTime )
+	{
+		/* Called by the idle task with the scheduler suspended.  Jump the
+		tick count to the tick before the next task wake time and generate the
+		final tick as an interrupt so the kernel processes the wake up as
+		usual. */
+		if( ( TickType_t ) ( xTaskGetTickCount() + xExpectedIdleTime ) != portMAX_DELAY )
+		{
+			vTaskStepTick( xExpectedIdleTime - 1 );
+			vPortGenerateSimulatedInterrupt( portINTERRUPT_TICK );
+		}
+	}
+	/*-----------------------------------------------------------*/
+
+#endif /* configUSE_VIRTUAL_TIME */
+
 void vPortDeleteThread( void *pvTaskToDelete )
 {
 xThreadState *pxThreadState;
@@ -153,5 +153,15 @@ void vPortGenerateSimulatedInterrupt( uint32_t ulInterruptNumber );
  */
 void vPortSetInterruptHandler( uint32_t ulInterruptNumber, uint32_t (*pvHandler)( void ) );
 
+/*
+ * In virtual time mode (configUSE_VIRTUAL_TIME set to 1 in FreeRTOSConfig.h)
+ * the tick is not driven by the host clock.  When every task is blocked the
+ * idle task jumps the tick count straight to the next wake time.
+ */
+#if( configUSE_VIRTUAL_TIME == 1 )
+	void vPortSuppressTicksAndSleep( TickType_t xExpectedIdleTime );
+	#define portSUPPRESS_TICKS_AND_SLEEP( xExpectedIdleTime ) vPortSuppressTicksAndSleep( xExpectedIdleTime )
+#endif
+
 #endif
 
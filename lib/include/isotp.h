@@ -4,6 +4,10 @@
 #include "comm_typedef.h"
 #include "timer.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 
 typedef enum {
 	ISOTP_IDLE = 0,
@@ -13,6 +17,7 @@ typedef enum {
 	ISOTP_WAIT_FIRST_FC,
 	ISOTP_WAIT_FC,
 	ISOTP_WAIT_DATA,
+	ISOTP_SEND_FC,		/* RX: FC.WAIT sent, the next FC is due */
 	ISOTP_FINISHED,
 	ISOTP_ERROR
 } isotp_states_t;
@@ -27,6 +32,30 @@ typedef enum {
  */
 #define ISOTP_FF_DL	(4095UL)
 
+/*
+ * ISO-15765-2:2016-9.6.3.1
+ * Messages longer than 4095 bytes are sent with FF_DL = 0 in the first two
+ * bytes, followed by a 32 bit FF_DL. They are received into a lent buffer
+ * large enough, or streamed with the sink/source callbacks, see
+ * isotp_stream_set().
+ */
+#define ISOTP_FF_DL_ESC	(0xFFFFFFFFUL)
+
+/*
+ * ISO-15765-2:2016 CAN FD
+ * TX_DL is the data length of the frames a channel sends, 8 for classical CAN,
+ * or one of the CAN FD lengths 12, 16, 20, 24, 32, 48, 64. The receiver takes
+ * RX_DL from the length of the FirstFrame.
+ */
+#define CAN_MAX_DL		(8UL)
+#define CANFD_MAX_DL	(64UL)
+
+/* no CAN ID, above the 29 bit IDs */
+#define ISOTP_NO_ID		(0xFFFFFFFFUL)
+
+/* returned by isotp_poll() when the channel has no pending timeout */
+#define ISOTP_WAIT_FOREVER	TIMER_FOREVER
+
 /* Flow Status given in FC frame */
 enum ISOTP_FS_e
 {
@@ -56,44 +85,164 @@ enum N_Result
 	N_ERROR
 };
 
+/*
+ * ISO-15765-2-10.3 addressing formats
+ * With extended and mixed addressing the first data byte of every frame
+ * holds N_TA or N_AE, and the N_PCI follows it.
+ */
+enum isotp_addr_e
+{
+	ISOTP_ADDR_NORMAL = 0UL,	/* the CAN ID only */
+	ISOTP_ADDR_EXTENDED,		/* N_TA in the first data byte */
+	ISOTP_ADDR_MIXED,			/* N_AE in the first data byte */
+};
+
 struct phy_msg_t
 {
 	uint8_t new_data;
 	uint32_t id;
 	uint8_t length;
-	uint8_t data[8];
+	uint8_t data[CANFD_MAX_DL];
 };
 
+/*
+ * Data link layer access. A phy_send that returns ERR_TIMEOUT, or takes
+ * longer than N_As/N_Ar to return, ends the message with N_TIMEOUT_A.
+ */
 typedef ERROR_CODE (*isotp_transfer)(struct phy_msg_t *);
 
+/*
+ * Vectored data link layer access, for drivers with a hardware FIFO or
+ * sendmmsg/recvmmsg. Sending takes up to count frames and sets done to the
+ * number accepted; receiving fills up to count frames, sets done to the
+ * number filled and returns ERR_EMPTY if none was waiting.
+ */
+typedef ERROR_CODE (*isotp_transfer_batch)(struct phy_msg_t * /*frame*/, uint32_t /*count*/, uint32_t * /*done*/);
+
+/*
+ * One piece of a buffer lent to a channel, see isotp_iov_set()
+ */
+struct isotp_iovec
+{
+	uint8_t *base;
+	uint32_t len;
+};
+
+struct isotp_t;
+struct isotp_capture_t;
+struct isotp_stats_t;
+struct isotp_pool_t;
+struct isotp_pool_ctx_t;
+/* store len received bytes at offset of the message, DL is already set */
+typedef ERROR_CODE (*isotp_sink)(struct isotp_t* /*msg*/, uint32_t /*offset*/, const uint8_t* /*data*/, uint16_t /*len*/);
+/* fetch len bytes from offset of the message being sent */
+typedef ERROR_CODE (*isotp_source)(struct isotp_t* /*msg*/, uint32_t /*offset*/, uint8_t* /*data*/, uint16_t /*len*/);
+
 struct isotp_msg_t
 {
 	struct phy_msg_t phy_rx;
 	struct phy_msg_t phy_tx;
 	uint32_t N_TA;		/* network target address */
 	uint32_t N_SA;		/* network source address */
+	uint32_t N_FA;		/* functional address received, see isotp_functional_set() */
+	enum isotp_addr_e addr_mode;
+	uint8_t addr_len;	/* 1 with extended or mixed addressing */
+	uint8_t tx_ae;		/* N_TA/N_AE byte of the frames sent */
+	uint8_t rx_ae;		/* N_TA/N_AE byte of the frames received */
 	isotp_transfer phy_send;
 	isotp_transfer phy_receive;
+	isotp_transfer_batch phy_send_batch;	/* NULL: phy_send for every frame */
+	struct isotp_capture_t *capture;		/* frames sent and accepted, see isotp_capture_set() */
+	struct isotp_stats_t *stats;			/* counters and histograms, see isotp_stats_set() */
 };
 
-struct isotp_t
+/*
+ * State of one direction of a channel. A channel has one for the messages
+ * it sends and one for the messages it receives, so a request can come in
+ * while a long response is still being sent.
+ */
+struct isotp_ctx_t
 {
-	uint16_t DL;		/* data length */
-	isotp_states_t tp_state;
-	
+	isotp_states_t state;
+	uint32_t DL;		/* data length */
 	uint16_t SN;		/* consecutive frame serial number */
+	uint8_t BS;			/* block size of the last FC, received (TX) or sent (RX) */
+	uint8_t BS_Counter;	/* consecutive frames left in the block */
+	uint8_t STmin;		/* SeparationTime minimum of the last FC, received (TX) or sent (RX) */
+	uint8_t wait_count;	/* FC.WAIT in a row, received (TX) or sent (RX) */
+	uint32_t rest;		/* bytes not received, or not put in a CF yet */
+	enum N_Result reply;
+	const struct isotp_iovec *iov;	/* buffer lent by the application */
+	uint8_t iovcnt;					/* number of pieces in iov */
+	uint8_t iov_index;				/* piece holding buffer_index */
+	uint32_t iov_offset;			/* offset of buffer_index in that piece */
+	uint32_t buffer_size;			/* total length of iov */
+	struct isotp_iovec buffer;		/* iov of isotp_buffer_set() */
+	uint32_t buffer_index;			/* current index in the message */
+};
+
+/*
+ * Flow control policy
+ * A receiving channel asks its policy for FS, BS and STmin before every FC
+ * it sends: after the FF, at the end of each block and when the time after
+ * a FC.WAIT is over. The channel fills in what it knows of the message, the
+ * probe given to isotp_fc_policy_set() adds what only the application
+ * knows, and may lower space when the data goes to a bounded sink.
+ * A FS above ISOTP_FS_OVFLW is sent as ISOTP_FS_OVFLW and ends the
+ * reception with N_ERROR.
+ */
+#define ISOTP_FC_UNKNOWN	(0xFFFFFFFFUL)
+
+struct isotp_fc_state_t
+{
+	uint32_t rest;			/* bytes of the message not received yet */
+	uint32_t space;			/* bytes the storage takes now, ISOTP_FC_UNKNOWN if not limited */
+	uint16_t cf_len;		/* payload bytes of one CF */
+	uint8_t wait_count;		/* FC.WAIT sent in a row for this block */
+	uint32_t queue_depth;	/* probe: frames waiting in the receive queue */
+	uint32_t queue_size;	/* probe: frames the receive queue holds, 0 if unknown */
+	uint32_t cpu_load;		/* probe: load of the receiving task in per mille */
+};
+
+/* the FC to send, set to the values of fc_set() before the policy is asked */
+struct isotp_fc_t
+{
+	enum ISOTP_FS_e FS;
+	uint8_t BS;
+	uint8_t STmin;
+};
+
+typedef void (*isotp_fc_probe)(struct isotp_t* /*msg*/, struct isotp_fc_state_t* /*state*/);
+typedef void (*isotp_fc_policy)(const struct isotp_fc_state_t* /*state*/, struct isotp_fc_t* /*fc*/);
+
+struct isotp_t
+{
+	struct isotp_ctx_t tx;	/* set tx.DL before isotp_send_start() */
+	struct isotp_ctx_t rx;
 
+	/* FC sent by the receiving side, see fc_set() */
 	enum ISOTP_FS_e FS;	/* Flow control status */
 	uint8_t BS;			/* setting block size, setting value */
-	uint8_t BS_Counter;	/* block size counter, setting value */
 	uint8_t STmin;		/* SeparationTime minimum */
+	uint8_t TX_DL;		/* data length of the frames sent, see isotp_dl_set() */
+	uint8_t RX_DL;		/* data length of the frames received, from the FF */
+	Bool duplex;		/* TX and RX do not share storage, see isotp_iov_set() */
 	ERROR_CODE (*fs_set_cb)(struct isotp_t* /*msg*/);
-	uint16_t rest;		/* mutilate frame remaining part */
+	isotp_fc_policy fc_policy;	/* picks the FC of each block, see isotp_fc_policy_set() */
+	isotp_fc_probe fc_probe;
+	ERROR_CODE (*rx_done_cb)(struct isotp_t* /*msg*/);	/* reception finished, result in rx.reply */
+	ERROR_CODE (*tx_done_cb)(struct isotp_t* /*msg*/);	/* transmission finished, result in tx.reply */
 	struct timer_t N_Bs;
 	struct timer_t N_Cr;
-	enum N_Result reply;
-	uint8_t Buffer[ISOTP_FF_DL];	/* data pool */
-	uint16_t buffer_index;			/* data_pool current index */
+	struct timer_t N_Cs;	/* STmin pacing of the next consecutive frame */
+	isotp_sink sink;				/* receive into the sink instead of rx.iov */
+	isotp_source source;			/* send from the source instead of tx.iov */
+	struct isotp_pool_t *pool;		/* rx.iov taken per message, see isotp_pool_set() */
+	struct isotp_pool_ctx_t *pool_ctx;	/* held from the SF or FF to rx_done */
+	struct phy_msg_t *tx_ring;		/* CFs built ahead, see isotp_tx_ring_set() */
+	uint8_t tx_ring_size;
+	uint8_t tx_ring_head;			/* next CF to send */
+	uint8_t tx_ring_count;			/* CFs built and not sent yet */
 	struct isotp_msg_t isotp;	/* isotp data from the bus */
 };
 
@@ -103,8 +252,80 @@ ERROR_CODE isotp_init(struct isotp_t *msg,
 							ERROR_CODE (*fs_set_cb)(struct isotp_t* /*msg*/),
 							isotp_transfer isotp_send, 
 							isotp_transfer isotp_receive);
+ERROR_CODE fc_set(struct isotp_t *msg, enum ISOTP_FS_e FS, uint8_t BS, uint8_t STmin);
+ERROR_CODE isotp_dl_set(struct isotp_t *msg, uint8_t TX_DL);
+ERROR_CODE isotp_addr_set(struct isotp_t *msg, enum isotp_addr_e mode, uint8_t tx_ae, uint8_t rx_ae);
+ERROR_CODE isotp_buffer_set(struct isotp_t *msg, uint8_t *buffer, uint32_t size);
+ERROR_CODE isotp_iov_set(struct isotp_t *msg, const struct isotp_iovec *iov, uint8_t iovcnt);
+ERROR_CODE isotp_tx_buffer_set(struct isotp_t *msg, uint8_t *buffer, uint32_t size);
+ERROR_CODE isotp_rx_buffer_set(struct isotp_t *msg, uint8_t *buffer, uint32_t size);
+ERROR_CODE isotp_tx_iov_set(struct isotp_t *msg, const struct isotp_iovec *iov, uint8_t iovcnt);
+ERROR_CODE isotp_rx_iov_set(struct isotp_t *msg, const struct isotp_iovec *iov, uint8_t iovcnt);
+ERROR_CODE isotp_stream_set(struct isotp_t *msg, isotp_sink sink, isotp_source source);
+ERROR_CODE isotp_cb_set(struct isotp_t *msg,
+							ERROR_CODE (*rx_done_cb)(struct isotp_t* /*msg*/),
+							ERROR_CODE (*tx_done_cb)(struct isotp_t* /*msg*/));
+ERROR_CODE isotp_fc_policy_set(struct isotp_t *msg, isotp_fc_policy policy, isotp_fc_probe probe);
+ERROR_CODE isotp_tx_ring_set(struct isotp_t *msg, struct phy_msg_t *frame, uint8_t size);
+ERROR_CODE isotp_send_batch_set(struct isotp_t *msg, isotp_transfer_batch send_batch);
+
+/*
+ * Event driven interface, none of these functions block.
+ * isotp_send_start() transmits the SF or FF of the first tx.DL bytes of the
+ * buffer lent with isotp_buffer_set()/isotp_iov_set(),
+ * every frame received from the bus is passed to isotp_on_frame(), and
+ * isotp_poll() handles timeouts and STmin pacing. isotp_poll() returns the
+ * number of milliseconds until it needs to be called again, so a task serving
+ * any number of channels can block on its frame queue for the smallest value:
+ *
+ *	for(;;)
+ *	{
+ *		wait = min(isotp_poll(&ch[0]), isotp_poll(&ch[1]), ...);
+ *		if(xQueueReceive(queue, &frame, wait == ISOTP_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait)) == pdPASS)
+ *		{
+ *			isotp_on_frame(&ch[n], &frame);
+ *		}
+ *	}
+ *
+ * Completion is reported through rx_done_cb/tx_done_cb, see isotp_cb_set().
+ * Sending and receiving go on at the same time when the two directions have
+ * their own storage, lent with isotp_tx_buffer_set()/isotp_rx_buffer_set()
+ * or a sink/source. With one buffer for both, frames starting a reception
+ * are ignored while a message is sent, and no message is sent while one is
+ * received.
+ * The consecutive frames keep STmin to the microsecond: isotp_poll() returns
+ * the whole milliseconds left, and the rest is slept with timer_wait() when
+ * the frame is sent. With a ring lent by isotp_tx_ring_set() the next CFs
+ * are built while the sender waits, and only handed to phy_send when due.
+ * With STmin 0 the CFs of the ring go out in one call of the phy_send_batch
+ * of isotp_send_batch_set(), up to the end of the block.
+ */
+ERROR_CODE isotp_send_start(struct isotp_t* msg);
+ERROR_CODE isotp_on_frame(struct isotp_t* msg, const struct phy_msg_t *frame);
+uint32_t isotp_poll(struct isotp_t* msg);
+
+/*
+ * ISO-15765-2-10.3.1 functional addressing
+ * A request to a functional ID, answered by every ECU listening to it, is a
+ * SingleFrame. isotp_functional_send() starts it like isotp_send_start(),
+ * with N_TA of isotp_init() as the functional ID, and refuses a tx.DL that
+ * takes a FirstFrame. An ECU channel given the functional ID with
+ * isotp_functional_set() receives such requests besides those on N_SA, and
+ * answers on N_TA as usual. The tester collects the responses of all ECUs
+ * with isotp_collect.h.
+ */
+ERROR_CODE isotp_functional_set(struct isotp_t* msg, uint32_t fa);
+ERROR_CODE isotp_functional_send(struct isotp_t* msg);
+
+/*
+ * Blocking interface, built on the functions above. Frames are fetched with
+ * the phy_receive function given to isotp_init().
+ */
 enum N_Result isotp_send(struct isotp_t* msg);
 enum N_Result isotp_receive(struct isotp_t* msg);
-ERROR_CODE fc_set(struct isotp_t *msg, enum ISOTP_FS_e FS, uint8_t BS, uint8_t STmin);
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
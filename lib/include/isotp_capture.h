@@ -0,0 +1,112 @@
+#ifndef __ISOTP_CAPTURE_H__
+#define __ISOTP_CAPTURE_H__
+
+#include "isotp.h"
+
+/*
+ * Frame capture
+ * A channel given a capture with isotp_capture_set() copies every frame it
+ * sends or accepts into the ring of the capture, with the time of
+ * timer_us(). Nothing is formatted on that path. Another task writes the
+ * frames out with isotp_capture_flush(), as a candump log or as a pcap file
+ * of LINKTYPE_CAN_SOCKETCAN, through a write function of the application:
+ *
+ *	channel task:
+ *		isotp_capture_set(&channel, &capture);
+ *
+ *	flush task, at a low priority:
+ *		isotp_capture_header(&capture, ISOTP_CAPTURE_PCAP, file_write, file);
+ *		for(;;)
+ *		{
+ *			isotp_capture_flush(&capture, ISOTP_CAPTURE_PCAP, file_write, file);
+ *			sleep;
+ *		}
+ *
+ * The ring has one producer, so all channels sharing a capture have to run
+ * in one task. Two channels talking to each other would both record each
+ * frame, tap one of them. A frame that finds the ring full is dropped and
+ * counted.
+ * Frames longer than 8 bytes are written as CAN FD frames.
+ *
+ * isotp_capture_parse() reads the frames of either format back, and
+ * isotp_replay_run() feeds the frames of one ID to a channel at the pace
+ * they were captured, or faster.
+ */
+enum isotp_capture_format_e
+{
+	ISOTP_CAPTURE_CANDUMP = 0UL,
+	ISOTP_CAPTURE_PCAP,
+};
+
+/* the interface name of candump lines */
+#define ISOTP_CAPTURE_IFNAME		"can0"
+/* LINKTYPE_CAN_SOCKETCAN */
+#define ISOTP_CAPTURE_LINKTYPE		(227UL)
+/* bytes of the pcap file header */
+#define ISOTP_CAPTURE_PCAP_HEADER	(24UL)
+
+struct isotp_capture_rec_t
+{
+	uint32_t time_us;		/* timer_us() when sent or received */
+	uint32_t id;
+	uint8_t length;
+	uint8_t data[CANFD_MAX_DL];
+};
+
+/* the application writes len bytes of data to the file */
+typedef ERROR_CODE (*isotp_capture_write)(void* /*arg*/, const uint8_t* /*data*/, uint32_t /*len*/);
+
+struct isotp_capture_t
+{
+	struct isotp_capture_rec_t *rec;	/* storage lent by the application */
+	uint32_t mask;				/* records in the ring - 1 */
+	volatile uint32_t head;		/* written by the channels */
+	volatile uint32_t tail;		/* written by isotp_capture_flush() */
+	volatile uint32_t overflow;	/* frames dropped because the ring was full */
+	/* time base of the file */
+	uint32_t start_sec;			/* wall clock at isotp_capture_init() */
+	uint32_t start_us;			/* timer_us() at isotp_capture_init() */
+	uint32_t last_us;			/* timer_us() of the last frame written */
+	unsigned long long elapsed_us;	/* from start_us to last_us, past the wraps of timer_us() */
+	uint32_t written;			/* frames written */
+};
+
+struct isotp_replay_t
+{
+	const struct isotp_capture_rec_t *rec;	/* in the order of time_us */
+	uint32_t count;
+	uint32_t next;
+	uint32_t id;				/* frames fed to the channel */
+	uint32_t speed;				/* 1 as captured, N times faster, 0 without pauses */
+	uint32_t start_us;			/* timer_us() of the first frame fed */
+	uint32_t fed;
+};
+
+ERROR_CODE isotp_capture_init(struct isotp_capture_t *capture,
+							struct isotp_capture_rec_t *rec,
+							uint32_t size,
+							uint32_t wall_sec);
+ERROR_CODE isotp_capture_set(struct isotp_t *msg, struct isotp_capture_t *capture);
+void isotp_capture_put(struct isotp_capture_t *capture, const struct phy_msg_t *frame);
+ERROR_CODE isotp_capture_header(struct isotp_capture_t *capture,
+							enum isotp_capture_format_e format,
+							isotp_capture_write write,
+							void *arg);
+uint32_t isotp_capture_flush(struct isotp_capture_t *capture,
+							enum isotp_capture_format_e format,
+							isotp_capture_write write,
+							void *arg);
+ERROR_CODE isotp_capture_parse(enum isotp_capture_format_e format,
+							const uint8_t *data,
+							uint32_t len,
+							struct isotp_capture_rec_t *rec,
+							uint32_t *used);
+
+ERROR_CODE isotp_replay_init(struct isotp_replay_t *replay,
+							const struct isotp_capture_rec_t *rec,
+							uint32_t count,
+							uint32_t id,
+							uint32_t speed);
+uint32_t isotp_replay_run(struct isotp_replay_t *replay, struct isotp_t *msg);
+
+#endif /* __ISOTP_CAPTURE_H__ */
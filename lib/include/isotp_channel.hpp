@@ -0,0 +1,239 @@
+#ifndef __ISOTP_CHANNEL_HPP__
+#define __ISOTP_CHANNEL_HPP__
+
+/* NULL of C++, before comm_typedef.h would define its own */
+#include <stddef.h>
+#include <string.h>
+#include "isotp.h"
+
+/*
+ * ISO-TP channel for C++, header only, C++17.
+ * IsoTpChannel<MaxLen, FrameSize, Addressing, PhyDriver> runs the protocol
+ * of lib/isotp.c on a struct isotp_t of its own, with what the C channel
+ * decides at run time fixed by the template:
+ *
+ *	MaxLen:     longest message, the send and receive buffers are members
+ *	            of exactly that size; beyond ISOTP_FF_DL the escape
+ *	            FirstFrame is used
+ *	FrameSize:  TX_DL, 8 for classical CAN or a CAN FD length
+ *	Addressing: IsoTpAddressing::Normal, Extended or Mixed
+ *	PhyDriver:  a class with
+ *	                static ERROR_CODE send(struct phy_msg_t &frame);
+ *	                static ERROR_CODE receive(struct phy_msg_t &frame);
+ *	            send takes the frame only when frame.new_data is TRUE and
+ *	            clears it, receive returns ERR_EMPTY when nothing waits
+ *
+ * The driver is called through one function per type of channel, which
+ * the compiler inlines it into, and service() fetches the frames with the
+ * driver directly. The constructor leaves out the calls for CAN FD and
+ * for the addressing byte when the template does not use them, and the
+ * frame geometry is known at compile time:
+ *
+ *	struct Can0
+ *	{
+ *		static ERROR_CODE send(struct phy_msg_t &frame);
+ *		static ERROR_CODE receive(struct phy_msg_t &frame);
+ *	};
+ *	static IsoTpChannel<64, 8, IsoTpAddressing::Normal, Can0> channel(0x7E8, 0x7E0);
+ *	static_assert(decltype(channel)::frames(64) == 10, "FF and 9 CFs");
+ *
+ *	channel.send(request, sizeof(request));
+ *	for(;;)
+ *	{
+ *		wait = channel.service();
+ *		sleep for wait
+ *	}
+ *
+ * The C functions take channel.c_channel() for anything else, a capture or
+ * statistics for example.
+ */
+enum class IsoTpAddressing : unsigned char
+{
+	Normal = ISOTP_ADDR_NORMAL,
+	Extended = ISOTP_ADDR_EXTENDED,
+	Mixed = ISOTP_ADDR_MIXED,
+};
+
+template <uint32_t MaxLen, uint8_t FrameSize, IsoTpAddressing Addressing, class PhyDriver>
+class IsoTpChannel
+{
+	static_assert(MaxLen > 0UL, "a message holds at least one byte");
+	static_assert(FrameSize == 8U || FrameSize == 12U || FrameSize == 16U || FrameSize == 20U
+			|| FrameSize == 24U || FrameSize == 32U || FrameSize == 48U || FrameSize == 64U,
+			"FrameSize is 8 or a CAN FD data length");
+
+public:
+	typedef void (*done_cb)(IsoTpChannel & /*channel*/, enum N_Result /*result*/);
+
+	static constexpr bool fd = FrameSize > CAN_MAX_DL;
+	static constexpr uint8_t addr_len = (Addressing == IsoTpAddressing::Normal) ? 0U : 1U;
+	/* the escape FirstFrame can be needed */
+	static constexpr bool escape = MaxLen > ISOTP_FF_DL;
+	/* payload of a SingleFrame, the CAN FD SF has a second N_PCI byte */
+	static constexpr uint32_t sf_max = fd ? FrameSize - addr_len - 2U : FrameSize - addr_len - 1U;
+	static constexpr uint32_t cf_len = FrameSize - addr_len - 1U;
+
+	/* frames a message of len bytes takes on the bus, FCs not counted */
+	static constexpr uint32_t frames(uint32_t len)
+	{
+		return (len <= sf_max) ? 1UL
+			: 1UL + (len - ff_len(len) + cf_len - 1UL) / cf_len;
+	}
+
+	/*
+	 * sa: ID of the frames received, ta: ID of the frames sent,
+	 * tx_ae/rx_ae: the addressing byte of the frames sent and received
+	 */
+	IsoTpChannel(uint32_t sa, uint32_t ta, uint8_t tx_ae = 0U, uint8_t rx_ae = 0U)
+		: rx_done_(NULL), tx_done_(NULL)
+	{
+		isotp_init(&channel_, sa, ta, NULL, phy_send, phy_receive);
+		isotp_tx_buffer_set(&channel_, tx_, MaxLen);
+		isotp_rx_buffer_set(&channel_, rx_, MaxLen);
+		isotp_cb_set(&channel_, rx_done, tx_done);
+		if constexpr (fd)
+		{
+			isotp_dl_set(&channel_, FrameSize);
+		}
+		if constexpr (Addressing != IsoTpAddressing::Normal)
+		{
+			isotp_addr_set(&channel_, static_cast<enum isotp_addr_e>(Addressing), tx_ae, rx_ae);
+		}
+		else
+		{
+			(void)tx_ae;
+			(void)rx_ae;
+		}
+	}
+
+	IsoTpChannel(const IsoTpChannel &) = delete;
+	IsoTpChannel &operator=(const IsoTpChannel &) = delete;
+
+	/* the FC sent when receiving, see fc_set() */
+	ERROR_CODE fc(enum ISOTP_FS_e FS, uint8_t BS, uint8_t STmin)
+	{
+		return fc_set(&channel_, FS, BS, STmin);
+	}
+
+	/* called when a message is received or sent, may be NULL */
+	void callbacks(done_cb rx, done_cb tx)
+	{
+		rx_done_ = rx;
+		tx_done_ = tx;
+	}
+
+	/* copy a message to the send buffer and start it */
+	ERROR_CODE send(const uint8_t *data, uint32_t len)
+	{
+		if(len == 0UL || len > MaxLen)
+		{
+			return ERR_PARAMETER;
+		}
+		if(channel_.tx.state != ISOTP_IDLE)
+		{
+			return ERR_FULL;
+		}
+		memcpy(tx_, data, len);
+
+		return send(len);
+	}
+
+	/* start the first len bytes of tx_data(), built in place */
+	ERROR_CODE send(uint32_t len)
+	{
+		if(len == 0UL || len > MaxLen)
+		{
+			return ERR_PARAMETER;
+		}
+		channel_.tx.DL = len;
+
+		return isotp_send_start(&channel_);
+	}
+
+	ERROR_CODE on_frame(const struct phy_msg_t &frame)
+	{
+		return isotp_on_frame(&channel_, &frame);
+	}
+
+	uint32_t poll(void)
+	{
+		return isotp_poll(&channel_);
+	}
+
+	/*
+	 * feed the frames waiting in the driver, then poll
+	 *
+	 * milliseconds until the next call is needed, ISOTP_WAIT_FOREVER if
+	 * only a frame can change the state
+	 */
+	uint32_t service(void)
+	{
+		struct phy_msg_t frame;
+
+		while(PhyDriver::receive(frame) == STATUS_NORMAL)
+		{
+			isotp_on_frame(&channel_, &frame);
+		}
+		return isotp_poll(&channel_);
+	}
+
+	uint8_t *tx_data(void) { return tx_; }
+	const uint8_t *rx_data(void) const { return rx_; }
+	/* bytes of the message received last */
+	uint32_t rx_len(void) const { return channel_.rx.DL; }
+	Bool tx_busy(void) const { return (channel_.tx.state != ISOTP_IDLE) ? TRUE : FALSE; }
+	struct isotp_t *c_channel(void) { return &channel_; }
+
+private:
+	static constexpr uint32_t ff_len(uint32_t len)
+	{
+		/* payload of the FirstFrame */
+		return FrameSize - addr_len - ((len > ISOTP_FF_DL) ? 6U : 2U);
+	}
+
+	/* the channel is the first member, the callbacks of the C core lead back */
+	static IsoTpChannel &from(struct isotp_t *msg)
+	{
+		return *reinterpret_cast<IsoTpChannel *>(msg);
+	}
+
+	static ERROR_CODE phy_send(struct phy_msg_t *frame)
+	{
+		return PhyDriver::send(*frame);
+	}
+
+	static ERROR_CODE phy_receive(struct phy_msg_t *frame)
+	{
+		return PhyDriver::receive(*frame);
+	}
+
+	static ERROR_CODE rx_done(struct isotp_t *msg)
+	{
+		IsoTpChannel &channel = from(msg);
+
+		if(channel.rx_done_ != NULL)
+		{
+			channel.rx_done_(channel, msg->rx.reply);
+		}
+		return STATUS_NORMAL;
+	}
+
+	static ERROR_CODE tx_done(struct isotp_t *msg)
+	{
+		IsoTpChannel &channel = from(msg);
+
+		if(channel.tx_done_ != NULL)
+		{
+			channel.tx_done_(channel, msg->tx.reply);
+		}
+		return STATUS_NORMAL;
+	}
+
+	struct isotp_t channel_;
+	done_cb rx_done_;
+	done_cb tx_done_;
+	uint8_t tx_[MaxLen];
+	uint8_t rx_[MaxLen];
+};
+
+#endif /* __ISOTP_CHANNEL_HPP__ */
@@ -0,0 +1,115 @@
+#ifndef __ISOTP_COLLECT_H__
+#define __ISOTP_COLLECT_H__
+
+#include "isotp.h"
+#include "isotp_dispatch.h"
+
+/*
+ * Response collector of a functional request
+ * One SingleFrame to a functional ID is answered by every ECU listening to
+ * it, each on its own physical response ID and at the same time as the
+ * others. The collector sends the request and gives every ECU that starts
+ * a response a responder of its own: a channel receiving from that ID,
+ * which sends its FCs to the physical request ID of the ECU, with a slice
+ * of the buffer lent to the collector. The responses are reassembled side
+ * by side, each under its own N_Cr, and the frames are routed to them by
+ * the dispatcher of isotp_dispatch.h. The table of responders and routes
+ * is lent by the application:
+ *
+ *	static struct isotp_responder_t responder[32];
+ *	static struct isotp_route_t route[32];
+ *	static uint8_t buffer[32][256];
+ *
+ *	isotp_collect_init(&collect, responder, route, 32, buffer[0], 256, phy_send, phy_receive);
+ *	isotp_collect_id_set(&collect, 0x18DB33F1, 0x18DAF100, 0x1FFFFF00, physical_id);
+ *	isotp_collect_start(&collect, request, sizeof(request), 0, 50);
+ *	while(collect.state == ISOTP_COLLECT_WAIT)
+ *	{
+ *		wait = isotp_collect_poll(&collect);
+ *		if(xQueueReceive(queue, &frame, wait == ISOTP_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait)) == pdPASS)
+ *		{
+ *			isotp_collect_frame(&collect, &frame);
+ *		}
+ *	}
+ *
+ * The collection ends when the expected number of responses is in, or when
+ * the window given to isotp_collect_start() is over and no response is
+ * still being received. Every frame of a response starts the window again:
+ * on a busy bus the ECUs with the higher response IDs lose the arbitration
+ * until the others are done, and their first frames come late. A responder
+ * that answers again, after a NRC 0x78 for example, is waited for again.
+ * FC and TX_DL are set on collect.request as on any channel: the request
+ * goes with its TX_DL, the responders send its FS, BS and STmin.
+ */
+enum isotp_collect_state_e
+{
+	ISOTP_COLLECT_IDLE = 0UL,
+	ISOTP_COLLECT_WAIT,		/* request sent, responses expected */
+	ISOTP_COLLECT_DONE,		/* request.tx.reply tells if it went out */
+};
+
+struct isotp_collect_t;
+
+/* maps the ID of a response to the physical request ID of the ECU */
+typedef uint32_t (*isotp_collect_map)(uint32_t /*id*/);
+
+struct isotp_responder_t
+{
+	struct isotp_t channel;		/* first, rx_done finds the responder by it */
+	struct isotp_collect_t *collect;
+	Bool done;					/* the response ended, result in channel.rx.reply */
+	uint8_t responses;			/* messages received since the request */
+	uint32_t time_us;			/* from the request to the end of the last response */
+};
+
+typedef void (*isotp_collect_cb)(struct isotp_collect_t* /*collect*/, struct isotp_responder_t* /*responder*/);
+
+struct isotp_collect_t
+{
+	struct isotp_t request;			/* sends the functional request */
+	struct isotp_iovec req_iov;
+	struct isotp_responder_t *responder;	/* table lent by the application, in order of the first frames */
+	uint16_t size;
+	uint16_t count;					/* responders in use */
+	uint16_t done;					/* responders whose response ended */
+	uint16_t expected;				/* responses that end the collection early, 0 if unknown */
+	struct isotp_dispatch_t bus;	/* routes the frames to the responders */
+	uint8_t *buffer;				/* size pieces of buffer_len bytes */
+	uint32_t buffer_len;
+	uint32_t resp_id;				/* frames with (id & resp_mask) == resp_id are responses */
+	uint32_t resp_mask;
+	isotp_collect_map physical;
+	isotp_collect_cb response_cb;	/* a response ended, may be NULL */
+	enum isotp_collect_state_e state;
+	struct timer_t window;			/* for the first frames, from the last frame of a response */
+	uint32_t window_ms;
+	uint32_t start_us;
+	uint32_t end_us;
+	uint32_t late;					/* responses started after the window */
+	uint32_t overflow;				/* responses with no responder left */
+};
+
+ERROR_CODE isotp_collect_init(struct isotp_collect_t *collect,
+							struct isotp_responder_t *responder,
+							struct isotp_route_t *route,
+							uint16_t size,
+							uint8_t *buffer,
+							uint32_t buffer_len,
+							isotp_transfer phy_send,
+							isotp_transfer phy_receive);
+ERROR_CODE isotp_collect_id_set(struct isotp_collect_t *collect,
+							uint32_t functional_id,
+							uint32_t resp_id,
+							uint32_t resp_mask,
+							isotp_collect_map physical);
+ERROR_CODE isotp_collect_cb_set(struct isotp_collect_t *collect, isotp_collect_cb response_cb);
+ERROR_CODE isotp_collect_start(struct isotp_collect_t *collect,
+							const uint8_t *req,
+							uint32_t len,
+							uint16_t expected,
+							uint32_t window_ms);
+ERROR_CODE isotp_collect_frame(struct isotp_collect_t *collect, const struct phy_msg_t *frame);
+ERROR_CODE isotp_collect_receive(struct isotp_collect_t *collect);
+uint32_t isotp_collect_poll(struct isotp_collect_t *collect);
+
+#endif /* __ISOTP_COLLECT_H__ */
@@ -0,0 +1,75 @@
+#ifndef __ISOTP_DISPATCH_H__
+#define __ISOTP_DISPATCH_H__
+
+#include "isotp.h"
+
+/*
+ * Multi-channel dispatcher
+ * One bus serves any number of ISO-TP channels. Every received frame is
+ * routed to its channel by the CAN ID, and with extended or mixed addressing
+ * by the N_TA/N_AE byte in front of the N_PCI. The routes are kept in a
+ * table lent by the application and sorted by key, so a lookup is a binary
+ * search and takes no allocation:
+ *
+ *	static struct isotp_route_t routes[8];
+ *	isotp_dispatch_init(&bus, routes, 8, phy_receive);
+ *	isotp_dispatch_add(&bus, &ch[0]);
+ *	isotp_dispatch_add(&bus, &ch[1]);
+ *	for(;;)
+ *	{
+ *		wait = isotp_dispatch_poll(&bus);
+ *		if(xQueueReceive(queue, &frame, wait == ISOTP_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait)) == pdPASS)
+ *		{
+ *			isotp_dispatch_frame(&bus, &frame);
+ *		}
+ *	}
+ *
+ * A driver that hands out many frames per call is given with
+ * isotp_dispatch_batch_set(), isotp_dispatch_receive() then fetches them
+ * into the lent frames instead of one by one.
+ *
+ * A channel with a functional ID, see isotp_functional_set(), takes a second
+ * route keyed on N_FA. Functional routes are one to many: any number of
+ * channels may share one functional ID, and a frame that has no physical
+ * route is passed to every channel listening to its functional ID.
+ */
+
+/* route key of a channel with normal addressing, above every address byte */
+#define ISOTP_DISPATCH_NO_AE	(0x100UL)
+
+struct isotp_route_t
+{
+	uint32_t id;				/* CAN ID of the frames received, N_SA of the channel */
+	uint16_t ae;				/* rx_ae, or ISOTP_DISPATCH_NO_AE */
+	Bool functional;			/* id is N_FA of the channel, after the physical route of the same key */
+	struct isotp_t *channel;
+};
+
+struct isotp_dispatch_t
+{
+	struct isotp_route_t *route;	/* table lent by the application, sorted by id, ae and functional */
+	uint16_t size;					/* entries in the table */
+	uint16_t count;					/* entries in use */
+	isotp_transfer phy_receive;		/* fetch frames for isotp_dispatch_receive() */
+	isotp_transfer_batch phy_receive_batch;	/* or many at once, into batch */
+	struct phy_msg_t *batch;		/* frames lent for phy_receive_batch */
+	uint32_t batch_size;
+	uint32_t unrouted;				/* frames that matched no channel */
+};
+
+ERROR_CODE isotp_dispatch_init(struct isotp_dispatch_t *bus,
+							struct isotp_route_t *route,
+							uint16_t size,
+							isotp_transfer phy_receive);
+ERROR_CODE isotp_dispatch_batch_set(struct isotp_dispatch_t *bus,
+							isotp_transfer_batch phy_receive_batch,
+							struct phy_msg_t *batch,
+							uint32_t size);
+ERROR_CODE isotp_dispatch_add(struct isotp_dispatch_t *bus, struct isotp_t *channel);
+ERROR_CODE isotp_dispatch_remove(struct isotp_dispatch_t *bus, struct isotp_t *channel);
+struct isotp_t *isotp_dispatch_find(struct isotp_dispatch_t *bus, const struct phy_msg_t *frame);
+ERROR_CODE isotp_dispatch_frame(struct isotp_dispatch_t *bus, const struct phy_msg_t *frame);
+ERROR_CODE isotp_dispatch_receive(struct isotp_dispatch_t *bus);
+uint32_t isotp_dispatch_poll(struct isotp_dispatch_t *bus);
+
+#endif /* __ISOTP_DISPATCH_H__ */
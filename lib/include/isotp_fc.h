@@ -0,0 +1,31 @@
+#ifndef __ISOTP_FC_H__
+#define __ISOTP_FC_H__
+
+#include "isotp.h"
+
+/*
+ * Built-in flow control policies, see isotp_fc_policy_set()
+ *
+ *	isotp_fc_policy_set(&channel, isotp_fc_max_throughput, probe);
+ *
+ * All of them send FC.WAIT when not even one CF fits in the storage or in
+ * the receive queue, and limit the block to what fits in both.
+ *
+ * isotp_fc_max_throughput: no block limit and no separation time while the
+ * rest of the message fits, blocks of the room left otherwise.
+ *
+ * isotp_fc_low_cpu: no block limit, the separation time grows with the
+ * load of the receiving task above ISOTP_FC_LOAD_LOW, so that the frames
+ * come at the rate the task handles them, FC.WAIT above ISOTP_FC_LOAD_HIGH.
+ *
+ * isotp_fc_memory: small blocks, never more than half of the free queue
+ * and what the storage takes, so that little is buffered at any time.
+ */
+#define ISOTP_FC_LOAD_LOW		(500UL)		/* per mille */
+#define ISOTP_FC_LOAD_HIGH		(950UL)		/* per mille */
+
+void isotp_fc_max_throughput(const struct isotp_fc_state_t *state, struct isotp_fc_t *fc);
+void isotp_fc_low_cpu(const struct isotp_fc_state_t *state, struct isotp_fc_t *fc);
+void isotp_fc_memory(const struct isotp_fc_state_t *state, struct isotp_fc_t *fc);
+
+#endif /* __ISOTP_FC_H__ */
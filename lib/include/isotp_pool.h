@@ -0,0 +1,70 @@
+#ifndef __ISOTP_POOL_H__
+#define __ISOTP_POOL_H__
+
+#include "isotp.h"
+
+/*
+ * Reassembly pool
+ * Channels given a pool with isotp_pool_set() have no receive buffer of
+ * their own. When a SF or FF comes in, the channel takes a context and as
+ * many blocks of the pool as the SF_DL or FF_DL needs, and receives into
+ * them through rx.iov. The context and blocks go back to the pool in
+ * rx_done, after rx_done_cb, whether the message was received, timed out
+ * with N_Cr or failed. So the memory for receiving depends on the number of
+ * messages received at the same time, not on the number of channels:
+ *
+ *	static struct isotp_pool_ctx_t ctx[4];
+ *	static uint8_t blocks[32][128];
+ *
+ *	isotp_pool_init(&pool, ctx, 4, blocks[0], 128, 32);
+ *	for(n = 0; n < 64; n ++)
+ *	{
+ *		isotp_pool_set(&ch[n], &pool);
+ *	}
+ *
+ * A FF that finds no context, or not enough blocks, is answered with
+ * FC.OVFLW and ends in N_BUFFER_OVFLW, a SF with N_BUFFER_OVFLW. The blocks
+ * of a message are only valid in rx_done_cb, rx.iov[0..rx.iovcnt) holds
+ * rx.DL bytes there.
+ * The pool has no lock, all channels sharing a pool have to run in one
+ * task, as with isotp_dispatch.h.
+ */
+
+/* blocks one message can take, messages are up to this many block_size */
+#define ISOTP_POOL_SEGMENTS		(16UL)
+
+struct isotp_pool_ctx_t
+{
+	struct isotp_pool_ctx_t *next;		/* free list */
+	struct isotp_iovec iov[ISOTP_POOL_SEGMENTS];
+	uint8_t count;						/* blocks taken */
+};
+
+struct isotp_pool_t
+{
+	struct isotp_pool_ctx_t *free_ctx;
+	uint8_t *free_block;		/* a free block holds the address of the next one */
+	uint32_t block_size;
+	uint16_t ctx_count;
+	uint16_t ctx_used;
+	uint16_t ctx_peak;
+	uint32_t block_count;
+	uint32_t block_used;
+	uint32_t block_peak;
+	uint32_t taken;				/* messages given a context */
+	uint32_t full;				/* messages refused, no context or blocks left */
+	uint32_t too_long;			/* messages refused, more than ISOTP_POOL_SEGMENTS blocks */
+};
+
+ERROR_CODE isotp_pool_init(struct isotp_pool_t *pool,
+							struct isotp_pool_ctx_t *ctx,
+							uint16_t ctx_count,
+							uint8_t *blocks,
+							uint32_t block_size,
+							uint32_t block_count);
+ERROR_CODE isotp_pool_set(struct isotp_t *msg, struct isotp_pool_t *pool);
+/* called by the channel, for the SF or FF of DL bytes and in rx_done */
+ERROR_CODE isotp_pool_take(struct isotp_t *msg, uint32_t DL);
+void isotp_pool_give(struct isotp_t *msg);
+
+#endif /* __ISOTP_POOL_H__ */
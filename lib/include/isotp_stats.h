@@ -0,0 +1,68 @@
+#ifndef __ISOTP_STATS_H__
+#define __ISOTP_STATS_H__
+
+#include "isotp.h"
+
+/*
+ * Channel statistics
+ * A channel given a stats object with isotp_stats_set() counts its frames,
+ * the messages it ended by N_Result, the FC.WAIT it sent and received, and
+ * keeps histograms of
+ *	fc_latency:	from the FF, the last CF of a block or a FC.WAIT received
+ *				to the next FC, how fast the peer handles a block
+ *	tx_cf_gap:	between the CFs of a block sent, STmin as kept, CFs handed
+ *				to phy_send_batch in one call count as one
+ *	rx_cf_gap:	between the CFs of a block received, STmin as seen
+ *	tx_time:	from isotp_send_start() to the last CF, messages sent with N_OK
+ *	rx_time:	from the FF to the last CF, messages received with N_OK
+ * Single frames only count. Without stats the channel pays one NULL check
+ * per event.
+ *
+ * The histograms have logarithmic buckets of microseconds: bucket 0 holds
+ * 0 us, bucket n holds 2^(n-1) to 2^n - 1 us, the last one everything above.
+ */
+#define ISOTP_HIST_BUCKETS		(24UL)
+
+struct isotp_hist_t
+{
+	uint32_t bucket[ISOTP_HIST_BUCKETS];
+	uint32_t count;
+	uint32_t max;
+	unsigned long long sum;
+};
+
+struct isotp_stats_t
+{
+	uint32_t tx_frames;
+	uint32_t rx_frames;		/* accepted by the channel */
+	uint32_t tx_bytes;		/* data of the messages sent with N_OK */
+	uint32_t rx_bytes;		/* data of the messages received with N_OK */
+	uint32_t tx_result[N_ERROR + 1];	/* messages sent, by result */
+	uint32_t rx_result[N_ERROR + 1];	/* messages received, by result */
+	uint32_t fc_wait_received;
+	uint32_t fc_wait_sent;
+	struct isotp_hist_t fc_latency;
+	struct isotp_hist_t tx_cf_gap;
+	struct isotp_hist_t rx_cf_gap;
+	struct isotp_hist_t tx_time;
+	struct isotp_hist_t rx_time;
+	/* kept by the channel */
+	uint32_t tx_start_us;
+	uint32_t rx_start_us;
+	uint32_t fc_wait_us;
+	uint32_t tx_cf_us;
+	uint32_t rx_cf_us;
+	Bool tx_segmented;
+	Bool rx_segmented;
+	Bool tx_cf;				/* a CF of this block was sent */
+	Bool rx_cf;				/* a CF of this block was received */
+};
+
+ERROR_CODE isotp_stats_set(struct isotp_t *msg, struct isotp_stats_t *stats);
+void isotp_stats_reset(struct isotp_stats_t *stats);
+void isotp_hist_add(struct isotp_hist_t *hist, uint32_t us);
+uint32_t isotp_hist_bucket_us(uint32_t index);
+uint32_t isotp_hist_mean(const struct isotp_hist_t *hist);
+uint32_t isotp_hist_percentile(const struct isotp_hist_t *hist, uint32_t percent);
+
+#endif /* __ISOTP_STATS_H__ */
@@ -0,0 +1,71 @@
+#ifndef __PHY_RING_H__
+#define __PHY_RING_H__
+
+#include "isotp.h"
+
+/*
+ * Lock-free frame ring
+ * One producer, normally the CAN receive interrupt, and one consumer, the
+ * task running the ISO-TP channels, share a ring of frames without a
+ * critical section. Head and tail run free and are only written by their
+ * own side, the ring size is a power of two. A full ring drops the new
+ * frame and counts it, it never overwrites a frame the consumer did not
+ * release yet.
+ *
+ *	ISR:
+ *		frame = phy_ring_claim(&ring);
+ *		if(frame != NULL)
+ *		{
+ *			read the mailbox into frame;
+ *			phy_ring_publish(&ring);
+ *		}
+ *
+ *	task:
+ *		while((count = phy_ring_peek(&ring, &frame)) != 0)
+ *		{
+ *			for(index = 0; index < count; index ++)
+ *			{
+ *				isotp_on_frame(&channel, &frame[index]);
+ *			}
+ *			phy_ring_release(&ring, count);
+ *		}
+ */
+
+/*
+ * producer and consumer indexes are kept this far apart so that they do
+ * not share a cache line, 0 on targets without a data cache
+ */
+#ifndef PHY_RING_CACHE_LINE
+#define PHY_RING_CACHE_LINE		(64UL)
+#endif
+
+struct phy_ring_t
+{
+	/* written by the producer */
+	volatile uint32_t head;
+	volatile uint32_t overflow;		/* frames dropped because the ring was full */
+	volatile uint32_t high_water;	/* most frames ever waiting */
+#if PHY_RING_CACHE_LINE > 12
+	uint8_t pad[PHY_RING_CACHE_LINE - 12UL];
+#endif
+	/* written by the consumer */
+	volatile uint32_t tail;
+	/* set by phy_ring_init() */
+	struct phy_msg_t *frame;		/* storage lent by the application */
+	uint32_t mask;					/* frames in the ring - 1 */
+};
+
+ERROR_CODE phy_ring_init(struct phy_ring_t *ring, struct phy_msg_t *frame, uint32_t size);
+/* producer side */
+struct phy_msg_t *phy_ring_claim(struct phy_ring_t *ring);
+void phy_ring_publish(struct phy_ring_t *ring);
+ERROR_CODE phy_ring_put(struct phy_ring_t *ring, const struct phy_msg_t *msg);
+/* consumer side */
+uint32_t phy_ring_peek(struct phy_ring_t *ring, struct phy_msg_t **frame);
+void phy_ring_release(struct phy_ring_t *ring, uint32_t count);
+ERROR_CODE phy_ring_get(struct phy_ring_t *ring, struct phy_msg_t *msg);
+uint32_t phy_ring_get_batch(struct phy_ring_t *ring, struct phy_msg_t *msg, uint32_t max);
+/* either side */
+uint32_t phy_ring_count(struct phy_ring_t *ring);
+
+#endif /* __PHY_RING_H__ */
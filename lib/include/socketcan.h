@@ -0,0 +1,57 @@
+#ifndef __SOCKETCAN_H__
+#define __SOCKETCAN_H__
+
+#include "isotp.h"
+
+/*
+ * Linux SocketCAN backend
+ * One raw CAN socket per node, bound to an interface such as vcan0 or can0.
+ * The socket is non-blocking: socketcan_send() returns ERR_FULL when the
+ * socket buffer is full and socketcan_receive() ERR_EMPTY when no frame is
+ * waiting, the caller decides whether to sleep. The batch functions move
+ * up to SOCKETCAN_BATCH_MAX frames per system call with sendmmsg/recvmmsg,
+ * and match isotp_transfer_batch once wrapped by the application:
+ *
+ *	static ERROR_CODE ecu_receive_batch(struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+ *	{
+ *		return socketcan_receive_batch(&ecu_can, msg, count, done);
+ *	}
+ *
+ * Identifiers above 0x7FF are sent in the 29 bit format. With fd set every
+ * frame is sent as a CAN FD frame with the bitrate switch, frames of both
+ * kinds are received.
+ *
+ * The kernel time stamps every frame it receives, stamp holds the stamps of
+ * the frames of the last receive call, in the order they were returned.
+ *
+ * Only built on Linux, socketcan_open() fails on other hosts.
+ */
+#define SOCKETCAN_BATCH_MAX		(32UL)
+
+struct socketcan_stamp_t
+{
+	uint32_t sec;			/* CLOCK_REALTIME */
+	uint32_t nsec;
+};
+
+struct socketcan_t
+{
+	int fd;					/* -1 when closed */
+	Bool can_fd;			/* send CAN FD frames */
+	uint32_t tx_frames;
+	uint32_t rx_frames;
+	uint32_t tx_again;		/* sends refused because the socket buffer was full */
+	uint32_t rx_dropped;	/* frames the kernel dropped for this socket */
+	struct socketcan_stamp_t stamp[SOCKETCAN_BATCH_MAX];
+};
+
+ERROR_CODE socketcan_open(struct socketcan_t *can, const char *ifname, Bool fd);
+void socketcan_close(struct socketcan_t *can);
+ERROR_CODE socketcan_filter_set(struct socketcan_t *can, uint32_t id, uint32_t mask);
+ERROR_CODE socketcan_send(struct socketcan_t *can, const struct phy_msg_t *msg);
+ERROR_CODE socketcan_receive(struct socketcan_t *can, struct phy_msg_t *msg);
+ERROR_CODE socketcan_send_batch(struct socketcan_t *can, const struct phy_msg_t *msg, uint32_t count, uint32_t *done);
+ERROR_CODE socketcan_receive_batch(struct socketcan_t *can, struct phy_msg_t *msg, uint32_t count, uint32_t *done);
+uint32_t socketcan_age_us(const struct socketcan_stamp_t *stamp);
+
+#endif /* __SOCKETCAN_H__ */
@@ -3,10 +3,18 @@
 
 #include "comm_typedef.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* returned by timer_remain() when the timer is not enabled */
+#define TIMER_FOREVER	(0xFFFFFFFFUL)
+
 struct timer_t
 {
     Bool enable;
     Bool timeout;
+    Bool us;			/* counts microseconds, see timer_add_us() */
     uint32_t curtime;
 };
 
@@ -17,7 +25,7 @@ struct timer_t
 void delay_1ms(uint16_t ms1);
 
 /* 
- * function: delay 100us
+ * function: delay a multiple of 100us, sleeps instead of spinning
  * This functionality needs to be reimplemented on your platform.
  */
 void delay_100us(uint16_t us100);
@@ -30,6 +38,22 @@ void delay_100us(uint16_t us100);
  */
 void timer_add(struct timer_t *timer);
 
+/*
+ * @Function: enable a timer counting microseconds and record current time,
+ *	the periods given to timer_overflow() and timer_remain() of this timer
+ *	are in microseconds too
+ * @Parameter: 
+ *	timer: timer object
+ * @Return: NULL
+ */
+void timer_add_us(struct timer_t *timer);
+
+/*
+ * @Function: get the microsecond clock, it wraps after 2^32 us
+ * @Return: current time in microseconds
+ */
+uint32_t timer_us(void);
+
 /*
  * @Function: disenable a timer
  * @Parameter: 
@@ -42,6 +66,7 @@ void xtimer_delete(struct timer_t *timer);
  * @Function: check if the timer is out of time
  * @Parameter: 
  *	timer: timer object
+ *	period_ms: timeout period of the timer, in us for timer_add_us()
  * @Return: 
  *	TRUE: the timer is out of time
  *	FLASE: the time is not out of time
@@ -66,6 +91,31 @@ Bool timer_is_added(struct timer_t  *timer);
  */
 void timer_refresh(struct timer_t * timer);
 
+/*
+ * @Function: get the time left until the timer is out of time
+ * @Parameter: 
+ *	timer: timer object
+ *	period_ms: timeout period of the timer, in us for timer_add_us()
+ * @Return: 
+ *	milliseconds left, microseconds for timer_add_us(), 0 if the timer is already out of time,
+ *	TIMER_FOREVER if the timer is not enabled
+ */
+uint32_t timer_remain(struct timer_t *timer, uint32_t period_ms);
+
+/*
+ * @Function: sleep until the timer is out of time, meant for the waits
+ *	shorter than a tick that a task can not block for
+ * @Parameter: 
+ *	timer: timer object
+ *	period_ms: timeout period of the timer, in us for timer_add_us()
+ * @Return: NULL
+ */
+void timer_wait(struct timer_t *timer, uint32_t period_ms);
+
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
 
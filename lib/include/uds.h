@@ -0,0 +1,225 @@
+#ifndef __UDS_H__
+#define __UDS_H__
+
+#include "isotp.h"
+#include "timer.h"
+
+/*
+ * UDS server, ISO 14229-1
+ * The server takes the requests of one ISO-TP channel and routes them by
+ * SID through a table of services lent by the application. Each entry says
+ * in which sessions and at which security levels the service runs and how
+ * short a request may be, so the handlers only deal with valid requests:
+ *
+ *	static const struct uds_service_t services[] =
+ *	{
+ *		{UDS_SID_SESSION_CONTROL, 2, UDS_SESSIONS_ALL, 0, TRUE, uds_session_control},
+ *		{UDS_SID_TESTER_PRESENT, 2, UDS_SESSIONS_ALL, 0, TRUE, uds_tester_present},
+ *		{0x22, 3, UDS_SESSIONS_ALL, 0, FALSE, read_did},
+ *	};
+ *
+ *	isotp_init(&server.channel, TESTER_ID, ECU_ID, NULL, phy_send, phy_receive);
+ *	uds_init(&server, services, 3, request, sizeof(request), response, sizeof(response));
+ *	for(;;)
+ *	{
+ *		wait = uds_poll(&server);
+ *		if(xQueueReceive(queue, &frame, wait == ISOTP_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait)) == pdPASS)
+ *		{
+ *			isotp_on_frame(&server.channel, &frame);
+ *		}
+ *	}
+ *
+ * The handlers run in uds_poll(), never inside isotp_on_frame(), and only
+ * once the response before has left the channel, which sends it from resp
+ * frame by frame. A handler that can not answer at once returns
+ * UDS_NRC_PENDING and is called again from every uds_poll(); the server
+ * sends the NRC 0x78 before P2 is over and repeats it within P2*. Requests
+ * that come meanwhile are dropped, they still keep the session like every
+ * request does.
+ * A set suppressPosRspMsgIndicationBit keeps the positive response of a
+ * service with a sub-function back, as TesterPresent 0x3E 0x80 does. A
+ * non-default session falls back to the default one when no request came
+ * for S3.
+ *
+ * SessionControl, SecurityAccess, TesterPresent and the download services
+ * are handlers of this file, the application puts them in its table with
+ * the sessions and levels it wants them to run at.
+ * RequestDownload/TransferData/RequestTransferExit stream: the data of a
+ * TransferData goes to the write function of the download as its frames
+ * arrive, so the block is in memory when the last CF is, and the positive
+ * response follows at once. A repeated block, the counter of the one
+ * before, is answered without being written again.
+ */
+#define UDS_SID_SESSION_CONTROL		(0x10U)
+#define UDS_SID_SECURITY_ACCESS		(0x27U)
+#define UDS_SID_REQUEST_DOWNLOAD	(0x34U)
+#define UDS_SID_TRANSFER_DATA		(0x36U)
+#define UDS_SID_TRANSFER_EXIT		(0x37U)
+#define UDS_SID_TESTER_PRESENT		(0x3EU)
+#define UDS_SID_NEGATIVE			(0x7FU)
+/* positive response SID = request SID + UDS_SID_POSITIVE */
+#define UDS_SID_POSITIVE			(0x40U)
+#define UDS_SUPPRESS_POS_RSP		(0x80U)
+
+#define UDS_NRC_OK							(0x00U)	/* positive response */
+#define UDS_NRC_SERVICE_NOT_SUPPORTED		(0x11U)
+#define UDS_NRC_SUBFUNCTION_NOT_SUPPORTED	(0x12U)
+#define UDS_NRC_INCORRECT_LENGTH			(0x13U)
+#define UDS_NRC_RESPONSE_TOO_LONG			(0x14U)
+#define UDS_NRC_CONDITIONS_NOT_CORRECT		(0x22U)
+#define UDS_NRC_REQUEST_SEQUENCE_ERROR		(0x24U)
+#define UDS_NRC_REQUEST_OUT_OF_RANGE		(0x31U)
+#define UDS_NRC_SECURITY_ACCESS_DENIED		(0x33U)
+#define UDS_NRC_INVALID_KEY					(0x35U)
+#define UDS_NRC_EXCEEDED_ATTEMPTS			(0x36U)
+#define UDS_NRC_TIME_DELAY_NOT_EXPIRED		(0x37U)
+#define UDS_NRC_UPLOAD_DOWNLOAD_NOT_ACCEPTED	(0x70U)
+#define UDS_NRC_TRANSFER_SUSPENDED			(0x71U)
+#define UDS_NRC_PROGRAMMING_FAILURE			(0x72U)
+#define UDS_NRC_WRONG_BLOCK_SEQUENCE		(0x73U)
+#define UDS_NRC_PENDING						(0x78U)	/* requestCorrectlyReceived-ResponsePending */
+#define UDS_NRC_SUBFUNCTION_NOT_IN_SESSION	(0x7EU)
+#define UDS_NRC_SERVICE_NOT_IN_SESSION		(0x7FU)
+
+#define UDS_SESSION_DEFAULT			(0x01U)
+#define UDS_SESSION_PROGRAMMING		(0x02U)
+#define UDS_SESSION_EXTENDED		(0x03U)
+#define UDS_SESSION_BIT(session)	(1U << (session))
+#define UDS_SESSIONS_ALL			(0xFFU)
+
+/* server timing, P2 and P2* are reported in the SessionControl response */
+#define UDS_P2_MS					(50UL)
+#define UDS_P2_STAR_MS				(5000UL)
+#define UDS_S3_MS					(5000UL)
+/* the NRC 0x78 goes out this long before P2 or P2* is over */
+#define UDS_PENDING_MARGIN_MS		(10UL)
+#define UDS_P2_STAR_RESEND_MS		(UDS_P2_STAR_MS * 8UL / 10UL)
+/* wrong keys in a row before SecurityAccess is locked for the delay */
+#define UDS_SECURITY_ATTEMPTS		(3UL)
+#define UDS_SECURITY_DELAY_MS		(10000UL)
+#define UDS_SECURITY_LEVELS			(7UL)
+#define UDS_SEED_MAX				(16UL)
+
+/* TransferData N_PCI-free header: SID and blockSequenceCounter */
+#define UDS_TRANSFER_HEAD			(2UL)
+
+struct uds_server_t;
+
+/*
+ * handle a request, req[0] is the SID, a sub-function comes without the
+ * suppress bit. The handler writes the response after the positive SID to
+ * resp, up to *resp_len bytes, and sets *resp_len to what it wrote.
+ * Returns UDS_NRC_OK, an NRC, or UDS_NRC_PENDING to be called again; resp
+ * is kept between those calls, the NRC 0x78 is sent from elsewhere.
+ */
+typedef uint8_t (*uds_handler)(struct uds_server_t* /*server*/, const uint8_t* /*req*/, uint32_t /*len*/,
+							uint8_t* /*resp*/, uint32_t* /*resp_len*/);
+
+struct uds_service_t
+{
+	uint8_t sid;
+	uint8_t min_len;		/* shortest request with the SID, NRC 0x13 below */
+	uint8_t sessions;		/* UDS_SESSION_BIT() of the sessions it runs in */
+	uint8_t security;		/* (1 << level) of the levels it runs at, 0 when locked too */
+	Bool subfunction;		/* req[1] is a sub-function with the suppress bit */
+	uds_handler handler;
+};
+
+/*
+ * SecurityAccess of the application: seed writes up to *len bytes of the
+ * seed of level and sets *len, key checks the key of the seed sent last.
+ * Both return UDS_NRC_OK or an NRC.
+ */
+struct uds_security_t
+{
+	uint8_t (*seed)(struct uds_server_t* /*server*/, uint8_t /*level*/, uint8_t* /*seed*/, uint32_t* /*len*/);
+	uint8_t (*key)(struct uds_server_t* /*server*/, uint8_t /*level*/, const uint8_t* /*key*/, uint32_t /*len*/);
+};
+
+/*
+ * Memory of the application for the download services.
+ * start checks and prepares address/size, erasing for example, finish
+ * checks what was written against the transferRequestParameterRecord of
+ * the RequestTransferExit, a checksum for example; both return UDS_NRC_OK,
+ * an NRC or UDS_NRC_PENDING to be called again. write stores len bytes at offset
+ * from the start address as they are received, STATUS_NORMAL or the
+ * block fails with NRC 0x72.
+ */
+struct uds_download_t
+{
+	uint8_t (*start)(struct uds_server_t* /*server*/, uint32_t /*address*/, uint32_t /*size*/);
+	ERROR_CODE (*write)(struct uds_server_t* /*server*/, uint32_t /*offset*/, const uint8_t* /*data*/, uint32_t /*len*/);
+	uint8_t (*finish)(struct uds_server_t* /*server*/, const uint8_t* /*record*/, uint32_t /*len*/);
+};
+
+struct uds_server_t
+{
+	struct isotp_t channel;		/* first, the ISO-TP callbacks find the server by it */
+	const struct uds_service_t *service;
+	uint8_t route[256];			/* index + 1 in service by SID, 0 for none */
+	/* request and response, storage lent by the application */
+	uint8_t *req;
+	uint32_t req_size;
+	uint32_t req_len;
+	Bool req_ready;				/* a request waits for uds_poll() */
+	Bool req_overflow;			/* longer than req_size */
+	Bool req_busy;				/* came while a handler is pending, dropped */
+	uint8_t *resp;
+	uint32_t resp_size;
+	uint32_t resp_len;
+	uint8_t nrc_resp[3];		/* negative responses, resp is left to the handler */
+	uint8_t *resp_data;			/* resp or nrc_resp, what resp_len counts */
+	Bool resp_ready;			/* a response waits for the channel */
+	/* a handler that returned UDS_NRC_PENDING */
+	const struct uds_service_t *pending;
+	Bool suppress;				/* suppressPosRspMsgIndicationBit of the request */
+	Bool pending_sent;			/* the NRC 0x78 went out at least once */
+	struct timer_t P2;			/* since the request or the last NRC 0x78 */
+	/* session and security */
+	uint8_t session;
+	uint8_t level;				/* unlocked security level, 0 when locked */
+	uint8_t seed_level;			/* level of the seed sent last, 0 for none */
+	uint8_t attempts;			/* wrong keys in a row */
+	struct timer_t S3;
+	struct timer_t delay;		/* SecurityAccess locked after too many wrong keys */
+	const struct uds_security_t *security;
+	/* download */
+	const struct uds_download_t *download;
+	Bool downloading;
+	uint32_t address;
+	uint32_t size;
+	uint32_t offset;			/* bytes written in the blocks acknowledged */
+	uint8_t bsc;				/* blockSequenceCounter expected next */
+	uint32_t max_block;			/* maxNumberOfBlockLength of the RequestDownload response */
+	Bool stream;				/* the TransferData being received goes to write */
+	uint32_t stream_len;		/* bytes of it written */
+	uint8_t stream_nrc;			/* NRC of a failed write */
+	/* counters */
+	uint32_t requests;
+	uint32_t negative;			/* NRC sent, without 0x78 */
+	uint32_t pending_count;		/* NRC 0x78 sent */
+	uint32_t dropped;			/* requests that came while one was pending */
+	void *arg;					/* for the application */
+};
+
+ERROR_CODE uds_init(struct uds_server_t *server,
+							const struct uds_service_t *service,
+							uint8_t count,
+							uint8_t *req,
+							uint32_t req_size,
+							uint8_t *resp,
+							uint32_t resp_size);
+ERROR_CODE uds_security_set(struct uds_server_t *server, const struct uds_security_t *security);
+ERROR_CODE uds_download_set(struct uds_server_t *server, const struct uds_download_t *download, uint32_t max_block);
+void uds_session_set(struct uds_server_t *server, uint8_t session);
+uint32_t uds_poll(struct uds_server_t *server);
+
+/* handlers of the services the server implements, see the top of the file */
+uint8_t uds_session_control(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+uint8_t uds_security_access(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+uint8_t uds_tester_present(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+uint8_t uds_request_download(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+uint8_t uds_transfer_data(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+uint8_t uds_transfer_exit(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len);
+
+#endif /* __UDS_H__ */
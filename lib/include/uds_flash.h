@@ -0,0 +1,105 @@
+#ifndef __UDS_FLASH_H__
+#define __UDS_FLASH_H__
+
+#include "uds.h"
+
+/*
+ * Download engine of the tester, the client side of
+ * RequestDownload/TransferData/RequestTransferExit.
+ * The image stays where the application has it, mapped from a file for
+ * example. Each TransferData is sent from two pieces, the SID with the
+ * blockSequenceCounter and the data in the image, so no block is copied.
+ * Two blocks are kept: while one is on the bus the next one is prepared,
+ * and its part of the CRC-32 of the image is computed, which also brings
+ * the pages of a mapped file in before the channel reads them. The
+ * RequestTransferExit carries the CRC-32 as its
+ * transferRequestParameterRecord, so it goes out as soon as the last block
+ * is acknowledged.
+ *
+ *	isotp_init(&flash.channel, ECU_ID, TESTER_ID, NULL, phy_send, phy_receive);
+ *	uds_flash_init(&flash, response, sizeof(response), 0xFFFF);
+ *	uds_flash_start(&flash, image, size, address);
+ *	while(flash.state != UDS_FLASH_DONE && flash.state != UDS_FLASH_FAILED)
+ *	{
+ *		wait = uds_flash_poll(&flash);
+ *		if(xQueueReceive(queue, &frame, wait == ISOTP_WAIT_FOREVER ? portMAX_DELAY : pdMS_TO_TICKS(wait)) == pdPASS)
+ *		{
+ *			isotp_on_frame(&flash.channel, &frame);
+ *		}
+ *	}
+ *
+ * The blocks are as long as the maxNumberOfBlockLength of the server
+ * allows, up to the limit given to uds_flash_init(); beyond ISOTP_FF_DL
+ * they go with the escape FirstFrame. A block without response within
+ * UDS_FLASH_P2_MS after its last frame is sent again with the same
+ * counter, the server acknowledges it without writing it twice.
+ * The channel is the application's otherwise: FC, TX_DL, a tx ring and the
+ * batch send set on it are used as they are.
+ */
+/* P2 client: P2 of the server and the latency of the bus */
+#define UDS_FLASH_P2_MS			(150UL)
+/* a block is sent this many times more before the download fails */
+#define UDS_FLASH_RETRIES		(2UL)
+/* RequestDownload with 4 bytes of address and size */
+#define UDS_FLASH_REQ_LEN		(11UL)
+#define UDS_FLASH_CRC_INIT		(0xFFFFFFFFUL)
+
+enum uds_flash_state_e
+{
+	UDS_FLASH_IDLE = 0UL,
+	UDS_FLASH_REQUEST,		/* RequestDownload sent */
+	UDS_FLASH_TRANSFER,		/* TransferData sent */
+	UDS_FLASH_EXIT,			/* RequestTransferExit sent */
+	UDS_FLASH_DONE,
+	UDS_FLASH_FAILED,		/* nrc and channel tx.reply tell why */
+};
+
+struct uds_flash_block_t
+{
+	uint8_t head[UDS_TRANSFER_HEAD];	/* SID and blockSequenceCounter */
+	struct isotp_iovec iov[2];			/* head, then the data in the image */
+	uint32_t offset;					/* of the data in the image */
+	uint32_t len;						/* bytes of data */
+	Bool ready;
+};
+
+struct uds_flash_t
+{
+	struct isotp_t channel;		/* first, the ISO-TP callbacks find the engine by it */
+	const uint8_t *image;		/* lent by the application until the end */
+	uint32_t size;
+	uint32_t address;
+	uint32_t limit;				/* longest message sent, see uds_flash_init() */
+	uint32_t block_len;			/* bytes of data in a block */
+	enum uds_flash_state_e state;
+	struct uds_flash_block_t block[2];
+	uint8_t current;			/* block on the bus */
+	uint8_t bsc;				/* blockSequenceCounter of the next block prepared */
+	uint32_t prepared;			/* bytes of the image in the blocks prepared */
+	uint32_t acked;				/* bytes of the image acknowledged */
+	uint32_t crc;				/* CRC-32 of the bytes prepared, not inverted yet */
+	uint8_t req[UDS_FLASH_REQ_LEN];	/* RequestDownload and RequestTransferExit */
+	struct isotp_iovec req_iov;
+	uint8_t *resp;				/* storage lent by the application */
+	uint32_t resp_size;
+	volatile Bool response;		/* a response is in resp */
+	volatile Bool sent;			/* the request went out, result in channel tx.reply */
+	struct timer_t P2;			/* from the end of the request or the last NRC 0x78 */
+	uint32_t P2_ms;
+	uint8_t retries;			/* of the block on the bus */
+	uint8_t nrc;				/* of the failure, 0 after a timeout */
+	/* results */
+	uint32_t blocks;
+	uint32_t repeated;			/* blocks sent again */
+	uint32_t pending;			/* NRC 0x78 received */
+	uint32_t start_us;
+	uint32_t end_us;
+};
+
+ERROR_CODE uds_flash_init(struct uds_flash_t *flash, uint8_t *resp, uint32_t resp_size, uint32_t limit);
+ERROR_CODE uds_flash_start(struct uds_flash_t *flash, const uint8_t *image, uint32_t size, uint32_t address);
+uint32_t uds_flash_poll(struct uds_flash_t *flash);
+uint32_t uds_flash_rate(const struct uds_flash_t *flash);
+uint32_t uds_flash_crc32(uint32_t crc, const uint8_t *data, uint32_t len);
+
+#endif /* __UDS_FLASH_H__ */
@@ -0,0 +1,115 @@
+#ifndef __VCAN_H__
+#define __VCAN_H__
+
+#include "isotp.h"
+
+/*
+ * In-process virtual CAN bus
+ * Nodes queue frames in their TX FIFO, the bus sends them one at a time in
+ * CAN ID order (the lowest ID wins arbitration among the frames waiting when
+ * the bus becomes free), takes the time a frame needs at the configured
+ * bitrate, and copies every frame into the RX FIFO of all other nodes whose
+ * acceptance filter matches. A full RX FIFO loses the frame for that node.
+ *
+ * The bus is driven by vcan_bus_run(), which moves the frames due up to the
+ * current time of timer_us() and returns the microseconds until the frame on
+ * the wire ends. One task runs it:
+ *
+ *	for(;;)
+ *	{
+ *		wait = vcan_bus_run(&bus);
+ *		sleep for wait, or until kick_cb when the bus is idle
+ *	}
+ *
+ * Each FIFO has a single producer and a single consumer, so nodes send and
+ * receive from their own task without locking. FIFO sizes are a power of
+ * two.
+ */
+
+/* frames longer than 8 bytes use the data bitrate of CAN FD */
+#define VCAN_BITRATE_DEFAULT		(500000UL)
+#define VCAN_DATA_BITRATE_DEFAULT	(2000000UL)
+
+/* returned by vcan_bus_run() when no frame is waiting */
+#define VCAN_IDLE			TIMER_FOREVER
+
+/* injected faults, rates in frames per million */
+enum vcan_fault_e
+{
+	VCAN_FAULT_DROP = 0UL,	/* nobody receives the frame, it still takes the bus time */
+	VCAN_FAULT_CORRUPT,		/* one data bit flipped, as if the CRC missed it */
+	VCAN_FAULT_REORDER,		/* the frame is delivered after the next one */
+	VCAN_FAULT_NUM
+};
+
+struct vcan_frame_t
+{
+	struct phy_msg_t msg;
+	uint32_t time_us;		/* when it was queued for sending */
+};
+
+struct vcan_fifo_t
+{
+	struct vcan_frame_t *frame;	/* storage lent by the application */
+	uint16_t mask;				/* frames in the FIFO - 1 */
+	volatile uint32_t head;		/* written by the producer */
+	volatile uint32_t tail;		/* written by the consumer */
+	uint32_t overflow;			/* frames lost because the FIFO was full */
+};
+
+struct vcan_bus_t;
+
+struct vcan_node_t
+{
+	struct vcan_fifo_t tx;
+	struct vcan_fifo_t rx;
+	uint32_t filter_id;		/* frames with (id & filter_mask) == filter_id are received */
+	uint32_t filter_mask;
+	uint32_t tx_frames;
+	uint32_t rx_frames;
+	struct vcan_bus_t *bus;
+	void (*rx_cb)(struct vcan_node_t* /*node*/);	/* frames were added to rx, may be NULL */
+	void *arg;				/* free for the application */
+};
+
+struct vcan_bus_t
+{
+	struct vcan_node_t **node;	/* table lent by the application */
+	uint8_t size;
+	uint8_t count;
+	uint32_t bitrate;
+	uint32_t data_bitrate;
+	uint32_t fault_ppm[VCAN_FAULT_NUM];
+	uint32_t seed;				/* of the fault injection */
+	void (*kick_cb)(struct vcan_bus_t* /*bus*/);	/* a node queued a frame, may be NULL */
+	struct vcan_frame_t wire;	/* the frame being sent */
+	struct vcan_node_t *sender;	/* node of wire, NULL when the bus is free */
+	struct vcan_frame_t held;	/* frame held back by VCAN_FAULT_REORDER */
+	struct vcan_node_t *held_sender;
+	uint32_t time_us;			/* end of the last frame that took the bus */
+	/* statistics since vcan_stats_reset() */
+	uint32_t start_us;
+	uint32_t busy_us;
+	uint32_t frames;
+	uint32_t faults[VCAN_FAULT_NUM];
+};
+
+ERROR_CODE vcan_bus_init(struct vcan_bus_t *bus,
+							struct vcan_node_t **node,
+							uint8_t size,
+							uint32_t bitrate,
+							uint32_t data_bitrate);
+ERROR_CODE vcan_node_init(struct vcan_node_t *node,
+							struct vcan_frame_t *tx, uint16_t tx_size,
+							struct vcan_frame_t *rx, uint16_t rx_size);
+ERROR_CODE vcan_attach(struct vcan_bus_t *bus, struct vcan_node_t *node);
+ERROR_CODE vcan_filter_set(struct vcan_node_t *node, uint32_t id, uint32_t mask);
+ERROR_CODE vcan_fault_set(struct vcan_bus_t *bus, enum vcan_fault_e fault, uint32_t ppm);
+ERROR_CODE vcan_send(struct vcan_node_t *node, const struct phy_msg_t *msg);
+ERROR_CODE vcan_receive(struct vcan_node_t *node, struct phy_msg_t *msg);
+uint32_t vcan_bus_run(struct vcan_bus_t *bus);
+uint32_t vcan_frame_time(struct vcan_bus_t *bus, const struct phy_msg_t *msg);
+uint32_t vcan_bus_load(struct vcan_bus_t *bus);
+void vcan_stats_reset(struct vcan_bus_t *bus);
+
+#endif /* __VCAN_H__ */
@@ -1,4 +1,7 @@
 #include "isotp.h"
+#include "isotp_capture.h"
+#include "isotp_pool.h"
+#include "isotp_stats.h"
 #include <string.h>
 #include <stdio.h>
 
@@ -38,6 +41,20 @@ enum n_pci_type_e
  */
 #define N_CR_TIMEOUT	1000UL
 
+/*
+ * N_As/N_Ar timeout
+ * Time for the transmission of
+ * a frame by the data link layer,
+ * on the sender/receiver side
+ */
+#define N_A_TIMEOUT		1000UL
+
+/*
+ * isotp_poll() works in milliseconds, the part of a separation time
+ * shorter than this is waited out when the next CF is sent
+ */
+#define ISOTP_PACING_US		1000UL
+
 /*
  * 0x00 BlockSize (BS)
  * The BS parameter value 0 shall be used to indicate to the sender that no more FC frames shall be sent
@@ -57,24 +74,67 @@ enum n_pci_type_e
  */
 #define UNUSED_PADDING_VALUE	0xFF
 
+/*
+ * ISO-15765-2:2016-10.4.2.2
+ * CAN FD frames longer than 8 bytes are always padded up to the next valid
+ * data length, with 0xCC when no padding value is configured above.
+ */
+#ifdef UNUSED_PADDING_VALUE
+#define CANFD_PADDING_VALUE		UNUSED_PADDING_VALUE
+#else
+#define CANFD_PADDING_VALUE		0xCC
+#endif
+
 /* Timeout values */
 #define TIMEOUT_SESSION		(500UL) /* Timeout between successfull send and isotp_receive */
 #define TIMEOUT_FC			(250UL) /* Timeout between FF and FC or Block CF and FC */
 #define TIMEOUT_CF			(250UL) /* Timeout between CFs                          */
-#define MAX_FCWAIT_FRAME	(10UL)
+#define MAX_FCWAIT_FRAME	(10UL) /* FC.WAIT in a row, N_WFTmax                   */
+#define TIMEOUT_FC_WAIT		(20UL) /* Time between a FC.WAIT and the next FC       */
 
-static void send_init(struct isotp_t* msg);
-static ERROR_CODE send_fc(struct isotp_t* msg);
+static void ctx_init(struct isotp_ctx_t *ctx);
+static void tx_init(struct isotp_t* msg);
+static ERROR_CODE send_fc(struct isotp_t* msg, enum ISOTP_FS_e FS);
+static ERROR_CODE fc_next(struct isotp_t* msg);
 static ERROR_CODE send_sf(struct isotp_t* msg);
 static ERROR_CODE send_ff(struct isotp_t* msg);
 static ERROR_CODE send_cf(struct isotp_t* msg);
+static ERROR_CODE cf_build(struct isotp_t* msg, struct phy_msg_t *frame);
+static void cf_prebuild(struct isotp_t* msg);
+static ERROR_CODE send_cf_block(struct isotp_t* msg);
 static ERROR_CODE rcv_sf(struct isotp_t* msg);
 static ERROR_CODE rcv_ff(struct isotp_t* msg);
 static ERROR_CODE rcv_cf(struct isotp_t* msg);
 static ERROR_CODE rcv_fc(struct isotp_t* msg);
-static void fc_delay(uint8_t STmin);
-static ERROR_CODE send_port(struct isotp_msg_t *msg);
-static ERROR_CODE receive_port(struct isotp_msg_t *msg);
+static void tx_done(struct isotp_t* msg, enum N_Result result);
+static void rx_done(struct isotp_t* msg, enum N_Result result);
+static Bool rx_fits(struct isotp_t* msg, uint32_t DL);
+static Bool tx_busy(struct isotp_t* msg);
+static Bool rx_busy(struct isotp_t* msg);
+static void ctx_iov_set(struct isotp_ctx_t *ctx, const struct isotp_iovec *iov, uint8_t iovcnt);
+static void duplex_update(struct isotp_t* msg);
+static uint32_t stmin_us(uint8_t STmin);
+static enum N_Result send_result(ERROR_CODE err);
+static void wait_event(struct isotp_t* msg);
+static uint8_t can_dl(uint8_t len);
+static uint16_t sf_max(struct isotp_t* msg);
+static uint8_t tx_space(struct isotp_t* msg);
+static uint8_t ff_pci_len(uint32_t DL);
+static uint8_t *iov_seek(struct isotp_ctx_t *ctx, uint32_t *avail);
+static ERROR_CODE iov_copy(struct isotp_ctx_t *ctx, uint8_t *data, uint16_t len, Bool tx);
+static ERROR_CODE data_get(struct isotp_t* msg, uint8_t *data, uint16_t len);
+static ERROR_CODE data_put(struct isotp_t* msg, const uint8_t *data, uint16_t len);
+static ERROR_CODE send_port(struct isotp_msg_t *msg, uint8_t len);
+static void frame_finish(struct isotp_msg_t *msg, struct phy_msg_t *frame, uint8_t len);
+static ERROR_CODE frame_send(struct isotp_msg_t *msg, struct phy_msg_t *frame);
+static ERROR_CODE frames_send(struct isotp_msg_t *msg, struct phy_msg_t *frame, uint32_t count, uint32_t *done);
+static ERROR_CODE send_cf_burst(struct isotp_t* msg, uint32_t *sent);
+static ERROR_CODE check_frame(struct isotp_msg_t *msg);
+static void stats_fc(struct isotp_stats_t *stats, enum ISOTP_FS_e FS);
+static void stats_tx_cf(struct isotp_stats_t *stats);
+static void stats_rx_cf(struct isotp_stats_t *stats);
+static void stats_tx_done(struct isotp_stats_t *stats, enum N_Result result, uint32_t DL);
+static void stats_rx_done(struct isotp_stats_t *stats, enum N_Result result, uint32_t DL);
 
 /*
  * initialize a message in tp layer
@@ -104,38 +164,67 @@ ERROR_CODE isotp_init(struct isotp_t *msg,
 	}
 	else
 	{
-		send_init(msg);
-		msg->tp_state = ISOTP_IDLE;
-		msg->DL = 0UL;			/* data length */
+		tx_init(msg);
+		ctx_init(&msg->rx);
+		xtimer_delete(&msg->N_Cr);
+		msg->tx.state = ISOTP_IDLE;
+		msg->rx.state = ISOTP_IDLE;
+		msg->tx.DL = 0UL;		/* data length */
+		msg->rx.DL = 0UL;
+		msg->FS = ISOTP_FS_CTS; /* Flow control status */
+		msg->BS = FC_DEFAULT_BS;		/* block size, setting value */
+		msg->STmin = 0UL;
+		msg->isotp.phy_rx.new_data = FALSE;
 		msg->isotp.N_TA = ta;
 		msg->isotp.N_SA = sa;
+		msg->isotp.N_FA = ISOTP_NO_ID;
 		msg->isotp.phy_send = send;
 		msg->isotp.phy_receive = receive;
+		msg->isotp.phy_send_batch = NULL;
+		msg->isotp.capture = NULL;
+		msg->isotp.stats = NULL;
 		msg->fs_set_cb = fs_set_cb;
+		msg->fc_policy = NULL;
+		msg->fc_probe = NULL;
+		msg->rx_done_cb = NULL;
+		msg->tx_done_cb = NULL;
+		msg->sink = NULL;
+		msg->source = NULL;
+		msg->pool = NULL;
+		msg->pool_ctx = NULL;
+		msg->tx_ring = NULL;
+		msg->tx_ring_size = 0UL;
+		isotp_iov_set(msg, NULL, 0UL);
+		msg->TX_DL = CAN_MAX_DL;
+		msg->RX_DL = CAN_MAX_DL;
+		isotp_addr_set(msg, ISOTP_ADDR_NORMAL, 0UL, 0UL);
 	}
 
 	return err;
 }
 
-static void send_init(struct isotp_t* msg)
+/*
+ * Reset the progress of one direction, its buffer and DL are kept
+ */
+static void ctx_init(struct isotp_ctx_t *ctx)
 {
-	msg->SN = ISOTP_DEFAULT_SN; 	/* consecutive frame serial number */
-	msg->FS = ISOTP_FS_CTS; /* Flow control status */
-	msg->BS = FC_DEFAULT_BS;		/* block size, setting value */
-	msg->BS_Counter = FC_DEFAULT_BS;	/* block size, setting value */
-	msg->STmin = 0UL;
-	msg->rest = 0UL;		/* mutilate frame remaining part */
-	if(msg->DL > ISOTP_FF_DL)
-	{
-		msg->DL = ISOTP_FF_DL;
-	}
-	else
-	{}
+	ctx->SN = ISOTP_DEFAULT_SN; 	/* consecutive frame serial number */
+	ctx->BS = FC_DEFAULT_BS;		/* block size, setting value */
+	ctx->BS_Counter = FC_DEFAULT_BS;
+	ctx->STmin = 0UL;
+	ctx->wait_count = 0UL;
+	ctx->rest = 0UL;		/* mutilate frame remaining part */
+	ctx->buffer_index = 0UL;
+	ctx->reply = N_OK;
+}
+
+static void tx_init(struct isotp_t* msg)
+{
+	ctx_init(&msg->tx);
+	msg->tx_ring_head = 0UL;
+	msg->tx_ring_count = 0UL;
 	xtimer_delete(&msg->N_Bs);
-	xtimer_delete(&msg->N_Cr);
-	msg->buffer_index = 0UL;
-	msg->reply = N_OK;
-	msg->isotp.phy_rx.new_data = FALSE;
+	xtimer_delete(&msg->N_Cs);
 }
 
 ERROR_CODE fc_set(struct isotp_t *msg, enum ISOTP_FS_e FS, uint8_t BS, uint8_t STmin)
@@ -157,470 +246,1820 @@ ERROR_CODE fc_set(struct isotp_t *msg, enum ISOTP_FS_e FS, uint8_t BS, uint8_t S
 	return err;
 }
 
-static ERROR_CODE send_port(struct isotp_msg_t *msg)
-{
-	msg->phy_tx.new_data = TRUE;
-	msg->phy_tx.id = msg->N_TA;
-	msg->phy_tx.length = 8UL;
-	return msg->phy_send(&msg->phy_tx);
-}
-
-static ERROR_CODE receive_port(struct isotp_msg_t *msg)
+/*
+ * set the data length of the frames sent by the channel
+ *
+ * @parameter in:
+ * msg:       object
+ * TX_DL:     8 for classical CAN, 12/16/20/24/32/48/64 for CAN FD
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_dl_set(struct isotp_t *msg, uint8_t TX_DL)
 {
-	ERROR_CODE err = ERR_EMPTY;
+	ERROR_CODE err = STATUS_NORMAL;
 
-	for(;;)
+	if(msg == NULL)
 	{
-		err = msg->phy_receive(&msg->phy_rx);
-		if(err != STATUS_NORMAL)
-		{
-			break;
-		}
-		if(msg->phy_rx.id != msg->N_SA)
-		{
-			err = ERR_NOT_FOUND;
-			break;
-		}
-		if(msg->phy_rx.length == 0)
-		{
-			err = ERR_EMPTY;
-			break;
-		}
-		if(msg->phy_rx.length > 8UL)
-		{
-			msg->phy_rx.length = 8UL;
-		}
-		err = STATUS_NORMAL;
-		break;
+		err = ERR_POINTER_0;
 	}
-	
+	else if(TX_DL < CAN_MAX_DL || TX_DL > CANFD_MAX_DL || can_dl(TX_DL) != TX_DL)
+	{
+		err = ERR_PARAMETER;
+	}
+	else
+	{
+		msg->TX_DL = TX_DL;
+	}
+
 	return err;
 }
 
 /*
- * Send a Flow Control Frame
+ * set the addressing format of the channel
+ *
+ * @parameter in:
+ * msg:       object
+ * mode:      normal, extended or mixed addressing
+ * tx_ae:     first data byte of the frames sent, N_TA of the remote
+ *            with extended addressing, N_AE with mixed addressing
+ * rx_ae:     first data byte of the frames received, N_TA of this
+ *            channel with extended addressing, N_AE with mixed addressing
+ * @parameter out:
+ * operation status return
  */
-static ERROR_CODE send_fc(struct isotp_t *msg)
+ERROR_CODE isotp_addr_set(struct isotp_t *msg, enum isotp_addr_e mode, uint8_t tx_ae, uint8_t rx_ae)
 {
-	uint8_t *data = msg->isotp.phy_tx.data;
+	ERROR_CODE err = STATUS_NORMAL;
 
-	if(msg->FS == ISOTP_FS_CTS)
+	if(msg == NULL)
 	{
-		timer_add(&msg->N_Cr);
+		err = ERR_POINTER_0;
 	}
-	else
+	else if(mode != ISOTP_ADDR_NORMAL && mode != ISOTP_ADDR_EXTENDED && mode != ISOTP_ADDR_MIXED)
 	{
-		xtimer_delete(&msg->N_Cr);
+		err = ERR_PARAMETER;
 	}
-#ifdef UNUSED_PADDING_VALUE
-	memset(data, UNUSED_PADDING_VALUE, 8UL);
-#endif
-	/* FC message high nibble = 0x3 , low nibble = FC Status */
-	data[0] = (N_PCI_FC | msg->FS);
-	data[1] = msg->BS;
-	/* fix wrong separation time values according spec */
-	if ((msg->STmin > 0x7F) && 
-		((msg->STmin < 0xF1) || (msg->STmin > 0xF9))) 
+	else
 	{
-		msg->STmin = ISOTP_DEFAULT_STmin;
+		msg->isotp.addr_mode = mode;
+		msg->isotp.addr_len = (mode == ISOTP_ADDR_NORMAL) ? 0UL : 1UL;
+		msg->isotp.tx_ae = tx_ae;
+		msg->isotp.rx_ae = rx_ae;
 	}
-	data[2] = msg->STmin;
 
-	return send_port(&msg->isotp);
+	return err;
 }
 
 /*
- * Send SF Message
+ * round a payload length up to the next length a CAN FD frame can have
  */
-static ERROR_CODE send_sf(struct isotp_t *msg)
+static uint8_t can_dl(uint8_t len)
 {
-	uint8_t *data = msg->isotp.phy_tx.data;
+	static const uint8_t dl_table[] = {12, 16, 20, 24, 32, 48, 64};
+	uint8_t i;
 
-#ifdef UNUSED_PADDING_VALUE
-	memset(data, UNUSED_PADDING_VALUE, 8UL);
-#endif
-
-	/* SF message high nibble = 0x0 , low nibble = Length */
-	data[0] = (N_PCI_SF | msg->DL);
-	memcpy(data + 1UL, msg->Buffer + msg->buffer_index, msg->DL);
+	if(len <= CAN_MAX_DL)
+	{
+		return len;
+	}
+	for(i = 0; i < sizeof(dl_table) - 1UL; i ++)
+	{
+		if(len <= dl_table[i])
+		{
+			break;
+		}
+	}
 
-	return send_port(&msg->isotp);
+	return dl_table[i];
 }
 
 /*
- * Send a First Frame
+ * the largest message sent in a SingleFrame, the escape sequence
+ * takes one byte more than the classical SF_DL
  */
-static ERROR_CODE send_ff(struct isotp_t *msg) 
+static uint16_t sf_max(struct isotp_t* msg)
 {
-	uint8_t *data = msg->isotp.phy_tx.data;
+	return ((msg->TX_DL == CAN_MAX_DL) ? 7UL : msg->TX_DL - 2UL) - msg->isotp.addr_len;
+}
 
-#ifdef UNUSED_PADDING_VALUE
-	memset(data, UNUSED_PADDING_VALUE, 8UL);
-#endif
-	msg->buffer_index = 0UL;
-	msg->SN = ISOTP_DEFAULT_SN;
-	data[0] = N_PCI_FF | ((msg->DL >> 8UL) & 0x0F);
-	data[1] = (msg->DL & 0xFF);
-	/* Skip 2 Bytes PCI */
-	memcpy(data + 2UL, msg->Buffer + msg->buffer_index, 6UL);
-	/* First Frame has full length */
-	return send_port(&msg->isotp);
+/*
+ * bytes of a frame sent left for N_PCI and data after the address byte
+ */
+static uint8_t tx_space(struct isotp_t* msg)
+{
+	return msg->TX_DL - msg->isotp.addr_len;
 }
 
 /*
- * Send a Consecutive Frame
+ * lend a buffer to the channel, messages are received into it and sent
+ * from it without any copy in between. The buffer belongs to the channel
+ * until the transfer using it is finished. With one buffer for both
+ * directions the channel is half-duplex, see isotp_tx_buffer_set().
+ *
+ * @parameter in:
+ * msg:       object
+ * buffer:    the buffer, NULL to remove it
+ * size:      size of the buffer
+ * @parameter out:
+ * operation status return
  */
-static ERROR_CODE send_cf(struct isotp_t *msg)
+ERROR_CODE isotp_buffer_set(struct isotp_t *msg, uint8_t *buffer, uint32_t size)
 {
-	uint8_t *data = msg->isotp.phy_tx.data;
-	uint16_t len = 7UL;
+	ERROR_CODE err = isotp_tx_buffer_set(msg, buffer, size);
 
-#ifdef UNUSED_PADDING_VALUE
-	memset(data, UNUSED_PADDING_VALUE, 8UL);
-#endif
-	data[0] = (N_PCI_CF | (msg->SN & 0x0F));
-	if(msg->DL > 7UL) 
-	{
-		len = 7UL;
-	}
-	else
+	if(err == STATUS_NORMAL)
 	{
-		len = msg->DL;
+		err = isotp_rx_buffer_set(msg, buffer, size);
 	}
-	/* Skip 1 Byte PCI */
-	memcpy(data + 1, msg->Buffer + msg->buffer_index, len);
 
-	return send_port(&msg->isotp);
+	return err;
 }
 
-static void fc_delay(uint8_t STmin)
+/*
+ * lend a buffer to the channel for the messages it sends only,
+ * see isotp_buffer_set()
+ */
+ERROR_CODE isotp_tx_buffer_set(struct isotp_t *msg, uint8_t *buffer, uint32_t size)
 {
-	/* SeparationTime minimum (STmin) range: 0ms~127ms */
-	if(STmin <= 0x7F)
-	{
-		delay_1ms(STmin);
-	}
-	else if(STmin <= 0xF0)
+	if(msg == NULL)
 	{
-		delay_1ms(ISOTP_DEFAULT_STmin);
+		return ERR_POINTER_0;
 	}
-	else if(STmin <= 0xF9)
+	msg->tx.buffer.base = buffer;
+	msg->tx.buffer.len = (buffer != NULL) ? size : 0UL;
+
+	return isotp_tx_iov_set(msg, &msg->tx.buffer, 1UL);
+}
+
+/*
+ * lend a buffer to the channel for the messages it receives only,
+ * see isotp_buffer_set()
+ */
+ERROR_CODE isotp_rx_buffer_set(struct isotp_t *msg, uint8_t *buffer, uint32_t size)
+{
+	if(msg == NULL)
 	{
-		/* SeparationTime minimum (STmin) range: 100us~900us */
-		delay_100us(STmin - 0xF0);
+		return ERR_POINTER_0;
 	}
-	else
+	msg->rx.buffer.base = buffer;
+	msg->rx.buffer.len = (buffer != NULL) ? size : 0UL;
+
+	return isotp_rx_iov_set(msg, &msg->rx.buffer, 1UL);
+}
+
+/*
+ * lend a scatter-gather list to the channel, the pieces are used in order
+ * as one buffer. The list and the pieces belong to the channel until the
+ * transfer using them is finished.
+ *
+ * @parameter in:
+ * msg:       object
+ * iov:       the pieces, NULL to remove them
+ * iovcnt:    number of pieces
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_iov_set(struct isotp_t *msg, const struct isotp_iovec *iov, uint8_t iovcnt)
+{
+	ERROR_CODE err = isotp_tx_iov_set(msg, iov, iovcnt);
+
+	if(err == STATUS_NORMAL)
 	{
-		delay_1ms(ISOTP_DEFAULT_STmin);
+		err = isotp_rx_iov_set(msg, iov, iovcnt);
 	}
+
+	return err;
 }
 
 /*
- * Receive a Single Frame
+ * lend a scatter-gather list for the messages sent only, see isotp_iov_set()
  */
-static ERROR_CODE rcv_sf(struct isotp_t* msg)
+ERROR_CODE isotp_tx_iov_set(struct isotp_t *msg, const struct isotp_iovec *iov, uint8_t iovcnt)
 {
-	/* get the SF_DL from the N_PCI byte */
-	msg->DL = msg->isotp.phy_rx.data[0] & 0x0F;
-	msg->buffer_index = 0UL;
-	/* copy the received data bytes */
-	/* Skip PCI, SF uses len bytes */
-	memcpy(msg->Buffer + msg->buffer_index, msg->isotp.phy_rx.data + 1UL, msg->DL);
-	msg->tp_state = ISOTP_FINISHED;
+	if(msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	ctx_iov_set(&msg->tx, iov, iovcnt);
+	duplex_update(msg);
 
 	return STATUS_NORMAL;
 }
 
 /*
- * Receive a First Frame
+ * lend a scatter-gather list for the messages received only, see isotp_iov_set()
  */
-static ERROR_CODE rcv_ff(struct isotp_t* msg)
+ERROR_CODE isotp_rx_iov_set(struct isotp_t *msg, const struct isotp_iovec *iov, uint8_t iovcnt)
 {
-	ERROR_CODE err = STATUS_NORMAL;
-	uint8_t *data = msg->isotp.phy_rx.data;
+	if(msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	ctx_iov_set(&msg->rx, iov, iovcnt);
+	duplex_update(msg);
 
-	/* get the FF_DL */
-	msg->DL = (data[0] & 0x0F) << 8;
-	msg->DL += data[1];
-	if(msg->DL <= 6UL)
+	return STATUS_NORMAL;
+}
+
+static void ctx_iov_set(struct isotp_ctx_t *ctx, const struct isotp_iovec *iov, uint8_t iovcnt)
+{
+	uint8_t i;
+
+	if(iov == NULL)
 	{
-		err = ERR_PARAMETER;
+		iovcnt = 0UL;
 	}
-	else
+	ctx->iov = iov;
+	ctx->iovcnt = iovcnt;
+	ctx->iov_index = 0UL;
+	ctx->iov_offset = 0UL;
+	ctx->buffer_size = 0UL;
+	for(i = 0; i < iovcnt; i ++)
 	{
-		msg->SN = ISOTP_DEFAULT_SN;
-		msg->rest = msg->DL;
-		msg->buffer_index = 0UL;
-		/* 
-		 * copy the first received data bytes
-		 * Skip 2 bytes PCI, FF must have 6 bytes!
-		 */
-		memcpy(msg->Buffer + msg->buffer_index, data + 2UL, 6UL);
-		msg->buffer_index += 6UL;
-		msg->rest -= 6UL; /* Rest length */
-		msg->BS_Counter = msg->BS;
-		msg->tp_state = ISOTP_WAIT_DATA;
-		err = send_fc(msg);
+		ctx->buffer_size += iov[i].len;
 	}
-
-	return err;
 }
 
 /*
- * Receive a Consecutive Frame
+ * The two directions can run at the same time unless a message received
+ * would be written over the one being sent
  */
-static ERROR_CODE rcv_cf(struct isotp_t* msg)
+static void duplex_update(struct isotp_t* msg)
 {
-	ERROR_CODE err = STATUS_NORMAL;
-	uint8_t *data = msg->isotp.phy_rx.data;
+	uint8_t i, j;
+	const struct isotp_iovec *a, *b;
 
-	timer_refresh(&msg->N_Bs);
-	timer_refresh(&msg->N_Cr);
-	for(;;)
+	msg->duplex = TRUE;
+	if(msg->sink != NULL || msg->source != NULL)
 	{
-		if(timer_overflow(&msg->N_Bs, TIMEOUT_FC) && (msg->SN != ISOTP_DEFAULT_SN))
-		{
-			msg->tp_state = ISOTP_IDLE;
-			msg->SN = ISOTP_DEFAULT_SN;
-			msg->rest = 0UL;
-			msg->buffer_index = 0UL;
-			msg->reply = N_TIMEOUT_Bs;
-			err = ERR_TIMEOUT;
-			break;
-		}
-		if (msg->tp_state != ISOTP_WAIT_DATA) 
-		{
-			err = ERR_PARAMETER;
-			break;
-		}
-		if ((data[0] & 0x0F) != (msg->SN & 0x0F))
-		{
-			msg->tp_state = ISOTP_IDLE;
-			msg->SN = ISOTP_DEFAULT_SN;
-			msg->reply = N_WRONG_SN;
-			err = ERR_PARAMETER;
-			break;
-		}
-		
-		if(msg->rest < 7UL)
-		{
-			/* Last Frame */
-			memcpy(msg->Buffer + msg->buffer_index, data + 1UL, msg->rest);	/* 6 Bytes in FF + 7 */
-			msg->tp_state = ISOTP_FINISHED;	/* per CF skip PCI */
-			msg->rest = 0UL;
-		}
-		else
+		return;
+	}
+	for(i = 0; i < msg->tx.iovcnt; i ++)
+	{
+		for(j = 0; j < msg->rx.iovcnt; j ++)
 		{
-			memcpy(msg->Buffer + msg->buffer_index, data + 1UL, 7UL);	/* 6 Bytes in FF + 7 */
-			msg->rest -= 7UL; /* Got another 7 Bytes of Data; */
-			if(msg->BS != 0UL
-				&& (--msg->BS_Counter) == 0UL)
+			a = &msg->tx.iov[i];
+			b = &msg->rx.iov[j];
+			if(a->len != 0UL && b->len != 0UL
+				&& a->base < b->base + b->len && b->base < a->base + a->len)
 			{
-				if(msg->fs_set_cb != NULL)
-				{
-					msg->fs_set_cb(msg);
-				}
-				msg->BS_Counter = msg->BS;
-				err = send_fc(msg);
+				msg->duplex = FALSE;
+				return;
 			}
 		}
-		msg->buffer_index += 7UL;
-		msg->SN ++;
-		break;
 	}
-	
-	return err;
 }
 
 /*
- * Receive a Flow Control Frame
+ * stream the messages through callbacks instead of the lent buffer,
+ * then the message length is not limited by the buffer size
+ *
+ * @parameter in:
+ * msg:       object
+ * sink:      receives the data of incoming messages, NULL to use the buffer
+ * source:    provides the data of outgoing messages, NULL to use the buffer
+ * @parameter out:
+ * operation status return
  */
-static ERROR_CODE rcv_fc(struct isotp_t* msg)
+ERROR_CODE isotp_stream_set(struct isotp_t *msg, isotp_sink sink, isotp_source source)
 {
 	ERROR_CODE err = STATUS_NORMAL;
-	uint8_t *data = msg->isotp.phy_rx.data;
-	for(;;)
+
+	if(msg == NULL)
 	{
-		if (msg->tp_state != ISOTP_WAIT_FC 
-			&& msg->tp_state != ISOTP_WAIT_FIRST_FC)
-		{
-			err = ERR_PARAMETER;
-			break;
-		}
-		if(N_PCI_FC != (data[0] & 0xF0))
-		{
-			err = ERR_PARAMETER;
-			break;
-		}
-		/* get communication parameters only from the first FC frame */
-		if (msg->tp_state == ISOTP_WAIT_FIRST_FC)
-		{
-			msg->FS = (enum ISOTP_FS_e)(data[0] & 0x0F);
-			msg->BS = data[1];
-			msg->BS_Counter = msg->BS;
-			msg->STmin = data[2];
-			/* fix wrong separation time values according spec */
-			if ((msg->STmin > 0x7F) 
-				&& ((msg->STmin < 0xF1) || (msg->STmin > 0xF9))) 
-			{
-				msg->STmin = ISOTP_DEFAULT_STmin;
-			}
-		}
-		switch (msg->FS)
-		{
-			case ISOTP_FS_CTS:
-				msg->tp_state = ISOTP_SEND_CF;
-				xtimer_delete(&msg->N_Bs);
-				break;
-			case ISOTP_FS_WAIT:
-				timer_refresh(&msg->N_Bs);
-				break;
-			case ISOTP_FS_OVFLW:
-				err = ERR_FULL;
-				msg->reply = N_BUFFER_OVFLW;
-				break;
-			default:
-				msg->tp_state = ISOTP_IDLE;
-				err = ERR_PARAMETER;
-				msg->reply = N_INVALID_FS;
-				break;
-		}
-		break;
+		err = ERR_POINTER_0;
 	}
-	
+	else
+	{
+		msg->sink = sink;
+		msg->source = source;
+		duplex_update(msg);
+	}
+
 	return err;
 }
 
-enum N_Result isotp_send(struct isotp_t* msg)
+/*
+ * let a policy pick the FC of every block received, instead of the fixed
+ * values of fc_set(), which become the starting point of the policy
+ *
+ * @parameter in:
+ * msg:       object
+ * policy:    decides FS, BS and STmin, NULL to send the values of fc_set()
+ * probe:     adds the receive queue and CPU load to the state, may be NULL
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_fc_policy_set(struct isotp_t *msg, isotp_fc_policy policy, isotp_fc_probe probe)
 {
 	ERROR_CODE err = STATUS_NORMAL;
 
-	
-	if(msg->tp_state != ISOTP_IDLE)
+	if(msg == NULL)
 	{
-		err = N_ERROR;
+		err = ERR_POINTER_0;
 	}
 	else
 	{
-		msg->tp_state = ISOTP_SEND;
-		send_init(msg);
-		while(msg->tp_state != ISOTP_IDLE && msg->tp_state != ISOTP_ERROR)
-		{
-			switch(msg->tp_state)
-			{
-				case ISOTP_IDLE:
-					break;
-				case ISOTP_SEND:
-					if(msg->DL <= 7UL)
-					{
-						err = send_sf(msg);
-						msg->tp_state = ISOTP_IDLE;
-					}
-					else
-					{
-						err = send_ff(msg);
-						if(err == STATUS_NORMAL) // FF complete
-						{
-							timer_add(&msg->N_Bs);
-							msg->buffer_index += 6UL;
-							msg->DL -= 6UL;
-							msg->tp_state = ISOTP_WAIT_FIRST_FC;
-						}
-					}
-					break;
-				case ISOTP_WAIT_FIRST_FC:
-					if(timer_overflow(&msg->N_Bs, TIMEOUT_FC))
-					{
-						msg->tp_state = ISOTP_IDLE;
-						err = ERR_TIMEOUT;
-						xtimer_delete(&msg->N_Bs);
-					}
-					/* break; */
-				case ISOTP_WAIT_FC:
-					if(receive_port(&msg->isotp) == STATUS_NORMAL)
-					{
-						err = rcv_fc(msg);
-					}
-					break;
-				case ISOTP_SEND_CF:
-					while(msg->tp_state == ISOTP_SEND_CF)
-					{
-						fc_delay(msg->STmin);
-						err = send_cf(msg);
-						if(err == STATUS_NORMAL)
-						{
-							if(msg->BS > 0UL)
-							{
-								if((--msg->BS_Counter) == 0UL)
-								{
-									timer_add(&msg->N_Bs);
-									msg->BS_Counter = msg->BS;
-									msg->tp_state = ISOTP_WAIT_FC;
-								}
-							}
-							msg->SN ++;
-							if(msg->DL > 7UL)
-							{
-								msg->buffer_index += 7UL;
-								msg->DL -= 7UL;
-							}
-							else
-							{
-								msg->buffer_index += msg->DL;
-								msg->DL = 0UL;
-								msg->tp_state = ISOTP_IDLE;
-							}
-						}
-					}
-					break;
-				default:
-					err = ERR_PARAMETER;
-					break;
-			}
-		}
+		msg->fc_policy = policy;
+		msg->fc_probe = probe;
 	}
-	return msg->reply;
-}
 
-enum N_Result isotp_receive(struct isotp_t* msg)
+	return err;
+}
+
+/*
+ * lend a ring of frames to the sender. While it waits for a FC, or for
+ * STmin, the next CFs are built into it, and sent back to back when the
+ * FC arrives, so the gap between two blocks is the FC latency alone.
+ *
+ * @parameter in:
+ * msg:       object
+ * frame:     storage of the ring, NULL to build every CF when it is sent
+ * size:      frames in frame
+ * @parameter out:
+ * operation status return, ERR_FULL while a message is sent
+ */
+ERROR_CODE isotp_tx_ring_set(struct isotp_t *msg, struct phy_msg_t *frame, uint8_t size)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(msg == NULL)
+	{
+		err = ERR_POINTER_0;
+	}
+	else if(tx_busy(msg) == TRUE)
+	{
+		err = ERR_FULL;
+	}
+	else
+	{
+		msg->tx_ring = (size != 0UL) ? frame : NULL;
+		msg->tx_ring_size = (frame != NULL) ? size : 0UL;
+		msg->tx_ring_head = 0UL;
+		msg->tx_ring_count = 0UL;
+	}
+
+	return err;
+}
+
+/*
+ * send the CFs of a burst with one call to the data link layer
+ *
+ * @parameter in:
+ * msg:        object
+ * send_batch: vectored send function, NULL to call phy_send for each frame
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_send_batch_set(struct isotp_t *msg, isotp_transfer_batch send_batch)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(msg == NULL)
+	{
+		err = ERR_POINTER_0;
+	}
+	else
+	{
+		msg->isotp.phy_send_batch = send_batch;
+	}
+
+	return err;
+}
+
+/*
+ * length of the FF N_PCI, 6 bytes with the 32 bit FF_DL escape sequence
+ */
+static uint8_t ff_pci_len(uint32_t DL)
+{
+	return (DL > ISOTP_FF_DL) ? 6UL : 2UL;
+}
+
+/*
+ * Get the piece of the lent buffer holding the position iov_index/iov_offset
+ * and the number of bytes left in it
+ */
+static uint8_t *iov_seek(struct isotp_ctx_t *ctx, uint32_t *avail)
+{
+	while(ctx->iov_index < ctx->iovcnt
+		&& ctx->iov_offset >= ctx->iov[ctx->iov_index].len)
+	{
+		ctx->iov_offset -= ctx->iov[ctx->iov_index].len;
+		ctx->iov_index ++;
+	}
+	if(ctx->iov_index >= ctx->iovcnt)
+	{
+		*avail = 0UL;
+		return NULL;
+	}
+	*avail = ctx->iov[ctx->iov_index].len - ctx->iov_offset;
+
+	return ctx->iov[ctx->iov_index].base + ctx->iov_offset;
+}
+
+/*
+ * copy between a frame and the lent buffer at buffer_index, tx selects the
+ * direction. The message is transferred in order, so the position in the
+ * buffer is kept from the previous call and only reset for a new message.
+ * buffer_index itself is advanced by the caller.
+ */
+static ERROR_CODE iov_copy(struct isotp_ctx_t *ctx, uint8_t *data, uint16_t len, Bool tx)
+{
+	uint32_t avail, part;
+	uint8_t *piece;
+
+	if(ctx->buffer_index == 0UL)
+	{
+		ctx->iov_index = 0UL;
+		ctx->iov_offset = 0UL;
+	}
+	while(len > 0UL)
+	{
+		piece = iov_seek(ctx, &avail);
+		if(piece == NULL)
+		{
+			return ERR_FULL;
+		}
+		part = (len < avail) ? len : avail;
+		if(tx == TRUE)
+		{
+			memcpy(data, piece, part);
+		}
+		else
+		{
+			memcpy(piece, data, part);
+		}
+		data += part;
+		len -= part;
+		ctx->iov_offset += part;
+	}
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * fetch the next len bytes to send, at tx.buffer_index
+ */
+static ERROR_CODE data_get(struct isotp_t* msg, uint8_t *data, uint16_t len)
+{
+	if(msg->source != NULL)
+	{
+		return msg->source(msg, msg->tx.buffer_index, data, len);
+	}
+
+	return iov_copy(&msg->tx, data, len, TRUE);
+}
+
+/*
+ * store the next len bytes received, at rx.buffer_index
+ */
+static ERROR_CODE data_put(struct isotp_t* msg, const uint8_t *data, uint16_t len)
+{
+	if(msg->sink != NULL)
+	{
+		return msg->sink(msg, msg->rx.buffer_index, data, len);
+	}
+
+	return iov_copy(&msg->rx, (uint8_t *)data, len, FALSE);
+}
+
+/*
+ * set the callbacks reporting the end of a reception or transmission
+ *
+ * @parameter in:
+ * msg:        object
+ * rx_done_cb: called when a message has been received or the reception failed,
+ *             the message is in the lent buffer, the result in msg->rx.reply
+ * tx_done_cb: called when a transmission is finished, the result in msg->tx.reply
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_cb_set(struct isotp_t *msg,
+							ERROR_CODE (*rx_done_cb)(struct isotp_t* /*msg*/),
+							ERROR_CODE (*tx_done_cb)(struct isotp_t* /*msg*/))
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(msg == NULL)
+	{
+		err = ERR_POINTER_0;
+	}
+	else
+	{
+		msg->rx_done_cb = rx_done_cb;
+		msg->tx_done_cb = tx_done_cb;
+	}
+
+	return err;
+}
+
+/*
+ * send len bytes of N_PCI and data from phy_tx, after the address byte,
+ * padded to a valid frame length
+ */
+static ERROR_CODE send_port(struct isotp_msg_t *msg, uint8_t len)
+{
+	frame_finish(msg, &msg->phy_tx, len);
+
+	return frame_send(msg, &msg->phy_tx);
+}
+
+/*
+ * Complete a frame holding len bytes after the address byte: the address
+ * byte, the padding, the ID and the data length
+ */
+static void frame_finish(struct isotp_msg_t *msg, struct phy_msg_t *frame, uint8_t len)
+{
+	uint8_t dl;
+
+	if(msg->addr_len != 0UL)
+	{
+		frame->data[0] = msg->tx_ae;
+	}
+	len += msg->addr_len;
+	dl = can_dl(len);
+
+	if(dl <= CAN_MAX_DL)
+	{
+#ifdef UNUSED_PADDING_VALUE
+		dl = CAN_MAX_DL;
+		memset(frame->data + len, UNUSED_PADDING_VALUE, dl - len);
+#endif
+	}
+	else
+	{
+		memset(frame->data + len, CANFD_PADDING_VALUE, dl - len);
+	}
+	frame->new_data = TRUE;
+	frame->id = msg->N_TA;
+	frame->length = dl;
+}
+
+/*
+ * Hand a complete frame to the data link layer
+ */
+static ERROR_CODE frame_send(struct isotp_msg_t *msg, struct phy_msg_t *frame)
+{
+	ERROR_CODE err;
+	struct timer_t N_A;
+
+	/* N_As/N_Ar, the frame has to be on the bus in time */
+	timer_add_us(&N_A);
+	err = msg->phy_send(frame);
+	if(err == STATUS_NORMAL && msg->capture != NULL)
+	{
+		isotp_capture_put(msg->capture, frame);
+	}
+	if(err == STATUS_NORMAL && msg->stats != NULL)
+	{
+		msg->stats->tx_frames ++;
+	}
+	if(err == STATUS_NORMAL && timer_overflow(&N_A, N_A_TIMEOUT * 1000UL))
+	{
+		err = ERR_TIMEOUT;
+	}
+
+	return err;
+}
+
+/*
+ * Hand count complete frames to the data link layer, in one call of
+ * phy_send_batch or frame by frame. done is the number of frames taken,
+ * a driver with a full FIFO may take less than count.
+ */
+static ERROR_CODE frames_send(struct isotp_msg_t *msg, struct phy_msg_t *frame, uint32_t count, uint32_t *done)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	struct timer_t N_A;
+	uint32_t index;
+
+	*done = 0UL;
+	if(msg->phy_send_batch == NULL)
+	{
+		while(*done < count && err == STATUS_NORMAL)
+		{
+			err = frame_send(msg, &frame[*done]);
+			if(err == STATUS_NORMAL)
+			{
+				(*done) ++;
+			}
+		}
+		return err;
+	}
+	/* N_As/N_Ar, the whole burst has to be on the bus in time */
+	timer_add_us(&N_A);
+	err = msg->phy_send_batch(frame, count, done);
+	if(*done > count)
+	{
+		*done = count;
+	}
+	if(msg->capture != NULL)
+	{
+		for(index = 0; index < *done; index ++)
+		{
+			isotp_capture_put(msg->capture, &frame[index]);
+		}
+	}
+	if(msg->stats != NULL)
+	{
+		msg->stats->tx_frames += *done;
+	}
+	if(err == STATUS_NORMAL && timer_overflow(&N_A, N_A_TIMEOUT * 1000UL))
+	{
+		err = ERR_TIMEOUT;
+	}
+
+	return err;
+}
+
+/*
+ * Check that the frame in phy_rx belongs to this channel and is long enough
+ * for its N_PCI, so the receive functions index the frame without checks of
+ * their own: SF_DL, FF_DL and FS are read from the N_PCI, what they cover
+ * is checked where they are read
+ */
+static ERROR_CODE check_frame(struct isotp_msg_t *msg)
+{
+	/* bytes of N_PCI and data a frame takes at least, by N_PCI type */
+	static const uint8_t pci_min_len[] = {2, 2, 2, 3};
+	ERROR_CODE err = ERR_EMPTY;
+	uint8_t pci;
+
+	for(;;)
+	{
+		if(msg->phy_rx.id != msg->N_SA && msg->phy_rx.id != msg->N_FA)
+		{
+			err = ERR_NOT_FOUND;
+			break;
+		}
+		if(msg->phy_rx.length <= msg->addr_len)
+		{
+			err = ERR_EMPTY;
+			break;
+		}
+		if(msg->addr_len != 0UL && msg->phy_rx.data[0] != msg->rx_ae)
+		{
+			err = ERR_NOT_FOUND;
+			break;
+		}
+		if(msg->phy_rx.length > CANFD_MAX_DL)
+		{
+			msg->phy_rx.length = CANFD_MAX_DL;
+		}
+		/* a CAN FD frame has one of the lengths of its DLC */
+		if(can_dl(msg->phy_rx.length) != msg->phy_rx.length)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		pci = msg->phy_rx.data[msg->addr_len] >> 4;
+		if(pci >= sizeof(pci_min_len)
+			|| msg->phy_rx.length < msg->addr_len + pci_min_len[pci])
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		/* the functional ID carries SingleFrames only */
+		if(msg->phy_rx.id != msg->N_SA && pci != (N_PCI_SF >> 4))
+		{
+			err = ERR_NOT_FOUND;
+			break;
+		}
+		err = STATUS_NORMAL;
+		break;
+	}
+	
+	return err;
+}
+
+/*
+ * Send a Flow Control Frame
+ */
+static ERROR_CODE send_fc(struct isotp_t *msg, enum ISOTP_FS_e FS)
+{
+	uint8_t *data = msg->isotp.phy_tx.data + msg->isotp.addr_len;
+
+	if(FS == ISOTP_FS_CTS)
+	{
+		timer_add(&msg->N_Cr);
+	}
+	else
+	{
+		xtimer_delete(&msg->N_Cr);
+	}
+	/* FC message high nibble = 0x3 , low nibble = FC Status */
+	data[0] = (N_PCI_FC | FS);
+	data[1] = msg->rx.BS;
+	data[2] = msg->rx.STmin;
+
+	return send_port(&msg->isotp, 3UL);
+}
+
+/*
+ * Send the FC of the next block of the message being received. fs_set_cb()
+ * may change the values of fc_set() first, the policy starts from them.
+ */
+static ERROR_CODE fc_next(struct isotp_t *msg)
+{
+	ERROR_CODE err;
+	struct isotp_ctx_t *rx = &msg->rx;
+	struct isotp_fc_state_t state;
+	struct isotp_fc_t fc;
+	enum N_Result result = N_BUFFER_OVFLW;
+
+	if(msg->fs_set_cb != NULL)
+	{
+		msg->fs_set_cb(msg);
+	}
+	fc.FS = msg->FS;
+	fc.BS = msg->BS;
+	fc.STmin = msg->STmin;
+	if(msg->fc_policy != NULL)
+	{
+		memset(&state, 0, sizeof(state));
+		state.rest = rx->rest;
+		state.space = (msg->sink != NULL) ? ISOTP_FC_UNKNOWN : rx->buffer_size - rx->buffer_index;
+		state.cf_len = msg->RX_DL - msg->isotp.addr_len - 1UL;
+		state.wait_count = rx->wait_count;
+		if(msg->fc_probe != NULL)
+		{
+			msg->fc_probe(msg, &state);
+		}
+		msg->fc_policy(&state, &fc);
+	}
+	if(fc.FS > ISOTP_FS_OVFLW)
+	{
+		/* no valid FS to send, the peer would end with N_INVALID_FS */
+		fc.FS = ISOTP_FS_OVFLW;
+		result = N_ERROR;
+	}
+	else if(fc.FS == ISOTP_FS_WAIT && rx->wait_count >= MAX_FCWAIT_FRAME)
+	{
+		/* the sender would give up with N_WFT_OVRN */
+		fc.FS = ISOTP_FS_OVFLW;
+		result = N_WFT_OVRN;
+	}
+	/* fix wrong separation time values according spec */
+	if ((fc.STmin > 0x7F) && 
+		((fc.STmin < 0xF1) || (fc.STmin > 0xF9))) 
+	{
+		fc.STmin = ISOTP_DEFAULT_STmin;
+	}
+	rx->BS = fc.BS;
+	rx->BS_Counter = fc.BS;
+	rx->STmin = fc.STmin;
+	if(msg->isotp.stats != NULL)
+	{
+		msg->isotp.stats->rx_cf = FALSE;
+		if(fc.FS == ISOTP_FS_WAIT)
+		{
+			msg->isotp.stats->fc_wait_sent ++;
+		}
+	}
+	err = send_fc(msg, fc.FS);
+	if(err != STATUS_NORMAL)
+	{
+		rx_done(msg, send_result(err));
+		return err;
+	}
+	switch(fc.FS)
+	{
+		case ISOTP_FS_CTS:
+			rx->wait_count = 0UL;
+			rx->state = ISOTP_WAIT_DATA;
+			break;
+		case ISOTP_FS_WAIT:
+			rx->wait_count ++;
+			rx->state = ISOTP_SEND_FC;
+			timer_add(&msg->N_Cr);
+			break;
+		default:
+			rx_done(msg, result);
+			break;
+	}
+
+	return err;
+}
+
+/*
+ * Send SF Message
+ */
+static ERROR_CODE send_sf(struct isotp_t *msg)
+{
+	uint8_t *data = msg->isotp.phy_tx.data + msg->isotp.addr_len;
+	uint8_t pci_len = 1UL;
+
+	if(msg->tx.DL <= 7UL - msg->isotp.addr_len)
+	{
+		/* SF message high nibble = 0x0 , low nibble = Length */
+		data[0] = (N_PCI_SF | msg->tx.DL);
+	}
+	else
+	{
+		/* CAN FD escape sequence, low nibble = 0, Length in the 2nd byte */
+		data[0] = N_PCI_SF;
+		data[1] = (uint8_t)msg->tx.DL;
+		pci_len = 2UL;
+	}
+	if(data_get(msg, data + pci_len, msg->tx.DL) != STATUS_NORMAL)
+	{
+		return ERR_FAIL;
+	}
+
+	return send_port(&msg->isotp, pci_len + msg->tx.DL);
+}
+
+/*
+ * Send a First Frame
+ */
+static ERROR_CODE send_ff(struct isotp_t *msg) 
+{
+	uint8_t *data = msg->isotp.phy_tx.data + msg->isotp.addr_len;
+	uint32_t DL = msg->tx.DL;
+
+	msg->tx.buffer_index = 0UL;
+	msg->tx.SN = ISOTP_DEFAULT_SN;
+	if(DL > ISOTP_FF_DL)
+	{
+		/* escape sequence, 32 bit FF_DL after FF_DL = 0 */
+		data[0] = N_PCI_FF;
+		data[1] = 0UL;
+		data[2] = (uint8_t)(DL >> 24UL);
+		data[3] = (uint8_t)(DL >> 16UL);
+		data[4] = (uint8_t)(DL >> 8UL);
+		data[5] = (uint8_t)DL;
+	}
+	else
+	{
+		data[0] = N_PCI_FF | ((DL >> 8UL) & 0x0F);
+		data[1] = (DL & 0xFF);
+	}
+	/* Skip the PCI bytes */
+	if(data_get(msg, data + ff_pci_len(DL), tx_space(msg) - ff_pci_len(DL)) != STATUS_NORMAL)
+	{
+		return ERR_FAIL;
+	}
+	/* First Frame has full length */
+	return send_port(&msg->isotp, tx_space(msg));
+}
+
+/*
+ * Send a Consecutive Frame
+ */
+static ERROR_CODE send_cf(struct isotp_t *msg)
+{
+	ERROR_CODE err;
+	struct phy_msg_t *frame;
+
+	if(msg->tx_ring_count == 0UL)
+	{
+		/* nothing built ahead */
+		frame = &msg->isotp.phy_tx;
+		err = cf_build(msg, frame);
+		if(err != STATUS_NORMAL)
+		{
+			return err;
+		}
+	}
+	else
+	{
+		frame = &msg->tx_ring[msg->tx_ring_head];
+		msg->tx_ring_head = (msg->tx_ring_head + 1UL) % msg->tx_ring_size;
+		msg->tx_ring_count --;
+	}
+
+	return frame_send(&msg->isotp, frame);
+}
+
+/*
+ * Send the CFs of the tx ring at once, with STmin 0: as many as are built,
+ * up to the end of the block and to the end of the ring storage
+ */
+static ERROR_CODE send_cf_burst(struct isotp_t *msg, uint32_t *sent)
+{
+	ERROR_CODE err;
+	uint32_t count;
+
+	cf_prebuild(msg);
+	count = msg->tx_ring_size - msg->tx_ring_head;
+	if(count > msg->tx_ring_count)
+	{
+		count = msg->tx_ring_count;
+	}
+	if(msg->tx.BS > 0UL && count > msg->tx.BS_Counter)
+	{
+		count = msg->tx.BS_Counter;
+	}
+	if(count == 0UL)
+	{
+		/* the ring could not be filled, the error comes up here */
+		*sent = 1UL;
+		return send_cf(msg);
+	}
+	err = frames_send(&msg->isotp, &msg->tx_ring[msg->tx_ring_head], count, sent);
+	msg->tx_ring_head = (msg->tx_ring_head + *sent) % msg->tx_ring_size;
+	msg->tx_ring_count -= *sent;
+
+	return err;
+}
+
+/*
+ * Build the next Consecutive Frame of the message into frame, tx.rest
+ * counts the bytes not built yet
+ */
+static ERROR_CODE cf_build(struct isotp_t *msg, struct phy_msg_t *frame)
+{
+	struct isotp_ctx_t *tx = &msg->tx;
+	uint8_t *data = frame->data + msg->isotp.addr_len;
+	uint16_t len = tx_space(msg) - 1UL;
+
+	data[0] = (N_PCI_CF | (tx->SN & 0x0F));
+	if(tx->rest < len) 
+	{
+		len = tx->rest;
+	}
+	/* Skip 1 Byte PCI */
+	if(data_get(msg, data + 1, len) != STATUS_NORMAL)
+	{
+		return ERR_FAIL;
+	}
+	frame_finish(&msg->isotp, frame, 1UL + len);
+	tx->SN ++;
+	tx->buffer_index += len;
+	tx->rest -= len;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * Fill the tx ring with the next CFs while the sender waits, a CF that can
+ * not be built is built again, and fails, when it is due
+ */
+static void cf_prebuild(struct isotp_t *msg)
+{
+	while(msg->tx_ring_count < msg->tx_ring_size && msg->tx.rest != 0UL)
+	{
+		if(cf_build(msg, &msg->tx_ring[(msg->tx_ring_head + msg->tx_ring_count) % msg->tx_ring_size]) != STATUS_NORMAL)
+		{
+			break;
+		}
+		msg->tx_ring_count ++;
+	}
+}
+
+/*
+ * Send the Consecutive Frames that are due, stops at the end of the block,
+ * at the end of the message or when STmin has to elapse before the next one.
+ * The separation time counts from the start of the previous CF, so the
+ * time spent here does not add to it. The last ISOTP_PACING_US of it are
+ * slept here, a poll would come up to a tick too late. Not while a message
+ * is being received on the channel, its frames would wait for the sleep:
+ * the CF is then sent by the next poll. With a tx ring and STmin 0 the CFs
+ * go out in bursts, see send_cf_burst().
+ */
+static ERROR_CODE send_cf_block(struct isotp_t *msg)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	struct isotp_ctx_t *tx = &msg->tx;
+	uint32_t sent;
+
+	while(tx->state == ISOTP_SEND_CF)
+	{
+		if(timer_is_added(&msg->N_Cs)
+			&& !timer_overflow(&msg->N_Cs, stmin_us(tx->STmin)))
+		{
+			if(timer_remain(&msg->N_Cs, stmin_us(tx->STmin)) >= ISOTP_PACING_US
+				|| rx_busy(msg) == TRUE)
+			{
+				break;
+			}
+			timer_wait(&msg->N_Cs, stmin_us(tx->STmin));
+		}
+		timer_add_us(&msg->N_Cs);
+		if(msg->tx_ring != NULL && stmin_us(tx->STmin) == 0UL)
+		{
+			err = send_cf_burst(msg, &sent);
+		}
+		else
+		{
+			err = send_cf(msg);
+			sent = 1UL;
+		}
+		if(err != STATUS_NORMAL)
+		{
+			tx_done(msg, send_result(err));
+			break;
+		}
+		if(sent != 0UL && msg->isotp.stats != NULL)
+		{
+			stats_tx_cf(msg->isotp.stats);
+		}
+		if(tx->rest == 0UL && msg->tx_ring_count == 0UL)
+		{
+			tx_done(msg, N_OK);
+			break;
+		}
+		if(sent == 0UL)
+		{
+			/* the driver takes no frame now, the next poll tries again */
+			break;
+		}
+		if(tx->BS > 0UL
+			&& (tx->BS_Counter -= sent) == 0UL)
+		{
+			if(msg->isotp.stats != NULL)
+			{
+				msg->isotp.stats->fc_wait_us = timer_us();
+			}
+			timer_add(&msg->N_Bs);
+			xtimer_delete(&msg->N_Cs);
+			tx->BS_Counter = tx->BS;
+			tx->state = ISOTP_WAIT_FC;
+			break;
+		}
+	}
+	/* the next frames are ready when the FC arrives or STmin is over */
+	if(tx_busy(msg) == TRUE)
+	{
+		cf_prebuild(msg);
+	}
+
+	return err;
+}
+
+/*
+ * SeparationTime minimum in microseconds
+ */
+static uint32_t stmin_us(uint8_t STmin)
+{
+	uint32_t us = ISOTP_DEFAULT_STmin * 1000UL;
+
+	/* SeparationTime minimum (STmin) range: 0ms~127ms */
+	if(STmin <= 0x7F)
+	{
+		us = STmin * 1000UL;
+	}
+	else if(STmin >= 0xF1 && STmin <= 0xF9)
+	{
+		/* SeparationTime minimum (STmin) range: 100us~900us */
+		us = (STmin - 0xF0) * 100UL;
+	}
+	else
+	{}
+
+	return us;
+}
+
+/*
+ * result of a transmission that failed in the data link layer
+ */
+static enum N_Result send_result(ERROR_CODE err)
+{
+	return (err == ERR_TIMEOUT) ? N_TIMEOUT_A : N_ERROR;
+}
+
+/*
+ * Receive a Single Frame
+ */
+static ERROR_CODE rcv_sf(struct isotp_t* msg)
+{
+	uint8_t *data = msg->isotp.phy_rx.data + msg->isotp.addr_len;
+	uint8_t space = msg->isotp.phy_rx.length - msg->isotp.addr_len;
+	uint16_t sf_dl;
+	uint8_t pci_len = 1UL;
+
+	/* get the SF_DL from the N_PCI byte */
+	sf_dl = data[0] & 0x0F;
+	if(sf_dl == 0UL && msg->isotp.phy_rx.length > CAN_MAX_DL)
+	{
+		/* CAN FD escape sequence, SF_DL in the 2nd byte */
+		sf_dl = data[1];
+		pci_len = 2UL;
+	}
+	else if(msg->isotp.phy_rx.length > CAN_MAX_DL)
+	{
+		/* a CAN FD SF longer than 8 bytes has to use the escape sequence */
+		return ERR_PARAMETER;
+	}
+	if(sf_dl == 0UL || pci_len + sf_dl > space)
+	{
+		return ERR_PARAMETER;
+	}
+	/* a new message ends the segmented one being received */
+	if(rx_busy(msg) == TRUE)
+	{
+		rx_done(msg, N_UNEXP_PDU);
+	}
+	msg->rx.DL = sf_dl;
+	msg->rx.buffer_index = 0UL;
+	/* copy the received data bytes */
+	/* Skip PCI, SF uses len bytes */
+	if(rx_fits(msg, msg->rx.DL) == FALSE)
+	{
+		rx_done(msg, N_BUFFER_OVFLW);
+	}
+	else
+	{
+		rx_done(msg, (data_put(msg, data + pci_len, msg->rx.DL) == STATUS_NORMAL) ? N_OK : N_ERROR);
+	}
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * Receive a First Frame
+ */
+static ERROR_CODE rcv_ff(struct isotp_t* msg)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	uint8_t *data = msg->isotp.phy_rx.data + msg->isotp.addr_len;
+	uint8_t rx_dl = msg->isotp.phy_rx.length;
+	uint8_t space = rx_dl - msg->isotp.addr_len;
+	uint8_t pci_len = 2UL;
+	uint32_t ff_dl;
+
+	/* get the FF_DL */
+	ff_dl = (data[0] & 0x0F) << 8;
+	ff_dl += data[1];
+	if(ff_dl == 0UL && rx_dl >= CAN_MAX_DL)
+	{
+		/* escape sequence, 32 bit FF_DL */
+		ff_dl = ((uint32_t)data[2] << 24UL) | ((uint32_t)data[3] << 16UL)
+				| ((uint32_t)data[4] << 8UL) | data[5];
+		pci_len = 6UL;
+	}
+	/* the FF sets RX_DL, a message that fits in a SF is not valid */
+	if(rx_dl < CAN_MAX_DL || can_dl(rx_dl) != rx_dl)
+	{
+		err = ERR_PARAMETER;
+	}
+	else if(ff_dl < ((rx_dl == CAN_MAX_DL) ? CAN_MAX_DL : rx_dl - 1UL) - msg->isotp.addr_len
+			|| (pci_len == 6UL && ff_dl <= ISOTP_FF_DL))
+	{
+		err = ERR_PARAMETER;
+	}
+	if(err != STATUS_NORMAL)
+	{
+		return err;
+	}
+	/* a new message ends the segmented one being received */
+	if(rx_busy(msg) == TRUE)
+	{
+		rx_done(msg, N_UNEXP_PDU);
+	}
+	if(rx_fits(msg, ff_dl) == FALSE)
+	{
+		/* does not fit in the lent buffer, or the pool is out of blocks */
+		err = send_fc(msg, ISOTP_FS_OVFLW);
+		rx_done(msg, N_BUFFER_OVFLW);
+	}
+	else
+	{
+		msg->rx.DL = ff_dl;
+		msg->rx.SN = ISOTP_DEFAULT_SN;
+		msg->rx.rest = msg->rx.DL;
+		msg->rx.buffer_index = 0UL;
+		msg->rx.reply = N_OK;
+		msg->RX_DL = rx_dl;
+		/* 
+		 * copy the first received data bytes
+		 * Skip the PCI bytes, FF must have RX_DL - PCI bytes!
+		 */
+		if(data_put(msg, data + pci_len, space - pci_len) != STATUS_NORMAL)
+		{
+			rx_done(msg, N_ERROR);
+			return ERR_FAIL;
+		}
+		msg->rx.buffer_index += space - pci_len;
+		msg->rx.rest -= space - pci_len; /* Rest length */
+		msg->rx.wait_count = 0UL;
+		if(msg->isotp.stats != NULL)
+		{
+			msg->isotp.stats->rx_start_us = timer_us();
+			msg->isotp.stats->rx_segmented = TRUE;
+		}
+		err = fc_next(msg);
+	}
+
+	return err;
+}
+
+/*
+ * Receive a Consecutive Frame
+ */
+static ERROR_CODE rcv_cf(struct isotp_t* msg)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	struct isotp_ctx_t *rx = &msg->rx;
+	uint8_t *data = msg->isotp.phy_rx.data + msg->isotp.addr_len;
+	uint16_t len = msg->RX_DL - msg->isotp.addr_len - 1UL;
+
+	for(;;)
+	{
+		if (rx->state != ISOTP_WAIT_DATA) 
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		if(rx->rest < len)
+		{
+			len = rx->rest;
+		}
+		/* a CF too short for its payload is ignored */
+		if(msg->isotp.phy_rx.length < msg->isotp.addr_len + 1UL + len)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		if ((data[0] & 0x0F) != (rx->SN & 0x0F))
+		{
+			rx_done(msg, N_WRONG_SN);
+			err = ERR_PARAMETER;
+			break;
+		}
+		timer_refresh(&msg->N_Cr);
+		if(msg->isotp.stats != NULL)
+		{
+			stats_rx_cf(msg->isotp.stats);
+		}
+
+		if(rx->rest == len)
+		{
+			/* Last Frame */
+			if(data_put(msg, data + 1UL, len) != STATUS_NORMAL)
+			{
+				rx_done(msg, N_ERROR);
+				err = ERR_FAIL;
+				break;
+			}
+			rx->buffer_index += len;
+			rx->rest = 0UL;
+			rx_done(msg, N_OK);
+		}
+		else
+		{
+			/* RX_DL - 1 bytes per CF */
+			if(data_put(msg, data + 1UL, len) != STATUS_NORMAL)
+			{
+				rx_done(msg, N_ERROR);
+				err = ERR_FAIL;
+				break;
+			}
+			rx->buffer_index += len;
+			rx->rest -= len; /* Got another RX_DL - 1 Bytes of Data; */
+			if(rx->BS != 0UL
+				&& (--rx->BS_Counter) == 0UL)
+			{
+				err = fc_next(msg);
+			}
+		}
+		rx->SN ++;
+		break;
+	}
+	
+	return err;
+}
+
+/*
+ * Receive a Flow Control Frame
+ */
+static ERROR_CODE rcv_fc(struct isotp_t* msg)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	struct isotp_ctx_t *tx = &msg->tx;
+	uint8_t *data = msg->isotp.phy_rx.data + msg->isotp.addr_len;
+	enum ISOTP_FS_e FS;
+
+	for(;;)
+	{
+		if (tx->state != ISOTP_WAIT_FC 
+			&& tx->state != ISOTP_WAIT_FIRST_FC)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		FS = (enum ISOTP_FS_e)(data[0] & 0x0F);
+		if(msg->isotp.stats != NULL && FS <= ISOTP_FS_OVFLW)
+		{
+			stats_fc(msg->isotp.stats, FS);
+		}
+		switch (FS)
+		{
+			case ISOTP_FS_CTS:
+				/*
+				 * take the parameters from every FC.CTS, a receiver with a
+				 * flow control policy adapts them block by block
+				 */
+				tx->BS = data[1];
+				tx->BS_Counter = tx->BS;
+				tx->STmin = data[2];
+				/* fix wrong separation time values according spec */
+				if ((tx->STmin > 0x7F) 
+					&& ((tx->STmin < 0xF1) || (tx->STmin > 0xF9))) 
+				{
+					tx->STmin = ISOTP_DEFAULT_STmin;
+				}
+				tx->wait_count = 0UL;
+				tx->state = ISOTP_SEND_CF;
+				xtimer_delete(&msg->N_Bs);
+				/* the first CF of a block is sent without waiting STmin */
+				xtimer_delete(&msg->N_Cs);
+				break;
+			case ISOTP_FS_WAIT:
+				if(++tx->wait_count > MAX_FCWAIT_FRAME)
+				{
+					err = ERR_FAIL;
+					tx_done(msg, N_WFT_OVRN);
+					break;
+				}
+				timer_refresh(&msg->N_Bs);
+				break;
+			case ISOTP_FS_OVFLW:
+				err = ERR_FULL;
+				tx_done(msg, N_BUFFER_OVFLW);
+				break;
+			default:
+				err = ERR_PARAMETER;
+				tx_done(msg, N_INVALID_FS);
+				break;
+		}
+		break;
+	}
+	
+	return err;
+}
+
+/*
+ * End a transmission and report the result
+ */
+static void tx_done(struct isotp_t* msg, enum N_Result result)
+{
+	xtimer_delete(&msg->N_Bs);
+	xtimer_delete(&msg->N_Cs);
+	msg->tx.state = ISOTP_IDLE;
+	msg->tx.reply = result;
+	if(msg->isotp.stats != NULL)
+	{
+		stats_tx_done(msg->isotp.stats, result, msg->tx.DL);
+	}
+	if(msg->tx_done_cb != NULL)
+	{
+		msg->tx_done_cb(msg);
+	}
+}
+
+/*
+ * End a reception and report the result
+ */
+static void rx_done(struct isotp_t* msg, enum N_Result result)
+{
+	xtimer_delete(&msg->N_Cr);
+	if(result == N_OK)
+	{
+		msg->rx.state = ISOTP_FINISHED;
+	}
+	else
+	{
+		msg->rx.state = ISOTP_ERROR;
+		msg->rx.SN = ISOTP_DEFAULT_SN;
+		msg->rx.rest = 0UL;
+	}
+	msg->rx.reply = result;
+	if(msg->isotp.stats != NULL)
+	{
+		stats_rx_done(msg->isotp.stats, result, msg->rx.DL);
+	}
+	if(msg->rx_done_cb != NULL)
+	{
+		msg->rx_done_cb(msg);
+	}
+	/* the blocks of the message are only lent to rx_done_cb */
+	if(msg->pool_ctx != NULL)
+	{
+		isotp_pool_give(msg);
+	}
+}
+
+/*
+ * storage for a message of DL bytes, taken from the pool of the channel
+ */
+static Bool rx_fits(struct isotp_t* msg, uint32_t DL)
+{
+	if(msg->sink != NULL)
+	{
+		return TRUE;
+	}
+	if(msg->pool != NULL && isotp_pool_take(msg, DL) != STATUS_NORMAL)
+	{
+		return FALSE;
+	}
+	return (DL <= msg->rx.buffer_size) ? TRUE : FALSE;
+}
+
+/*
+ * A FC answered the FF, the end of a block or a FC.WAIT
+ */
+static void stats_fc(struct isotp_stats_t *stats, enum ISOTP_FS_e FS)
+{
+	uint32_t now = timer_us();
+
+	isotp_hist_add(&stats->fc_latency, now - stats->fc_wait_us);
+	if(FS == ISOTP_FS_WAIT)
+	{
+		stats->fc_wait_received ++;
+		stats->fc_wait_us = now;
+	}
+	else
+	{
+		stats->tx_cf = FALSE;
+	}
+}
+
+/*
+ * CFs were handed to the data link layer
+ */
+static void stats_tx_cf(struct isotp_stats_t *stats)
+{
+	uint32_t now = timer_us();
+
+	if(stats->tx_cf == TRUE)
+	{
+		isotp_hist_add(&stats->tx_cf_gap, now - stats->tx_cf_us);
+	}
+	stats->tx_cf_us = now;
+	stats->tx_cf = TRUE;
+}
+
+/*
+ * A CF in sequence was received
+ */
+static void stats_rx_cf(struct isotp_stats_t *stats)
+{
+	uint32_t now = timer_us();
+
+	if(stats->rx_cf == TRUE)
+	{
+		isotp_hist_add(&stats->rx_cf_gap, now - stats->rx_cf_us);
+	}
+	stats->rx_cf_us = now;
+	stats->rx_cf = TRUE;
+}
+
+static void stats_tx_done(struct isotp_stats_t *stats, enum N_Result result, uint32_t DL)
+{
+	stats->tx_result[(result <= N_ERROR) ? result : N_ERROR] ++;
+	if(result == N_OK)
+	{
+		stats->tx_bytes += DL;
+		if(stats->tx_segmented == TRUE)
+		{
+			isotp_hist_add(&stats->tx_time, timer_us() - stats->tx_start_us);
+		}
+	}
+	stats->tx_segmented = FALSE;
+}
+
+static void stats_rx_done(struct isotp_stats_t *stats, enum N_Result result, uint32_t DL)
+{
+	stats->rx_result[(result <= N_ERROR) ? result : N_ERROR] ++;
+	if(result == N_OK)
+	{
+		stats->rx_bytes += DL;
+		if(stats->rx_segmented == TRUE)
+		{
+			isotp_hist_add(&stats->rx_time, timer_us() - stats->rx_start_us);
+		}
+	}
+	stats->rx_segmented = FALSE;
+}
+
+/*
+ * A transmission is in progress
+ */
+static Bool tx_busy(struct isotp_t* msg)
+{
+	return (msg->tx.state == ISOTP_SEND
+			|| msg->tx.state == ISOTP_SEND_FF
+			|| msg->tx.state == ISOTP_SEND_CF
+			|| msg->tx.state == ISOTP_WAIT_FIRST_FC
+			|| msg->tx.state == ISOTP_WAIT_FC) ? TRUE : FALSE;
+}
+
+/*
+ * A segmented message is being received
+ */
+static Bool rx_busy(struct isotp_t* msg)
+{
+	return (msg->rx.state == ISOTP_WAIT_DATA
+			|| msg->rx.state == ISOTP_SEND_FC) ? TRUE : FALSE;
+}
+
+/*
+ * start the transmission of the first tx.DL bytes of the lent buffer, the
+ * remaining frames are sent from isotp_on_frame() and isotp_poll()
+ *
+ * @parameter in:
+ * msg:       object
+ * @parameter out:
+ * operation status return, ERR_FULL if a transmission is in progress,
+ * or a reception into the same buffer
+ */
+ERROR_CODE isotp_send_start(struct isotp_t* msg)
 {
-	enum n_pci_type_e n_pci_type = N_PCI_SF;
 	ERROR_CODE err = STATUS_NORMAL;
+	struct isotp_ctx_t *tx;
 
-	msg->reply = N_OK;
-	msg->tp_state = ISOTP_IDLE;
-	while(msg->tp_state != ISOTP_FINISHED && msg->tp_state != ISOTP_ERROR)
+	for(;;)
 	{
-		if(receive_port(&msg->isotp) == STATUS_NORMAL)
+		if(msg == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		tx = &msg->tx;
+		/* with one buffer a reception in progress owns it */
+		if(tx_busy(msg) == TRUE
+			|| (msg->duplex == FALSE && rx_busy(msg) == TRUE))
+		{
+			err = ERR_FULL;
+			break;
+		}
+		if(tx->DL == 0UL
+			|| (msg->source == NULL && tx->DL > tx->buffer_size))
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		tx_init(msg);
+		tx->state = ISOTP_SEND;
+		if(msg->isotp.stats != NULL)
 		{
-			n_pci_type = (enum n_pci_type_e)(msg->isotp.phy_rx.data[0] & 0xF0);
-			switch (n_pci_type)
+			msg->isotp.stats->tx_start_us = timer_us();
+			msg->isotp.stats->tx_segmented = FALSE;
+		}
+		if(tx->DL <= sf_max(msg))
+		{
+			err = send_sf(msg);
+			tx_done(msg, (err == STATUS_NORMAL) ? N_OK : send_result(err));
+		}
+		else
+		{
+			err = send_ff(msg);
+			if(err == STATUS_NORMAL) // FF complete
 			{
-				case N_PCI_FC:
-					rcv_fc(msg);/* tx path: fc frame */
-					break;
-				case N_PCI_SF:
-					rcv_sf(msg);/* rx path: single frame */
-					break;
-				case N_PCI_FF:
-					rcv_ff(msg);/* rx path: first frame */
-					break;
-				case N_PCI_CF:
-					rcv_cf(msg);/* rx path: consecutive frame */
-					break;
-				default:
-					err = ERR_PARAMETER;
-					msg->reply = N_ERROR;
-					break;
+				timer_add(&msg->N_Bs);
+				tx->buffer_index += tx_space(msg) - ff_pci_len(tx->DL);
+				tx->rest = tx->DL - (tx_space(msg) - ff_pci_len(tx->DL));
+				tx->state = ISOTP_WAIT_FIRST_FC;
+				if(msg->isotp.stats != NULL)
+				{
+					msg->isotp.stats->tx_segmented = TRUE;
+					msg->isotp.stats->fc_wait_us = timer_us();
+				}
+				cf_prebuild(msg);
 			}
+			else
+			{
+				tx_done(msg, send_result(err));
+			}
+		}
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * receive the requests sent to a functional ID too, they are taken like
+ * SingleFrames on N_SA and answered on N_TA
+ *
+ * @parameter in:
+ * msg:       object
+ * fa:        functional ID, ISOTP_NO_ID for none
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_functional_set(struct isotp_t* msg, uint32_t fa)
+{
+	if(msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	msg->isotp.N_FA = fa;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * ISO-15765-2-10.3.1 functional addressing
+ * start the transmission of a request to N_TA as a functional target,
+ * which is only defined for SingleFrames: every receiver of the ID would
+ * answer a FirstFrame with its own FC
+ *
+ * @parameter in:
+ * msg:       object, N_TA is the functional ID
+ * @parameter out:
+ * operation status return, ERR_PARAMETER if tx.DL does not fit a SingleFrame
+ */
+ERROR_CODE isotp_functional_send(struct isotp_t* msg)
+{
+	if(msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(msg->tx.DL > sf_max(msg))
+	{
+		return ERR_PARAMETER;
+	}
+
+	return isotp_send_start(msg);
+}
+
+/*
+ * handle one frame received from the bus
+ *
+ * @parameter in:
+ * msg:       object
+ * frame:     the received frame, frames of other channels are ignored
+ * @parameter out:
+ * operation status return, ERR_NOT_FOUND if the frame is not for this channel
+ */
+ERROR_CODE isotp_on_frame(struct isotp_t* msg, const struct phy_msg_t *frame)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	for(;;)
+	{
+		if(msg == NULL || frame == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		if(frame != &msg->isotp.phy_rx)
+		{
+			memcpy(&msg->isotp.phy_rx, frame, sizeof(*frame));
+		}
+		err = check_frame(&msg->isotp);
+		if(err != STATUS_NORMAL)
+		{
+			break;
+		}
+		if(msg->isotp.capture != NULL)
+		{
+			isotp_capture_put(msg->isotp.capture, &msg->isotp.phy_rx);
 		}
-		if(timer_overflow(&msg->N_Cr, N_CR_TIMEOUT))
+		if(msg->isotp.stats != NULL)
 		{
-			msg->reply = N_TIMEOUT_Cr;
-			err = ERR_TIMEOUT;
-			msg->tp_state = ISOTP_ERROR;
+			msg->isotp.stats->rx_frames ++;
+		}
+		switch ((enum n_pci_type_e)(msg->isotp.phy_rx.data[msg->isotp.addr_len] & 0xF0))
+		{
+			case N_PCI_FC:
+				err = rcv_fc(msg);/* tx path: fc frame */
+				if(msg->tx.state == ISOTP_SEND_CF)
+				{
+					err = send_cf_block(msg);
+				}
+				break;
+			/* with one buffer a transmission in progress owns it */
+			case N_PCI_SF:
+				err = (msg->duplex == FALSE && tx_busy(msg) == TRUE) ? ERR_PARAMETER : rcv_sf(msg);/* rx path: single frame */
+				break;
+			case N_PCI_FF:
+				err = (msg->duplex == FALSE && tx_busy(msg) == TRUE) ? ERR_PARAMETER : rcv_ff(msg);/* rx path: first frame */
+				break;
+			case N_PCI_CF:
+				err = rcv_cf(msg);/* rx path: consecutive frame */
+				break;
+			default:
+				err = ERR_PARAMETER;
+				break;
 		}
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * handle the timeouts and send the consecutive frames that are due
+ *
+ * @parameter in:
+ * msg:       object
+ * @parameter out:
+ * milliseconds until the next call is needed,
+ * ISOTP_WAIT_FOREVER if only a received frame can change the state
+ */
+uint32_t isotp_poll(struct isotp_t* msg)
+{
+	uint32_t wait = ISOTP_WAIT_FOREVER;
+	uint32_t rx_wait = ISOTP_WAIT_FOREVER;
+
+	if(msg == NULL)
+	{
+		return wait;
+	}
+
+	switch(msg->tx.state)
+	{
+		case ISOTP_WAIT_FIRST_FC:
+		case ISOTP_WAIT_FC:
+			if(timer_overflow(&msg->N_Bs, TIMEOUT_FC))
+			{
+				tx_done(msg, N_TIMEOUT_Bs);
+			}
+			break;
+		case ISOTP_SEND_CF:
+			send_cf_block(msg);
+			break;
+		default:
+			break;
+	}
+	if(msg->rx.state == ISOTP_WAIT_DATA
+		&& timer_overflow(&msg->N_Cr, N_CR_TIMEOUT))
+	{
+		rx_done(msg, N_TIMEOUT_Cr);
+	}
+	else if(msg->rx.state == ISOTP_SEND_FC
+		&& timer_overflow(&msg->N_Cr, TIMEOUT_FC_WAIT))
+	{
+		fc_next(msg);
+	}
+
+	switch(msg->tx.state)
+	{
+		case ISOTP_WAIT_FIRST_FC:
+		case ISOTP_WAIT_FC:
+			wait = timer_remain(&msg->N_Bs, TIMEOUT_FC);
+			break;
+		case ISOTP_SEND_CF:
+			wait = timer_remain(&msg->N_Cs, stmin_us(msg->tx.STmin));
+			if(wait != ISOTP_WAIT_FOREVER)
+			{
+				/*
+				 * a task wakes up to a tick late, ask for one tick early,
+				 * send_cf_block() waits the rest
+				 */
+				wait = (wait >= 2000UL) ? wait / 1000UL - 1UL : 1UL;
+			}
+			break;
+		default:
+			break;
+	}
+	if(msg->rx.state == ISOTP_WAIT_DATA)
+	{
+		rx_wait = timer_remain(&msg->N_Cr, N_CR_TIMEOUT);
+	}
+	else if(msg->rx.state == ISOTP_SEND_FC)
+	{
+		rx_wait = timer_remain(&msg->N_Cr, TIMEOUT_FC_WAIT);
+	}
+
+	return (rx_wait < wait) ? rx_wait : wait;
+}
+
+/*
+ * Wait for the next event of the blocking interface
+ */
+static void wait_event(struct isotp_t* msg)
+{
+	Bool received = FALSE;
+
+	if(msg->isotp.phy_receive(&msg->isotp.phy_rx) == STATUS_NORMAL)
+	{
+		isotp_on_frame(msg, &msg->isotp.phy_rx);
+		received = TRUE;
+	}
+	/* phy_receive can not block, give the cpu away until the next tick */
+	if(isotp_poll(msg) != 0UL && received == FALSE)
+	{
+		delay_1ms(1UL);
+	}
+}
+
+enum N_Result isotp_send(struct isotp_t* msg)
+{
+	if(isotp_send_start(msg) != STATUS_NORMAL)
+	{
+		return N_ERROR;
+	}
+	while(tx_busy(msg) == TRUE)
+	{
+		wait_event(msg);
+	}
+
+	return msg->tx.reply;
+}
+
+enum N_Result isotp_receive(struct isotp_t* msg)
+{
+	msg->rx.reply = N_OK;
+	msg->rx.state = ISOTP_IDLE;
+	while(msg->rx.state != ISOTP_FINISHED && msg->rx.state != ISOTP_ERROR)
+	{
+		wait_event(msg);
 	}
 
-	return msg->reply;
+	return msg->rx.reply;
 }
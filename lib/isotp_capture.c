@@ -0,0 +1,584 @@
+#include "isotp_capture.h"
+#include "ring_atomic.h"
+#include <string.h>
+
+#define CAPTURE_PCAP_MAGIC		(0xA1B2C3D4UL)
+#define CAPTURE_PCAP_RECORD		(16UL)
+/* can_id, length, flags, two reserved bytes */
+#define CAPTURE_CAN_HEADER		(8UL)
+#define CAPTURE_SNAPLEN			(CAPTURE_CAN_HEADER + CANFD_MAX_DL)
+/* of can_id in LINKTYPE_CAN_SOCKETCAN, and of the FD flags */
+#define CAPTURE_EFF_FLAG		(0x80000000UL)
+#define CAPTURE_EFF_MASK		(0x1FFFFFFFUL)
+#define CAPTURE_SFF_MASK		(0x7FFUL)
+#define CAPTURE_FD_BRS			(0x01U)
+#define CAPTURE_FD_FDF			(0x04U)
+/* "(4294967295.999999) can0 1FFFFFFF##1" and 128 hex digits */
+#define CAPTURE_LINE_LEN		(180UL)
+
+static void put_le32(uint8_t *data, uint32_t value);
+static void put_le16(uint8_t *data, uint16_t value);
+static uint32_t get_le32(const uint8_t *data);
+static uint32_t put_dec(char *line, uint32_t value, uint8_t width);
+static uint32_t put_hex(char *line, uint32_t value, uint8_t width);
+static int8_t hex_value(uint8_t c);
+static uint32_t candump_line(char *line, const struct isotp_capture_rec_t *rec, uint32_t sec, uint32_t usec);
+static uint32_t pcap_record(uint8_t *data, const struct isotp_capture_rec_t *rec, uint32_t sec, uint32_t usec);
+static ERROR_CODE candump_parse(const uint8_t *data, uint32_t len, struct isotp_capture_rec_t *rec, uint32_t *used);
+static ERROR_CODE pcap_parse(const uint8_t *data, uint32_t len, struct isotp_capture_rec_t *rec, uint32_t *used);
+
+/*
+ * initialize a capture
+ *
+ * @parameter in:
+ * capture:   object
+ * rec:       storage of the ring
+ * size:      records in rec, a power of two
+ * wall_sec:  seconds since 1970 now, the time of the file starts there
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_capture_init(struct isotp_capture_t *capture,
+							struct isotp_capture_rec_t *rec,
+							uint32_t size,
+							uint32_t wall_sec)
+{
+	if(capture == NULL || rec == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(size == 0UL || (size & (size - 1UL)) != 0UL)
+	{
+		return ERR_PARAMETER;
+	}
+	memset(capture, 0, sizeof(*capture));
+	capture->rec = rec;
+	capture->mask = size - 1UL;
+	capture->start_sec = wall_sec;
+	capture->start_us = timer_us();
+	capture->last_us = capture->start_us;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * tap the frames of a channel, NULL to stop
+ *
+ * @parameter in:
+ * msg:       object
+ * capture:   the capture, shared by the channels of one task
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_capture_set(struct isotp_t *msg, struct isotp_capture_t *capture)
+{
+	if(msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	msg->isotp.capture = capture;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * producer: copy a frame into the ring, dropped if the ring is full
+ */
+void isotp_capture_put(struct isotp_capture_t *capture, const struct phy_msg_t *frame)
+{
+	struct isotp_capture_rec_t *rec;
+	uint32_t head = capture->head;
+
+	if(head - ring_load(&capture->tail) > capture->mask)
+	{
+		capture->overflow ++;
+		return;
+	}
+	rec = &capture->rec[head & capture->mask];
+	rec->time_us = timer_us();
+	rec->id = frame->id;
+	rec->length = (frame->length > CANFD_MAX_DL) ? CANFD_MAX_DL : frame->length;
+	memcpy(rec->data, frame->data, rec->length);
+	ring_store(&capture->head, head + 1UL);
+}
+
+/*
+ * write the start of the file, nothing for a candump log
+ *
+ * @parameter in:
+ * capture:   object
+ * format:    of the file
+ * write:     output of the application
+ * arg:       passed to write
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_capture_header(struct isotp_capture_t *capture,
+							enum isotp_capture_format_e format,
+							isotp_capture_write write,
+							void *arg)
+{
+	uint8_t header[ISOTP_CAPTURE_PCAP_HEADER];
+
+	if(capture == NULL || write == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(format != ISOTP_CAPTURE_PCAP)
+	{
+		return STATUS_NORMAL;
+	}
+	/* little endian, microseconds, version 2.4, no time zone */
+	memset(header, 0, sizeof(header));
+	put_le32(&header[0], CAPTURE_PCAP_MAGIC);
+	put_le16(&header[4], 2U);
+	put_le16(&header[6], 4U);
+	put_le32(&header[16], CAPTURE_SNAPLEN);
+	put_le32(&header[20], ISOTP_CAPTURE_LINKTYPE);
+
+	return write(arg, header, sizeof(header));
+}
+
+/*
+ * consumer: write the frames captured since the last call
+ *
+ * @parameter in:
+ * capture:   object
+ * format:    of the file
+ * write:     output of the application, one call per frame
+ * arg:       passed to write
+ * @parameter out:
+ * frames written, the frames write failed on stay in the ring
+ */
+uint32_t isotp_capture_flush(struct isotp_capture_t *capture,
+							enum isotp_capture_format_e format,
+							isotp_capture_write write,
+							void *arg)
+{
+	const struct isotp_capture_rec_t *rec;
+	uint8_t out[CAPTURE_LINE_LEN];
+	unsigned long long elapsed;
+	uint32_t tail, head, len, sec, usec, count = 0UL;
+
+	if(capture == NULL || write == NULL)
+	{
+		return 0UL;
+	}
+	tail = capture->tail;
+	head = ring_load(&capture->head);
+	for(; tail != head; tail ++)
+	{
+		rec = &capture->rec[tail & capture->mask];
+		elapsed = capture->elapsed_us + (uint32_t)(rec->time_us - capture->last_us);
+		sec = capture->start_sec + (uint32_t)(elapsed / 1000000ULL);
+		usec = (uint32_t)(elapsed % 1000000ULL);
+		if(format == ISOTP_CAPTURE_PCAP)
+		{
+			len = pcap_record(out, rec, sec, usec);
+		}
+		else
+		{
+			len = candump_line((char *)out, rec, sec, usec);
+		}
+		if(write(arg, out, len) != STATUS_NORMAL)
+		{
+			break;
+		}
+		capture->elapsed_us = elapsed;
+		capture->last_us = rec->time_us;
+		count ++;
+	}
+	ring_store(&capture->tail, tail);
+	capture->written += count;
+
+	return count;
+}
+
+/*
+ * read one frame of a file
+ * A candump log is read line by line, a pcap file record by record after
+ * its header. Only little endian pcap files with microseconds are read,
+ * like the ones isotp_capture_flush() writes. time_us of the records is
+ * the time in the file, modulo 2^32 microseconds.
+ *
+ * @parameter in:
+ * format:    of the file
+ * data:      the bytes of the file not read yet
+ * len:       bytes in data
+ * @parameter out:
+ * rec:       the frame
+ * used:      bytes of data read, skip them for the next call
+ * operation status return, ERR_EMPTY for bytes holding no frame (the pcap
+ * header, an empty line), ERR_PARAMETER for a frame that can not be read
+ */
+ERROR_CODE isotp_capture_parse(enum isotp_capture_format_e format,
+							const uint8_t *data,
+							uint32_t len,
+							struct isotp_capture_rec_t *rec,
+							uint32_t *used)
+{
+	if(data == NULL || rec == NULL || used == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	*used = 0UL;
+	if(len == 0UL)
+	{
+		return ERR_EMPTY;
+	}
+	if(format == ISOTP_CAPTURE_PCAP)
+	{
+		return pcap_parse(data, len, rec, used);
+	}
+	return candump_parse(data, len, rec, used);
+}
+
+/*
+ * prepare the replay of the frames of one ID
+ *
+ * @parameter in:
+ * replay:    object
+ * rec:       the capture, in the order of time
+ * count:     records in rec
+ * id:        frames with this ID are fed to the channel, the others only
+ *            keep the time
+ * speed:     1 at the pace of the capture, N times faster, 0 at once
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_replay_init(struct isotp_replay_t *replay,
+							const struct isotp_capture_rec_t *rec,
+							uint32_t count,
+							uint32_t id,
+							uint32_t speed)
+{
+	if(replay == NULL || rec == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	memset(replay, 0, sizeof(*replay));
+	replay->rec = rec;
+	replay->count = count;
+	replay->id = id;
+	replay->speed = speed;
+	replay->start_us = timer_us();
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * feed the frames that are due to a channel
+ *
+ * @parameter in:
+ * replay:    object
+ * msg:       the channel
+ * @parameter out:
+ * milliseconds until the next frame is due,
+ * ISOTP_WAIT_FOREVER when all frames were fed
+ */
+uint32_t isotp_replay_run(struct isotp_replay_t *replay, struct isotp_t *msg)
+{
+	const struct isotp_capture_rec_t *rec;
+	struct phy_msg_t frame;
+	uint32_t due, now;
+
+	if(replay == NULL || msg == NULL)
+	{
+		return ISOTP_WAIT_FOREVER;
+	}
+	for(; replay->next < replay->count; replay->next ++)
+	{
+		rec = &replay->rec[replay->next];
+		if(rec->id != replay->id)
+		{
+			continue;
+		}
+		if(replay->speed != 0UL)
+		{
+			due = (rec->time_us - replay->rec[0].time_us) / replay->speed;
+			now = timer_us() - replay->start_us;
+			if((int32_t)(due - now) > 0)
+			{
+				return (due - now + 999UL) / 1000UL;
+			}
+		}
+		frame.new_data = TRUE;
+		frame.id = rec->id;
+		frame.length = rec->length;
+		memcpy(frame.data, rec->data, rec->length);
+		isotp_on_frame(msg, &frame);
+		replay->fed ++;
+	}
+
+	return ISOTP_WAIT_FOREVER;
+}
+
+static void put_le32(uint8_t *data, uint32_t value)
+{
+	data[0] = (uint8_t)value;
+	data[1] = (uint8_t)(value >> 8);
+	data[2] = (uint8_t)(value >> 16);
+	data[3] = (uint8_t)(value >> 24);
+}
+
+static void put_le16(uint8_t *data, uint16_t value)
+{
+	data[0] = (uint8_t)value;
+	data[1] = (uint8_t)(value >> 8);
+}
+
+static uint32_t get_le32(const uint8_t *data)
+{
+	return (uint32_t)data[0] | ((uint32_t)data[1] << 8) | ((uint32_t)data[2] << 16) | ((uint32_t)data[3] << 24);
+}
+
+/*
+ * value in decimal, padded with zeros to width digits
+ */
+static uint32_t put_dec(char *line, uint32_t value, uint8_t width)
+{
+	char digit[10];
+	uint32_t count = 0UL, len = 0UL;
+
+	do
+	{
+		digit[count ++] = (char)('0' + value % 10UL);
+		value /= 10UL;
+	} while(value != 0UL);
+	for(; count < width; width --)
+	{
+		line[len ++] = '0';
+	}
+	while(count > 0UL)
+	{
+		line[len ++] = digit[-- count];
+	}
+	return len;
+}
+
+/*
+ * the low width digits of value in upper case hex
+ */
+static uint32_t put_hex(char *line, uint32_t value, uint8_t width)
+{
+	static const char hex[] = "0123456789ABCDEF";
+	uint32_t index;
+
+	for(index = 0; index < width; index ++)
+	{
+		line[index] = hex[(value >> ((width - 1UL - index) * 4UL)) & 0x0F];
+	}
+	return width;
+}
+
+static int8_t hex_value(uint8_t c)
+{
+	if(c >= '0' && c <= '9')
+	{
+		return (int8_t)(c - '0');
+	}
+	if(c >= 'A' && c <= 'F')
+	{
+		return (int8_t)(c - 'A' + 10);
+	}
+	if(c >= 'a' && c <= 'f')
+	{
+		return (int8_t)(c - 'a' + 10);
+	}
+	return -1;
+}
+
+/*
+ * "(1436509052.249713) can0 7E0#0211223344556677", "7E0##1..." for CAN FD
+ */
+static uint32_t candump_line(char *line, const struct isotp_capture_rec_t *rec, uint32_t sec, uint32_t usec)
+{
+	uint32_t len = 0UL;
+	uint8_t index;
+
+	line[len ++] = '(';
+	len += put_dec(&line[len], sec, 10U);
+	line[len ++] = '.';
+	len += put_dec(&line[len], usec, 6U);
+	line[len ++] = ')';
+	line[len ++] = ' ';
+	memcpy(&line[len], ISOTP_CAPTURE_IFNAME, sizeof(ISOTP_CAPTURE_IFNAME) - 1UL);
+	len += sizeof(ISOTP_CAPTURE_IFNAME) - 1UL;
+	line[len ++] = ' ';
+	if(rec->id > CAPTURE_SFF_MASK)
+	{
+		len += put_hex(&line[len], rec->id & CAPTURE_EFF_MASK, 8U);
+	}
+	else
+	{
+		len += put_hex(&line[len], rec->id, 3U);
+	}
+	line[len ++] = '#';
+	if(rec->length > CAN_MAX_DL)
+	{
+		line[len ++] = '#';
+		len += put_hex(&line[len], CAPTURE_FD_BRS, 1U);
+	}
+	for(index = 0; index < rec->length; index ++)
+	{
+		len += put_hex(&line[len], rec->data[index], 2U);
+	}
+	line[len ++] = '\n';
+
+	return len;
+}
+
+/*
+ * pcap record header and the frame in the layout of struct canfd_frame,
+ * with the ID in network byte order
+ */
+static uint32_t pcap_record(uint8_t *data, const struct isotp_capture_rec_t *rec, uint32_t sec, uint32_t usec)
+{
+	uint32_t id = (rec->id > CAPTURE_SFF_MASK) ? ((rec->id & CAPTURE_EFF_MASK) | CAPTURE_EFF_FLAG) : rec->id;
+	uint32_t len = CAPTURE_CAN_HEADER + rec->length;
+	uint8_t *frame = &data[CAPTURE_PCAP_RECORD];
+
+	put_le32(&data[0], sec);
+	put_le32(&data[4], usec);
+	put_le32(&data[8], len);
+	put_le32(&data[12], len);
+	frame[0] = (uint8_t)(id >> 24);
+	frame[1] = (uint8_t)(id >> 16);
+	frame[2] = (uint8_t)(id >> 8);
+	frame[3] = (uint8_t)id;
+	frame[4] = rec->length;
+	frame[5] = (rec->length > CAN_MAX_DL) ? (CAPTURE_FD_FDF | CAPTURE_FD_BRS) : 0U;
+	frame[6] = 0U;
+	frame[7] = 0U;
+	memcpy(&frame[CAPTURE_CAN_HEADER], rec->data, rec->length);
+
+	return CAPTURE_PCAP_RECORD + len;
+}
+
+static ERROR_CODE candump_parse(const uint8_t *data, uint32_t len, struct isotp_capture_rec_t *rec, uint32_t *used)
+{
+	uint32_t index = 0UL, end, sec = 0UL, usec = 0UL, digits = 0UL;
+	int8_t high, low;
+
+	for(end = 0UL; end < len && data[end] != '\n'; end ++)
+	{
+	}
+	*used = (end < len) ? end + 1UL : end;
+	/* (sec.usec) */
+	while(index < end && data[index] == ' ')
+	{
+		index ++;
+	}
+	if(index == end || data[index] == '\r')
+	{
+		return ERR_EMPTY;
+	}
+	if(data[index ++] != '(')
+	{
+		return ERR_PARAMETER;
+	}
+	for(; index < end && data[index] >= '0' && data[index] <= '9'; index ++)
+	{
+		sec = sec * 10UL + (data[index] - '0');
+	}
+	if(index == end || data[index ++] != '.')
+	{
+		return ERR_PARAMETER;
+	}
+	for(; index < end && data[index] >= '0' && data[index] <= '9'; index ++)
+	{
+		/* only the first 6 digits, some logs have nanoseconds */
+		if(digits ++ < 6UL)
+		{
+			usec = usec * 10UL + (data[index] - '0');
+		}
+	}
+	for(; digits < 6UL; digits ++)
+	{
+		usec *= 10UL;
+	}
+	if(index == end || data[index ++] != ')')
+	{
+		return ERR_PARAMETER;
+	}
+	/* interface */
+	while(index < end && data[index] == ' ')
+	{
+		index ++;
+	}
+	while(index < end && data[index] != ' ')
+	{
+		index ++;
+	}
+	while(index < end && data[index] == ' ')
+	{
+		index ++;
+	}
+	/* ID#data or ID##<flags>data */
+	rec->id = 0UL;
+	for(digits = 0UL; index < end && hex_value(data[index]) >= 0; index ++, digits ++)
+	{
+		rec->id = (rec->id << 4) | (uint32_t)hex_value(data[index]);
+	}
+	if(digits == 0UL || digits > 8UL || index == end || data[index ++] != '#')
+	{
+		return ERR_PARAMETER;
+	}
+	if(index < end && data[index] == '#')
+	{
+		index += 2UL;
+	}
+	else if(index < end && (data[index] == 'R' || data[index] == 'r'))
+	{
+		/* remote frames carry no ISO-TP data */
+		return ERR_EMPTY;
+	}
+	for(rec->length = 0U; index + 1UL < end && rec->length < CANFD_MAX_DL; index += 2UL)
+	{
+		high = hex_value(data[index]);
+		low = hex_value(data[index + 1UL]);
+		if(high < 0 || low < 0)
+		{
+			break;
+		}
+		rec->data[rec->length ++] = (uint8_t)((high << 4) | low);
+	}
+	rec->time_us = sec * 1000000UL + usec;
+
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE pcap_parse(const uint8_t *data, uint32_t len, struct isotp_capture_rec_t *rec, uint32_t *used)
+{
+	uint32_t incl, id;
+	const uint8_t *frame = &data[CAPTURE_PCAP_RECORD];
+
+	if(len >= ISOTP_CAPTURE_PCAP_HEADER && get_le32(data) == CAPTURE_PCAP_MAGIC)
+	{
+		*used = ISOTP_CAPTURE_PCAP_HEADER;
+		return (get_le32(&data[20]) == ISOTP_CAPTURE_LINKTYPE) ? ERR_EMPTY : ERR_PARAMETER;
+	}
+	if(len < CAPTURE_PCAP_RECORD)
+	{
+		*used = len;
+		return ERR_PARAMETER;
+	}
+	incl = get_le32(&data[8]);
+	if(incl > len - CAPTURE_PCAP_RECORD)
+	{
+		*used = len;
+		return ERR_PARAMETER;
+	}
+	*used = CAPTURE_PCAP_RECORD + incl;
+	if(incl < CAPTURE_CAN_HEADER || frame[4] > CANFD_MAX_DL || frame[4] > incl - CAPTURE_CAN_HEADER)
+	{
+		return ERR_PARAMETER;
+	}
+	id = ((uint32_t)frame[0] << 24) | ((uint32_t)frame[1] << 16) | ((uint32_t)frame[2] << 8) | frame[3];
+	rec->id = (id & CAPTURE_EFF_FLAG) ? (id & CAPTURE_EFF_MASK) : (id & CAPTURE_SFF_MASK);
+	rec->length = frame[4];
+	memcpy(rec->data, &frame[CAPTURE_CAN_HEADER], rec->length);
+	rec->time_us = get_le32(data) * 1000000UL + get_le32(&data[4]);
+
+	return STATUS_NORMAL;
+}
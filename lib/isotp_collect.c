@@ -0,0 +1,401 @@
+#include "isotp_collect.h"
+#include <string.h>
+
+static Bool window_open(struct isotp_collect_t *collect);
+static Bool frame_starts(const struct phy_msg_t *frame);
+static void responder_open(struct isotp_collect_t *collect, struct isotp_responder_t *responder, uint32_t id);
+static ERROR_CODE responder_done(struct isotp_t *msg);
+
+/*
+ * initialize a collector
+ *
+ * @parameter in:
+ * collect:     object
+ * responder:   responder table, one entry per ECU that may answer
+ * route:       route table of as many entries
+ * size:        entries in responder and route
+ * buffer:      size * buffer_len bytes, a response is received into
+ *              buffer_len of them
+ * buffer_len:  longest response
+ * phy_send:    send data function in data link layer
+ * phy_receive: receive data function in data link layer
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_collect_init(struct isotp_collect_t *collect,
+							struct isotp_responder_t *responder,
+							struct isotp_route_t *route,
+							uint16_t size,
+							uint8_t *buffer,
+							uint32_t buffer_len,
+							isotp_transfer phy_send,
+							isotp_transfer phy_receive)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	for(;;)
+	{
+		if(collect == NULL || responder == NULL || route == NULL || buffer == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		if(size == 0UL || buffer_len == 0UL)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		/* the request channel receives nothing */
+		err = isotp_init(&collect->request, ISOTP_NO_ID, ISOTP_NO_ID, NULL, phy_send, phy_receive);
+		if(err != STATUS_NORMAL)
+		{
+			break;
+		}
+		isotp_dispatch_init(&collect->bus, route, size, phy_receive);
+		collect->responder = responder;
+		collect->size = size;
+		collect->count = 0UL;
+		collect->done = 0UL;
+		collect->expected = 0UL;
+		collect->buffer = buffer;
+		collect->buffer_len = buffer_len;
+		collect->resp_id = 0UL;
+		collect->resp_mask = 0UL;
+		collect->physical = NULL;
+		collect->response_cb = NULL;
+		collect->state = ISOTP_COLLECT_IDLE;
+		xtimer_delete(&collect->window);
+		collect->window_ms = 0UL;
+		collect->start_us = 0UL;
+		collect->end_us = 0UL;
+		collect->late = 0UL;
+		collect->overflow = 0UL;
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * set the IDs of the request and of the responses
+ *
+ * @parameter in:
+ * collect:       object
+ * functional_id: ID the request is sent to
+ * resp_id:       frames with (id & resp_mask) == resp_id are responses,
+ *                each ID is one ECU
+ * resp_mask:     bits of resp_id to match
+ * physical:      the physical request ID of the ECU answering on an ID,
+ *                the FCs of its response go there
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_collect_id_set(struct isotp_collect_t *collect,
+							uint32_t functional_id,
+							uint32_t resp_id,
+							uint32_t resp_mask,
+							isotp_collect_map physical)
+{
+	if(collect == NULL || physical == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	collect->request.isotp.N_TA = functional_id;
+	collect->resp_id = resp_id & resp_mask;
+	collect->resp_mask = resp_mask;
+	collect->physical = physical;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * set the function called when a response ended
+ *
+ * @parameter in:
+ * collect:     object
+ * response_cb: called with the responder, result in channel.rx.reply,
+ *              may be NULL
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_collect_cb_set(struct isotp_collect_t *collect, isotp_collect_cb response_cb)
+{
+	if(collect == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	collect->response_cb = response_cb;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * send a functional request and start collecting the responses, the
+ * responders of the request before are dropped
+ *
+ * @parameter in:
+ * collect:     object
+ * req:         request, lent until it is sent
+ * len:         bytes of the request, up to a SingleFrame
+ * expected:    responses that end the collection before the window,
+ *              0 to wait for the window
+ * window_ms:   time the first frames of the responses are accepted,
+ *              from the request and from the last frame of a response
+ * @parameter out:
+ * operation status return, ERR_FULL while a collection is in progress,
+ * ERR_PARAMETER if the request takes more than a SingleFrame
+ */
+ERROR_CODE isotp_collect_start(struct isotp_collect_t *collect,
+							const uint8_t *req,
+							uint32_t len,
+							uint16_t expected,
+							uint32_t window_ms)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	for(;;)
+	{
+		if(collect == NULL || req == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		if(len == 0UL || collect->physical == NULL)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		if(collect->state == ISOTP_COLLECT_WAIT)
+		{
+			err = ERR_FULL;
+			break;
+		}
+		isotp_dispatch_init(&collect->bus, collect->bus.route, collect->size, collect->bus.phy_receive);
+		collect->count = 0UL;
+		collect->done = 0UL;
+		collect->expected = expected;
+		collect->late = 0UL;
+		collect->overflow = 0UL;
+		/* the channel only reads the request */
+		collect->req_iov.base = (uint8_t *)req;
+		collect->req_iov.len = len;
+		isotp_tx_iov_set(&collect->request, &collect->req_iov, 1U);
+		collect->request.tx.DL = len;
+		collect->window_ms = window_ms;
+		collect->start_us = timer_us();
+		collect->state = ISOTP_COLLECT_WAIT;
+		/* a response may come before the send returns */
+		timer_add(&collect->window);
+		err = isotp_functional_send(&collect->request);
+		if(err != STATUS_NORMAL)
+		{
+			xtimer_delete(&collect->window);
+			collect->state = ISOTP_COLLECT_IDLE;
+		}
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * pass a frame received from the bus to the responder of its ID, the
+ * first frame of a response in the window takes a free responder
+ *
+ * @parameter in:
+ * collect:     object
+ * frame:       frame received from the bus
+ * @parameter out:
+ * status of isotp_on_frame(), ERR_NOT_FOUND if the frame is no response
+ * or came too late, ERR_FULL if no responder was left for it
+ */
+ERROR_CODE isotp_collect_frame(struct isotp_collect_t *collect, const struct phy_msg_t *frame)
+{
+	struct isotp_responder_t *responder;
+
+	if(collect == NULL || frame == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if((frame->id & collect->resp_mask) != collect->resp_id || collect->physical == NULL)
+	{
+		return ERR_NOT_FOUND;
+	}
+	/* the channel is the first member of its responder */
+	responder = (struct isotp_responder_t *)isotp_dispatch_find(&collect->bus, frame);
+	if(responder == NULL)
+	{
+		if(frame_starts(frame) == FALSE)
+		{
+			collect->bus.unrouted++;
+			return ERR_NOT_FOUND;
+		}
+		if(collect->state != ISOTP_COLLECT_WAIT || window_open(collect) == FALSE)
+		{
+			collect->late++;
+			return ERR_NOT_FOUND;
+		}
+		if(collect->count >= collect->size)
+		{
+			collect->overflow++;
+			return ERR_FULL;
+		}
+		responder = &collect->responder[collect->count];
+		responder_open(collect, responder, frame->id);
+		collect->count++;
+	}
+	else if(responder->done == TRUE && frame_starts(frame) == TRUE
+			&& collect->state == ISOTP_COLLECT_WAIT)
+	{
+		/* the ECU answers again, the final response after a NRC 0x78 */
+		responder->done = FALSE;
+		collect->done--;
+	}
+	/* an ECU may still be losing the arbitration to those sending */
+	if(collect->state == ISOTP_COLLECT_WAIT && window_open(collect) == TRUE)
+	{
+		timer_add(&collect->window);
+	}
+
+	return isotp_on_frame(&responder->channel, frame);
+}
+
+/*
+ * pass every frame pending in phy_receive to isotp_collect_frame()
+ *
+ * @parameter in:
+ * collect:     object
+ * @parameter out:
+ * operation status return, ERR_EMPTY if no frame was pending
+ */
+ERROR_CODE isotp_collect_receive(struct isotp_collect_t *collect)
+{
+	ERROR_CODE err = ERR_EMPTY;
+	struct phy_msg_t frame;
+
+	if(collect == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	while(collect->request.isotp.phy_receive(&frame) == STATUS_NORMAL)
+	{
+		isotp_collect_frame(collect, &frame);
+		err = STATUS_NORMAL;
+	}
+
+	return err;
+}
+
+/*
+ * handle the timeouts of the responders and end the collection
+ *
+ * @parameter in:
+ * collect:     object
+ * @parameter out:
+ * milliseconds until the collector needs to be polled again,
+ * ISOTP_WAIT_FOREVER if only a frame can change its state
+ */
+uint32_t isotp_collect_poll(struct isotp_collect_t *collect)
+{
+	uint32_t wait, next;
+
+	if(collect == NULL)
+	{
+		return ISOTP_WAIT_FOREVER;
+	}
+	wait = isotp_dispatch_poll(&collect->bus);
+	next = isotp_poll(&collect->request);
+	if(next < wait)
+	{
+		wait = next;
+	}
+	if(collect->state != ISOTP_COLLECT_WAIT)
+	{
+		return wait;
+	}
+	if((collect->expected != 0UL && collect->done >= collect->expected)
+		|| (window_open(collect) == FALSE && collect->done == collect->count))
+	{
+		xtimer_delete(&collect->window);
+		collect->end_us = timer_us();
+		collect->state = ISOTP_COLLECT_DONE;
+		return wait;
+	}
+	/* after the window the N_Cr of the responders is what is left */
+	next = timer_remain(&collect->window, collect->window_ms);
+	if(next < wait)
+	{
+		wait = next;
+	}
+
+	return wait;
+}
+
+/*
+ * the window is closed once it is over, so its time is only waited for once
+ */
+static Bool window_open(struct isotp_collect_t *collect)
+{
+	if(timer_is_added(&collect->window) == FALSE)
+	{
+		return FALSE;
+	}
+	if(timer_overflow(&collect->window, collect->window_ms) == TRUE)
+	{
+		xtimer_delete(&collect->window);
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/*
+ * a SingleFrame or FirstFrame, with normal addressing
+ */
+static Bool frame_starts(const struct phy_msg_t *frame)
+{
+	if(frame->length == 0UL)
+	{
+		return FALSE;
+	}
+	return ((frame->data[0] & 0xE0U) == 0x00U) ? TRUE : FALSE;
+}
+
+/*
+ * a responder receiving from id, as the request channel is set
+ */
+static void responder_open(struct isotp_collect_t *collect, struct isotp_responder_t *responder, uint32_t id)
+{
+	struct isotp_t *request = &collect->request;
+	struct isotp_t *channel = &responder->channel;
+
+	isotp_init(channel, id, collect->physical(id), NULL, request->isotp.phy_send, request->isotp.phy_receive);
+	isotp_dl_set(channel, request->TX_DL);
+	isotp_rx_buffer_set(channel, collect->buffer + (uint32_t)(responder - collect->responder) * collect->buffer_len,
+			collect->buffer_len);
+	fc_set(channel, request->FS, request->BS, request->STmin);
+	isotp_cb_set(channel, responder_done, NULL);
+	responder->collect = collect;
+	responder->done = FALSE;
+	responder->responses = 0U;
+	responder->time_us = 0UL;
+	isotp_dispatch_add(&collect->bus, channel);
+}
+
+static ERROR_CODE responder_done(struct isotp_t *msg)
+{
+	struct isotp_responder_t *responder = (struct isotp_responder_t *)msg;
+	struct isotp_collect_t *collect = responder->collect;
+
+	responder->responses++;
+	responder->time_us = timer_us() - collect->start_us;
+	if(responder->done == FALSE)
+	{
+		responder->done = TRUE;
+		collect->done++;
+	}
+	if(collect->response_cb != NULL)
+	{
+		collect->response_cb(collect, responder);
+	}
+	return STATUS_NORMAL;
+}
@@ -0,0 +1,451 @@
+#include "isotp_dispatch.h"
+#include <string.h>
+
+static int32_t route_cmp(const struct isotp_route_t *route, uint32_t id, uint16_t ae, Bool functional);
+static uint16_t route_search(struct isotp_dispatch_t *bus, uint32_t id, uint16_t ae, Bool functional, Bool *found);
+static uint16_t route_lookup(struct isotp_dispatch_t *bus, const struct phy_msg_t *frame, Bool functional, Bool *found);
+static void route_insert(struct isotp_dispatch_t *bus, uint16_t index, uint32_t id, uint16_t ae,
+							Bool functional, struct isotp_t *channel);
+static void route_delete(struct isotp_dispatch_t *bus, uint16_t index);
+static uint16_t channel_ae(struct isotp_t *channel);
+
+/*
+ * initialize a dispatcher over a route table
+ *
+ * @parameter in:
+ * bus:         object
+ * route:       route table, one entry per channel, two for a channel
+ *              with a functional ID
+ * size:        entries in route
+ * phy_receive: receive data function in data link layer, may be NULL
+ *              when frames are passed with isotp_dispatch_frame() only
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_dispatch_init(struct isotp_dispatch_t *bus,
+							struct isotp_route_t *route,
+							uint16_t size,
+							isotp_transfer phy_receive)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(bus == NULL || route == NULL)
+	{
+		err = ERR_POINTER_0;
+	}
+	else if(size == 0UL)
+	{
+		err = ERR_PARAMETER;
+	}
+	else
+	{
+		bus->route = route;
+		bus->size = size;
+		bus->count = 0UL;
+		bus->phy_receive = phy_receive;
+		bus->phy_receive_batch = NULL;
+		bus->batch = NULL;
+		bus->batch_size = 0UL;
+		bus->unrouted = 0UL;
+	}
+
+	return err;
+}
+
+/*
+ * fetch the frames with a vectored receive function
+ *
+ * @parameter in:
+ * bus:               object
+ * phy_receive_batch: vectored receive function, NULL to use phy_receive
+ * batch:             frames lent for one call
+ * size:              frames in batch
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_dispatch_batch_set(struct isotp_dispatch_t *bus,
+							isotp_transfer_batch phy_receive_batch,
+							struct phy_msg_t *batch,
+							uint32_t size)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	if(bus == NULL)
+	{
+		err = ERR_POINTER_0;
+	}
+	else if(phy_receive_batch != NULL && (batch == NULL || size == 0UL))
+	{
+		err = ERR_PARAMETER;
+	}
+	else
+	{
+		bus->phy_receive_batch = phy_receive_batch;
+		bus->batch = batch;
+		bus->batch_size = size;
+	}
+
+	return err;
+}
+
+/*
+ * route the frames of a channel through the dispatcher, by its N_SA
+ * and addressing set with isotp_init() and isotp_addr_set(), and by its
+ * functional ID if isotp_functional_set() gave it one
+ *
+ * @parameter in:
+ * bus:       object
+ * channel:   initialized channel
+ * @parameter out:
+ * operation status return, ERR_PARAMETER if another channel
+ * already receives the same CAN ID and address byte
+ */
+ERROR_CODE isotp_dispatch_add(struct isotp_dispatch_t *bus, struct isotp_t *channel)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	uint16_t index;
+	uint16_t ae;
+	uint16_t need = 1UL;
+	Bool found;
+
+	for(;;)
+	{
+		if(bus == NULL || channel == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		if(channel->isotp.N_FA != ISOTP_NO_ID)
+		{
+			need ++;
+		}
+		if(bus->count + need > bus->size)
+		{
+			err = ERR_FULL;
+			break;
+		}
+		ae = channel_ae(channel);
+		index = route_search(bus, channel->isotp.N_SA, ae, FALSE, &found);
+		if(found == TRUE)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		route_insert(bus, index, channel->isotp.N_SA, ae, FALSE, channel);
+		if(channel->isotp.N_FA != ISOTP_NO_ID)
+		{
+			/* behind the channels that share the functional ID already */
+			index = route_search(bus, channel->isotp.N_FA, ae, TRUE, &found);
+			while(index < bus->count
+				&& route_cmp(&bus->route[index], channel->isotp.N_FA, ae, TRUE) == 0L)
+			{
+				index ++;
+			}
+			route_insert(bus, index, channel->isotp.N_FA, ae, TRUE, channel);
+		}
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * stop routing frames to a channel
+ *
+ * @parameter in:
+ * bus:       object
+ * channel:   channel added with isotp_dispatch_add()
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_dispatch_remove(struct isotp_dispatch_t *bus, struct isotp_t *channel)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	uint16_t index;
+	Bool found;
+
+	for(;;)
+	{
+		if(bus == NULL || channel == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		index = route_search(bus, channel->isotp.N_SA, channel_ae(channel), FALSE, &found);
+		if(found == FALSE || bus->route[index].channel != channel)
+		{
+			err = ERR_NOT_FOUND;
+			break;
+		}
+		route_delete(bus, index);
+		/* the functional route, whatever N_FA is now */
+		for(index = 0UL; index < bus->count; index ++)
+		{
+			if(bus->route[index].functional == TRUE && bus->route[index].channel == channel)
+			{
+				route_delete(bus, index);
+				break;
+			}
+		}
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * look up the channel of a frame by its physical route, a channel with
+ * extended or mixed addressing takes precedence over one with normal
+ * addressing on the same ID
+ *
+ * @parameter in:
+ * bus:       object
+ * frame:     frame received from the bus
+ * @parameter out:
+ * the channel, NULL if no channel receives the frame on its N_SA
+ */
+struct isotp_t *isotp_dispatch_find(struct isotp_dispatch_t *bus, const struct phy_msg_t *frame)
+{
+	uint16_t index;
+	Bool found;
+
+	if(bus == NULL || frame == NULL)
+	{
+		return NULL;
+	}
+	index = route_lookup(bus, frame, FALSE, &found);
+
+	return (found == TRUE) ? bus->route[index].channel : NULL;
+}
+
+/*
+ * pass a frame received from the bus to its channel, or to every channel
+ * listening to its functional ID
+ *
+ * @parameter in:
+ * bus:       object
+ * frame:     frame received from the bus
+ * @parameter out:
+ * status of isotp_on_frame(), of the last channel for a functional frame,
+ * ERR_NOT_FOUND if no channel receives the frame
+ */
+ERROR_CODE isotp_dispatch_frame(struct isotp_dispatch_t *bus, const struct phy_msg_t *frame)
+{
+	ERROR_CODE err;
+	struct isotp_t *channel;
+	struct isotp_route_t first;
+	uint16_t index;
+	Bool found;
+
+	if(bus == NULL || frame == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	channel = isotp_dispatch_find(bus, frame);
+	if(channel != NULL)
+	{
+		return isotp_on_frame(channel, frame);
+	}
+	index = route_lookup(bus, frame, TRUE, &found);
+	if(found == FALSE)
+	{
+		bus->unrouted++;
+		return ERR_NOT_FOUND;
+	}
+	first = bus->route[index];
+	do
+	{
+		err = isotp_on_frame(bus->route[index].channel, frame);
+		index ++;
+	}
+	while(index < bus->count && route_cmp(&bus->route[index], first.id, first.ae, TRUE) == 0L);
+
+	return err;
+}
+
+/*
+ * pass every frame pending in phy_receive, or phy_receive_batch, to its
+ * channel
+ *
+ * @parameter in:
+ * bus:       object
+ * @parameter out:
+ * operation status return, ERR_EMPTY if no frame was pending
+ */
+ERROR_CODE isotp_dispatch_receive(struct isotp_dispatch_t *bus)
+{
+	ERROR_CODE err = ERR_EMPTY;
+	struct phy_msg_t frame;
+	uint32_t index, done;
+
+	if(bus == NULL || (bus->phy_receive == NULL && bus->phy_receive_batch == NULL))
+	{
+		return ERR_POINTER_0;
+	}
+	if(bus->phy_receive_batch != NULL)
+	{
+		for(;;)
+		{
+			done = 0UL;
+			bus->phy_receive_batch(bus->batch, bus->batch_size, &done);
+			if(done > bus->batch_size)
+			{
+				done = bus->batch_size;
+			}
+			if(done == 0UL)
+			{
+				break;
+			}
+			for(index = 0UL; index < done; index ++)
+			{
+				isotp_dispatch_frame(bus, &bus->batch[index]);
+			}
+			err = STATUS_NORMAL;
+			/* a short batch emptied the driver */
+			if(done < bus->batch_size)
+			{
+				break;
+			}
+		}
+		return err;
+	}
+	while(bus->phy_receive(&frame) == STATUS_NORMAL)
+	{
+		isotp_dispatch_frame(bus, &frame);
+		err = STATUS_NORMAL;
+	}
+
+	return err;
+}
+
+/*
+ * handle timeouts and STmin pacing of every channel
+ *
+ * @parameter in:
+ * bus:       object
+ * @parameter out:
+ * milliseconds until the earliest channel needs to be polled again,
+ * ISOTP_WAIT_FOREVER if none has a pending timeout
+ */
+uint32_t isotp_dispatch_poll(struct isotp_dispatch_t *bus)
+{
+	uint32_t wait = ISOTP_WAIT_FOREVER;
+	uint32_t next;
+	uint16_t index;
+
+	if(bus == NULL)
+	{
+		return wait;
+	}
+	for(index = 0UL; index < bus->count; index++)
+	{
+		/* a channel with a functional route is polled by its physical one */
+		if(bus->route[index].functional == TRUE)
+		{
+			continue;
+		}
+		next = isotp_poll(bus->route[index].channel);
+		if(next < wait)
+		{
+			wait = next;
+		}
+	}
+
+	return wait;
+}
+
+/*
+ * order of a route against a key, by ID first, then by address byte,
+ * a physical route before a functional one
+ */
+static int32_t route_cmp(const struct isotp_route_t *route, uint32_t id, uint16_t ae, Bool functional)
+{
+	if(route->id != id)
+	{
+		return (route->id < id) ? -1L : 1L;
+	}
+	if(route->ae != ae)
+	{
+		return (int32_t)route->ae - (int32_t)ae;
+	}
+	return (int32_t)route->functional - (int32_t)functional;
+}
+
+/*
+ * binary search of a key in the route table
+ * returns the index of the first route of the key if found, the insertion
+ * index otherwise
+ */
+static uint16_t route_search(struct isotp_dispatch_t *bus, uint32_t id, uint16_t ae, Bool functional, Bool *found)
+{
+	uint16_t low = 0UL;
+	uint16_t high = bus->count;
+	uint16_t mid;
+
+	while(low < high)
+	{
+		mid = low + (high - low) / 2UL;
+		if(route_cmp(&bus->route[mid], id, ae, functional) < 0L)
+		{
+			low = mid + 1UL;
+		}
+		else
+		{
+			high = mid;
+		}
+	}
+	*found = (low < bus->count && route_cmp(&bus->route[low], id, ae, functional) == 0L) ? TRUE : FALSE;
+
+	return low;
+}
+
+/*
+ * the first route of a frame, by its address byte first, then with normal
+ * addressing
+ */
+static uint16_t route_lookup(struct isotp_dispatch_t *bus, const struct phy_msg_t *frame, Bool functional, Bool *found)
+{
+	uint16_t index;
+
+	*found = FALSE;
+	if(frame->length > 1UL)
+	{
+		index = route_search(bus, frame->id, frame->data[0], functional, found);
+	}
+	if(*found == FALSE)
+	{
+		index = route_search(bus, frame->id, ISOTP_DISPATCH_NO_AE, functional, found);
+	}
+
+	return index;
+}
+
+/*
+ * keep the table sorted
+ */
+static void route_insert(struct isotp_dispatch_t *bus, uint16_t index, uint32_t id, uint16_t ae,
+							Bool functional, struct isotp_t *channel)
+{
+	memmove(&bus->route[index + 1UL], &bus->route[index],
+			(bus->count - index) * sizeof(struct isotp_route_t));
+	bus->route[index].id = id;
+	bus->route[index].ae = ae;
+	bus->route[index].functional = functional;
+	bus->route[index].channel = channel;
+	bus->count++;
+}
+
+static void route_delete(struct isotp_dispatch_t *bus, uint16_t index)
+{
+	bus->count--;
+	memmove(&bus->route[index], &bus->route[index + 1UL],
+			(bus->count - index) * sizeof(struct isotp_route_t));
+}
+
+/*
+ * route key of the address byte of a channel
+ */
+static uint16_t channel_ae(struct isotp_t *channel)
+{
+	return (channel->isotp.addr_len != 0UL) ? channel->isotp.rx_ae : ISOTP_DISPATCH_NO_AE;
+}
@@ -0,0 +1,149 @@
+#include "isotp_fc.h"
+
+/* the longest separation time the low CPU policy asks for, in ms */
+#define FC_STMIN_MAX		(10UL)
+/* largest block of the memory policy */
+#define FC_MEMORY_BS		(8UL)
+/* largest block a FC can give */
+#define FC_BS_MAX			(0xFFUL)
+
+static uint32_t frames_left(const struct isotp_fc_state_t *state);
+static uint32_t fc_room(const struct isotp_fc_state_t *state);
+static uint8_t block_size(const struct isotp_fc_state_t *state, uint32_t room);
+
+/*
+ * CFs still to come
+ */
+static uint32_t frames_left(const struct isotp_fc_state_t *state)
+{
+	if(state->cf_len == 0UL)
+	{
+		return 0UL;
+	}
+	return (state->rest + state->cf_len - 1UL) / state->cf_len;
+}
+
+/*
+ * CFs the storage and the receive queue take now,
+ * ISOTP_FC_UNKNOWN if neither is limited
+ */
+static uint32_t fc_room(const struct isotp_fc_state_t *state)
+{
+	uint32_t room = ISOTP_FC_UNKNOWN;
+	uint32_t frames;
+
+	if(state->space != ISOTP_FC_UNKNOWN && state->space < state->rest)
+	{
+		room = (state->cf_len != 0UL) ? state->space / state->cf_len : 0UL;
+	}
+	if(state->queue_size != 0UL)
+	{
+		frames = (state->queue_depth < state->queue_size) ? state->queue_size - state->queue_depth : 0UL;
+		if(frames < room)
+		{
+			room = frames;
+		}
+	}
+	return room;
+}
+
+/*
+ * BS for room CFs, 0 when the rest of the message fits
+ */
+static uint8_t block_size(const struct isotp_fc_state_t *state, uint32_t room)
+{
+	if(room >= frames_left(state))
+	{
+		return 0UL;
+	}
+	return (room > FC_BS_MAX) ? FC_BS_MAX : (uint8_t)room;
+}
+
+/*
+ * send as fast as the room left allows
+ *
+ * @parameter in:
+ * state:     what the channel and the probe know
+ * fc:        the values of fc_set()
+ * @parameter out:
+ * fc:        the FC to send
+ */
+void isotp_fc_max_throughput(const struct isotp_fc_state_t *state, struct isotp_fc_t *fc)
+{
+	uint32_t room = fc_room(state);
+
+	if(room == 0UL)
+	{
+		fc->FS = ISOTP_FS_WAIT;
+		return;
+	}
+	fc->FS = ISOTP_FS_CTS;
+	fc->BS = block_size(state, room);
+	fc->STmin = 0UL;
+}
+
+/*
+ * spread the frames when the receiving task gets busy
+ *
+ * @parameter in:
+ * state:     what the channel and the probe know
+ * fc:        the values of fc_set()
+ * @parameter out:
+ * fc:        the FC to send
+ */
+void isotp_fc_low_cpu(const struct isotp_fc_state_t *state, struct isotp_fc_t *fc)
+{
+	uint32_t room = fc_room(state);
+	uint32_t load = (state->cpu_load > 1000UL) ? 1000UL : state->cpu_load;
+	uint32_t stmin;
+
+	if(room == 0UL || load >= ISOTP_FC_LOAD_HIGH)
+	{
+		fc->FS = ISOTP_FS_WAIT;
+		return;
+	}
+	fc->FS = ISOTP_FS_CTS;
+	fc->BS = block_size(state, room);
+	if(load > ISOTP_FC_LOAD_LOW)
+	{
+		/* from 1 ms just above the low mark to FC_STMIN_MAX at full load */
+		stmin = 1UL + (load - ISOTP_FC_LOAD_LOW) * (FC_STMIN_MAX - 1UL) / (1000UL - ISOTP_FC_LOAD_LOW);
+		/* the 100 us steps of 0xF1-0xF9 are below 1 ms */
+		if(fc->STmin > 0x7F || fc->STmin < stmin)
+		{
+			fc->STmin = (uint8_t)stmin;
+		}
+	}
+}
+
+/*
+ * keep little data buffered: small blocks, never all of the free space
+ *
+ * @parameter in:
+ * state:     what the channel and the probe know
+ * fc:        the values of fc_set()
+ * @parameter out:
+ * fc:        the FC to send
+ */
+void isotp_fc_memory(const struct isotp_fc_state_t *state, struct isotp_fc_t *fc)
+{
+	uint32_t room = fc_room(state);
+	uint32_t frames;
+
+	if(state->queue_size != 0UL && room != 0UL)
+	{
+		/* leave half of the free queue to the other channels */
+		frames = (state->queue_size - state->queue_depth + 1UL) / 2UL;
+		if(frames < room)
+		{
+			room = frames;
+		}
+	}
+	if(room == 0UL)
+	{
+		fc->FS = ISOTP_FS_WAIT;
+		return;
+	}
+	fc->FS = ISOTP_FS_CTS;
+	fc->BS = (room > FC_MEMORY_BS) ? FC_MEMORY_BS : (uint8_t)room;
+}
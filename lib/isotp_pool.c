@@ -0,0 +1,203 @@
+#include "isotp_pool.h"
+#include <string.h>
+
+static uint8_t *block_get(struct isotp_pool_t *pool);
+static void block_put(struct isotp_pool_t *pool, uint8_t *block);
+
+/*
+ * initialize a pool
+ *
+ * @parameter in:
+ * pool:        object
+ * ctx:         contexts, one per message received at the same time
+ * ctx_count:   entries in ctx
+ * blocks:      block_count * block_size bytes
+ * block_size:  bytes of a block, at least a pointer
+ * block_count: blocks shared by the contexts
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_pool_init(struct isotp_pool_t *pool,
+							struct isotp_pool_ctx_t *ctx,
+							uint16_t ctx_count,
+							uint8_t *blocks,
+							uint32_t block_size,
+							uint32_t block_count)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	uint32_t index;
+
+	for(;;)
+	{
+		if(pool == NULL || ctx == NULL || blocks == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		/* a free block keeps the free list in its first bytes */
+		if(ctx_count == 0UL || block_count == 0UL || block_size < sizeof(uint8_t *))
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		pool->free_ctx = NULL;
+		for(index = ctx_count; index > 0UL; index --)
+		{
+			ctx[index - 1UL].next = pool->free_ctx;
+			ctx[index - 1UL].count = 0U;
+			pool->free_ctx = &ctx[index - 1UL];
+		}
+		pool->free_block = NULL;
+		pool->block_size = block_size;
+		for(index = block_count; index > 0UL; index --)
+		{
+			block_put(pool, blocks + (index - 1UL) * block_size);
+		}
+		pool->ctx_count = ctx_count;
+		pool->ctx_used = 0U;
+		pool->ctx_peak = 0U;
+		pool->block_count = block_count;
+		pool->block_used = 0UL;
+		pool->block_peak = 0UL;
+		pool->taken = 0UL;
+		pool->full = 0UL;
+		pool->too_long = 0UL;
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * receive the messages of a channel into blocks of a pool, instead of the
+ * lent rx buffer
+ *
+ * @parameter in:
+ * msg:       object
+ * pool:      pool shared with the other channels of the task, NULL to go
+ *            back to a buffer lent with isotp_rx_buffer_set()
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_pool_set(struct isotp_t *msg, struct isotp_pool_t *pool)
+{
+	if(msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(msg->pool_ctx != NULL)
+	{
+		isotp_pool_give(msg);
+	}
+	msg->pool = pool;
+	if(pool == NULL)
+	{
+		/* rx.buffer still holds the buffer lent before the pool */
+		return isotp_rx_buffer_set(msg, msg->rx.buffer.base, msg->rx.buffer.len);
+	}
+	isotp_rx_iov_set(msg, NULL, 0U);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * take a context and the blocks for DL bytes, a context still held from a
+ * message given up for a new SF or FF is given back first
+ *
+ * @parameter in:
+ * msg:       object, with a pool
+ * DL:        length of the message
+ * @parameter out:
+ * operation status return, ERR_FULL if the pool has no context or not
+ * enough blocks left, ERR_PARAMETER if DL takes more than
+ * ISOTP_POOL_SEGMENTS blocks
+ */
+ERROR_CODE isotp_pool_take(struct isotp_t *msg, uint32_t DL)
+{
+	struct isotp_pool_t *pool = msg->pool;
+	struct isotp_pool_ctx_t *ctx;
+	uint32_t count, index;
+
+	if(msg->pool_ctx != NULL)
+	{
+		isotp_pool_give(msg);
+	}
+	/* no overflow for the 32 bit FF_DL of the escape sequence */
+	count = DL / pool->block_size + ((DL % pool->block_size != 0UL) ? 1UL : 0UL);
+	if(count > ISOTP_POOL_SEGMENTS)
+	{
+		pool->too_long ++;
+		return ERR_PARAMETER;
+	}
+	if(pool->free_ctx == NULL || count > pool->block_count - pool->block_used)
+	{
+		pool->full ++;
+		return ERR_FULL;
+	}
+	ctx = pool->free_ctx;
+	pool->free_ctx = ctx->next;
+	for(index = 0; index < count; index ++)
+	{
+		ctx->iov[index].base = block_get(pool);
+		ctx->iov[index].len = pool->block_size;
+	}
+	/* the last block holds the rest */
+	ctx->iov[count - 1UL].len = DL - (count - 1UL) * pool->block_size;
+	ctx->count = (uint8_t)count;
+	pool->ctx_used ++;
+	pool->block_used += count;
+	if(pool->ctx_used > pool->ctx_peak)
+	{
+		pool->ctx_peak = pool->ctx_used;
+	}
+	if(pool->block_used > pool->block_peak)
+	{
+		pool->block_peak = pool->block_used;
+	}
+	pool->taken ++;
+	msg->pool_ctx = ctx;
+	isotp_rx_iov_set(msg, ctx->iov, ctx->count);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * give the context and blocks of the channel back to its pool
+ *
+ * @parameter in:
+ * msg:       object, holding a context
+ */
+void isotp_pool_give(struct isotp_t *msg)
+{
+	struct isotp_pool_t *pool = msg->pool;
+	struct isotp_pool_ctx_t *ctx = msg->pool_ctx;
+	uint8_t index;
+
+	for(index = 0; index < ctx->count; index ++)
+	{
+		block_put(pool, ctx->iov[index].base);
+	}
+	pool->block_used -= ctx->count;
+	pool->ctx_used --;
+	ctx->count = 0U;
+	ctx->next = pool->free_ctx;
+	pool->free_ctx = ctx;
+	msg->pool_ctx = NULL;
+	isotp_rx_iov_set(msg, NULL, 0U);
+}
+
+static uint8_t *block_get(struct isotp_pool_t *pool)
+{
+	uint8_t *block = pool->free_block;
+
+	/* the blocks need no alignment for the link */
+	memcpy(&pool->free_block, block, sizeof(uint8_t *));
+
+	return block;
+}
+
+static void block_put(struct isotp_pool_t *pool, uint8_t *block)
+{
+	memcpy(block, &pool->free_block, sizeof(uint8_t *));
+	pool->free_block = block;
+}
@@ -0,0 +1,115 @@
+#include "isotp_stats.h"
+#include <string.h>
+
+/*
+ * count the events of a channel, NULL to stop. The counts go on from what
+ * stats holds, so one object can follow a channel across isotp_init(),
+ * isotp_stats_reset() clears it
+ *
+ * @parameter in:
+ * msg:       object
+ * stats:     storage lent by the application
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE isotp_stats_set(struct isotp_t *msg, struct isotp_stats_t *stats)
+{
+	if(msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	msg->isotp.stats = stats;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * clear the counters and the histograms, a message in progress is counted
+ * from its next event
+ */
+void isotp_stats_reset(struct isotp_stats_t *stats)
+{
+	if(stats != NULL)
+	{
+		memset(stats, 0, sizeof(*stats));
+	}
+}
+
+/*
+ * count a time in its bucket
+ */
+void isotp_hist_add(struct isotp_hist_t *hist, uint32_t us)
+{
+	uint32_t index = 0UL, value = us;
+
+	while(value != 0UL && index < ISOTP_HIST_BUCKETS - 1UL)
+	{
+		value >>= 1;
+		index ++;
+	}
+	hist->bucket[index] ++;
+	hist->count ++;
+	hist->sum += us;
+	if(us > hist->max)
+	{
+		hist->max = us;
+	}
+}
+
+/*
+ * first time above a bucket, TIMER_FOREVER for the last one
+ */
+uint32_t isotp_hist_bucket_us(uint32_t index)
+{
+	if(index >= ISOTP_HIST_BUCKETS - 1UL)
+	{
+		return TIMER_FOREVER;
+	}
+	return 1UL << index;
+}
+
+uint32_t isotp_hist_mean(const struct isotp_hist_t *hist)
+{
+	if(hist == NULL || hist->count == 0UL)
+	{
+		return 0UL;
+	}
+	return (uint32_t)(hist->sum / hist->count);
+}
+
+/*
+ * time percent of the counted times are below, to the precision of the
+ * buckets: the end of the bucket it falls into, never above the largest
+ * time counted
+ *
+ * @parameter in:
+ * hist:      object
+ * percent:   1-100
+ * @parameter out:
+ * the time in microseconds, 0 if nothing was counted
+ */
+uint32_t isotp_hist_percentile(const struct isotp_hist_t *hist, uint32_t percent)
+{
+	unsigned long long rank;
+	uint32_t index, seen = 0UL, bound;
+
+	if(hist == NULL || hist->count == 0UL)
+	{
+		return 0UL;
+	}
+	rank = ((unsigned long long)hist->count * percent + 99ULL) / 100ULL;
+	for(index = 0; index < ISOTP_HIST_BUCKETS; index ++)
+	{
+		seen += hist->bucket[index];
+		if(seen >= rank)
+		{
+			break;
+		}
+	}
+	bound = isotp_hist_bucket_us(index);
+	if(bound != TIMER_FOREVER && bound != 0UL)
+	{
+		bound --;
+	}
+	return (bound < hist->max) ? bound : hist->max;
+}
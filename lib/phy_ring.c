@@ -0,0 +1,178 @@
+#include "phy_ring.h"
+#include "ring_atomic.h"
+#include <string.h>
+
+/*
+ * initialize a ring
+ *
+ * @parameter in:
+ * ring:      object
+ * frame:     storage of the ring
+ * size:      frames in frame, a power of two
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE phy_ring_init(struct phy_ring_t *ring, struct phy_msg_t *frame, uint32_t size)
+{
+	if(ring == NULL || frame == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(size == 0UL || (size & (size - 1UL)) != 0UL)
+	{
+		return ERR_PARAMETER;
+	}
+	memset(ring, 0, sizeof(*ring));
+	ring->frame = frame;
+	ring->mask = size - 1UL;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * producer: the free slot for the next frame, it is not seen by the
+ * consumer until phy_ring_publish()
+ *
+ * @parameter in:
+ * ring:      object
+ * @parameter out:
+ * the slot, NULL if the ring is full, the frame is counted as overflow
+ */
+struct phy_msg_t *phy_ring_claim(struct phy_ring_t *ring)
+{
+	uint32_t head = ring->head;
+	uint32_t used = head - ring_load(&ring->tail);
+
+	if(used > ring->mask)
+	{
+		ring->overflow ++;
+		return NULL;
+	}
+	if(used + 1UL > ring->high_water)
+	{
+		ring->high_water = used + 1UL;
+	}
+
+	return &ring->frame[head & ring->mask];
+}
+
+/*
+ * producer: hand the slot of phy_ring_claim() to the consumer
+ */
+void phy_ring_publish(struct phy_ring_t *ring)
+{
+	ring_store(&ring->head, ring->head + 1UL);
+}
+
+/*
+ * producer: copy a frame into the ring
+ *
+ * @parameter in:
+ * ring:      object
+ * msg:       frame received
+ * @parameter out:
+ * operation status return, ERR_FULL if the frame was dropped
+ */
+ERROR_CODE phy_ring_put(struct phy_ring_t *ring, const struct phy_msg_t *msg)
+{
+	struct phy_msg_t *frame = phy_ring_claim(ring);
+
+	if(frame == NULL)
+	{
+		return ERR_FULL;
+	}
+	memcpy(frame, msg, sizeof(*frame));
+	phy_ring_publish(ring);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * consumer: the frames waiting that are stored in one piece, up to the
+ * end of the storage. They stay valid until phy_ring_release().
+ *
+ * @parameter in:
+ * ring:      object
+ * @parameter out:
+ * frame:     the oldest frame
+ * number of frames from frame on, 0 if the ring is empty
+ */
+uint32_t phy_ring_peek(struct phy_ring_t *ring, struct phy_msg_t **frame)
+{
+	uint32_t tail = ring->tail;
+	uint32_t count = ring_load(&ring->head) - tail;
+	uint32_t linear = ring->mask + 1UL - (tail & ring->mask);
+
+	*frame = &ring->frame[tail & ring->mask];
+
+	return (count < linear) ? count : linear;
+}
+
+/*
+ * consumer: give count frames of phy_ring_peek() back to the producer
+ */
+void phy_ring_release(struct phy_ring_t *ring, uint32_t count)
+{
+	ring_store(&ring->tail, ring->tail + count);
+}
+
+/*
+ * consumer: take the oldest frame, can be used as the phy_receive of a
+ * channel through a wrapper that names the ring
+ *
+ * @parameter in:
+ * ring:      object
+ * @parameter out:
+ * msg:       the frame
+ * operation status return, ERR_EMPTY if no frame is waiting
+ */
+ERROR_CODE phy_ring_get(struct phy_ring_t *ring, struct phy_msg_t *msg)
+{
+	struct phy_msg_t *frame;
+
+	if(phy_ring_peek(ring, &frame) == 0UL)
+	{
+		return ERR_EMPTY;
+	}
+	memcpy(msg, frame, sizeof(*msg));
+	phy_ring_release(ring, 1UL);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * consumer: take up to max frames at once
+ *
+ * @parameter in:
+ * ring:      object
+ * max:       frames msg can hold
+ * @parameter out:
+ * msg:       the frames, oldest first
+ * number of frames taken
+ */
+uint32_t phy_ring_get_batch(struct phy_ring_t *ring, struct phy_msg_t *msg, uint32_t max)
+{
+	struct phy_msg_t *frame;
+	uint32_t count, total = 0UL;
+
+	while(total < max && (count = phy_ring_peek(ring, &frame)) != 0UL)
+	{
+		if(count > max - total)
+		{
+			count = max - total;
+		}
+		memcpy(&msg[total], frame, count * sizeof(*msg));
+		phy_ring_release(ring, count);
+		total += count;
+	}
+
+	return total;
+}
+
+/*
+ * frames waiting, the other side may change it at any time
+ */
+uint32_t phy_ring_count(struct phy_ring_t *ring)
+{
+	return ring_load(&ring->head) - ring_load(&ring->tail);
+}
@@ -0,0 +1,24 @@
+#ifndef __RING_ATOMIC_H__
+#define __RING_ATOMIC_H__
+
+/*
+ * Index access of the single producer, single consumer rings in lib.
+ * The index of one side is read with acquire and written with release
+ * semantics: the consumer sees a frame only after all of it was written,
+ * and the producer reuses a slot only after the consumer is done with it.
+ */
+#if defined(__GNUC__)
+#define ring_load(p)		__atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define ring_store(p,v)		__atomic_store_n((p), (v), __ATOMIC_RELEASE)
+#elif defined(_MSC_VER)
+#include <intrin.h>
+/* volatile accesses are acquire/release with /volatile:ms, the default on x86 */
+#define ring_load(p)		(*(p))
+#define ring_store(p,v)		do { _ReadWriteBarrier(); *(p) = (v); } while(0)
+#else
+/* single core targets, the interrupt and the task see memory in order */
+#define ring_load(p)		(*(p))
+#define ring_store(p,v)		(*(p) = (v))
+#endif
+
+#endif /* __RING_ATOMIC_H__ */
@@ -0,0 +1,423 @@
+#ifdef __linux__
+/* sendmmsg and recvmmsg */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
+#include <linux/can.h>
+#include <linux/can/raw.h>
+/* of the host, comm_typedef.h has its own */
+#undef LITTLE_ENDIAN
+#undef BIG_ENDIAN
+#endif
+
+#include "socketcan.h"
+
+#ifdef __linux__
+
+/* identifiers above this are sent in the 29 bit format */
+#define SOCKETCAN_SFF_MASK		(0x7FFUL)
+
+/* room for the time stamp and the drop counter of one frame */
+#define SOCKETCAN_CONTROL_LEN	(CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+
+static void frame_from_msg(struct socketcan_t *can, struct canfd_frame *frame, const struct phy_msg_t *msg);
+static void msg_from_frame(struct phy_msg_t *msg, const struct canfd_frame *frame);
+static void control_read(struct socketcan_t *can, struct msghdr *hdr, struct socketcan_stamp_t *stamp);
+
+/*
+ * open a raw CAN socket on an interface
+ *
+ * @parameter in:
+ * can:       object
+ * ifname:    interface, e.g. "vcan0"
+ * fd:        TRUE to send CAN FD frames, the interface needs an MTU of 72
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE socketcan_open(struct socketcan_t *can, const char *ifname, Bool fd)
+{
+	struct sockaddr_can addr;
+	struct ifreq ifr;
+	int on = 1;
+	ERROR_CODE err = ERR_FAIL;
+
+	if(can == NULL || ifname == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(strlen(ifname) >= IFNAMSIZ)
+	{
+		return ERR_PARAMETER;
+	}
+	memset(can, 0, sizeof(*can));
+	can->can_fd = fd;
+	can->fd = socket(PF_CAN, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, CAN_RAW);
+	if(can->fd < 0)
+	{
+		return ERR_FAIL;
+	}
+	for(;;)
+	{
+		memset(&ifr, 0, sizeof(ifr));
+		strcpy(ifr.ifr_name, ifname);
+		if(ioctl(can->fd, SIOCGIFINDEX, &ifr) < 0)
+		{
+			err = ERR_NOT_FOUND;
+			break;
+		}
+		if(fd == TRUE)
+		{
+			/* fails on interfaces that only take classical frames */
+			if(ioctl(can->fd, SIOCGIFMTU, &ifr) < 0 || ifr.ifr_mtu != CANFD_MTU
+				|| setsockopt(can->fd, SOL_CAN_RAW, CAN_RAW_FD_FRAMES, &on, sizeof(on)) < 0)
+			{
+				err = ERR_PARAMETER;
+				break;
+			}
+			/* SIOCGIFMTU wrote over the index */
+			ioctl(can->fd, SIOCGIFINDEX, &ifr);
+		}
+		/* best effort, the frames are still received without them */
+		setsockopt(can->fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+		setsockopt(can->fd, SOL_SOCKET, SO_RXQ_OVFL, &on, sizeof(on));
+		memset(&addr, 0, sizeof(addr));
+		addr.can_family = AF_CAN;
+		addr.can_ifindex = ifr.ifr_ifindex;
+		if(bind(can->fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+		{
+			break;
+		}
+		return STATUS_NORMAL;
+	}
+	close(can->fd);
+	can->fd = -1;
+	return err;
+}
+
+void socketcan_close(struct socketcan_t *can)
+{
+	if(can != NULL && can->fd >= 0)
+	{
+		close(can->fd);
+		can->fd = -1;
+	}
+}
+
+/*
+ * receive only the frames with (id & mask) == id & mask, in the kernel
+ *
+ * @parameter in:
+ * can:       object
+ * id:        identifier, above 0x7FF for the 29 bit format
+ * mask:      bits of id compared
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE socketcan_filter_set(struct socketcan_t *can, uint32_t id, uint32_t mask)
+{
+	struct can_filter filter;
+
+	if(can == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(id > SOCKETCAN_SFF_MASK)
+	{
+		filter.can_id = (id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+		filter.can_mask = (mask & CAN_EFF_MASK) | CAN_EFF_FLAG | CAN_RTR_FLAG;
+	}
+	else
+	{
+		filter.can_id = id & CAN_SFF_MASK;
+		filter.can_mask = (mask & CAN_SFF_MASK) | CAN_EFF_FLAG | CAN_RTR_FLAG;
+	}
+	if(setsockopt(can->fd, SOL_CAN_RAW, CAN_RAW_FILTER, &filter, sizeof(filter)) < 0)
+	{
+		return ERR_FAIL;
+	}
+	return STATUS_NORMAL;
+}
+
+/*
+ * send one frame without waiting
+ *
+ * @parameter in:
+ * can:       object
+ * msg:       frame
+ * @parameter out:
+ * operation status return, ERR_FULL when the socket buffer is full
+ */
+ERROR_CODE socketcan_send(struct socketcan_t *can, const struct phy_msg_t *msg)
+{
+	uint32_t done;
+
+	return socketcan_send_batch(can, msg, 1UL, &done);
+}
+
+/*
+ * receive one frame without waiting, its time stamp goes to stamp[0]
+ *
+ * @parameter in:
+ * can:       object
+ * @parameter out:
+ * msg:       frame
+ * operation status return, ERR_EMPTY when no frame is waiting
+ */
+ERROR_CODE socketcan_receive(struct socketcan_t *can, struct phy_msg_t *msg)
+{
+	uint32_t done;
+
+	return socketcan_receive_batch(can, msg, 1UL, &done);
+}
+
+/*
+ * send up to count frames in one system call
+ *
+ * @parameter in:
+ * can:       object
+ * msg:       frames
+ * count:     frames in msg
+ * @parameter out:
+ * done:      frames the kernel took
+ * operation status return, ERR_FULL when the socket buffer took not all
+ */
+ERROR_CODE socketcan_send_batch(struct socketcan_t *can, const struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+{
+	struct canfd_frame frame[SOCKETCAN_BATCH_MAX];
+	struct iovec iov[SOCKETCAN_BATCH_MAX];
+	struct mmsghdr hdr[SOCKETCAN_BATCH_MAX];
+	uint32_t index, sent, chunk;
+	int ret;
+
+	if(can == NULL || msg == NULL || done == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	for(sent = 0UL; sent < count; sent += (uint32_t)ret)
+	{
+		chunk = (count - sent > SOCKETCAN_BATCH_MAX) ? SOCKETCAN_BATCH_MAX : count - sent;
+		memset(hdr, 0, sizeof(hdr[0]) * chunk);
+		for(index = 0; index < chunk; index ++)
+		{
+			frame_from_msg(can, &frame[index], &msg[sent + index]);
+			iov[index].iov_base = &frame[index];
+			iov[index].iov_len = (can->can_fd == TRUE) ? CANFD_MTU : CAN_MTU;
+			hdr[index].msg_hdr.msg_iov = &iov[index];
+			hdr[index].msg_hdr.msg_iovlen = 1;
+		}
+		ret = sendmmsg(can->fd, hdr, chunk, MSG_DONTWAIT);
+		if(ret <= 0)
+		{
+			if(ret < 0 && errno == EINTR)
+			{
+				ret = 0;
+				continue;
+			}
+			*done = sent;
+			can->tx_frames += sent;
+			if(ret == 0 || errno == EAGAIN || errno == ENOBUFS)
+			{
+				can->tx_again ++;
+				return ERR_FULL;
+			}
+			return ERR_FAIL;
+		}
+	}
+	*done = sent;
+	can->tx_frames += sent;
+	return STATUS_NORMAL;
+}
+
+/*
+ * receive up to count frames in one system call, their time stamps go to
+ * stamp
+ *
+ * @parameter in:
+ * can:       object
+ * count:     frames msg takes
+ * @parameter out:
+ * msg:       frames
+ * done:      frames received
+ * operation status return, ERR_EMPTY when no frame was waiting
+ */
+ERROR_CODE socketcan_receive_batch(struct socketcan_t *can, struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+{
+	struct canfd_frame frame[SOCKETCAN_BATCH_MAX];
+	struct iovec iov[SOCKETCAN_BATCH_MAX];
+	struct mmsghdr hdr[SOCKETCAN_BATCH_MAX];
+	uint8_t control[SOCKETCAN_BATCH_MAX][SOCKETCAN_CONTROL_LEN];
+	uint32_t index;
+	int ret;
+
+	if(can == NULL || msg == NULL || done == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	*done = 0UL;
+	if(count > SOCKETCAN_BATCH_MAX)
+	{
+		count = SOCKETCAN_BATCH_MAX;
+	}
+	memset(hdr, 0, sizeof(hdr[0]) * count);
+	for(index = 0; index < count; index ++)
+	{
+		iov[index].iov_base = &frame[index];
+		iov[index].iov_len = sizeof(frame[index]);
+		hdr[index].msg_hdr.msg_iov = &iov[index];
+		hdr[index].msg_hdr.msg_iovlen = 1;
+		hdr[index].msg_hdr.msg_control = control[index];
+		hdr[index].msg_hdr.msg_controllen = sizeof(control[index]);
+	}
+	do
+	{
+		ret = recvmmsg(can->fd, hdr, count, MSG_DONTWAIT, NULL);
+	} while(ret < 0 && errno == EINTR);
+	if(ret <= 0)
+	{
+		return (ret == 0 || errno == EAGAIN) ? ERR_EMPTY : ERR_FAIL;
+	}
+	for(index = 0; index < (uint32_t)ret; index ++)
+	{
+		/* a classical frame fills the start of a canfd_frame */
+		if(hdr[index].msg_len != CAN_MTU && hdr[index].msg_len != CANFD_MTU)
+		{
+			continue;
+		}
+		msg_from_frame(&msg[*done], &frame[index]);
+		control_read(can, &hdr[index].msg_hdr, &can->stamp[*done]);
+		(*done) ++;
+	}
+	can->rx_frames += *done;
+	return (*done != 0UL) ? STATUS_NORMAL : ERR_EMPTY;
+}
+
+/*
+ * microseconds since a time stamp of the kernel
+ */
+uint32_t socketcan_age_us(const struct socketcan_stamp_t *stamp)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	return (uint32_t)((uint32_t)now.tv_sec - stamp->sec) * 1000000UL
+			+ (uint32_t)((int32_t)((uint32_t)now.tv_nsec - stamp->nsec) / 1000);
+}
+
+static void frame_from_msg(struct socketcan_t *can, struct canfd_frame *frame, const struct phy_msg_t *msg)
+{
+	uint8_t len = (msg->length > CANFD_MAX_DL) ? CANFD_MAX_DL : msg->length;
+
+	memset(frame, 0, sizeof(*frame));
+	if(can->can_fd == FALSE && len > CAN_MAX_DL)
+	{
+		len = CAN_MAX_DL;
+	}
+	if(msg->id > SOCKETCAN_SFF_MASK)
+	{
+		frame->can_id = (msg->id & CAN_EFF_MASK) | CAN_EFF_FLAG;
+	}
+	else
+	{
+		frame->can_id = msg->id;
+	}
+	frame->len = len;
+	if(can->can_fd == TRUE)
+	{
+		frame->flags = CANFD_BRS;
+	}
+	memcpy(frame->data, msg->data, len);
+}
+
+static void msg_from_frame(struct phy_msg_t *msg, const struct canfd_frame *frame)
+{
+	msg->new_data = TRUE;
+	msg->id = (frame->can_id & CAN_EFF_FLAG) ? (frame->can_id & CAN_EFF_MASK) : (frame->can_id & CAN_SFF_MASK);
+	msg->length = (frame->len > CANFD_MAX_DL) ? CANFD_MAX_DL : frame->len;
+	memcpy(msg->data, frame->data, msg->length);
+}
+
+/*
+ * the time stamp and the drop counter the kernel sent with a frame
+ */
+static void control_read(struct socketcan_t *can, struct msghdr *hdr, struct socketcan_stamp_t *stamp)
+{
+	struct cmsghdr *cmsg;
+	struct timespec ts;
+	uint32_t dropped;
+
+	stamp->sec = stamp->nsec = 0UL;
+	for(cmsg = CMSG_FIRSTHDR(hdr); cmsg != NULL; cmsg = CMSG_NXTHDR(hdr, cmsg))
+	{
+		if(cmsg->cmsg_level != SOL_SOCKET)
+		{
+			continue;
+		}
+		if(cmsg->cmsg_type == SCM_TIMESTAMPNS)
+		{
+			memcpy(&ts, CMSG_DATA(cmsg), sizeof(ts));
+			stamp->sec = (uint32_t)ts.tv_sec;
+			stamp->nsec = (uint32_t)ts.tv_nsec;
+		}
+		else if(cmsg->cmsg_type == SO_RXQ_OVFL)
+		{
+			/* counted by the kernel since the socket was opened */
+			memcpy(&dropped, CMSG_DATA(cmsg), sizeof(dropped));
+			can->rx_dropped = dropped;
+		}
+	}
+}
+
+#else
+
+ERROR_CODE socketcan_open(struct socketcan_t *can, const char *ifname, Bool fd)
+{
+	if(can == NULL || ifname == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	can->fd = -1;
+	return ERR_FAIL;
+}
+
+void socketcan_close(struct socketcan_t *can)
+{
+}
+
+ERROR_CODE socketcan_filter_set(struct socketcan_t *can, uint32_t id, uint32_t mask)
+{
+	return ERR_FAIL;
+}
+
+ERROR_CODE socketcan_send(struct socketcan_t *can, const struct phy_msg_t *msg)
+{
+	return ERR_FAIL;
+}
+
+ERROR_CODE socketcan_receive(struct socketcan_t *can, struct phy_msg_t *msg)
+{
+	return ERR_EMPTY;
+}
+
+ERROR_CODE socketcan_send_batch(struct socketcan_t *can, const struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+{
+	*done = 0UL;
+	return ERR_FAIL;
+}
+
+ERROR_CODE socketcan_receive_batch(struct socketcan_t *can, struct phy_msg_t *msg, uint32_t count, uint32_t *done)
+{
+	*done = 0UL;
+	return ERR_EMPTY;
+}
+
+uint32_t socketcan_age_us(const struct socketcan_stamp_t *stamp)
+{
+	return 0UL;
+}
+
+#endif /* __linux__ */
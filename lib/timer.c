@@ -2,12 +2,44 @@
 #include "FreeRTOS.h"
 #include "task.h"
 
+/*
+ * The microsecond timers run on a high resolution counter of the host,
+ * define TIMER_US_CLOCK to 0 to count them in system ticks instead.
+ * Virtual time does not move the host counter, so it always uses the ticks.
+ */
+#ifndef TIMER_US_CLOCK
+#if (configUSE_VIRTUAL_TIME == 1)
+#define TIMER_US_CLOCK	0
+#else
+#define TIMER_US_CLOCK	1
+#endif
+#endif
+
+#if (TIMER_US_CLOCK == 1)
+#ifdef WIN32
+#include <windows.h>
+#ifndef CREATE_WAITABLE_TIMER_HIGH_RESOLUTION
+#define CREATE_WAITABLE_TIMER_HIGH_RESOLUTION	0x00000002
+#endif
+#else
+#include <time.h>
+#include <errno.h>
+#endif
+#endif
+
+/*
+ * The clocks are 32 bit counters that wrap, compare them by the signed
+ * difference so that intervals up to half the range are always right.
+ */
 #define time_after(a,b)  \
-((long)(b) - (long)(a) <= 0)
+((int32_t)((uint32_t)(b) - (uint32_t)(a)) <= 0)
 
 #define time_before(a,b) time_after(b,a)
 
-#define time_interval(now,pre) ((long)(now) - (long)(pre)) 
+#define time_interval(now,pre) ((int32_t)((uint32_t)(now) - (uint32_t)(pre)))
+
+static uint32_t systickus(void);
+static void delay_us(uint32_t us);
 
 /* 
  * function: system tick
@@ -15,7 +47,45 @@
  */
 static uint32_t systickms(void)
 {
-	return 0;
+	return (uint32_t)(xTaskGetTickCount() * portTICK_PERIOD_MS);
+}
+
+/* 
+ * function: microsecond counter
+ * This functionality needs to be reimplemented on your platform.
+ */
+static uint32_t systickus(void)
+{
+#if (TIMER_US_CLOCK == 1)
+#ifdef WIN32
+	LARGE_INTEGER freq, count;
+
+	QueryPerformanceFrequency(&freq);
+	QueryPerformanceCounter(&count);
+	return (uint32_t)((count.QuadPart / freq.QuadPart) * 1000000ULL
+			+ (count.QuadPart % freq.QuadPart) * 1000000ULL / freq.QuadPart);
+#else
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint32_t)((unsigned long long)now.tv_sec * 1000000ULL + now.tv_nsec / 1000UL);
+#endif
+#else
+	return systickms() * 1000UL;
+#endif
+}
+
+/*
+ * current time in the unit of the timer
+ */
+static uint32_t timer_now(struct timer_t *timer)
+{
+	return (timer->us == TRUE) ? systickus() : systickms();
+}
+
+uint32_t timer_us(void)
+{
+	return systickus();
 }
 
 
@@ -34,30 +104,83 @@ void delay_1ms(uint16_t ms1)
 
 void delay_100us(uint16_t us100)
 {
-	uint16_t i, j;
-	
-	for(i = 0UL; i < 100UL; i ++)
+	delay_us(us100 * 100UL);
+}
+
+/* 
+ * function: sleep for us microseconds, shorter than a tick,
+ * without keeping the cpu busy
+ * This functionality needs to be reimplemented on your platform.
+ */
+static void delay_us(uint32_t us)
+{
+#if (TIMER_US_CLOCK == 1)
+#ifdef WIN32
+	HANDLE timer;
+	LARGE_INTEGER due;
+	uint32_t deadline = systickus() + us;
+
+	/* relative due time in 100ns */
+	due.QuadPart = -(LONGLONG)us * 10LL;
+	timer = CreateWaitableTimerEx(NULL, NULL, CREATE_WAITABLE_TIMER_HIGH_RESOLUTION, TIMER_ALL_ACCESS);
+	if(timer != NULL && SetWaitableTimer(timer, &due, 0, NULL, NULL, FALSE))
 	{
-		for(j = 0UL; j < 1000UL; j ++)
-		{
-			;
-		}
+		WaitForSingleObject(timer, INFINITE);
 	}
+	if(timer != NULL)
+	{
+		CloseHandle(timer);
+	}
+	/* no high resolution timers before Windows 10 1803 */
+	while(time_before(systickus(), deadline))
+	{
+		SwitchToThread();
+	}
+#else
+	struct timespec deadline;
+
+	/* an absolute deadline, a signal that interrupts the sleep does not stretch it */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += us / 1000000UL;
+	deadline.tv_nsec += (us % 1000000UL) * 1000UL;
+	if(deadline.tv_nsec >= 1000000000L)
+	{
+		deadline.tv_sec ++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &deadline, NULL) == EINTR)
+	{
+		;
+	}
+#endif
+#else
+	/* the clock only moves by ticks */
+	vTaskDelay((us + portTICK_PERIOD_MS * 1000UL - 1UL) / (portTICK_PERIOD_MS * 1000UL));
+#endif
 }
 
 void timer_add(struct timer_t *timer)
 {
 	timer->enable = TRUE;
 	timer->timeout = FALSE;
+	timer->us = FALSE;
 	timer->curtime = systickms();
 }
 
+void timer_add_us(struct timer_t *timer)
+{
+	timer->enable = TRUE;
+	timer->timeout = FALSE;
+	timer->us = TRUE;
+	timer->curtime = systickus();
+}
+
 
 void timer_refresh(struct timer_t *timer)
 {
 	if(timer->enable == TRUE)
 	{
-		timer->curtime = systickms();
+		timer->curtime = timer_now(timer);
 	}
 }
 
@@ -70,7 +193,7 @@ Bool timer_overflow(struct timer_t * timer, uint32_t period_ms)
 {
     if(timer->enable)
     {
-        if(time_after(systickms(), timer->curtime + period_ms))
+        if(time_after(timer_now(timer), timer->curtime + period_ms))
         {
             timer->timeout = TRUE;
         }
@@ -92,3 +215,37 @@ Bool timer_is_added(struct timer_t  *timer)
     return timer->enable;
 }
 
+void timer_wait(struct timer_t *timer, uint32_t period_ms)
+{
+	uint32_t remain = timer_remain(timer, period_ms);
+
+	if(remain == TIMER_FOREVER || remain == 0UL)
+	{
+		return;
+	}
+	if(timer->us == TRUE)
+	{
+		delay_us(remain);
+	}
+	else
+	{
+		delay_1ms(remain);
+	}
+}
+
+uint32_t timer_remain(struct timer_t *timer, uint32_t period_ms)
+{
+	int32_t remain;
+
+	if(timer->enable != TRUE)
+	{
+		return TIMER_FOREVER;
+	}
+	remain = time_interval(timer->curtime + period_ms, timer_now(timer));
+	if(remain < 0)
+	{
+		remain = 0;
+	}
+
+	return (uint32_t)remain;
+}
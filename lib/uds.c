@@ -0,0 +1,734 @@
+#include "uds.h"
+#include <string.h>
+
+static ERROR_CODE uds_sink(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len);
+static ERROR_CODE uds_rx_done(struct isotp_t* msg);
+static Bool stream_start(struct uds_server_t *server, uint32_t DL);
+static void request_start(struct uds_server_t *server);
+static void request_run(struct uds_server_t *server);
+static void respond(struct uds_server_t *server, uint8_t sid, uint8_t nrc);
+static Bool respond_send(struct uds_server_t *server);
+static uint32_t be_get(const uint8_t *data, uint8_t len);
+
+/*
+ * initialize a server on its channel, after isotp_init() of server->channel.
+ * The server takes the receive side of the channel over with a sink, and
+ * sends its positive responses from resp.
+ *
+ * @parameter in:
+ * server:    object
+ * service:   service table lent by the application
+ * count:     entries in service
+ * req:       storage for one request, TransferData streams past it
+ * req_size:  bytes of req, at least UDS_TRANSFER_HEAD
+ * resp:      storage for one response
+ * resp_size: bytes of resp, at least the positive SID
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE uds_init(struct uds_server_t *server,
+							const struct uds_service_t *service,
+							uint8_t count,
+							uint8_t *req,
+							uint32_t req_size,
+							uint8_t *resp,
+							uint32_t resp_size)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+	uint8_t index;
+
+	for(;;)
+	{
+		if(server == NULL || service == NULL || req == NULL || resp == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		if(req_size < UDS_TRANSFER_HEAD || resp_size == 0UL)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		server->service = service;
+		memset(server->route, 0, sizeof(server->route));
+		for(index = 0; index < count; index ++)
+		{
+			/* the first entry of a SID wins */
+			if(server->route[service[index].sid] == 0U)
+			{
+				server->route[service[index].sid] = index + 1U;
+			}
+		}
+		server->req = req;
+		server->req_size = req_size;
+		server->req_len = 0UL;
+		server->req_ready = FALSE;
+		server->req_overflow = FALSE;
+		server->req_busy = FALSE;
+		server->resp = resp;
+		server->resp_size = resp_size;
+		server->resp_len = 0UL;
+		server->resp_data = resp;
+		server->resp_ready = FALSE;
+		server->pending = NULL;
+		server->suppress = FALSE;
+		server->pending_sent = FALSE;
+		xtimer_delete(&server->P2);
+		server->session = UDS_SESSION_DEFAULT;
+		server->level = 0U;
+		server->seed_level = 0U;
+		server->attempts = 0U;
+		xtimer_delete(&server->S3);
+		xtimer_delete(&server->delay);
+		server->security = NULL;
+		server->download = NULL;
+		server->downloading = FALSE;
+		server->max_block = 0UL;
+		server->stream = FALSE;
+		server->requests = 0UL;
+		server->negative = 0UL;
+		server->pending_count = 0UL;
+		server->dropped = 0UL;
+		err = isotp_stream_set(&server->channel, uds_sink, NULL);
+		if(err == STATUS_NORMAL)
+		{
+			err = isotp_tx_buffer_set(&server->channel, resp, resp_size);
+		}
+		if(err == STATUS_NORMAL)
+		{
+			err = isotp_cb_set(&server->channel, uds_rx_done, NULL);
+		}
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * lend the seed and key functions of SecurityAccess
+ *
+ * @parameter in:
+ * server:    object
+ * security:  functions of the application, NULL: every level is refused
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE uds_security_set(struct uds_server_t *server, const struct uds_security_t *security)
+{
+	if(server == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	server->security = security;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * lend the memory functions of the download services
+ *
+ * @parameter in:
+ * server:    object
+ * download:  functions of the application, NULL: no download is accepted
+ * max_block: maxNumberOfBlockLength, SID and counter included, up to the
+ *            largest message of the channel, not limited by req_size
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE uds_download_set(struct uds_server_t *server, const struct uds_download_t *download, uint32_t max_block)
+{
+	if(server == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(download != NULL
+		&& (download->start == NULL || download->write == NULL
+			|| max_block <= UDS_TRANSFER_HEAD || max_block > 0xFFFFUL))
+	{
+		return ERR_PARAMETER;
+	}
+	server->download = download;
+	server->max_block = max_block;
+	server->downloading = FALSE;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * change the session, every change locks the security levels and ends a
+ * download
+ */
+void uds_session_set(struct uds_server_t *server, uint8_t session)
+{
+	if(session != server->session || session == UDS_SESSION_DEFAULT)
+	{
+		server->level = 0U;
+		server->seed_level = 0U;
+		server->downloading = FALSE;
+	}
+	server->session = session;
+	if(session == UDS_SESSION_DEFAULT)
+	{
+		xtimer_delete(&server->S3);
+	}
+	else
+	{
+		timer_add(&server->S3);
+	}
+}
+
+/*
+ * handle the channel, the requests received, the pending handlers and S3
+ *
+ * @parameter in:
+ * server:    object
+ * @parameter out:
+ * milliseconds until the next call is needed,
+ * ISOTP_WAIT_FOREVER if only a received frame can change the state
+ */
+uint32_t uds_poll(struct uds_server_t *server)
+{
+	uint32_t wait, remain;
+
+	if(server == NULL)
+	{
+		return ISOTP_WAIT_FOREVER;
+	}
+	isotp_poll(&server->channel);
+	if(server->resp_ready == TRUE)
+	{
+		respond_send(server);
+	}
+	/* the response before may still be sent from resp frame by frame */
+	if(server->resp_ready == FALSE && server->channel.tx.state == ISOTP_IDLE)
+	{
+		if(server->pending != NULL)
+		{
+			request_run(server);
+		}
+		else if(server->req_ready == TRUE)
+		{
+			request_start(server);
+		}
+	}
+	if(server->session != UDS_SESSION_DEFAULT && server->pending == NULL
+		&& timer_overflow(&server->S3, UDS_S3_MS))
+	{
+		uds_session_set(server, UDS_SESSION_DEFAULT);
+	}
+
+	wait = isotp_poll(&server->channel);
+	if(server->pending != NULL || server->resp_ready == TRUE || server->req_ready == TRUE)
+	{
+		wait = 1UL;
+	}
+	else if(server->session != UDS_SESSION_DEFAULT)
+	{
+		remain = timer_remain(&server->S3, UDS_S3_MS);
+		wait = (remain < wait) ? remain : wait;
+	}
+
+	return wait;
+}
+
+/*
+ * The request arrives here frame by frame. The server is the first member
+ * of the channel, so the channel leads back to it. The SID and the
+ * blockSequenceCounter of a TransferData decide whether its data goes to
+ * the download as it comes.
+ */
+static ERROR_CODE uds_sink(struct isotp_t* msg, uint32_t offset, const uint8_t *data, uint16_t len)
+{
+	struct uds_server_t *server = (struct uds_server_t *)msg;
+	uint32_t part;
+
+	if(offset == 0UL)
+	{
+		server->req_busy = (server->pending != NULL || server->req_ready == TRUE) ? TRUE : FALSE;
+		if(server->req_busy == FALSE)
+		{
+			server->req_overflow = FALSE;
+			server->stream = FALSE;
+			server->stream_len = 0UL;
+			server->stream_nrc = UDS_NRC_OK;
+		}
+	}
+	if(server->req_busy == TRUE)
+	{
+		return STATUS_NORMAL;
+	}
+	while(offset < UDS_TRANSFER_HEAD && len > 0UL)
+	{
+		server->req[offset ++] = *data ++;
+		len --;
+		if(offset == UDS_TRANSFER_HEAD)
+		{
+			server->stream = stream_start(server, msg->rx.DL);
+		}
+	}
+	if(len == 0UL)
+	{
+		return STATUS_NORMAL;
+	}
+	if(server->stream == TRUE)
+	{
+		if(server->stream_nrc == UDS_NRC_OK
+			&& server->download->write(server, server->offset + offset - UDS_TRANSFER_HEAD, data, len) != STATUS_NORMAL)
+		{
+			server->stream_nrc = UDS_NRC_PROGRAMMING_FAILURE;
+		}
+		server->stream_len += len;
+		return STATUS_NORMAL;
+	}
+	part = (offset < server->req_size) ? server->req_size - offset : 0UL;
+	if(part > len)
+	{
+		part = len;
+	}
+	memcpy(server->req + offset, data, part);
+	/* the data of a TransferData not streamed is not needed */
+	if(part < len && server->req[0] != UDS_SID_TRANSFER_DATA)
+	{
+		server->req_overflow = TRUE;
+	}
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * a TransferData of the block expected next, that fits the block length
+ * and the size of the download, is written as it arrives
+ */
+static Bool stream_start(struct uds_server_t *server, uint32_t DL)
+{
+	return (server->req[0] == UDS_SID_TRANSFER_DATA
+			&& server->downloading == TRUE
+			&& server->req[1] == server->bsc
+			&& DL > UDS_TRANSFER_HEAD
+			&& DL <= server->max_block
+			&& server->offset + DL - UDS_TRANSFER_HEAD <= server->size) ? TRUE : FALSE;
+}
+
+static ERROR_CODE uds_rx_done(struct isotp_t* msg)
+{
+	struct uds_server_t *server = (struct uds_server_t *)msg;
+
+	/* a broken TransferData is written again when the tester repeats it */
+	if(msg->rx.reply != N_OK)
+	{
+		if(server->req_busy == FALSE)
+		{
+			server->stream = FALSE;
+		}
+		return STATUS_NORMAL;
+	}
+	if(server->session != UDS_SESSION_DEFAULT)
+	{
+		timer_add(&server->S3);
+	}
+	if(server->req_busy == TRUE)
+	{
+		server->dropped ++;
+		return STATUS_NORMAL;
+	}
+	server->req_len = (msg->rx.DL < server->req_size) ? msg->rx.DL : server->req_size;
+	server->req_ready = TRUE;
+	timer_add(&server->P2);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * Route a request to its service. The checks go in the order of
+ * ISO 14229-1 figure 5: SID, session, security, length.
+ */
+static void request_start(struct uds_server_t *server)
+{
+	const struct uds_service_t *service = NULL;
+	uint8_t sid = server->req[0];
+	uint8_t nrc = UDS_NRC_OK;
+
+	server->req_ready = FALSE;
+	server->requests ++;
+	server->suppress = FALSE;
+	server->pending_sent = FALSE;
+	for(;;)
+	{
+		if(server->route[sid] == 0U)
+		{
+			nrc = UDS_NRC_SERVICE_NOT_SUPPORTED;
+			break;
+		}
+		service = &server->service[server->route[sid] - 1U];
+		if((service->sessions & UDS_SESSION_BIT(server->session)) == 0U)
+		{
+			nrc = UDS_NRC_SERVICE_NOT_IN_SESSION;
+			break;
+		}
+		if(service->security != 0U && (service->security & (1U << server->level)) == 0U)
+		{
+			nrc = UDS_NRC_SECURITY_ACCESS_DENIED;
+			break;
+		}
+		if(server->req_overflow == TRUE || server->req_len < service->min_len
+			|| (service->subfunction == TRUE && server->req_len < 2UL))
+		{
+			nrc = UDS_NRC_INCORRECT_LENGTH;
+			break;
+		}
+		if(service->subfunction == TRUE)
+		{
+			server->suppress = (server->req[1] & UDS_SUPPRESS_POS_RSP) ? TRUE : FALSE;
+			server->req[1] &= (uint8_t)~UDS_SUPPRESS_POS_RSP;
+		}
+		break;
+	}
+	if(nrc != UDS_NRC_OK)
+	{
+		respond(server, sid, nrc);
+		return;
+	}
+	server->pending = service;
+	request_run(server);
+}
+
+/*
+ * Call the handler of the request, again while it returns UDS_NRC_PENDING,
+ * and keep the tester waiting with NRC 0x78 before P2, then P2*, is over
+ */
+static void request_run(struct uds_server_t *server)
+{
+	uint8_t sid = server->req[0];
+	uint8_t nrc;
+	uint32_t resp_len = server->resp_size - 1UL;
+
+	nrc = server->pending->handler(server, server->req, server->req_len, server->resp + 1, &resp_len);
+	if(nrc != UDS_NRC_PENDING)
+	{
+		server->pending = NULL;
+		if(nrc != UDS_NRC_OK)
+		{
+			respond(server, sid, nrc);
+		}
+		/* a positive response announced by NRC 0x78 is sent in any case */
+		else if(server->suppress == FALSE || server->pending_sent == TRUE)
+		{
+			server->resp[0] = sid + UDS_SID_POSITIVE;
+			server->resp_len = resp_len + 1UL;
+			server->resp_data = server->resp;
+			server->resp_ready = TRUE;
+			respond_send(server);
+		}
+		return;
+	}
+	/* uds_poll() only runs the handler with the channel idle */
+	if(timer_overflow(&server->P2, (server->pending_sent == TRUE) ?
+						UDS_P2_STAR_RESEND_MS : UDS_P2_MS - UDS_PENDING_MARGIN_MS))
+	{
+		respond(server, sid, UDS_NRC_PENDING);
+		server->pending_sent = TRUE;
+		timer_add(&server->P2);
+	}
+}
+
+/*
+ * a negative response, sent from nrc_resp: a pending handler may have
+ * built part of its response in resp already
+ */
+static void respond(struct uds_server_t *server, uint8_t sid, uint8_t nrc)
+{
+	server->nrc_resp[0] = UDS_SID_NEGATIVE;
+	server->nrc_resp[1] = sid;
+	server->nrc_resp[2] = nrc;
+	server->resp_len = sizeof(server->nrc_resp);
+	server->resp_data = server->nrc_resp;
+	server->resp_ready = TRUE;
+	if(nrc == UDS_NRC_PENDING)
+	{
+		server->pending_count ++;
+	}
+	else
+	{
+		server->negative ++;
+	}
+	respond_send(server);
+}
+
+/*
+ * hand the response to the channel once it is done with the last one
+ */
+static Bool respond_send(struct uds_server_t *server)
+{
+	if(server->channel.tx.state != ISOTP_IDLE)
+	{
+		return FALSE;
+	}
+	isotp_tx_buffer_set(&server->channel, server->resp_data, server->resp_len);
+	server->channel.tx.DL = server->resp_len;
+	isotp_send_start(&server->channel);
+	server->resp_ready = FALSE;
+
+	return TRUE;
+}
+
+static uint32_t be_get(const uint8_t *data, uint8_t len)
+{
+	uint32_t value = 0UL;
+
+	while(len -- > 0U)
+	{
+		value = (value << 8) | *data ++;
+	}
+
+	return value;
+}
+
+/*
+ * DiagnosticSessionControl 0x10: default, programming and extended session,
+ * the response carries P2 in ms and P2* in 10 ms
+ */
+uint8_t uds_session_control(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	uint8_t session = req[1];
+
+	if(session < UDS_SESSION_DEFAULT || session > UDS_SESSION_EXTENDED)
+	{
+		return UDS_NRC_SUBFUNCTION_NOT_SUPPORTED;
+	}
+	if(len != 2UL)
+	{
+		return UDS_NRC_INCORRECT_LENGTH;
+	}
+	if(*resp_len < 5UL)
+	{
+		return UDS_NRC_RESPONSE_TOO_LONG;
+	}
+	uds_session_set(server, session);
+	resp[0] = session;
+	resp[1] = (uint8_t)(UDS_P2_MS >> 8);
+	resp[2] = (uint8_t)UDS_P2_MS;
+	resp[3] = (uint8_t)((UDS_P2_STAR_MS / 10UL) >> 8);
+	resp[4] = (uint8_t)(UDS_P2_STAR_MS / 10UL);
+	*resp_len = 5UL;
+
+	return UDS_NRC_OK;
+}
+
+/*
+ * SecurityAccess 0x27: the odd sub-functions ask for the seed of level
+ * (sub-function + 1) / 2, the even ones send its key. The seed of the level
+ * already unlocked is all zero. Too many wrong keys lock the service for
+ * UDS_SECURITY_DELAY_MS.
+ */
+uint8_t uds_security_access(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	uint8_t sub = req[1];
+	uint8_t level = (sub + 1U) / 2U;
+	uint8_t nrc;
+	uint32_t seed_len;
+
+	if(server->security == NULL || sub == 0U || level > UDS_SECURITY_LEVELS)
+	{
+		return UDS_NRC_SUBFUNCTION_NOT_SUPPORTED;
+	}
+	if(sub & 0x01U)
+	{
+		if(len != 2UL)
+		{
+			return UDS_NRC_INCORRECT_LENGTH;
+		}
+		if(timer_is_added(&server->delay) == TRUE
+			&& timer_overflow(&server->delay, UDS_SECURITY_DELAY_MS) == FALSE)
+		{
+			return UDS_NRC_TIME_DELAY_NOT_EXPIRED;
+		}
+		xtimer_delete(&server->delay);
+		seed_len = *resp_len - 1UL;
+		if(seed_len > UDS_SEED_MAX)
+		{
+			seed_len = UDS_SEED_MAX;
+		}
+		nrc = server->security->seed(server, level, resp + 1, &seed_len);
+		if(nrc != UDS_NRC_OK)
+		{
+			return nrc;
+		}
+		if(level == server->level)
+		{
+			memset(resp + 1, 0, seed_len);
+		}
+		else
+		{
+			server->seed_level = level;
+		}
+		resp[0] = sub;
+		*resp_len = seed_len + 1UL;
+		return UDS_NRC_OK;
+	}
+	if(server->seed_level != level)
+	{
+		return UDS_NRC_REQUEST_SEQUENCE_ERROR;
+	}
+	server->seed_level = 0U;
+	nrc = server->security->key(server, level, req + 2, len - 2UL);
+	if(nrc != UDS_NRC_OK)
+	{
+		if(++ server->attempts >= UDS_SECURITY_ATTEMPTS)
+		{
+			server->attempts = 0U;
+			timer_add(&server->delay);
+			return UDS_NRC_EXCEEDED_ATTEMPTS;
+		}
+		return nrc;
+	}
+	server->attempts = 0U;
+	server->level = level;
+	resp[0] = sub;
+	*resp_len = 1UL;
+
+	return UDS_NRC_OK;
+}
+
+/*
+ * TesterPresent 0x3E, keeps a non-default session, as every request does
+ */
+uint8_t uds_tester_present(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	(void)server;
+
+	if(req[1] != 0x00U)
+	{
+		return UDS_NRC_SUBFUNCTION_NOT_SUPPORTED;
+	}
+	if(len != 2UL)
+	{
+		return UDS_NRC_INCORRECT_LENGTH;
+	}
+	resp[0] = 0x00U;
+	*resp_len = 1UL;
+
+	return UDS_NRC_OK;
+}
+
+/*
+ * RequestDownload 0x34: dataFormatIdentifier 0, no compression nor
+ * encryption, address and size of 1 to 4 bytes
+ */
+uint8_t uds_request_download(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	uint8_t addr_len, size_len, nrc;
+	uint32_t address, size;
+
+	if(server->download == NULL)
+	{
+		return UDS_NRC_CONDITIONS_NOT_CORRECT;
+	}
+	if(len < 3UL)
+	{
+		return UDS_NRC_INCORRECT_LENGTH;
+	}
+	addr_len = req[2] & 0x0FU;
+	size_len = req[2] >> 4;
+	if(len != 3UL + addr_len + size_len)
+	{
+		return UDS_NRC_INCORRECT_LENGTH;
+	}
+	if(server->downloading == TRUE)
+	{
+		return UDS_NRC_CONDITIONS_NOT_CORRECT;
+	}
+	if(req[1] != 0x00U || addr_len == 0U || addr_len > 4U || size_len == 0U || size_len > 4U)
+	{
+		return UDS_NRC_REQUEST_OUT_OF_RANGE;
+	}
+	address = be_get(req + 3, addr_len);
+	size = be_get(req + 3 + addr_len, size_len);
+	if(size == 0UL)
+	{
+		return UDS_NRC_REQUEST_OUT_OF_RANGE;
+	}
+	nrc = server->download->start(server, address, size);
+	if(nrc != UDS_NRC_OK)
+	{
+		return nrc;
+	}
+	server->downloading = TRUE;
+	server->address = address;
+	server->size = size;
+	server->offset = 0UL;
+	server->bsc = 1U;
+	/* lengthFormatIdentifier: 2 bytes of maxNumberOfBlockLength */
+	resp[0] = 0x20U;
+	resp[1] = (uint8_t)(server->max_block >> 8);
+	resp[2] = (uint8_t)server->max_block;
+	*resp_len = 3UL;
+
+	return UDS_NRC_OK;
+}
+
+/*
+ * TransferData 0x36, the data of the block expected next was written while
+ * it was received, see uds_sink()
+ */
+uint8_t uds_transfer_data(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	uint8_t bsc = req[1];
+
+	if(server->downloading == FALSE)
+	{
+		return UDS_NRC_REQUEST_SEQUENCE_ERROR;
+	}
+	if(server->stream == TRUE)
+	{
+		server->stream = FALSE;
+		if(server->stream_nrc != UDS_NRC_OK)
+		{
+			return server->stream_nrc;
+		}
+		server->offset += server->stream_len;
+		server->bsc ++;
+	}
+	else if(bsc == server->bsc)
+	{
+		/* the block expected, but not one that could be written */
+		if(len <= UDS_TRANSFER_HEAD || len > server->max_block)
+		{
+			return UDS_NRC_INCORRECT_LENGTH;
+		}
+		return UDS_NRC_TRANSFER_SUSPENDED;
+	}
+	else if(bsc != (uint8_t)(server->bsc - 1U) || server->offset == 0UL)
+	{
+		return UDS_NRC_WRONG_BLOCK_SEQUENCE;
+	}
+	/* else the block acknowledged last, repeated */
+	resp[0] = bsc;
+	*resp_len = 1UL;
+
+	return UDS_NRC_OK;
+}
+
+/*
+ * RequestTransferExit 0x37, after all the data announced by RequestDownload
+ */
+uint8_t uds_transfer_exit(struct uds_server_t *server, const uint8_t *req, uint32_t len, uint8_t *resp, uint32_t *resp_len)
+{
+	uint8_t nrc = UDS_NRC_OK;
+
+	(void)resp;
+	if(server->downloading == FALSE || server->offset != server->size)
+	{
+		return UDS_NRC_REQUEST_SEQUENCE_ERROR;
+	}
+	if(server->download->finish != NULL)
+	{
+		nrc = server->download->finish(server, req + 1, len - 1UL);
+	}
+	if(nrc != UDS_NRC_PENDING)
+	{
+		server->downloading = FALSE;
+	}
+	*resp_len = 0UL;
+
+	return nrc;
+}
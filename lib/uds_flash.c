@@ -0,0 +1,476 @@
+#include "uds_flash.h"
+
+static ERROR_CODE flash_rx_done(struct isotp_t* msg);
+static ERROR_CODE flash_tx_done(struct isotp_t* msg);
+static ERROR_CODE request_send(struct uds_flash_t *flash, const struct isotp_iovec *iov, uint8_t iovcnt, uint32_t len);
+static void block_prepare(struct uds_flash_t *flash, uint8_t index);
+static ERROR_CODE block_send(struct uds_flash_t *flash);
+static ERROR_CODE exit_send(struct uds_flash_t *flash);
+static void response_handle(struct uds_flash_t *flash);
+static void block_retry(struct uds_flash_t *flash);
+static void flash_end(struct uds_flash_t *flash, enum uds_flash_state_e state, uint8_t nrc);
+static void crc_table_init(void);
+
+static uint32_t crc_table[256];
+static Bool crc_table_ready = FALSE;
+
+/*
+ * initialize the engine on its channel, after isotp_init() of
+ * flash->channel. The engine takes the callbacks of the channel over, and
+ * receives the responses into resp.
+ *
+ * @parameter in:
+ * flash:     object
+ * resp:      storage for one response
+ * resp_size: bytes of resp, at least 4 for the response of RequestDownload
+ * limit:     longest TransferData the tester sends, SID and counter
+ *            included, the server may ask for shorter ones
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE uds_flash_init(struct uds_flash_t *flash, uint8_t *resp, uint32_t resp_size, uint32_t limit)
+{
+	ERROR_CODE err = STATUS_NORMAL;
+
+	for(;;)
+	{
+		if(flash == NULL || resp == NULL)
+		{
+			err = ERR_POINTER_0;
+			break;
+		}
+		if(resp_size < 4UL || limit <= UDS_TRANSFER_HEAD)
+		{
+			err = ERR_PARAMETER;
+			break;
+		}
+		flash->resp = resp;
+		flash->resp_size = resp_size;
+		flash->limit = limit;
+		flash->state = UDS_FLASH_IDLE;
+		xtimer_delete(&flash->P2);
+		crc_table_init();
+		err = isotp_rx_buffer_set(&flash->channel, resp, resp_size);
+		if(err != STATUS_NORMAL)
+		{
+			break;
+		}
+		err = isotp_cb_set(&flash->channel, flash_rx_done, flash_tx_done);
+		break;
+	}
+
+	return err;
+}
+
+/*
+ * start the download of an image with a RequestDownload
+ *
+ * @parameter in:
+ * flash:     object
+ * image:     data to download, lent until the state is DONE or FAILED
+ * size:      bytes of image
+ * address:   memoryAddress of the RequestDownload
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE uds_flash_start(struct uds_flash_t *flash, const uint8_t *image, uint32_t size, uint32_t address)
+{
+	if(flash == NULL || image == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(size == 0UL)
+	{
+		return ERR_PARAMETER;
+	}
+	if(flash->state != UDS_FLASH_IDLE && flash->state != UDS_FLASH_DONE && flash->state != UDS_FLASH_FAILED)
+	{
+		return ERR_FULL;
+	}
+	flash->image = image;
+	flash->size = size;
+	flash->address = address;
+	flash->block[0].ready = FALSE;
+	flash->block[1].ready = FALSE;
+	flash->current = 0U;
+	flash->bsc = 1U;
+	flash->prepared = 0UL;
+	flash->acked = 0UL;
+	flash->crc = UDS_FLASH_CRC_INIT;
+	flash->retries = 0U;
+	flash->nrc = UDS_NRC_OK;
+	flash->blocks = 0UL;
+	flash->repeated = 0UL;
+	flash->pending = 0UL;
+	flash->start_us = timer_us();
+	flash->end_us = flash->start_us;
+
+	/* dataFormatIdentifier 0, 4 bytes of size and 4 bytes of address */
+	flash->req[0] = UDS_SID_REQUEST_DOWNLOAD;
+	flash->req[1] = 0x00U;
+	flash->req[2] = 0x44U;
+	flash->req[3] = (uint8_t)(address >> 24);
+	flash->req[4] = (uint8_t)(address >> 16);
+	flash->req[5] = (uint8_t)(address >> 8);
+	flash->req[6] = (uint8_t)address;
+	flash->req[7] = (uint8_t)(size >> 24);
+	flash->req[8] = (uint8_t)(size >> 16);
+	flash->req[9] = (uint8_t)(size >> 8);
+	flash->req[10] = (uint8_t)size;
+	flash->req_iov.base = flash->req;
+	flash->req_iov.len = UDS_FLASH_REQ_LEN;
+	flash->state = UDS_FLASH_REQUEST;
+
+	return request_send(flash, &flash->req_iov, 1U, UDS_FLASH_REQ_LEN);
+}
+
+/*
+ * handle the channel, the responses and the timeouts, and prepare the next
+ * block while the current one is sent
+ *
+ * @parameter in:
+ * flash:     object
+ * @parameter out:
+ * milliseconds until the next call is needed,
+ * ISOTP_WAIT_FOREVER if only a received frame can change the state
+ */
+uint32_t uds_flash_poll(struct uds_flash_t *flash)
+{
+	uint32_t wait, remain;
+
+	if(flash == NULL)
+	{
+		return ISOTP_WAIT_FOREVER;
+	}
+	isotp_poll(&flash->channel);
+	if(flash->response == TRUE)
+	{
+		flash->response = FALSE;
+		response_handle(flash);
+	}
+	/* after the response, which may have sent the next request at once */
+	if(flash->sent == TRUE && flash->state >= UDS_FLASH_REQUEST && flash->state <= UDS_FLASH_EXIT)
+	{
+		flash->sent = FALSE;
+		if(flash->channel.tx.reply == N_OK)
+		{
+			timer_add(&flash->P2);
+		}
+		else if(flash->state == UDS_FLASH_TRANSFER)
+		{
+			block_retry(flash);
+		}
+		else
+		{
+			flash_end(flash, UDS_FLASH_FAILED, UDS_NRC_OK);
+		}
+	}
+	if(flash->state == UDS_FLASH_TRANSFER)
+	{
+		block_prepare(flash, flash->current ^ 1U);
+	}
+	if(timer_overflow(&flash->P2, flash->P2_ms))
+	{
+		xtimer_delete(&flash->P2);
+		if(flash->state == UDS_FLASH_TRANSFER)
+		{
+			block_retry(flash);
+		}
+		else
+		{
+			flash_end(flash, UDS_FLASH_FAILED, UDS_NRC_OK);
+		}
+	}
+
+	wait = isotp_poll(&flash->channel);
+	if(flash->sent == TRUE && flash->state >= UDS_FLASH_REQUEST && flash->state <= UDS_FLASH_EXIT)
+	{
+		/* a request sent again in one go, its P2 starts at the next call */
+		return 0UL;
+	}
+	remain = timer_remain(&flash->P2, flash->P2_ms);
+
+	return (remain < wait) ? remain : wait;
+}
+
+/*
+ * bytes per second of the download, from the RequestDownload to the
+ * response of the RequestTransferExit
+ */
+uint32_t uds_flash_rate(const struct uds_flash_t *flash)
+{
+	uint32_t elapsed;
+
+	if(flash == NULL || flash->state != UDS_FLASH_DONE)
+	{
+		return 0UL;
+	}
+	elapsed = flash->end_us - flash->start_us;
+	if(elapsed == 0UL)
+	{
+		return 0UL;
+	}
+	return (uint32_t)((unsigned long long)flash->size * 1000000ULL / elapsed);
+}
+
+/*
+ * CRC-32 of IEEE 802.3, reflected, polynomial 0xEDB88320. Start with
+ * UDS_FLASH_CRC_INIT, feed the data in any number of pieces, and invert
+ * the result after the last one.
+ */
+uint32_t uds_flash_crc32(uint32_t crc, const uint8_t *data, uint32_t len)
+{
+	crc_table_init();
+	while(len != 0UL)
+	{
+		crc = crc_table[(crc ^ *data) & 0xFFUL] ^ (crc >> 8);
+		data ++;
+		len --;
+	}
+	return crc;
+}
+
+static void crc_table_init(void)
+{
+	uint32_t index, bit, crc;
+
+	if(crc_table_ready == TRUE)
+	{
+		return;
+	}
+	for(index = 0; index < 256UL; index ++)
+	{
+		crc = index;
+		for(bit = 0; bit < 8UL; bit ++)
+		{
+			crc = (crc & 1UL) ? (crc >> 1) ^ 0xEDB88320UL : crc >> 1;
+		}
+		crc_table[index] = crc;
+	}
+	crc_table_ready = TRUE;
+}
+
+/*
+ * The engine is the first member of the channel, so the channel leads
+ * back to it. Only flags are set here, uds_flash_poll() acts on them.
+ */
+static ERROR_CODE flash_rx_done(struct isotp_t* msg)
+{
+	struct uds_flash_t *flash = (struct uds_flash_t *)msg;
+
+	if(msg->rx.reply == N_OK && msg->rx.DL != 0UL)
+	{
+		flash->response = TRUE;
+	}
+	return STATUS_NORMAL;
+}
+
+static ERROR_CODE flash_tx_done(struct isotp_t* msg)
+{
+	struct uds_flash_t *flash = (struct uds_flash_t *)msg;
+
+	flash->sent = TRUE;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * send a request, P2 starts when its last frame is out
+ */
+static ERROR_CODE request_send(struct uds_flash_t *flash, const struct isotp_iovec *iov, uint8_t iovcnt, uint32_t len)
+{
+	ERROR_CODE err;
+
+	xtimer_delete(&flash->P2);
+	flash->P2_ms = UDS_FLASH_P2_MS;
+	flash->response = FALSE;
+	flash->sent = FALSE;
+	err = isotp_tx_iov_set(&flash->channel, iov, iovcnt);
+	if(err == STATUS_NORMAL)
+	{
+		flash->channel.tx.DL = len;
+		err = isotp_send_start(&flash->channel);
+	}
+	if(err != STATUS_NORMAL)
+	{
+		flash_end(flash, UDS_FLASH_FAILED, UDS_NRC_OK);
+	}
+
+	return err;
+}
+
+/*
+ * Point a block at the next data of the image and add the data to the
+ * CRC. Nothing is copied, the channel reads the image when it builds the
+ * frames.
+ */
+static void block_prepare(struct uds_flash_t *flash, uint8_t index)
+{
+	struct uds_flash_block_t *block = &flash->block[index];
+
+	if(block->ready == TRUE || flash->prepared >= flash->size)
+	{
+		return;
+	}
+	block->offset = flash->prepared;
+	block->len = flash->size - flash->prepared;
+	if(block->len > flash->block_len)
+	{
+		block->len = flash->block_len;
+	}
+	block->head[0] = UDS_SID_TRANSFER_DATA;
+	block->head[1] = flash->bsc;
+	block->iov[0].base = block->head;
+	block->iov[0].len = UDS_TRANSFER_HEAD;
+	/* the channel only reads what it sends */
+	block->iov[1].base = (uint8_t *)(flash->image + block->offset);
+	block->iov[1].len = block->len;
+	flash->crc = uds_flash_crc32(flash->crc, flash->image + block->offset, block->len);
+	flash->prepared += block->len;
+	flash->bsc ++;
+	block->ready = TRUE;
+}
+
+static ERROR_CODE block_send(struct uds_flash_t *flash)
+{
+	struct uds_flash_block_t *block = &flash->block[flash->current];
+
+	return request_send(flash, block->iov, 2U, UDS_TRANSFER_HEAD + block->len);
+}
+
+/*
+ * RequestTransferExit with the CRC-32 of the image
+ */
+static ERROR_CODE exit_send(struct uds_flash_t *flash)
+{
+	uint32_t crc = ~flash->crc;
+
+	flash->req[0] = UDS_SID_TRANSFER_EXIT;
+	flash->req[1] = (uint8_t)(crc >> 24);
+	flash->req[2] = (uint8_t)(crc >> 16);
+	flash->req[3] = (uint8_t)(crc >> 8);
+	flash->req[4] = (uint8_t)crc;
+	flash->req_iov.base = flash->req;
+	flash->req_iov.len = 5UL;
+	flash->state = UDS_FLASH_EXIT;
+
+	return request_send(flash, &flash->req_iov, 1U, 5UL);
+}
+
+/*
+ * a block without response, or that could not be sent, goes again with
+ * the same counter
+ */
+static void block_retry(struct uds_flash_t *flash)
+{
+	if(flash->retries >= UDS_FLASH_RETRIES)
+	{
+		flash_end(flash, UDS_FLASH_FAILED, UDS_NRC_OK);
+		return;
+	}
+	flash->retries ++;
+	flash->repeated ++;
+	block_send(flash);
+}
+
+static void response_handle(struct uds_flash_t *flash)
+{
+	const uint8_t *resp = flash->resp;
+	uint32_t len = flash->channel.rx.DL;
+	uint32_t max_block = 0UL, index;
+	struct uds_flash_block_t *block = &flash->block[flash->current];
+	uint8_t sid;
+
+	switch(flash->state)
+	{
+		case UDS_FLASH_REQUEST:
+			sid = UDS_SID_REQUEST_DOWNLOAD;
+			break;
+		case UDS_FLASH_TRANSFER:
+			sid = UDS_SID_TRANSFER_DATA;
+			break;
+		case UDS_FLASH_EXIT:
+			sid = UDS_SID_TRANSFER_EXIT;
+			break;
+		default:
+			return;
+	}
+	if(len == 3UL && resp[0] == UDS_SID_NEGATIVE && resp[1] == sid)
+	{
+		if(resp[2] == UDS_NRC_PENDING)
+		{
+			/* the server needs longer, P2* from now */
+			flash->pending ++;
+			flash->P2_ms = UDS_P2_STAR_MS;
+			timer_add(&flash->P2);
+		}
+		else
+		{
+			flash_end(flash, UDS_FLASH_FAILED, resp[2]);
+		}
+		return;
+	}
+	if(resp[0] != sid + UDS_SID_POSITIVE
+		|| (flash->state == UDS_FLASH_TRANSFER && (len < 2UL || resp[1] != block->head[1])))
+	{
+		/* late response to a request sent before, the timeout goes on */
+		return;
+	}
+	xtimer_delete(&flash->P2);
+	switch(flash->state)
+	{
+		case UDS_FLASH_REQUEST:
+			/* lengthFormatIdentifier, then maxNumberOfBlockLength */
+			if(len < 2UL || (resp[1] >> 4) == 0U || (resp[1] >> 4) > 4U || len < 2UL + (resp[1] >> 4))
+			{
+				flash_end(flash, UDS_FLASH_FAILED, UDS_NRC_OK);
+				break;
+			}
+			for(index = 0; index < (uint32_t)(resp[1] >> 4); index ++)
+			{
+				max_block = (max_block << 8) | resp[2 + index];
+			}
+			if(max_block > flash->limit)
+			{
+				max_block = flash->limit;
+			}
+			if(max_block <= UDS_TRANSFER_HEAD)
+			{
+				flash_end(flash, UDS_FLASH_FAILED, UDS_NRC_OK);
+				break;
+			}
+			flash->block_len = max_block - UDS_TRANSFER_HEAD;
+			flash->state = UDS_FLASH_TRANSFER;
+			block_prepare(flash, flash->current);
+			block_send(flash);
+			break;
+		case UDS_FLASH_TRANSFER:
+			flash->acked += block->len;
+			flash->blocks ++;
+			flash->retries = 0U;
+			block->ready = FALSE;
+			if(flash->acked >= flash->size)
+			{
+				exit_send(flash);
+				break;
+			}
+			/* normally ready since the block before was sent */
+			flash->current ^= 1U;
+			block_prepare(flash, flash->current);
+			block_send(flash);
+			break;
+		case UDS_FLASH_EXIT:
+			flash_end(flash, UDS_FLASH_DONE, UDS_NRC_OK);
+			break;
+		default:
+			break;
+	}
+}
+
+static void flash_end(struct uds_flash_t *flash, enum uds_flash_state_e state, uint8_t nrc)
+{
+	xtimer_delete(&flash->P2);
+	flash->state = state;
+	flash->nrc = nrc;
+	flash->end_us = timer_us();
+}
@@ -0,0 +1,509 @@
+#include "vcan.h"
+#include "ring_atomic.h"
+#include <string.h>
+
+/* wrap-safe order of two times of timer_us() */
+#define vcan_before(a,b)	((int32_t)((uint32_t)(a) - (uint32_t)(b)) < 0)
+
+/* identifiers above this are sent in the 29 bit format */
+#define VCAN_SFF_MASK		(0x7FFUL)
+
+static void fifo_init(struct vcan_fifo_t *fifo, struct vcan_frame_t *frame, uint16_t size);
+static Bool fifo_put(struct vcan_fifo_t *fifo, const struct phy_msg_t *msg, uint32_t time_us);
+static struct vcan_frame_t *fifo_peek(struct vcan_fifo_t *fifo);
+static void fifo_drop(struct vcan_fifo_t *fifo);
+static uint32_t fault_rand(struct vcan_bus_t *bus);
+static Bool fault_hit(struct vcan_bus_t *bus, enum vcan_fault_e fault);
+static void deliver(struct vcan_bus_t *bus, struct vcan_node_t *sender, struct vcan_frame_t *frame);
+static void transmit(struct vcan_bus_t *bus, struct vcan_node_t *sender, struct vcan_frame_t *frame);
+
+/*
+ * initialize a bus
+ *
+ * @parameter in:
+ * bus:          object
+ * node:         node table, one entry per node attached
+ * size:         entries in node
+ * bitrate:      nominal bitrate, 0 for VCAN_BITRATE_DEFAULT
+ * data_bitrate: CAN FD data bitrate, 0 for VCAN_DATA_BITRATE_DEFAULT
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE vcan_bus_init(struct vcan_bus_t *bus,
+							struct vcan_node_t **node,
+							uint8_t size,
+							uint32_t bitrate,
+							uint32_t data_bitrate)
+{
+	if(bus == NULL || node == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(size == 0UL)
+	{
+		return ERR_PARAMETER;
+	}
+	memset(bus, 0, sizeof(*bus));
+	bus->node = node;
+	bus->size = size;
+	bus->bitrate = (bitrate != 0UL) ? bitrate : VCAN_BITRATE_DEFAULT;
+	bus->data_bitrate = (data_bitrate != 0UL) ? data_bitrate : VCAN_DATA_BITRATE_DEFAULT;
+	bus->seed = 0x2545F491UL;
+	bus->time_us = timer_us();
+	vcan_stats_reset(bus);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * initialize a node, it receives every frame until vcan_filter_set()
+ *
+ * @parameter in:
+ * node:      object
+ * tx:        storage of the TX FIFO
+ * tx_size:   frames in tx, a power of two
+ * rx:        storage of the RX FIFO
+ * rx_size:   frames in rx, a power of two
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE vcan_node_init(struct vcan_node_t *node,
+							struct vcan_frame_t *tx, uint16_t tx_size,
+							struct vcan_frame_t *rx, uint16_t rx_size)
+{
+	if(node == NULL || tx == NULL || rx == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(tx_size == 0UL || (tx_size & (tx_size - 1UL)) != 0UL
+		|| rx_size == 0UL || (rx_size & (rx_size - 1UL)) != 0UL)
+	{
+		return ERR_PARAMETER;
+	}
+	memset(node, 0, sizeof(*node));
+	fifo_init(&node->tx, tx, tx_size);
+	fifo_init(&node->rx, rx, rx_size);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * connect a node to a bus
+ *
+ * @parameter in:
+ * bus:       object
+ * node:      initialized node
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE vcan_attach(struct vcan_bus_t *bus, struct vcan_node_t *node)
+{
+	if(bus == NULL || node == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(bus->count >= bus->size)
+	{
+		return ERR_FULL;
+	}
+	node->bus = bus;
+	bus->node[bus->count ++] = node;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * set the acceptance filter of a node, a mask of 0 receives every frame
+ *
+ * @parameter in:
+ * node:      object
+ * id:        identifier bits to match
+ * mask:      identifier bits that are compared
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE vcan_filter_set(struct vcan_node_t *node, uint32_t id, uint32_t mask)
+{
+	if(node == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	node->filter_id = id & mask;
+	node->filter_mask = mask;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * set the rate of an injected fault
+ *
+ * @parameter in:
+ * bus:       object
+ * fault:     fault to inject
+ * ppm:       frames per million hit by the fault, 0 to turn it off
+ * @parameter out:
+ * operation status return
+ */
+ERROR_CODE vcan_fault_set(struct vcan_bus_t *bus, enum vcan_fault_e fault, uint32_t ppm)
+{
+	if(bus == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(fault >= VCAN_FAULT_NUM || ppm > 1000000UL)
+	{
+		return ERR_PARAMETER;
+	}
+	bus->fault_ppm[fault] = ppm;
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * queue a frame for sending, can be used as the phy_send of a channel
+ *
+ * @parameter in:
+ * node:      object
+ * msg:       frame to send
+ * @parameter out:
+ * operation status return, ERR_FULL if the TX FIFO is full
+ */
+ERROR_CODE vcan_send(struct vcan_node_t *node, const struct phy_msg_t *msg)
+{
+	if(node == NULL || msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	if(msg->length > CANFD_MAX_DL)
+	{
+		return ERR_PARAMETER;
+	}
+	if(fifo_put(&node->tx, msg, timer_us()) == FALSE)
+	{
+		return ERR_FULL;
+	}
+	if(node->bus != NULL && node->bus->kick_cb != NULL)
+	{
+		node->bus->kick_cb(node->bus);
+	}
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * take the oldest frame received by a node
+ *
+ * @parameter in:
+ * node:      object
+ * @parameter out:
+ * msg:       the frame
+ * operation status return, ERR_EMPTY if nothing was received
+ */
+ERROR_CODE vcan_receive(struct vcan_node_t *node, struct phy_msg_t *msg)
+{
+	struct vcan_frame_t *frame;
+
+	if(node == NULL || msg == NULL)
+	{
+		return ERR_POINTER_0;
+	}
+	frame = fifo_peek(&node->rx);
+	if(frame == NULL)
+	{
+		return ERR_EMPTY;
+	}
+	memcpy(msg, &frame->msg, sizeof(*msg));
+	fifo_drop(&node->rx);
+
+	return STATUS_NORMAL;
+}
+
+/*
+ * move the bus up to the current time: end the frame on the wire when its
+ * time is over, and start the next one by arbitration
+ *
+ * @parameter in:
+ * bus:       object
+ * @parameter out:
+ * microseconds until the frame on the wire ends, VCAN_IDLE if none
+ */
+uint32_t vcan_bus_run(struct vcan_bus_t *bus)
+{
+	struct vcan_node_t *winner;
+	struct vcan_frame_t *frame, *best;
+	uint32_t now = timer_us();
+	uint32_t earliest = 0UL;
+	Bool waiting;
+	uint8_t index;
+
+	if(bus == NULL)
+	{
+		return VCAN_IDLE;
+	}
+	for(;;)
+	{
+		if(bus->sender != NULL)
+		{
+			if(vcan_before(now, bus->time_us))
+			{
+				return bus->time_us - now;
+			}
+			transmit(bus, bus->sender, &bus->wire);
+			bus->sender = NULL;
+		}
+		/* arbitration among the frames queued when the bus became free */
+		winner = NULL;
+		best = NULL;
+		waiting = FALSE;
+		for(index = 0; index < bus->count; index ++)
+		{
+			frame = fifo_peek(&bus->node[index]->tx);
+			if(frame == NULL)
+			{
+				continue;
+			}
+			if(vcan_before(bus->time_us, frame->time_us))
+			{
+				if(waiting == FALSE || vcan_before(frame->time_us, earliest))
+				{
+					earliest = frame->time_us;
+				}
+				waiting = TRUE;
+				continue;
+			}
+			if(best == NULL || frame->msg.id < best->msg.id)
+			{
+				best = frame;
+				winner = bus->node[index];
+			}
+		}
+		if(winner == NULL)
+		{
+			if(waiting == FALSE)
+			{
+				break;
+			}
+			/* the bus was idle until the first of them was queued */
+			bus->time_us = earliest;
+			continue;
+		}
+		memcpy(&bus->wire, best, sizeof(bus->wire));
+		fifo_drop(&winner->tx);
+		winner->tx_frames ++;
+		bus->sender = winner;
+		bus->time_us += vcan_frame_time(bus, &bus->wire.msg);
+		bus->busy_us += vcan_frame_time(bus, &bus->wire.msg);
+	}
+	/* nothing follows a frame held back, deliver it now */
+	if(bus->held_sender != NULL)
+	{
+		deliver(bus, bus->held_sender, &bus->held);
+		bus->held_sender = NULL;
+	}
+	/* an idle bus starts the next frame when it is queued */
+	if(vcan_before(bus->time_us, now))
+	{
+		bus->time_us = now;
+	}
+
+	return VCAN_IDLE;
+}
+
+/*
+ * time a frame takes on the bus in microseconds, with the worst case bit
+ * stuffing and the 3 bit interframe space
+ */
+uint32_t vcan_frame_time(struct vcan_bus_t *bus, const struct phy_msg_t *msg)
+{
+	uint32_t nominal, data, crc;
+	uint32_t n = msg->length;
+	unsigned long long ns;
+
+	if(n <= CAN_MAX_DL)
+	{
+		/* SOF to EOF: 44 bits with an 11 bit ID, 64 with a 29 bit ID */
+		nominal = (msg->id > VCAN_SFF_MASK) ? 54UL : 34UL;
+		nominal += 8UL * n;
+		nominal += 10UL + (nominal - 1UL) / 4UL + 3UL;
+		ns = (unsigned long long)nominal * 1000000000ULL / bus->bitrate;
+	}
+	else
+	{
+		/* arbitration and end of frame at the nominal, the rest at the data bitrate */
+		nominal = ((msg->id > VCAN_SFF_MASK) ? 36UL : 17UL) + 13UL;
+		nominal += nominal / 4UL;
+		crc = (n <= 16UL) ? 17UL : 21UL;
+		data = 1UL + 4UL + 8UL * n + 4UL;
+		data += data / 4UL + crc + crc / 4UL + 1UL;
+		ns = (unsigned long long)nominal * 1000000000ULL / bus->bitrate
+			+ (unsigned long long)data * 1000000000ULL / bus->data_bitrate;
+	}
+
+	return (uint32_t)((ns + 999ULL) / 1000ULL);
+}
+
+/*
+ * bus load since vcan_stats_reset() in per mille
+ */
+uint32_t vcan_bus_load(struct vcan_bus_t *bus)
+{
+	uint32_t elapsed = timer_us() - bus->start_us;
+
+	if(elapsed == 0UL)
+	{
+		return 0UL;
+	}
+	return (uint32_t)((unsigned long long)bus->busy_us * 1000ULL / elapsed);
+}
+
+void vcan_stats_reset(struct vcan_bus_t *bus)
+{
+	uint8_t index;
+
+	bus->start_us = timer_us();
+	bus->busy_us = 0UL;
+	bus->frames = 0UL;
+	memset(bus->faults, 0, sizeof(bus->faults));
+	for(index = 0; index < bus->count; index ++)
+	{
+		bus->node[index]->tx_frames = 0UL;
+		bus->node[index]->rx_frames = 0UL;
+		bus->node[index]->tx.overflow = 0UL;
+		bus->node[index]->rx.overflow = 0UL;
+	}
+}
+
+/*
+ * a frame left the wire, inject the faults and hand it to the receivers
+ */
+static void transmit(struct vcan_bus_t *bus, struct vcan_node_t *sender, struct vcan_frame_t *frame)
+{
+	uint32_t bit;
+
+	bus->frames ++;
+	if(fault_hit(bus, VCAN_FAULT_DROP) == TRUE)
+	{
+		bus->faults[VCAN_FAULT_DROP] ++;
+		return;
+	}
+	if(frame->msg.length != 0UL && fault_hit(bus, VCAN_FAULT_CORRUPT) == TRUE)
+	{
+		bus->faults[VCAN_FAULT_CORRUPT] ++;
+		bit = fault_rand(bus) % (frame->msg.length * 8UL);
+		frame->msg.data[bit / 8UL] ^= (uint8_t)(1UL << (bit % 8UL));
+	}
+	if(bus->held_sender == NULL && fault_hit(bus, VCAN_FAULT_REORDER) == TRUE)
+	{
+		bus->faults[VCAN_FAULT_REORDER] ++;
+		memcpy(&bus->held, frame, sizeof(bus->held));
+		bus->held_sender = sender;
+		return;
+	}
+	deliver(bus, sender, frame);
+	if(bus->held_sender != NULL)
+	{
+		deliver(bus, bus->held_sender, &bus->held);
+		bus->held_sender = NULL;
+	}
+}
+
+/*
+ * copy a frame to the RX FIFO of every other node that accepts it
+ */
+static void deliver(struct vcan_bus_t *bus, struct vcan_node_t *sender, struct vcan_frame_t *frame)
+{
+	struct vcan_node_t *node;
+	uint8_t index;
+
+	for(index = 0; index < bus->count; index ++)
+	{
+		node = bus->node[index];
+		if(node == sender
+			|| (frame->msg.id & node->filter_mask) != node->filter_id)
+		{
+			continue;
+		}
+		if(fifo_put(&node->rx, &frame->msg, bus->time_us) == TRUE)
+		{
+			node->rx_frames ++;
+			if(node->rx_cb != NULL)
+			{
+				node->rx_cb(node);
+			}
+		}
+	}
+}
+
+static void fifo_init(struct vcan_fifo_t *fifo, struct vcan_frame_t *frame, uint16_t size)
+{
+	fifo->frame = frame;
+	fifo->mask = size - 1U;
+	fifo->head = 0UL;
+	fifo->tail = 0UL;
+	fifo->overflow = 0UL;
+}
+
+/*
+ * producer side, the head is published after the frame is written
+ */
+static Bool fifo_put(struct vcan_fifo_t *fifo, const struct phy_msg_t *msg, uint32_t time_us)
+{
+	struct vcan_frame_t *frame;
+	uint32_t head = fifo->head;
+
+	if(head - ring_load(&fifo->tail) > fifo->mask)
+	{
+		fifo->overflow ++;
+		return FALSE;
+	}
+	frame = &fifo->frame[head & fifo->mask];
+	memcpy(&frame->msg, msg, sizeof(frame->msg));
+	frame->msg.new_data = TRUE;
+	frame->time_us = time_us;
+	ring_store(&fifo->head, head + 1UL);
+
+	return TRUE;
+}
+
+/*
+ * consumer side, the slot stays valid until fifo_drop()
+ */
+static struct vcan_frame_t *fifo_peek(struct vcan_fifo_t *fifo)
+{
+	uint32_t tail = fifo->tail;
+
+	if(ring_load(&fifo->head) == tail)
+	{
+		return NULL;
+	}
+	return &fifo->frame[tail & fifo->mask];
+}
+
+static void fifo_drop(struct vcan_fifo_t *fifo)
+{
+	ring_store(&fifo->tail, fifo->tail + 1UL);
+}
+
+/*
+ * xorshift32, reproducible for a given seed
+ */
+static uint32_t fault_rand(struct vcan_bus_t *bus)
+{
+	uint32_t x = bus->seed;
+
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	bus->seed = x;
+
+	return x;
+}
+
+static Bool fault_hit(struct vcan_bus_t *bus, enum vcan_fault_e fault)
+{
+	if(bus->fault_ppm[fault] == 0UL)
+	{
+		return FALSE;
+	}
+	return (fault_rand(bus) % 1000000UL < bus->fault_ppm[fault]) ? TRUE : FALSE;
+}